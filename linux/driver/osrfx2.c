@@ -26,6 +26,24 @@ unicornx, May/27/2013, to pass building on 2.6.32
 #include <linux/poll.h>
 #include <asm/uaccess.h>
 #include <linux/usb.h>
+#include <linux/workqueue.h>
+#include <linux/timer.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/scatterlist.h>
+#include <linux/highmem.h>
+#include <linux/aio.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+
+#include "osrfx2_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "osrfx2_trace.h"
 #include <linux/smp_lock.h> // for lock_kernel/unlock_kernel, notice BKL was
                             // removed since 2.6.39, 
                             // @http://kernelnewbies.org/BigKernelLock
@@ -37,7 +55,168 @@ unicornx, May/27/2013, to pass building on 2.6.32
 #define PRODUCT_ID  0x1002
 
 #define DEVICE_MINOR_BASE   192
-             
+
+/*****************************************************************************/
+/* Read-ahead tunables.                                                      */
+/*                                                                           */
+/* When readahead_urbs is non-zero, opening the device for read primes a     */
+/* ring of that many bulk-IN URBs on EP8 and keeps them submitted; read()    */
+/* then just drains whatever the ring has already received. The URB size     */
+/* defaults to the endpoint's wMaxPacketSize, so every packet the firmware   */
+/* loops back completes an URB. Both values can be overridden per device     */
+/* through the readahead_depth and readahead_size sysfs attributes.          */
+/*****************************************************************************/
+#define MAX_READAHEAD_URBS      64
+#define MAX_READAHEAD_SIZE      (64 * 1024)
+
+static unsigned int readahead_urbs = 0;
+module_param(readahead_urbs, uint, S_IRUGO);
+MODULE_PARM_DESC(readahead_urbs,
+                 "Bulk-IN URBs kept submitted while open for read (0=off)");
+
+static unsigned int readahead_size = 0;
+module_param(readahead_size, uint, S_IRUGO);
+MODULE_PARM_DESC(readahead_size,
+                 "Bytes per read-ahead URB (0=bulk-IN wMaxPacketSize)");
+
+/*****************************************************************************/
+/* Device FIFO depth.                                                        */
+/*                                                                           */
+/* osrfx2fw offers alternate settings of interface 0 which only differ in    */
+/* how many bulk packets the FX2 buffers between OUT and IN: 4, 6 or 8.      */
+/* Each one carries a class-specific FIFO descriptor with its OUT and IN     */
+/* buffer counts. Probe selects the deepest setting unless altsetting names  */
+/* another one; firmware without the descriptor buffers four packets.        */
+/*****************************************************************************/
+#define USB_DT_OSRFX2_FIFO      0x24
+#define OSRFX2_FIFO_BULK        1
+#define DEFAULT_FIFO_PACKETS    4
+
+static int altsetting = -1;
+module_param(altsetting, int, S_IRUGO);
+MODULE_PARM_DESC(altsetting,
+                 "Alternate setting to use (-1=deepest device FIFO)");
+
+/*****************************************************************************/
+/* Write pool tunables.                                                      */
+/*                                                                           */
+/* write() never allocates: each device owns write_urbs bulk-OUT URBs with   */
+/* coherent buffers of write_urb_packets * wMaxPacketSize bytes, built at    */
+/* probe time and recycled by the completion routine. A larger write() is    */
+/* spread over several pool entries. By default there is one entry per       */
+/* packet the device FIFO holds, so the writes in flight match what the      */
+/* firmware can absorb before it NAKs.                                       */
+/*****************************************************************************/
+#define MAX_WRITE_URBS          64
+#define MAX_WRITE_URB_PACKETS   128
+
+static unsigned int write_urbs = 0;
+module_param(write_urbs, uint, S_IRUGO);
+MODULE_PARM_DESC(write_urbs,
+                 "Bulk-OUT URBs in the write pool (0=FIFO depth, 1-64)");
+
+static unsigned int write_urb_packets = 4;
+module_param(write_urb_packets, uint, S_IRUGO);
+MODULE_PARM_DESC(write_urb_packets,
+                 "Bulk-OUT packets per write pool buffer (1-128)");
+
+/*****************************************************************************/
+/* Small-write coalescing.                                                   */
+/*                                                                           */
+/* When coalesce_usecs is non-zero, write() packs consecutive writes into    */
+/* one pool buffer and only sends it once the buffer is full, so a chatty    */
+/* producer turns into full-sized packets and far fewer URB completions.     */
+/* A partly filled buffer goes out at the latest coalesce_usecs after its    */
+/* first byte was staged, or earlier on fsync() or close(). Per device the   */
+/* value can be changed through the coalesce_usecs sysfs attribute.          */
+/*****************************************************************************/
+#define MAX_COALESCE_USECS      100000
+
+static unsigned int coalesce_usecs = 0;
+module_param(coalesce_usecs, uint, S_IRUGO);
+MODULE_PARM_DESC(coalesce_usecs,
+                 "Max delay of coalesced small writes in usecs (0=off)");
+
+/*****************************************************************************/
+/* Vectored I/O: readv()/writev() move at most this many bytes per call, as  */
+/* a single scatter-gather bulk transfer made of up to MAX_SG_ENTRIES        */
+/* pieces - enough for a full transfer of 512-byte records.                  */
+/*****************************************************************************/
+#define MAX_SG_TRANSFER         (64 * 1024)
+#define MAX_SG_ENTRIES          ((MAX_SG_TRANSFER / 512) + 1)
+
+/*****************************************************************************/
+/* Zero-copy receive ring (see osrfx2_ioctl.h): bulk-IN URBs kept in flight  */
+/* on the slots of a mapped ring. A full ring is looked at again when poll   */
+/* finds room, or after RING_FULL_JIFFIES for a consumer which never polls;  */
+/* an URB which failed is retried after RING_RETRY_JIFFIES.                  */
+/*****************************************************************************/
+#define RING_URBS               8
+#define RING_FULL_JIFFIES       (HZ / 20)
+#define RING_RETRY_JIFFIES      (HZ / 10)
+
+#ifndef VM_RESERVED
+#define VM_RESERVED             (VM_DONTEXPAND | VM_DONTDUMP)
+#endif
+
+/*****************************************************************************/
+/* Asynchronous I/O: how many AIO reads may be in flight per device. AIO     */
+/* writes are bounded by the write pool (write_urbs) instead.                */
+/*****************************************************************************/
+#define MAX_AIO_DEPTH           256
+
+static unsigned int aio_depth = 32;
+module_param(aio_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(aio_depth, "AIO reads in flight per device (1-256)");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,4,0)
+#define osrfx2_kmap_atomic(page)    kmap_atomic(page, KM_IRQ0)
+#define osrfx2_kunmap_atomic(addr)  kunmap_atomic(addr, KM_IRQ0)
+#else
+#define osrfx2_kmap_atomic(page)    kmap_atomic(page)
+#define osrfx2_kunmap_atomic(addr)  kunmap_atomic(addr)
+#endif
+
+/*****************************************************************************/
+/* Switch/mouse event queue: how many interrupt reports are kept for         */
+/* OSRFX2_IOCTL_GET_EVENTS before the newest ones have to be dropped.        */
+/*****************************************************************************/
+#define MAX_EVENT_DEPTH         4096
+#define EVENT_CHUNK             16
+
+static unsigned int event_depth = 256;
+module_param(event_depth, uint, S_IRUGO);
+MODULE_PARM_DESC(event_depth, "Switch events queued per device (1-4096)");
+
+/*****************************************************************************/
+/* Key event reports: osrfx2fw can queue key changes on the board and send   */
+/* several per interrupt report, KEY_EVENT_LEN bytes each: sequence number,  */
+/* keys and the USB frame number (LSB, MSB). Probe asks for them unless      */
+/* key_events is cleared; firmware which stalls the request keeps sending    */
+/* one-byte switch reports.                                                  */
+/*****************************************************************************/
+#define KEY_EVENT_LEN           4
+
+static int key_events = 1;
+module_param(key_events, bool, S_IRUGO);
+MODULE_PARM_DESC(key_events, "Ask the firmware for queued key event reports");
+
+/*
+ *  The kfifo API was rewritten in 2.6.33; these hide the difference.
+ *  The callers hold event_lock, so the unlocked variants are used.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+#define event_fifo_len(f)           __kfifo_len(f)
+#define event_fifo_avail(f)         ((f)->size - __kfifo_len(f))
+#define event_fifo_in(f, buf, n)    __kfifo_put(f, (unsigned char *)(buf), n)
+#define event_fifo_out(f, buf, n)   __kfifo_get(f, (unsigned char *)(buf), n)
+#else
+#define event_fifo_len(f)           kfifo_len(f)
+#define event_fifo_avail(f)         kfifo_avail(f)
+#define event_fifo_in(f, buf, n)    kfifo_in(f, buf, n)
+#define event_fifo_out(f, buf, n)   kfifo_out(f, buf, n)
+#endif
+
 #undef TRUE
 #define TRUE  (1)
 #undef FALSE
@@ -53,6 +232,18 @@ unicornx, May/27/2013, to pass building on 2.6.32
 #define OSRFX2_IS_HIGH_SPEED              0xD9
 #define OSRFX2_REENUMERATE                0xDA
 #define OSRFX2_SET_7SEGMENT_DISPLAY       0xDB
+#define OSRFX2_SET_KEY_EVENTS             0xDE
+#define OSRFX2_READ_COUNTERS              0xDF
+#define OSRFX2_RESET_COUNTERS             0xE0
+#define OSRFX2_SET_STREAM_MODE            0xE1
+
+/*****************************************************************************/
+/* Stream modes of OSRFX2_SET_STREAM_MODE, what osrfx2fw does with the bulk  */
+/* endpoints: loop OUT back to IN, discard OUT, or send IN without pause.    */
+/*****************************************************************************/
+#define OSRFX2_STREAM_LOOPBACK            0
+#define OSRFX2_STREAM_SINK                1
+#define OSRFX2_STREAM_SOURCE              2
               
 /*****************************************************************************/
 /* BARGRAPH_STATE is a bit field structure with each bit corresponding       */
@@ -111,6 +302,21 @@ struct segment_state {
     };
 } __attribute__ ((packed));
 
+/*****************************************************************************/
+/* FW_COUNTERS is the reply to OSRFX2_READ_COUNTERS: the performance         */
+/* counters osrfx2fw keeps since power-up or OSRFX2_RESET_COUNTERS, little   */
+/* endian. See icd.h of osrfx2fw for their exact meaning.                    */
+/*****************************************************************************/
+struct fw_counters {
+    __le32 packets;         /* looped bulk OUT -> bulk IN                    */
+    __le32 bytes;
+    __le32 in_full;         /* OUT held a packet, IN had no free buffer      */
+    __le32 reports;         /* EP1 reports sent                              */
+    __le32 polls;           /* TD_Poll passes                                */
+    __le16 cycles;          /* instruction cycles of the last looped packet  */
+    __le16 cycles_max;      /* ... and of the slowest one                    */
+} __attribute__ ((packed));
+
 static const unsigned char digit_to_segments [10] = { 
     0xD7,  /* 0 */
     0x06,  /* 1 */
@@ -166,6 +372,138 @@ static struct usb_device_id id_table [] = {
 
 MODULE_DEVICE_TABLE(usb, id_table);
 
+struct osrfx2;
+
+/*****************************************************************************/
+/* One slot of the read-ahead ring. The slot sits on the rx_done list of     */
+/* the device from the time its URB completes with data until read() has     */
+/* copied all of it out; only then is the URB submitted again.               */
+/*****************************************************************************/
+struct osrfx2_rx_urb {
+
+    struct list_head  list;
+    struct urb      * urb;
+    struct osrfx2   * fx2dev;
+
+    size_t            copied;     /* bytes of this URB already read */
+    int               failed;     /* completed in error, not resubmitted */
+    ktime_t           submitted;
+};
+
+/*****************************************************************************/
+/* One entry of the write pool. The entry is on the tx_free list of the      */
+/* device while idle, and off it from the time write() claims it until its   */
+/* URB completes.                                                            */
+/*****************************************************************************/
+struct osrfx2_tx_urb {
+
+    struct list_head  list;
+    struct urb      * urb;
+    struct osrfx2   * fx2dev;
+    struct kiocb    * iocb;       /* AIO write to complete, if any */
+    ktime_t           submitted;
+};
+
+/*****************************************************************************/
+/* The zero-copy receive ring. The header page and the slot pages are        */
+/* mapped into the reader's address space; the URBs fill the slots in place. */
+/* Each in-flight URB is bound to the slot with sequence number seq, so      */
+/* completions - which arrive in order on the one endpoint - publish slots   */
+/* strictly in order. An URB which finds the ring full is parked until the   */
+/* consumer frees a slot, one which failed until the refill retries it.      */
+/*****************************************************************************/
+struct osrfx2_ring;
+
+struct osrfx2_ring_urb {
+
+    struct urb         * urb;
+    struct osrfx2_ring * ring;
+    unsigned int         seq;
+    int                  parked;     /* boolean */
+    int                  failed;     /* boolean: parked after an error */
+    ktime_t              submitted;
+};
+
+struct osrfx2_ring {
+
+    struct osrfx2             * fx2dev;
+    struct osrfx2_ring_header * hdr;
+
+    struct page  ** slot_page;        /* first page of each slot */
+    unsigned int    slot_size;
+    unsigned int    slot_count;
+    unsigned int    order;            /* slot_size == PAGE_SIZE << order */
+
+    struct osrfx2_ring_urb urbs [RING_URBS];
+    unsigned int    nurbs;
+
+    unsigned int    head;             /* next slot to publish */
+    unsigned int    submit;           /* next slot to bind to an URB */
+    int             active;           /* boolean */
+    int             restart;          /* boolean: was active at suspend */
+    int             halted;           /* boolean: refill clears the halt */
+
+    spinlock_t          lock;
+    struct usb_anchor   anchor;
+    struct delayed_work refill;
+    atomic_t            maps;         /* live mmap()s of the ring */
+};
+
+/*****************************************************************************/
+/* Statistics, kept per URB class: the three data pipes and each vendor      */
+/* request, any unknown one under STAT_VENDOR_OTHER. The counters and        */
+/* latency histograms are per-CPU and only summed up when debugfs is read,   */
+/* so they are cheap enough to leave on. Latency is submit-to-complete, in   */
+/* log2 buckets of microseconds: bucket 0 is < 1us, bucket k is              */
+/* [2^(k-1), 2^k) us, the last one collects everything longer. Errors are    */
+/* counted for the few statuses an URB of this driver really ends with,      */
+/* STAT_ERR_OTHER collects the rest.                                         */
+/*****************************************************************************/
+enum osrfx2_stat_class {
+    STAT_BULK_IN = 0,
+    STAT_BULK_OUT,
+    STAT_INT_IN,
+    STAT_READ_7SEGMENT_DISPLAY,
+    STAT_READ_SWITCHES,
+    STAT_READ_BARGRAPH_DISPLAY,
+    STAT_SET_BARGRAPH_DISPLAY,
+    STAT_IS_HIGH_SPEED,
+    STAT_REENUMERATE,
+    STAT_SET_7SEGMENT_DISPLAY,
+    STAT_SET_KEY_EVENTS,
+    STAT_READ_COUNTERS,
+    STAT_RESET_COUNTERS,
+    STAT_SET_STREAM_MODE,
+    STAT_VENDOR_OTHER,
+    STAT_CLASSES
+};
+
+enum osrfx2_stat_error {
+    STAT_ERR_ENOENT = 0,
+    STAT_ERR_ECONNRESET,
+    STAT_ERR_ESHUTDOWN,
+    STAT_ERR_EPIPE,
+    STAT_ERR_EPROTO,
+    STAT_ERR_EOVERFLOW,
+    STAT_ERR_ETIMEDOUT,
+    STAT_ERR_OTHER,
+    STAT_ERRORS
+};
+
+#define STAT_HIST_BUCKETS       24
+
+struct osrfx2_stat {
+    u64  submitted;
+    u64  completed;
+    u64  bytes;
+    u64  errors [STAT_ERRORS];
+    u64  latency [STAT_HIST_BUCKETS];
+};
+
+struct osrfx2_stats {
+    struct osrfx2_stat  cls [STAT_CLASSES];
+};
+
 /*****************************************************************************/
 /* This is the private device context structure.                             */
 /*****************************************************************************/
@@ -192,6 +530,11 @@ struct osrfx2 {
     size_t int_in_size;
     size_t bulk_in_size;
     size_t bulk_out_size;
+
+    /*
+     *  Bulk packets the device buffers in the selected alternate setting
+     */
+    unsigned int fifo_packets;
     
     /*
      *  USB Endpoints
@@ -225,7 +568,26 @@ struct osrfx2 {
      */
     struct switches_state  switches;
 
-    unsigned char notify;
+    atomic_t notify;                     /* boolean, consumed by poll */
+
+    /*
+     *  Every interrupt report is also queued, time-stamped, in event_fifo
+     *  (under event_lock). event_seq numbers the reports; event_lost and
+     *  event_overflows count the ones dropped on a full queue, since the
+     *  last OSRFX2_IOCTL_GET_EVENTS and in total.
+     */
+    struct kfifo    * event_fifo;
+    spinlock_t        event_lock;
+    __u32             event_seq;
+    __u32             event_lost;
+    unsigned long     event_overflows;
+
+    /*
+     *  Set when the firmware sends key event reports; key_seq is the
+     *  firmware's number of the next event expected.
+     */
+    int               key_events;        /* boolean */
+    __u8              key_seq;
 
     /*
      *  Track usage of the bulk pipes: serialize each pipe's use.
@@ -237,6 +599,7 @@ struct osrfx2 {
      *  Data tracking for Read/Write. 
      *  Writes will add to the pending_data count and 
      *  reads will deplete the pending_data count.
+     *  It is atomic so that poll can test it without taking sem.
      *
      *  Note: The OSRFX2 device specs states that the firmware will buffer
      *        up-to four write packet (two on EP6 and two on EP8).
@@ -244,15 +607,101 @@ struct osrfx2 {
      *        The fifth outstanding write packet attempt will cause the write
      *        to block, waiting for the arrival of a read request to
      *        effectively free a buffer into which the write data can be 
-     *        held.
+     *        held. osrfx2fw can buffer more in its other alternate
+     *        settings; fifo_packets holds the depth actually in use.
+     */
+    atomic_long_t  pending_data;
+
+    /*
+     *  OSRFX2_STREAM_* last set through the stream_mode attribute. Outside
+     *  loopback pending_data means nothing and is reset on every change.
+     */
+    int            stream_mode;
+
+    /*
+     *  Read-ahead ring: rx_depth URBs of rx_urb_size bytes each, primed
+     *  on open for read when rx_depth is non-zero. Completed slots are
+     *  queued on rx_done (under rx_lock) until read() drains them.
+     *  rx_mutex serializes readers sharing the one read-open file.
+     */
+    struct osrfx2_rx_urb * rx_ring;
+    unsigned int      rx_depth;
+    size_t            rx_urb_size;
+    int               rx_active;         /* boolean */
+    int               rx_error;
+    struct list_head  rx_done;
+    spinlock_t        rx_lock;
+    struct mutex      rx_mutex;
+    struct usb_anchor rx_anchor;
+
+    /*
+     *  Write pool: tx_count URBs with tx_urb_size byte coherent buffers.
+     *  Idle entries sit on tx_free (under tx_lock); writers wait on
+     *  FieldEventQueue for one to come back. tx_credits counts them, so
+     *  poll can tell whether a write would block without the lock.
+     */
+    struct osrfx2_tx_urb * tx_pool;
+    unsigned int      tx_count;
+    size_t            tx_urb_size;
+    struct list_head  tx_free;
+    atomic_t          tx_credits;
+    spinlock_t        tx_lock;
+    struct usb_anchor tx_anchor;
+
+    /*
+     *  Write coalescing: tx_stage is the pool entry being filled, holding
+     *  tx_stage_len bytes. tx_mutex guards both and serializes writers
+     *  against tx_flush_work, which sends a partly filled entry when the
+     *  coalescing delay expires.
+     */
+    unsigned int      tx_coalesce;       /* usecs, 0 = off */
+    struct osrfx2_tx_urb * tx_stage;
+    size_t            tx_stage_len;
+    struct mutex      tx_mutex;
+    struct delayed_work tx_flush_work;
+
+    /*
+     *  Zero-copy receive ring, set up through OSRFX2_IOCTL_RING_SETUP.
+     *  ring_mutex serializes setup, start, stop and mmap. poll looks at
+     *  the ring under rcu_read_lock() only, so it is unpublished and an
+     *  RCU grace period passes before it is freed (ring_remove()).
      */
-    size_t  pending_data;
+    struct osrfx2_ring * ring;
+    struct mutex      ring_mutex;
+
+    /*
+     *  AIO reads currently in flight, bounded by aio_depth, and their
+     *  URBs for suspend and disconnect to kill.
+     */
+    atomic_t          aio_reads;
+    unsigned int      aio_depth;
+    struct usb_anchor aio_anchor;
+
+    /*
+     *  Statistics (per-CPU), the URBs in flight per class and their
+     *  high-water marks, and this device's debugfs directory.
+     */
+    struct osrfx2_stats * stats;
+    atomic_t          stat_inflight [STAT_CLASSES];
+    int               stat_inflight_max [STAT_CLASSES];
+    struct dentry   * debugfs_dir;
+
+    /*
+     *  Time the interrupt-IN URB was last submitted.
+     */
+    ktime_t           int_in_submitted;
 
     /*
      *  Power Managment related fields
      */
     int   suspended;        /* boolean */
 
+    /*
+     *  Set once disconnect has begun; ends the waits which only the
+     *  device could end.
+     */
+    int   disconnected;     /* boolean */
+
 };
  
 /*****************************************************************************/
@@ -269,6 +718,168 @@ struct interrupt_packet {
 
 } __attribute__ ((packed));
 
+/*****************************************************************************/
+/* Account for an URB (or synchronous transfer) being started. Returns the   */
+/* start time to hand to stat_complete().                                    */
+/*****************************************************************************/
+static ktime_t stat_submit(struct osrfx2 * fx2dev, int cls)
+{
+    unsigned long flags;
+    int inflight;
+    int max;
+
+    local_irq_save(flags);
+    per_cpu_ptr(fx2dev->stats, smp_processor_id())->cls[cls].submitted++;
+    local_irq_restore(flags);
+
+    inflight = atomic_inc_return(&fx2dev->stat_inflight[cls]);
+    max = ACCESS_ONCE(fx2dev->stat_inflight_max[cls]);
+    while (inflight > max) {
+        int old = cmpxchg(&fx2dev->stat_inflight_max[cls], max, inflight);
+        if (old == max)
+            break;
+        max = old;
+    }
+
+    return ktime_get();
+}
+
+/*****************************************************************************/
+/* Account for a finished URB: status 0 or negative errno, bytes moved.      */
+/*****************************************************************************/
+static int stat_error(int status)
+{
+    switch (status) {
+        case -ENOENT:       return STAT_ERR_ENOENT;
+        case -ECONNRESET:   return STAT_ERR_ECONNRESET;
+        case -ESHUTDOWN:    return STAT_ERR_ESHUTDOWN;
+        case -EPIPE:        return STAT_ERR_EPIPE;
+        case -EPROTO:       return STAT_ERR_EPROTO;
+        case -EOVERFLOW:    return STAT_ERR_EOVERFLOW;
+        case -ETIMEDOUT:    return STAT_ERR_ETIMEDOUT;
+        default:            return STAT_ERR_OTHER;
+    }
+}
+
+static void stat_complete(struct osrfx2 * fx2dev, int cls, ktime_t start,
+                          int status, unsigned int bytes)
+{
+    struct osrfx2_stat * st;
+    unsigned long flags;
+    s64 usecs;
+    int bucket;
+
+    usecs  = ktime_us_delta(ktime_get(), start);
+    bucket = (usecs <= 0) ? 0 : 
+             min(fls64((u64)usecs), STAT_HIST_BUCKETS - 1);
+
+    atomic_dec(&fx2dev->stat_inflight[cls]);
+
+    local_irq_save(flags);
+    st = &per_cpu_ptr(fx2dev->stats, smp_processor_id())->cls[cls];
+    st->completed++;
+    st->bytes += bytes;
+    st->latency[bucket]++;
+    if (status < 0)
+        st->errors[stat_error(status)]++;
+    local_irq_restore(flags);
+}
+
+/*****************************************************************************/
+/* Account for a submission that failed: the URB never went out.             */
+/*****************************************************************************/
+static void stat_submit_failed(struct osrfx2 * fx2dev, int cls, int status)
+{
+    unsigned long flags;
+
+    atomic_dec(&fx2dev->stat_inflight[cls]);
+
+    local_irq_save(flags);
+    per_cpu_ptr(fx2dev->stats, smp_processor_id())->
+        cls[cls].errors[stat_error(status)]++;
+    local_irq_restore(flags);
+}
+
+/*****************************************************************************/
+/* Wake up whoever sleeps on or polls the device; reason is one of the       */
+/* OSRFX2_WAKE_* codes of osrfx2_trace.h and only shows up in the trace.     */
+/*****************************************************************************/
+static void wake_pollers(struct osrfx2 * fx2dev, int reason)
+{
+    trace_osrfx2_poll_wakeup(fx2dev->interface->minor, reason);
+    wake_up(&(fx2dev->FieldEventQueue));
+}
+
+/*****************************************************************************/
+/* Issue one vendor request on the control pipe (IN when USB_DIR_IN is set   */
+/* in dir) and account for it in the statistics of that request.             */
+/*****************************************************************************/
+static int vendor_request(struct osrfx2 * fx2dev, __u8 request, __u8 dir,
+                          __u16 value, void * data, __u16 size)
+{
+    ktime_t start;
+    int cls;
+    int pipe;
+    int retval;
+
+    switch (request) {
+        case OSRFX2_READ_7SEGMENT_DISPLAY:
+            cls = STAT_READ_7SEGMENT_DISPLAY;
+            break;
+        case OSRFX2_READ_SWITCHES:
+            cls = STAT_READ_SWITCHES;
+            break;
+        case OSRFX2_READ_BARGRAPH_DISPLAY:
+            cls = STAT_READ_BARGRAPH_DISPLAY;
+            break;
+        case OSRFX2_SET_BARGRAPH_DISPLAY:
+            cls = STAT_SET_BARGRAPH_DISPLAY;
+            break;
+        case OSRFX2_IS_HIGH_SPEED:
+            cls = STAT_IS_HIGH_SPEED;
+            break;
+        case OSRFX2_REENUMERATE:
+            cls = STAT_REENUMERATE;
+            break;
+        case OSRFX2_SET_KEY_EVENTS:
+            cls = STAT_SET_KEY_EVENTS;
+            break;
+        case OSRFX2_READ_COUNTERS:
+            cls = STAT_READ_COUNTERS;
+            break;
+        case OSRFX2_RESET_COUNTERS:
+            cls = STAT_RESET_COUNTERS;
+            break;
+        case OSRFX2_SET_STREAM_MODE:
+            cls = STAT_SET_STREAM_MODE;
+            break;
+        case OSRFX2_SET_7SEGMENT_DISPLAY:
+            cls = STAT_SET_7SEGMENT_DISPLAY;
+            break;
+        default:
+            cls = STAT_VENDOR_OTHER;
+            break;
+    }
+
+    pipe = (dir & USB_DIR_IN) ? usb_rcvctrlpipe(fx2dev->udev, 0) :
+                                usb_sndctrlpipe(fx2dev->udev, 0);
+
+    start  = stat_submit(fx2dev, cls);
+    retval = usb_control_msg(fx2dev->udev, 
+                             pipe, 
+                             request, 
+                             dir | USB_TYPE_VENDOR,
+                             value,
+                             0,
+                             data, 
+                             size,
+                             USB_CTRL_GET_TIMEOUT);
+    stat_complete(fx2dev, cls, start, 
+                  (retval < 0) ? retval : 0, (retval < 0) ? 0 : retval);
+
+    return retval;
+}
+
 /*****************************************************************************/
 /* This routine will retrieve the switches state, format it and return a     */
 /* representative string.                                                    */
@@ -290,15 +901,12 @@ static ssize_t show_switches(struct device * dev,
     }
     packet->SwitchesOctet = 0;
 
-    retval = usb_control_msg(fx2dev->udev, 
-                             usb_rcvctrlpipe(fx2dev->udev, 0), 
-                             OSRFX2_READ_SWITCHES, 
-                             USB_DIR_IN | USB_TYPE_VENDOR,
-                             0,
-                             0,
-                             packet, 
-                             sizeof(*packet),
-                             USB_CTRL_GET_TIMEOUT);
+    retval = vendor_request(fx2dev, 
+                            OSRFX2_READ_SWITCHES, 
+                            USB_DIR_IN,
+                            0,
+                            packet, 
+                            sizeof(*packet));
 
     if (retval < 0) {
         dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", __FUNCTION__, retval);
@@ -334,6 +942,22 @@ static ssize_t show_switches(struct device * dev,
 /*****************************************************************************/
 static DEVICE_ATTR( switches, S_IRUGO, show_switches, NULL );
 
+/*****************************************************************************/
+/* This routine shows how many switch events were dropped because the event  */
+/* queue was full, since the device was attached.                            */
+/*****************************************************************************/
+static ssize_t show_event_overflows(struct device * dev, 
+                                    struct device_attribute * attr, 
+                                    char * buf)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+
+    return sprintf(buf, "%lu\n", fx2dev->event_overflows);
+}
+
+static DEVICE_ATTR( event_overflows, S_IRUGO, show_event_overflows, NULL );
+
 
 /*****************************************************************************/
 /* This routine will retrieve the bargraph LED state, format it and return a */
@@ -356,15 +980,12 @@ static ssize_t show_bargraph(struct device * dev,
     }
     packet->BarsOctet = 0;
 
-    retval = usb_control_msg(fx2dev->udev, 
-                             usb_rcvctrlpipe(fx2dev->udev, 0), 
-                             OSRFX2_READ_BARGRAPH_DISPLAY, 
-                             USB_DIR_IN | USB_TYPE_VENDOR,
-                             0,
-                             0,
-                             packet, 
-                             sizeof(*packet),
-                             USB_CTRL_GET_TIMEOUT);
+    retval = vendor_request(fx2dev, 
+                            OSRFX2_READ_BARGRAPH_DISPLAY, 
+                            USB_DIR_IN,
+                            0,
+                            packet, 
+                            sizeof(*packet));
 
     if (retval < 0) {
         dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", 
@@ -426,15 +1047,12 @@ static ssize_t set_bargraph(struct device * dev,
     packet->Bar7 = (value & 0x40) ? 1 : 0;
     packet->Bar8 = (value & 0x80) ? 1 : 0;
 
-    retval = usb_control_msg(fx2dev->udev, 
-                             usb_sndctrlpipe(fx2dev->udev, 0), 
-                             OSRFX2_SET_BARGRAPH_DISPLAY, 
-                             USB_DIR_OUT | USB_TYPE_VENDOR,
-                             0,
-                             0,
-                             packet, 
-                             sizeof(*packet),
-                             USB_CTRL_GET_TIMEOUT);
+    retval = vendor_request(fx2dev, 
+                            OSRFX2_SET_BARGRAPH_DISPLAY, 
+                            USB_DIR_OUT,
+                            0,
+                            packet, 
+                            sizeof(*packet));
 
     if (retval < 0) {
         dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", 
@@ -487,15 +1105,12 @@ static ssize_t show_7segment(struct device * dev,
     }
     packet->SegmentsOctet = nondisplayable;
 
-    retval = usb_control_msg(fx2dev->udev, 
-                             usb_rcvctrlpipe(fx2dev->udev, 0), 
-                             OSRFX2_READ_7SEGMENT_DISPLAY, 
-                             USB_DIR_IN | USB_TYPE_VENDOR,
-                             0,
-                             0,
-                             packet, 
-                             sizeof(*packet),
-                             USB_CTRL_GET_TIMEOUT);
+    retval = vendor_request(fx2dev, 
+                            OSRFX2_READ_7SEGMENT_DISPLAY, 
+                            USB_DIR_IN,
+                            0,
+                            packet, 
+                            sizeof(*packet));
     if (retval < 0) {
         dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", 
                 __FUNCTION__, retval);
@@ -562,15 +1177,12 @@ static ssize_t set_7segment(struct device * dev,
     packet->SegmentsOctet = (value < 10) ? 
         digit_to_segments[value] : nondisplayable;
 
-    retval = usb_control_msg(fx2dev->udev, 
-                             usb_sndctrlpipe(fx2dev->udev, 0), 
-                             OSRFX2_SET_7SEGMENT_DISPLAY, 
-                             USB_DIR_OUT | USB_TYPE_VENDOR,
-                             0,
-                             0,
-                             packet, 
-                             sizeof(*packet),
-                             USB_CTRL_GET_TIMEOUT);
+    retval = vendor_request(fx2dev, 
+                            OSRFX2_SET_7SEGMENT_DISPLAY, 
+                            USB_DIR_OUT,
+                            0,
+                            packet, 
+                            sizeof(*packet));
     if (retval < 0) {
         dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", 
                 __FUNCTION__, retval);
@@ -591,491 +1203,3074 @@ static ssize_t set_7segment(struct device * dev,
 static DEVICE_ATTR( 7segment, S_IRUGO | S_IWUGO, show_7segment, set_7segment );
 
 /*****************************************************************************/
-/* Whenever one of the DIP switches is toggled, an interrupt packet will     */
-/* be sent by the device. This routine will catch that packet.               */
+/* These routines show and set the read-ahead ring geometry.                 */
+/*                                                                           */
+/* The ring is only built when the device is opened for read, so a new       */
+/* value is refused with -EBUSY while a reader has the device open and       */
+/* otherwise takes effect on the next open.                                  */
 /*****************************************************************************/
-static void interrupt_handler(struct urb * urb)
+static ssize_t show_readahead_depth(struct device * dev,
+                                    struct device_attribute * attr,
+                                    char * buf)
 {
-    struct osrfx2           * fx2dev = urb->context;
-    struct interrupt_packet * packet = urb->transfer_buffer;
-    int retval;
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
 
-    if (urb->status == 0) {
-
-        /* 
-         *  Retain the updated switches state 
-         */
-        fx2dev->switches.SwitchesOctet = packet->switches.SwitchesOctet;
-        fx2dev->notify = TRUE;
-        
-        /*
-         *  Wake-up any requests enqueued.
-         */
-        wake_up(&(fx2dev->FieldEventQueue));
+    return sprintf(buf, "%u\n", fx2dev->rx_depth);
+}
 
-        /* 
-         *  Restart interrupt urb 
-         */
-        retval = usb_submit_urb(urb, GFP_ATOMIC);
-        if (retval != 0) {
-            dev_err(&urb->dev->dev, "%s - error %d submitting interrupt urb\n",
-                    __FUNCTION__, retval);
-        }
+static ssize_t set_readahead_depth(struct device * dev,
+                                   struct device_attribute * attr,
+                                   const char * buf,
+                                   size_t count)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+    unsigned long value;
+    char * end;
 
-        /* 
-         *  Successful completion 
-         */
-        return;   
-    } 
+    value = simple_strtoul(buf, &end, 10);
+    if (buf == end || value > MAX_READAHEAD_URBS) {
+        return -EINVAL;
+    }
 
-    /* Reached here due to an error: log some useful information */
-    switch (urb->status) {
-        case -ECONNRESET:
-        case -ENOENT:
-        case -ESHUTDOWN:
-            return;
-        default: 
-            dev_err(&urb->dev->dev, "%s - non-zero urb status received: %d\n", 
-                    __FUNCTION__, urb->status);
-            return;
+    mutex_lock(&fx2dev->rx_mutex);
+    if (fx2dev->rx_active) {
+        mutex_unlock(&fx2dev->rx_mutex);
+        return -EBUSY;
     }
+    fx2dev->rx_depth = value;
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    return count;
+}
+
+static DEVICE_ATTR( readahead_depth, S_IRUGO | S_IWUSR,
+                    show_readahead_depth, set_readahead_depth );
+
+static ssize_t show_readahead_size(struct device * dev,
+                                   struct device_attribute * attr,
+                                   char * buf)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+
+    return sprintf(buf, "%zu\n", fx2dev->rx_urb_size);
 }
 
 /*****************************************************************************/
-/* This routine will ready operations for receiving interrupts from the      */
-/* OSR USB-FX2 device.                                                       */
-/*****************************************************************************/
-static int init_interrupts(struct osrfx2 * fx2dev)
+/* The URB size is rounded up to whole bulk-IN packets: an URB that ends in  */
+/* the middle of a packet would see the rest of it as babble (-EOVERFLOW).   */
+/* Zero selects a single packet per URB.                                     */
+/*****************************************************************************/
+static ssize_t set_readahead_size(struct device * dev,
+                                  struct device_attribute * attr,
+                                  const char * buf,
+                                  size_t count)
 {
-    int pipe;
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+    unsigned long value;
+    char * end;
+
+    value = simple_strtoul(buf, &end, 10);
+    if (buf == end || value > MAX_READAHEAD_SIZE) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&fx2dev->rx_mutex);
+    if (fx2dev->rx_active) {
+        mutex_unlock(&fx2dev->rx_mutex);
+        return -EBUSY;
+    }
+    fx2dev->rx_urb_size = (value == 0) ? fx2dev->bulk_in_size :
+                          roundup(value, fx2dev->bulk_in_size);
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    return count;
+}
+
+static DEVICE_ATTR( readahead_size, S_IRUGO | S_IWUSR,
+                    show_readahead_size, set_readahead_size );
+
+/*****************************************************************************/
+/* These routines show and set the write coalescing delay (0 = off). A new   */
+/* value applies from the next write() on; data already staged still goes    */
+/* out on the old schedule.                                                  */
+/*****************************************************************************/
+static ssize_t show_coalesce_usecs(struct device * dev,
+                                   struct device_attribute * attr,
+                                   char * buf)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+
+    return sprintf(buf, "%u\n", fx2dev->tx_coalesce);
+}
+
+static ssize_t set_coalesce_usecs(struct device * dev,
+                                  struct device_attribute * attr,
+                                  const char * buf,
+                                  size_t count)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+    unsigned long value;
+    char * end;
+
+    value = simple_strtoul(buf, &end, 10);
+    if (buf == end || value > MAX_COALESCE_USECS) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&fx2dev->tx_mutex);
+    fx2dev->tx_coalesce = value;
+    mutex_unlock(&fx2dev->tx_mutex);
+
+    return count;
+}
+
+static DEVICE_ATTR( coalesce_usecs, S_IRUGO | S_IWUSR,
+                    show_coalesce_usecs, set_coalesce_usecs );
+
+/*****************************************************************************/
+/* This routine shows how many bulk packets the device FIFO holds in the     */
+/* alternate setting selected at probe time.                                 */
+/*****************************************************************************/
+static ssize_t show_fifo_depth(struct device * dev,
+                               struct device_attribute * attr,
+                               char * buf)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+
+    return sprintf(buf, "%u\n", fx2dev->fifo_packets);
+}
+
+static DEVICE_ATTR( fifo_depth, S_IRUGO, show_fifo_depth, NULL );
+
+/*****************************************************************************/
+/* These routines read the firmware performance counters, one "name value"   */
+/* line each, and reset them on any write. Comparing them with the host side */
+/* statistics in debugfs shows whether a throughput problem is in the host   */
+/* or in the device: e.g. a growing in_full means the device waits for the   */
+/* host to read.                                                             */
+/*****************************************************************************/
+static ssize_t show_fw_counters(struct device * dev,
+                                struct device_attribute * attr,
+                                char * buf)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+    struct fw_counters   * counters;
     int retval;
 
-    pipe = usb_rcvintpipe(fx2dev->udev, fx2dev->int_in_endpointAddr);
-    
-    fx2dev->int_in_size = sizeof(struct interrupt_packet);  
-    
-    fx2dev->int_in_buffer = kmalloc(fx2dev->int_in_size, GFP_KERNEL);
-    if (!fx2dev->int_in_buffer) {
+    counters = kzalloc(sizeof(*counters), GFP_KERNEL);
+    if (!counters) {
         return -ENOMEM;
     }
 
-    fx2dev->int_in_urb = usb_alloc_urb(0, GFP_KERNEL);
-    if (!fx2dev->int_in_urb) {
-        return -ENOMEM;
+    retval = vendor_request(fx2dev,
+                            OSRFX2_READ_COUNTERS,
+                            USB_DIR_IN,
+                            0,
+                            counters,
+                            sizeof(*counters));
+
+    if (retval < 0) {
+        dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", __FUNCTION__, retval);
+        kfree(counters);
+        return retval;
+    }
+    if (retval < sizeof(*counters)) {
+        kfree(counters);
+        return -EIO;
     }
 
-    usb_fill_int_urb( fx2dev->int_in_urb, 
-                      fx2dev->udev,
-                      pipe,
-                      fx2dev->int_in_buffer, 
-                      fx2dev->int_in_size,
-                      interrupt_handler, 
-                      fx2dev,
-                      fx2dev->int_in_endpointInterval );
+    retval = sprintf(buf,
+                     "packets %u\n"
+                     "bytes %u\n"
+                     "in_full %u\n"
+                     "reports %u\n"
+                     "polls %u\n"
+                     "cycles %u\n"
+                     "cycles_max %u\n",
+                     le32_to_cpu(counters->packets),
+                     le32_to_cpu(counters->bytes),
+                     le32_to_cpu(counters->in_full),
+                     le32_to_cpu(counters->reports),
+                     le32_to_cpu(counters->polls),
+                     le16_to_cpu(counters->cycles),
+                     le16_to_cpu(counters->cycles_max));
+
+    kfree(counters);
 
-    retval = usb_submit_urb( fx2dev->int_in_urb, GFP_KERNEL );
-    if (retval != 0) {
-        dev_err(&fx2dev->udev->dev, "usb_submit_urb error %d \n", retval);
+    return retval;
+}
+
+static ssize_t reset_fw_counters(struct device * dev,
+                                 struct device_attribute * attr,
+                                 const char * buf,
+                                 size_t count)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+    int retval;
+
+    retval = vendor_request(fx2dev,
+                            OSRFX2_RESET_COUNTERS,
+                            USB_DIR_OUT,
+                            0,
+                            NULL,
+                            0);
+
+    if (retval < 0) {
+        dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", __FUNCTION__, retval);
         return retval;
     }
 
-    return 0; 
+    return count;
 }
 
+static DEVICE_ATTR( fw_counters, S_IRUGO | S_IWUSR,
+                    show_fw_counters, reset_fw_counters );
+
 /*****************************************************************************/
-/*                                                                           */
+/* These routines show and set the stream mode of the firmware: "loopback",  */
+/* "sink" or "source". The mode can only change while nobody has the device  */
+/* open for reading, so no read-ahead data of the old mode is left over.     */
 /*****************************************************************************/
-static int init_bulks(struct osrfx2 * fx2dev)
+static const char * const stream_mode_name [] = {
+    [OSRFX2_STREAM_LOOPBACK] = "loopback",
+    [OSRFX2_STREAM_SINK]     = "sink",
+    [OSRFX2_STREAM_SOURCE]   = "source",
+};
+
+static ssize_t show_stream_mode(struct device * dev,
+                                struct device_attribute * attr,
+                                char * buf)
 {
-    fx2dev->bulk_in_buffer = kmalloc(fx2dev->bulk_in_size, GFP_KERNEL);
-    if (!fx2dev->bulk_in_buffer) {
-        return -ENOMEM;
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+
+    return sprintf(buf, "%s\n", stream_mode_name[fx2dev->stream_mode]);
+}
+
+static ssize_t set_stream_mode(struct device * dev,
+                               struct device_attribute * attr,
+                               const char * buf,
+                               size_t count)
+{
+    struct usb_interface * intf   = to_usb_interface(dev);
+    struct osrfx2        * fx2dev = usb_get_intfdata(intf);
+    int mode;
+    int retval;
+
+    for (mode = 0; mode < ARRAY_SIZE(stream_mode_name); mode++) {
+        if (sysfs_streq(buf, stream_mode_name[mode]))
+            break;
     }
-    fx2dev->bulk_out_buffer = kmalloc(fx2dev->bulk_out_size, GFP_KERNEL);
-    if (!fx2dev->bulk_out_buffer) {
-        return -ENOMEM;
+    if (mode == ARRAY_SIZE(stream_mode_name)) {
+        return -EINVAL;
     }
 
-    init_MUTEX( &fx2dev->sem );
-    init_waitqueue_head( &fx2dev->FieldEventQueue );
+    /*
+     *  rx_mutex keeps open() from priming the read-ahead meanwhile.
+     */
+    mutex_lock(&fx2dev->rx_mutex);
 
-    return 0; 
+    if (atomic_read(&fx2dev->bulk_read_available) <= 0) {
+        mutex_unlock(&fx2dev->rx_mutex);
+        return -EBUSY;
+    }
+
+    retval = vendor_request(fx2dev,
+                            OSRFX2_SET_STREAM_MODE,
+                            USB_DIR_OUT,
+                            mode,
+                            NULL,
+                            0);
+
+    if (retval < 0) {
+        dev_err(&fx2dev->udev->dev, "%s - retval=%d\n", __FUNCTION__, retval);
+        mutex_unlock(&fx2dev->rx_mutex);
+        return retval;
+    }
+
+    fx2dev->stream_mode = mode;
+    atomic_long_set(&fx2dev->pending_data, 0);
+
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    return count;
 }
 
+static DEVICE_ATTR( stream_mode, S_IRUGO | S_IWUSR,
+                    show_stream_mode, set_stream_mode );
+
 /*****************************************************************************/
-/* This routine will attempt to locate the required endpoints and            */
-/* retain relevant information in the osrfx2 structure instance.             */
+/* Allocate and free the event queue.                                        */
 /*****************************************************************************/
-static int find_endpoints(struct osrfx2 * fx2dev)
+static int event_fifo_alloc(struct osrfx2 * fx2dev)
 {
-    struct usb_interface * interface = fx2dev->interface;
-    struct usb_endpoint_descriptor * endpoint;
-    unsigned char dir;
-    unsigned char attr;
-    int i;
+    unsigned int size;
 
-    for (i=0; i < interface->cur_altsetting->desc.bNumEndpoints; i++) {
+    spin_lock_init( &fx2dev->event_lock );
 
-        endpoint = &interface->cur_altsetting->endpoint[i].desc;
-        dir  = endpoint->bEndpointAddress & USB_DIR_IN;
-        attr = endpoint->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+    size = roundup_pow_of_two(clamp(event_depth, 1U, 
+                                    (unsigned int)MAX_EVENT_DEPTH)) *
+           sizeof(struct osrfx2_event);
 
-        switch ((dir << 8) + attr) {
-            case ((USB_DIR_IN << 8) + USB_ENDPOINT_XFER_INT) :
-                fx2dev->int_in_endpointAddr = endpoint->bEndpointAddress;
-                fx2dev->int_in_endpointInterval = endpoint->bInterval;
-                fx2dev->int_in_size = endpoint->wMaxPacketSize;
-                break;
-            case ((USB_DIR_IN << 8) + USB_ENDPOINT_XFER_BULK) :
-                fx2dev->bulk_in_endpointAddr = endpoint->bEndpointAddress;
-                fx2dev->bulk_in_endpointInterval = endpoint->bInterval;
-                fx2dev->bulk_in_size = endpoint->wMaxPacketSize;
-                break;
-            case ((USB_DIR_OUT << 8) + USB_ENDPOINT_XFER_BULK) :
-                fx2dev->bulk_out_endpointAddr = endpoint->bEndpointAddress;
-                fx2dev->bulk_out_endpointInterval = endpoint->bInterval;
-                fx2dev->bulk_out_size = endpoint->wMaxPacketSize;
-                break;
-            default:
-                break;
-        }
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,33)
+    fx2dev->event_fifo = kfifo_alloc(size, GFP_KERNEL, &fx2dev->event_lock);
+    if (IS_ERR(fx2dev->event_fifo)) {
+        fx2dev->event_fifo = NULL;
+        return -ENOMEM;
     }
-    if (fx2dev->int_in_endpointAddr   == 0 || 
-        fx2dev->bulk_in_endpointAddr  == 0 ||
-        fx2dev->bulk_out_endpointAddr == 0) {
-        dev_err(&interface->dev, "%s - failed to find required endpoints\n", 
-                __FUNCTION__);
-        return -ENODEV;
+#else
+    fx2dev->event_fifo = kmalloc(sizeof(struct kfifo), GFP_KERNEL);
+    if (!fx2dev->event_fifo)
+        return -ENOMEM;
+    if (kfifo_alloc(fx2dev->event_fifo, size, GFP_KERNEL)) {
+        kfree(fx2dev->event_fifo);
+        fx2dev->event_fifo = NULL;
+        return -ENOMEM;
     }
+#endif
     return 0;
 }
 
+static void event_fifo_free(struct osrfx2 * fx2dev)
+{
+    if (!fx2dev->event_fifo)
+        return;
+
+    kfifo_free(fx2dev->event_fifo);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,33)
+    kfree(fx2dev->event_fifo);
+#endif
+    fx2dev->event_fifo = NULL;
+}
+
 /*****************************************************************************/
-/*                                                                           */
+/* Queue one event. Runs in the URB completion routine. A full queue drops   */
+/* the new event, not old ones, so what is queued stays a gap-free run of    */
+/* seq numbers. skipped events were already dropped by the firmware: they    */
+/* take up seq numbers and count as lost, too.                               */
 /*****************************************************************************/
-static void osrfx2_delete(struct kref * kref)
+static void event_queue(struct osrfx2 * fx2dev, s64 timestamp_ns,
+                        unsigned char switches, unsigned int skipped,
+                        int frame)
 {
-    struct osrfx2 * fx2dev = container_of(kref, struct osrfx2, kref);
+    struct osrfx2_event event;
+    unsigned long flags;
+
+    memset(&event, 0, sizeof(event));
+    event.timestamp_ns = timestamp_ns;
+    event.switches     = switches;
+    if (frame >= 0) {
+        event.flags = OSRFX2_EVENT_FRAME;
+        event.frame = frame;
+    }
 
-    usb_put_dev( fx2dev->udev );
-    
-    if (fx2dev->int_in_urb) {
-        usb_free_urb(fx2dev->int_in_urb);
+    spin_lock_irqsave(&fx2dev->event_lock, flags);
+
+    fx2dev->event_seq       += skipped;
+    fx2dev->event_lost      += skipped;
+    fx2dev->event_overflows += skipped;
+
+    event.seq = fx2dev->event_seq++;
+
+    if (event_fifo_avail(fx2dev->event_fifo) < sizeof(event)) {
+        fx2dev->event_lost++;
+        fx2dev->event_overflows++;
     }
-    if (fx2dev->int_in_buffer) {
-        kfree(fx2dev->int_in_buffer);
+    else {
+        event_fifo_in(fx2dev->event_fifo, &event, sizeof(event));
     }
-    if (fx2dev->bulk_in_buffer) {
-        kfree( fx2dev->bulk_in_buffer );
+
+    spin_unlock_irqrestore(&fx2dev->event_lock, flags);
+}
+
+/*****************************************************************************/
+/* True while events are queued. The fifo length is read without the lock:   */
+/* it is only a hint, event_get() takes the events out under event_lock.     */
+/*****************************************************************************/
+static int event_pending(struct osrfx2 * fx2dev)
+{
+    return event_fifo_len(fx2dev->event_fifo) != 0;
+}
+
+/*****************************************************************************/
+/* OSRFX2_IOCTL_GET_EVENTS: move a batch of queued events to user space,     */
+/* EVENT_CHUNK records at a time so the lock is never held across a copy.    */
+/*****************************************************************************/
+static long event_get(struct osrfx2 * fx2dev, struct file * file,
+                      unsigned long arg)
+{
+    struct osrfx2_event_batch batch;
+    struct osrfx2_event chunk [EVENT_CHUNK];
+    struct osrfx2_event __user * events;
+    unsigned int got;
+    unsigned int n;
+
+    if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+        return -EFAULT;
+
+    events      = (struct osrfx2_event __user *)(unsigned long)batch.events;
+    batch.count = 0;
+
+    if (batch.max_events != 0 && !event_pending(fx2dev)) {
+        if (ACCESS_ONCE(fx2dev->disconnected))
+            return -ENODEV;
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(fx2dev->FieldEventQueue,
+                                     event_pending(fx2dev) ||
+                                     ACCESS_ONCE(fx2dev->disconnected))) {
+            return -ERESTARTSYS;
+        }
+        if (!event_pending(fx2dev))
+            return -ENODEV;
     }
-    if (fx2dev->bulk_out_buffer) {
-        kfree( fx2dev->bulk_out_buffer );
+
+    while (batch.count < batch.max_events) {
+
+        n = min(batch.max_events - batch.count, (__u32)EVENT_CHUNK);
+
+        spin_lock_irq(&fx2dev->event_lock);
+        got = event_fifo_out(fx2dev->event_fifo, chunk, 
+                             n * sizeof(struct osrfx2_event));
+        spin_unlock_irq(&fx2dev->event_lock);
+
+        got /= sizeof(struct osrfx2_event);
+        if (got == 0)
+            break;
+
+        if (copy_to_user(events + batch.count, chunk, 
+                         got * sizeof(struct osrfx2_event))) {
+            return -EFAULT;
+        }
+        batch.count += got;
     }
 
-    kfree( fx2dev );
+    spin_lock_irq(&fx2dev->event_lock);
+    batch.overflows    = fx2dev->event_lost;
+    fx2dev->event_lost = 0;
+    spin_unlock_irq(&fx2dev->event_lock);
+
+    if (copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+        return -EFAULT;
+
+    return 0;
 }
 
 /*****************************************************************************/
-/* osrfx2_open                                                               */
-/*                                                                           */
-/* Note:                                                                     */
-/*   The serialization method used below has a side-effect which I don't     */
-/*   particularly care for. In effect switch_events and bulk I/O are         */
-/*   mutually exclusive, e.g. an open for switch_events will exclude         */
-/*   opens for bulk I/O (osrbulk) and vis-a-verse.                           */
-/*                                                                           */
-/* Note:                                                                     */
-/*   The usb_clear_halt() is being used to effect a pipe reset.              */
-/*   This will clear any residual data at the endpoint and ready it for      */
-/*   the new endpoint user's data.                                           */
+/* Whenever one of the DIP switches is toggled, an interrupt packet will     */
+/* be sent by the device. This routine will catch that packet.               */
 /*****************************************************************************/
-static int osrfx2_open(struct inode * inode, struct file * file)
+static void interrupt_handler(struct urb * urb)
 {
-    struct usb_interface * interface;
-    struct osrfx2 * fx2dev;
+    struct osrfx2           * fx2dev = urb->context;
+    struct interrupt_packet * packet = urb->transfer_buffer;
+    unsigned char           * event;
+    s64 now;
     int retval;
-    int flags;
-    
-    interface = usb_find_interface(&osrfx2_driver, iminor(inode));
-    if (interface == NULL) 
-        return -ENODEV;
+    int i;
 
-    fx2dev = usb_get_intfdata(interface);
-    if (fx2dev == NULL) 
-        return -ENODEV;
+    trace_osrfx2_urb_complete(urb);
+    stat_complete(fx2dev, STAT_INT_IN, fx2dev->int_in_submitted,
+                  urb->status, urb->actual_length);
 
-    /*
-     *   Serialize access to each of the bulk pipes.
-     */ 
-    flags = (file->f_flags & O_ACCMODE);
+    if (urb->status == 0) {
 
-    if ((flags == O_WRONLY) || (flags == O_RDWR)) {
-        if (atomic_dec_and_test( &fx2dev->bulk_write_available ) == 0) {
-            atomic_inc( &fx2dev->bulk_write_available );
-            return -EBUSY;
+        now = ktime_to_ns(ktime_get());
+
+        if (fx2dev->key_events) {
+            /*
+             *  Several key events per report; the last one is the
+             *  current switches state.
+             */
+            for (i=0; i + KEY_EVENT_LEN <= urb->actual_length;
+                 i += KEY_EVENT_LEN) {
+                event = urb->transfer_buffer + i;
+                event_queue(fx2dev, now, event[1],
+                            (__u8)(event[0] - fx2dev->key_seq),
+                            event[2] | ((event[3] & 0x07) << 8));
+                fx2dev->key_seq = event[0] + 1;
+                fx2dev->switches.SwitchesOctet = event[1];
+            }
         }
+        else {
+            /* 
+             *  Retain the updated switches state 
+             */
+            fx2dev->switches.SwitchesOctet = packet->switches.SwitchesOctet;
 
+            /*
+             *  Keep every transition, not just the latest state.
+             */
+            event_queue(fx2dev, now, packet->switches.SwitchesOctet, 0, -1);
+        }
+        atomic_set(&fx2dev->notify, TRUE);
+        
         /*
-         *   The write interface is serialized, so reset bulk-out pipe (ep-6).
+         *  Wake-up any requests enqueued.
          */
-        retval = usb_clear_halt(fx2dev->udev, fx2dev->bulk_out_endpointAddr);
-        if ((retval != 0) && (retval != -EPIPE)) {
-            dev_err(&interface->dev, "%s - error(%d) usb_clear_halt(%02X)\n", 
-                    __FUNCTION__, retval, fx2dev->bulk_out_endpointAddr);
-        }
-    }
+        wake_pollers(fx2dev, OSRFX2_WAKE_INT_IN);
 
-    if ((flags == O_RDONLY) || (flags == O_RDWR)) {
-        if (atomic_dec_and_test( &fx2dev->bulk_read_available ) == 0) {
-            atomic_inc( &fx2dev->bulk_read_available );
+        /* 
+         *  Restart interrupt urb 
+         */
+        fx2dev->int_in_submitted = stat_submit(fx2dev, STAT_INT_IN);
+        trace_osrfx2_urb_submit(urb);
+        retval = usb_submit_urb(urb, GFP_ATOMIC);
+        if (retval != 0) {
+            stat_submit_failed(fx2dev, STAT_INT_IN, retval);
+            dev_err(&urb->dev->dev, "%s - error %d submitting interrupt urb\n",
+                    __FUNCTION__, retval);
+        }
+
+        /* 
+         *  Successful completion 
+         */
+        return;   
+    } 
+
+    /* Reached here due to an error: log some useful information */
+    switch (urb->status) {
+        case -ECONNRESET:
+        case -ENOENT:
+        case -ESHUTDOWN:
+            return;
+        default: 
+            dev_err(&urb->dev->dev, "%s - non-zero urb status received: %d\n", 
+                    __FUNCTION__, urb->status);
+            return;
+    }
+}
+
+/*****************************************************************************/
+/* This routine will ready operations for receiving interrupts from the      */
+/* OSR USB-FX2 device.                                                       */
+/*****************************************************************************/
+static int init_interrupts(struct osrfx2 * fx2dev)
+{
+    int pipe;
+    int retval;
+
+    pipe = usb_rcvintpipe(fx2dev->udev, fx2dev->int_in_endpointAddr);
+    
+    /*
+     *  A key event report can fill the whole packet.
+     */
+    fx2dev->int_in_size = max(fx2dev->int_in_size,
+                              sizeof(struct interrupt_packet));
+
+    if (key_events) {
+        retval = vendor_request(fx2dev, OSRFX2_SET_KEY_EVENTS, USB_DIR_OUT,
+                                1, NULL, 0);
+        fx2dev->key_events = (retval >= 0);
+        fx2dev->key_seq    = 0;
+    }
+
+    retval = event_fifo_alloc(fx2dev);
+    if (retval != 0) {
+        return retval;
+    }
+    
+    fx2dev->int_in_buffer = kmalloc(fx2dev->int_in_size, GFP_KERNEL);
+    if (!fx2dev->int_in_buffer) {
+        return -ENOMEM;
+    }
+
+    fx2dev->int_in_urb = usb_alloc_urb(0, GFP_KERNEL);
+    if (!fx2dev->int_in_urb) {
+        return -ENOMEM;
+    }
+
+    usb_fill_int_urb( fx2dev->int_in_urb, 
+                      fx2dev->udev,
+                      pipe,
+                      fx2dev->int_in_buffer, 
+                      fx2dev->int_in_size,
+                      interrupt_handler, 
+                      fx2dev,
+                      fx2dev->int_in_endpointInterval );
+
+    fx2dev->int_in_submitted = stat_submit(fx2dev, STAT_INT_IN);
+    trace_osrfx2_urb_submit(fx2dev->int_in_urb);
+    retval = usb_submit_urb( fx2dev->int_in_urb, GFP_KERNEL );
+    if (retval != 0) {
+        stat_submit_failed(fx2dev, STAT_INT_IN, retval);
+        dev_err(&fx2dev->udev->dev, "usb_submit_urb error %d \n", retval);
+        return retval;
+    }
+
+    return 0; 
+}
+
+/*****************************************************************************/
+/* Write pool completion routine: hand the entry back and wake any writer.   */
+/*****************************************************************************/
+static void write_pool_complete(struct urb * urb)
+{
+    struct osrfx2_tx_urb * tx     = urb->context;
+    struct osrfx2        * fx2dev = tx->fx2dev;
+    unsigned long flags;
+
+    trace_osrfx2_urb_complete(urb);
+    stat_complete(fx2dev, STAT_BULK_OUT, tx->submitted,
+                  urb->status, urb->actual_length);
+
+    /* 
+     *  Filter sync and async unlink events as non-errors.
+     */
+    if (urb->status && 
+        !(urb->status == -ENOENT || 
+          urb->status == -ECONNRESET ||
+          urb->status == -ESHUTDOWN)) {
+        dev_err(&fx2dev->interface->dev, 
+                "%s - non-zero status received: %d\n",
+                __FUNCTION__, urb->status);
+    }
+
+    /*
+     *  An AIO write completes right here, with the byte count or error.
+     */
+    if (tx->iocb) {
+        aio_complete(tx->iocb, 
+                     urb->status ? urb->status : urb->actual_length, 0);
+        tx->iocb = NULL;
+    }
+
+    spin_lock_irqsave(&fx2dev->tx_lock, flags);
+    list_add_tail(&tx->list, &fx2dev->tx_free);
+    atomic_inc(&fx2dev->tx_credits);
+    spin_unlock_irqrestore(&fx2dev->tx_lock, flags);
+
+    wake_pollers(fx2dev, OSRFX2_WAKE_TX_FREE);
+}
+
+/*****************************************************************************/
+/* Claim an idle write pool entry, or NULL if all of them are in flight.     */
+/*****************************************************************************/
+static struct osrfx2_tx_urb * write_pool_get(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_tx_urb * tx = NULL;
+
+    spin_lock_irq(&fx2dev->tx_lock);
+    if (!list_empty(&fx2dev->tx_free)) {
+        tx = list_first_entry(&fx2dev->tx_free, struct osrfx2_tx_urb, list);
+        list_del_init(&tx->list);
+        atomic_dec(&fx2dev->tx_credits);
+    }
+    spin_unlock_irq(&fx2dev->tx_lock);
+
+    return tx;
+}
+
+/*****************************************************************************/
+/* Return an entry which was claimed but never submitted.                    */
+/*****************************************************************************/
+static void write_pool_put(struct osrfx2 * fx2dev, struct osrfx2_tx_urb * tx)
+{
+    tx->iocb = NULL;
+
+    spin_lock_irq(&fx2dev->tx_lock);
+    list_add(&tx->list, &fx2dev->tx_free);
+    atomic_inc(&fx2dev->tx_credits);
+    spin_unlock_irq(&fx2dev->tx_lock);
+
+    wake_pollers(fx2dev, OSRFX2_WAKE_TX_FREE);
+}
+
+/*****************************************************************************/
+/* True when an idle write pool entry is available. Lock-free, so it is      */
+/* only a hint: write_pool_get() is what actually claims the entry.          */
+/*****************************************************************************/
+static int write_pool_ready(struct osrfx2 * fx2dev)
+{
+    return atomic_read(&fx2dev->tx_credits) > 0;
+}
+
+/*****************************************************************************/
+/* Claim an idle write pool entry for file, waiting for one to come back     */
+/* unless the file is non-blocking.                                          */
+/*****************************************************************************/
+static int write_pool_claim(struct osrfx2 * fx2dev, struct file * file,
+                            struct osrfx2_tx_urb ** ptx)
+{
+    *ptx = write_pool_get(fx2dev);
+    if (*ptx != NULL)
+        return 0;
+
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    if (wait_event_interruptible(fx2dev->FieldEventQueue,
+                                 (*ptx = write_pool_get(fx2dev)) != NULL)) {
+        return -ERESTARTSYS;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Send the first len bytes of a claimed entry out the bulk-OUT endpoint.    */
+/* On failure the entry goes straight back to the pool.                      */
+/*****************************************************************************/
+static int write_pool_submit(struct osrfx2 * fx2dev, 
+                             struct osrfx2_tx_urb * tx, size_t len)
+{
+    int retval;
+
+    tx->urb->transfer_buffer_length = len;
+
+    usb_anchor_urb(tx->urb, &fx2dev->tx_anchor);
+
+    tx->submitted = stat_submit(fx2dev, STAT_BULK_OUT);
+    trace_osrfx2_urb_submit(tx->urb);
+    retval = usb_submit_urb(tx->urb, GFP_KERNEL);
+    if (retval) {
+        stat_submit_failed(fx2dev, STAT_BULK_OUT, retval);
+        usb_unanchor_urb(tx->urb);
+        write_pool_put(fx2dev, tx);
+        dev_err(&fx2dev->interface->dev, 
+                "%s - usb_submit_urb failed: %d\n",
+                __FUNCTION__, retval);
+        return retval;
+    }
+
+    /*
+     *  Increment the pending_data counter by the byte count sent.
+     */
+    atomic_long_add(len, &fx2dev->pending_data);
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* Send whatever the coalescing stage holds. Called with tx_mutex held.      */
+/*****************************************************************************/
+static int coalesce_flush(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_tx_urb * tx = fx2dev->tx_stage;
+
+    if (tx == NULL)
+        return 0;
+
+    fx2dev->tx_stage = NULL;
+
+    if (fx2dev->tx_stage_len == 0) {
+        write_pool_put(fx2dev, tx);
+        return 0;
+    }
+
+    return write_pool_submit(fx2dev, tx, fx2dev->tx_stage_len);
+}
+
+/*****************************************************************************/
+/* The coalescing delay expired: send the partly filled stage.               */
+/*****************************************************************************/
+static void coalesce_flush_work(struct work_struct * work)
+{
+    struct osrfx2 * fx2dev = container_of(to_delayed_work(work),
+                                          struct osrfx2, tx_flush_work);
+
+    mutex_lock(&fx2dev->tx_mutex);
+    coalesce_flush(fx2dev);
+    mutex_unlock(&fx2dev->tx_mutex);
+}
+
+/*****************************************************************************/
+/* Release the write pool. No entry may be in flight any more.               */
+/*****************************************************************************/
+static void write_pool_free(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_tx_urb * tx;
+    unsigned int i;
+
+    if (!fx2dev->tx_pool)
+        return;
+
+    for (i=0; i < fx2dev->tx_count; i++) {
+        tx = &fx2dev->tx_pool[i];
+        if (!tx->urb)
+            continue;
+        if (tx->urb->transfer_buffer) {
+            usb_buffer_free( fx2dev->udev,
+                             fx2dev->tx_urb_size,
+                             tx->urb->transfer_buffer,
+                             tx->urb->transfer_dma );
+        }
+        usb_free_urb(tx->urb);
+    }
+
+    kfree(fx2dev->tx_pool);
+    fx2dev->tx_pool = NULL;
+    atomic_set(&fx2dev->tx_credits, 0);
+}
+
+/*****************************************************************************/
+/* Build the write pool: every entry gets its URB and coherent buffer now,   */
+/* so that write() itself never has to allocate.                             */
+/*****************************************************************************/
+static int write_pool_init(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_tx_urb * tx;
+    unsigned int i;
+    void * buf;
+    int pipe;
+
+    INIT_LIST_HEAD( &fx2dev->tx_free );
+    spin_lock_init( &fx2dev->tx_lock );
+    init_usb_anchor( &fx2dev->tx_anchor );
+    mutex_init( &fx2dev->tx_mutex );
+    INIT_DELAYED_WORK( &fx2dev->tx_flush_work, coalesce_flush_work );
+
+    fx2dev->tx_coalesce = min(coalesce_usecs, 
+                              (unsigned int)MAX_COALESCE_USECS);
+
+    fx2dev->tx_count    = clamp(write_urbs ? write_urbs : fx2dev->fifo_packets,
+                                1U, (unsigned int)MAX_WRITE_URBS);
+    fx2dev->tx_urb_size = fx2dev->bulk_out_size *
+                          clamp(write_urb_packets, 1U,
+                                (unsigned int)MAX_WRITE_URB_PACKETS);
+
+    fx2dev->tx_pool = kzalloc(fx2dev->tx_count * sizeof(*tx), GFP_KERNEL);
+    if (!fx2dev->tx_pool)
+        return -ENOMEM;
+
+    pipe = usb_sndbulkpipe(fx2dev->udev, fx2dev->bulk_out_endpointAddr);
+
+    for (i=0; i < fx2dev->tx_count; i++) {
+        tx = &fx2dev->tx_pool[i];
+        tx->fx2dev = fx2dev;
+
+        tx->urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (!tx->urb)
+            goto error;
+
+        buf = usb_buffer_alloc( fx2dev->udev,
+                                fx2dev->tx_urb_size,
+                                GFP_KERNEL,
+                                &tx->urb->transfer_dma );
+        if (!buf)
+            goto error;
+
+        usb_fill_bulk_urb( tx->urb,
+                           fx2dev->udev,
+                           pipe,
+                           buf,
+                           fx2dev->tx_urb_size,
+                           write_pool_complete,
+                           tx );
+
+        tx->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+        list_add_tail(&tx->list, &fx2dev->tx_free);
+        atomic_inc(&fx2dev->tx_credits);
+    }
+
+    return 0;
+
+error:
+    write_pool_free(fx2dev);
+    return -ENOMEM;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/*****************************************************************************/
+static int init_bulks(struct osrfx2 * fx2dev)
+{
+    fx2dev->bulk_in_buffer = kmalloc(fx2dev->bulk_in_size, GFP_KERNEL);
+    if (!fx2dev->bulk_in_buffer) {
+        return -ENOMEM;
+    }
+    fx2dev->bulk_out_buffer = kmalloc(fx2dev->bulk_out_size, GFP_KERNEL);
+    if (!fx2dev->bulk_out_buffer) {
+        return -ENOMEM;
+    }
+
+    init_MUTEX( &fx2dev->sem );
+    init_waitqueue_head( &fx2dev->FieldEventQueue );
+
+    /*
+     *  The read-ahead ring itself is only built on open for read.
+     */
+    INIT_LIST_HEAD( &fx2dev->rx_done );
+    spin_lock_init( &fx2dev->rx_lock );
+    mutex_init( &fx2dev->rx_mutex );
+    init_usb_anchor( &fx2dev->rx_anchor );
+
+    mutex_init( &fx2dev->ring_mutex );
+
+    atomic_set( &fx2dev->aio_reads, 0 );
+    init_usb_anchor( &fx2dev->aio_anchor );
+    fx2dev->aio_depth = clamp(aio_depth, 1U, (unsigned int)MAX_AIO_DEPTH);
+
+    fx2dev->rx_depth    = min(readahead_urbs, (unsigned int)MAX_READAHEAD_URBS);
+    fx2dev->rx_urb_size = fx2dev->bulk_in_size;
+    if (readahead_size != 0) {
+        fx2dev->rx_urb_size = roundup(min(readahead_size,
+                                          (unsigned int)MAX_READAHEAD_SIZE),
+                                      fx2dev->bulk_in_size);
+    }
+
+    return write_pool_init( fx2dev );
+}
+
+/*****************************************************************************/
+/* This routine returns the number of bulk packets the device buffers in an  */
+/* alternate setting, taken from the FIFO descriptor among its extra         */
+/* descriptors, or 0 if it has none.                                         */
+/*****************************************************************************/
+static unsigned int fifo_packets_of(struct usb_host_interface * alt)
+{
+    unsigned char * extra = alt->extra;
+    int len = alt->extralen;
+
+    while (len >= 2 && extra[0] >= 2 && extra[0] <= len) {
+        if (extra[0] >= 5 &&
+            extra[1] == USB_DT_OSRFX2_FIFO &&
+            extra[2] == OSRFX2_FIFO_BULK) {
+            return extra[3] + extra[4];
+        }
+        len   -= extra[0];
+        extra += extra[0];
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* This routine selects the alternate setting named by the altsetting        */
+/* parameter, or else the one with the deepest device FIFO, and records its  */
+/* depth. It must run before find_endpoints(): the bulk endpoint addresses   */
+/* differ between the settings.                                              */
+/*****************************************************************************/
+static int select_altsetting(struct osrfx2 * fx2dev)
+{
+    struct usb_interface * interface = fx2dev->interface;
+    struct usb_host_interface * alt;
+    struct usb_host_interface * best = NULL;
+    unsigned int best_packets = 0;
+    unsigned int packets;
+    int retval;
+    int i;
+
+    for (i=0; i < interface->num_altsetting; i++) {
+
+        alt = &interface->altsetting[i];
+        packets = fifo_packets_of(alt);
+
+        if (altsetting >= 0) {
+            if (alt->desc.bAlternateSetting != altsetting)
+                continue;
+        }
+        else if (best != NULL && packets <= best_packets) {
+            continue;
+        }
+        best = alt;
+        best_packets = packets;
+    }
+    if (best == NULL) {
+        dev_err(&interface->dev, "%s - no alternate setting %d\n",
+                __FUNCTION__, altsetting);
+        return -ENODEV;
+    }
+
+    if (best != interface->cur_altsetting) {
+        retval = usb_set_interface(fx2dev->udev,
+                                   best->desc.bInterfaceNumber,
+                                   best->desc.bAlternateSetting);
+        if (retval != 0) {
+            dev_err(&interface->dev, "%s - usb_set_interface failed %d\n",
+                    __FUNCTION__, retval);
+            return retval;
+        }
+    }
+
+    fx2dev->fifo_packets = best_packets ? best_packets : DEFAULT_FIFO_PACKETS;
+
+    dev_info(&interface->dev, "alternate setting %d, %u packet device FIFO\n",
+             best->desc.bAlternateSetting, fx2dev->fifo_packets);
+    return 0;
+}
+
+/*****************************************************************************/
+/* This routine will attempt to locate the required endpoints and            */
+/* retain relevant information in the osrfx2 structure instance.             */
+/*****************************************************************************/
+static int find_endpoints(struct osrfx2 * fx2dev)
+{
+    struct usb_interface * interface = fx2dev->interface;
+    struct usb_endpoint_descriptor * endpoint;
+    unsigned char dir;
+    unsigned char attr;
+    int i;
+
+    for (i=0; i < interface->cur_altsetting->desc.bNumEndpoints; i++) {
+
+        endpoint = &interface->cur_altsetting->endpoint[i].desc;
+        dir  = endpoint->bEndpointAddress & USB_DIR_IN;
+        attr = endpoint->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK;
+
+        switch ((dir << 8) + attr) {
+            case ((USB_DIR_IN << 8) + USB_ENDPOINT_XFER_INT) :
+                fx2dev->int_in_endpointAddr = endpoint->bEndpointAddress;
+                fx2dev->int_in_endpointInterval = endpoint->bInterval;
+                fx2dev->int_in_size = endpoint->wMaxPacketSize;
+                break;
+            case ((USB_DIR_IN << 8) + USB_ENDPOINT_XFER_BULK) :
+                fx2dev->bulk_in_endpointAddr = endpoint->bEndpointAddress;
+                fx2dev->bulk_in_endpointInterval = endpoint->bInterval;
+                fx2dev->bulk_in_size = endpoint->wMaxPacketSize;
+                break;
+            case ((USB_DIR_OUT << 8) + USB_ENDPOINT_XFER_BULK) :
+                fx2dev->bulk_out_endpointAddr = endpoint->bEndpointAddress;
+                fx2dev->bulk_out_endpointInterval = endpoint->bInterval;
+                fx2dev->bulk_out_size = endpoint->wMaxPacketSize;
+                break;
+            default:
+                break;
+        }
+    }
+    if (fx2dev->int_in_endpointAddr   == 0 || 
+        fx2dev->bulk_in_endpointAddr  == 0 ||
+        fx2dev->bulk_out_endpointAddr == 0) {
+        dev_err(&interface->dev, "%s - failed to find required endpoints\n", 
+                __FUNCTION__);
+        return -ENODEV;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/*****************************************************************************/
+static void osrfx2_delete(struct kref * kref)
+{
+    struct osrfx2 * fx2dev = container_of(kref, struct osrfx2, kref);
+
+    write_pool_free( fx2dev );
+    event_fifo_free( fx2dev );
+
+    if (fx2dev->stats) {
+        free_percpu(fx2dev->stats);
+    }
+
+    usb_put_dev( fx2dev->udev );
+    
+    if (fx2dev->int_in_urb) {
+        usb_free_urb(fx2dev->int_in_urb);
+    }
+    if (fx2dev->int_in_buffer) {
+        kfree(fx2dev->int_in_buffer);
+    }
+    if (fx2dev->bulk_in_buffer) {
+        kfree( fx2dev->bulk_in_buffer );
+    }
+    if (fx2dev->bulk_out_buffer) {
+        kfree( fx2dev->bulk_out_buffer );
+    }
+
+    kfree( fx2dev );
+}
+
+/*****************************************************************************/
+/* (Re)submit one read-ahead slot to the bulk-IN endpoint.                   */
+/*****************************************************************************/
+static int readahead_submit(struct osrfx2_rx_urb * rx, gfp_t mem_flags)
+{
+    struct osrfx2 * fx2dev = rx->fx2dev;
+    int retval;
+
+    usb_anchor_urb(rx->urb, &fx2dev->rx_anchor);
+
+    rx->submitted = stat_submit(fx2dev, STAT_BULK_IN);
+    trace_osrfx2_urb_submit(rx->urb);
+    retval = usb_submit_urb(rx->urb, mem_flags);
+    if (retval != 0) {
+        stat_submit_failed(fx2dev, STAT_BULK_IN, retval);
+        usb_unanchor_urb(rx->urb);
+        dev_err(&fx2dev->interface->dev,
+                "%s - usb_submit_urb failed: %d\n", __FUNCTION__, retval);
+    }
+    return retval;
+}
+
+/*****************************************************************************/
+/* Read-ahead completion routine.                                            */
+/*                                                                           */
+/* A slot which received data is queued for read() and stays idle until it   */
+/* has been drained. Zero-length packets carry nothing for read(), so that   */
+/* slot goes straight back to the device. Unlinks mean the ring is being     */
+/* stopped (release/suspend/disconnect) and are simply dropped.              */
+/*****************************************************************************/
+static void readahead_complete(struct urb * urb)
+{
+    struct osrfx2_rx_urb * rx     = urb->context;
+    struct osrfx2        * fx2dev = rx->fx2dev;
+    unsigned long flags;
+    int retval;
+
+    trace_osrfx2_urb_complete(urb);
+    stat_complete(fx2dev, STAT_BULK_IN, rx->submitted,
+                  urb->status, urb->actual_length);
+
+    switch (urb->status) {
+        case 0:
+            break;
+        case -ECONNRESET:
+        case -ENOENT:
+        case -ESHUTDOWN:
+            return;
+        default:
+            dev_err(&fx2dev->interface->dev,
+                    "%s - non-zero urb status received: %d\n",
+                    __FUNCTION__, urb->status);
+            spin_lock_irqsave(&fx2dev->rx_lock, flags);
+            fx2dev->rx_error = urb->status;
+            rx->failed = TRUE;
+            spin_unlock_irqrestore(&fx2dev->rx_lock, flags);
+            wake_pollers(fx2dev, OSRFX2_WAKE_RX_DATA);
+            return;
+    }
+
+    if (urb->actual_length == 0) {
+        /*
+         *  Completion took the URB off rx_anchor; readahead_submit() puts
+         *  it back, so that stopping the ring still finds it in flight.
+         */
+        retval = readahead_submit(rx, GFP_ATOMIC);
+        if (retval != 0) {
+            spin_lock_irqsave(&fx2dev->rx_lock, flags);
+            fx2dev->rx_error = retval;
+            rx->failed = TRUE;
+            spin_unlock_irqrestore(&fx2dev->rx_lock, flags);
+            wake_pollers(fx2dev, OSRFX2_WAKE_RX_DATA);
+        }
+        return;
+    }
+
+    rx->copied = 0;
+
+    spin_lock_irqsave(&fx2dev->rx_lock, flags);
+    list_add_tail(&rx->list, &fx2dev->rx_done);
+    spin_unlock_irqrestore(&fx2dev->rx_lock, flags);
+
+    wake_pollers(fx2dev, OSRFX2_WAKE_RX_DATA);
+}
+
+/*****************************************************************************/
+/* Tear down the read-ahead ring. Anything staged but not yet read is lost.  */
+/* Called with rx_mutex held.                                                */
+/*****************************************************************************/
+static void readahead_stop(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_rx_urb * rx;
+    unsigned int i;
+
+    if (!fx2dev->rx_ring)
+        return;
+
+    fx2dev->rx_active = FALSE;
+    usb_kill_anchored_urbs(&fx2dev->rx_anchor);
+
+    spin_lock_irq(&fx2dev->rx_lock);
+    INIT_LIST_HEAD(&fx2dev->rx_done);
+    fx2dev->rx_error = 0;
+    spin_unlock_irq(&fx2dev->rx_lock);
+
+    for (i=0; i < fx2dev->rx_depth; i++) {
+        rx = &fx2dev->rx_ring[i];
+        if (!rx->urb)
+            continue;
+        if (rx->urb->transfer_buffer) {
+            usb_buffer_free( fx2dev->udev,
+                             rx->urb->transfer_buffer_length,
+                             rx->urb->transfer_buffer,
+                             rx->urb->transfer_dma );
+        }
+        usb_free_urb(rx->urb);
+    }
+
+    kfree(fx2dev->rx_ring);
+    fx2dev->rx_ring = NULL;
+}
+
+/*****************************************************************************/
+/* Build the read-ahead ring and prime every slot on the bulk-IN endpoint.   */
+/* Called with rx_mutex held.                                                */
+/*****************************************************************************/
+static int readahead_start(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_rx_urb * rx;
+    unsigned int i;
+    void * buf;
+    int pipe;
+    int retval;
+
+    if (fx2dev->rx_depth == 0 || fx2dev->rx_ring)
+        return 0;
+
+    fx2dev->rx_ring = kzalloc(fx2dev->rx_depth * sizeof(*rx), GFP_KERNEL);
+    if (!fx2dev->rx_ring)
+        return -ENOMEM;
+
+    pipe = usb_rcvbulkpipe(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
+
+    for (i=0; i < fx2dev->rx_depth; i++) {
+        rx = &fx2dev->rx_ring[i];
+        rx->fx2dev = fx2dev;
+        INIT_LIST_HEAD(&rx->list);
+
+        rx->urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (!rx->urb) {
+            retval = -ENOMEM;
+            goto error;
+        }
+
+        buf = usb_buffer_alloc( fx2dev->udev,
+                                fx2dev->rx_urb_size,
+                                GFP_KERNEL,
+                                &rx->urb->transfer_dma );
+        if (!buf) {
+            retval = -ENOMEM;
+            goto error;
+        }
+
+        usb_fill_bulk_urb( rx->urb,
+                           fx2dev->udev,
+                           pipe,
+                           buf,
+                           fx2dev->rx_urb_size,
+                           readahead_complete,
+                           rx );
+
+        rx->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+    }
+
+    fx2dev->rx_error  = 0;
+    fx2dev->rx_active = TRUE;
+
+    for (i=0; i < fx2dev->rx_depth; i++) {
+        retval = readahead_submit(&fx2dev->rx_ring[i], GFP_KERNEL);
+        if (retval != 0)
+            goto error;
+    }
+
+    return 0;
+
+error:
+    readahead_stop(fx2dev);
+    return retval;
+}
+
+/*****************************************************************************/
+/* True when read() has something to report: staged data, an error, or the   */
+/* ring going away underneath it (disconnect).                               */
+/* Lock-free hint; readahead_read() dequeues under rx_lock.                  */
+/*****************************************************************************/
+static int readahead_ready(struct osrfx2 * fx2dev)
+{
+    return !list_empty_careful(&fx2dev->rx_done) || 
+           ACCESS_ONCE(fx2dev->rx_error) ||
+           !ACCESS_ONCE(fx2dev->rx_active);
+}
+
+/*****************************************************************************/
+/* Put slots that ended in error back on the endpoint. A stalled endpoint    */
+/* is cleared first, just like open does. Called with rx_mutex held.         */
+/*****************************************************************************/
+static void readahead_recover(struct osrfx2 * fx2dev, int error)
+{
+    struct osrfx2_rx_urb * rx;
+    unsigned int i;
+    int retval;
+
+    if (error == -EPIPE) {
+        retval = usb_clear_halt(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
+        if (retval != 0) {
+            dev_err(&fx2dev->interface->dev,
+                    "%s - error(%d) usb_clear_halt(%02X)\n",
+                    __FUNCTION__, retval, fx2dev->bulk_in_endpointAddr);
+        }
+    }
+
+    for (i=0; i < fx2dev->rx_depth; i++) {
+        rx = &fx2dev->rx_ring[i];
+        if (rx->failed) {
+            rx->failed = FALSE;
+            readahead_submit(rx, GFP_KERNEL);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* read() for the read-ahead mode.                                           */
+/*                                                                           */
+/* Copies as much staged data as fits into the caller's buffer, possibly     */
+/* spanning several completed slots, and hands every fully drained slot      */
+/* straight back to the device. Only blocks (or returns -EAGAIN) when        */
+/* nothing at all is staged. An URB error is reported once, after the data   */
+/* received ahead of it has been read.                                       */
+/*****************************************************************************/
+static ssize_t readahead_read(struct osrfx2 * fx2dev, char * buffer,
+                              size_t count, int nonblock)
+{
+    struct osrfx2_rx_urb * rx;
+    ssize_t retval = 0;
+    size_t copied = 0;
+    size_t chunk;
+    int error;
+
+    if (mutex_lock_interruptible(&fx2dev->rx_mutex))
+        return -ERESTARTSYS;
+
+    while (copied < count) {
+
+        if (!fx2dev->rx_active) {
+            retval = -ENODEV;
+            break;
+        }
+
+        error = 0;
+
+        spin_lock_irq(&fx2dev->rx_lock);
+        rx = list_empty(&fx2dev->rx_done) ? NULL :
+             list_first_entry(&fx2dev->rx_done, struct osrfx2_rx_urb, list);
+        if (rx == NULL && copied == 0) {
+            error = fx2dev->rx_error;
+            fx2dev->rx_error = 0;
+        }
+        spin_unlock_irq(&fx2dev->rx_lock);
+
+        if (rx == NULL) {
+            if (copied != 0)
+                break;
+
+            if (error != 0) {
+                readahead_recover(fx2dev, error);
+                retval = (error == -EPIPE) ? error : -EIO;
+                break;
+            }
+
+            if (nonblock) {
+                retval = -EAGAIN;
+                break;
+            }
+
+            mutex_unlock(&fx2dev->rx_mutex);
+            if (wait_event_interruptible(fx2dev->FieldEventQueue,
+                                         readahead_ready(fx2dev))) {
+                return -ERESTARTSYS;
+            }
+            if (mutex_lock_interruptible(&fx2dev->rx_mutex))
+                return -ERESTARTSYS;
+            continue;
+        }
+
+        chunk = min(rx->urb->actual_length - rx->copied, count - copied);
+
+        if (copy_to_user(buffer + copied,
+                         (char *)rx->urb->transfer_buffer + rx->copied,
+                         chunk)) {
+            retval = -EFAULT;
+            break;
+        }
+
+        rx->copied += chunk;
+        copied     += chunk;
+
+        if (rx->copied == rx->urb->actual_length) {
+            spin_lock_irq(&fx2dev->rx_lock);
+            list_del_init(&rx->list);
+            spin_unlock_irq(&fx2dev->rx_lock);
+
+            readahead_submit(rx, GFP_KERNEL);
+        }
+    }
+
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    if (copied == 0)
+        return retval;
+
+    atomic_long_sub(copied, &fx2dev->pending_data);
+
+    return copied;
+}
+
+/*****************************************************************************/
+/* Bind an URB to the next free slot and submit it, or park it if the        */
+/* consumer hasn't made room yet. Called with ring->lock held.               */
+/*****************************************************************************/
+static void ring_feed(struct osrfx2_ring * ring, struct osrfx2_ring_urb * ru)
+{
+    unsigned int tail;
+    int retval;
+
+    tail = ACCESS_ONCE(ring->hdr->tail);
+    smp_rmb();
+
+    ru->failed = FALSE;
+
+    if (!ring->active || (ring->submit - tail) >= ring->slot_count) {
+        ru->parked = TRUE;
+        if (ring->active)
+            schedule_delayed_work(&ring->refill, RING_FULL_JIFFIES);
+        return;
+    }
+
+    ru->parked = FALSE;
+    ru->seq    = ring->submit++;
+
+    ru->urb->transfer_buffer = 
+        page_address(ring->slot_page[ru->seq % ring->slot_count]);
+
+    usb_anchor_urb(ru->urb, &ring->anchor);
+
+    ru->submitted = stat_submit(ring->fx2dev, STAT_BULK_IN);
+    trace_osrfx2_urb_submit(ru->urb);
+    retval = usb_submit_urb(ru->urb, GFP_ATOMIC);
+    if (retval != 0) {
+        stat_submit_failed(ring->fx2dev, STAT_BULK_IN, retval);
+        usb_unanchor_urb(ru->urb);
+        ring->submit--;
+        ru->parked = TRUE;
+        ru->failed = TRUE;
+        ring->hdr->error = retval;
+        schedule_delayed_work(&ring->refill, RING_RETRY_JIFFIES);
+        dev_err(&ring->fx2dev->interface->dev,
+                "%s - usb_submit_urb failed: %d\n", __FUNCTION__, retval);
+    }
+}
+
+/*****************************************************************************/
+/* Ring completion routine: publish the slot, then feed the URB again. After */
+/* an error the slot is published empty and the URB parked for the refill,   */
+/* which first clears a stalled endpoint, as the read path does.             */
+/*****************************************************************************/
+static void ring_complete(struct urb * urb)
+{
+    struct osrfx2_ring_urb * ru   = urb->context;
+    struct osrfx2_ring     * ring = ru->ring;
+    unsigned long flags;
+    int resubmit = TRUE;
+    __u32 len = urb->actual_length;
+
+    trace_osrfx2_urb_complete(urb);
+    stat_complete(ring->fx2dev, STAT_BULK_IN, ru->submitted,
+                  urb->status, urb->actual_length);
+
+    switch (urb->status) {
+        case 0:
+            break;
+        case -ECONNRESET:
+        case -ENOENT:
+        case -ESHUTDOWN:
+            return;
+        default:
+            dev_err(&ring->fx2dev->interface->dev,
+                    "%s - non-zero urb status received: %d\n",
+                    __FUNCTION__, urb->status);
+            ring->hdr->error = urb->status;
+            resubmit = FALSE;
+            len = 0;
+            break;
+    }
+
+    spin_lock_irqsave(&ring->lock, flags);
+
+    if (ru->seq != ring->head) {
+        dev_err(&ring->fx2dev->interface->dev,
+                "%s - slot %u completed, expected %u\n",
+                __FUNCTION__, ru->seq, ring->head);
+    }
+
+    ring->hdr->slot_len[ring->head % ring->slot_count] = len;
+    smp_wmb();
+    ring->hdr->head = ++ring->head;
+
+    if (resubmit) {
+        ring_feed(ring, ru);
+    }
+    else {
+        ru->parked = TRUE;
+        ru->failed = TRUE;
+        if (urb->status == -EPIPE)
+            ring->halted = TRUE;
+        if (ring->active)
+            schedule_delayed_work(&ring->refill, RING_RETRY_JIFFIES);
+    }
+
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    wake_pollers(ring->fx2dev, OSRFX2_WAKE_RING);
+}
+
+/*****************************************************************************/
+/* Look again at parked URBs once the consumer may have freed slots or the   */
+/* retry delay of a failed one is up. Runs from the refill work.             */
+/*****************************************************************************/
+static void ring_refill(struct osrfx2_ring * ring)
+{
+    struct osrfx2 * fx2dev = ring->fx2dev;
+    unsigned long flags;
+    unsigned int i;
+    int halted;
+    int retval;
+
+    spin_lock_irqsave(&ring->lock, flags);
+    halted = ring->halted;
+    ring->halted = FALSE;
+    spin_unlock_irqrestore(&ring->lock, flags);
+
+    if (halted) {
+        retval = usb_clear_halt(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
+        if (retval != 0) {
+            dev_err(&fx2dev->interface->dev,
+                    "%s - error(%d) usb_clear_halt(%02X)\n",
+                    __FUNCTION__, retval, fx2dev->bulk_in_endpointAddr);
+        }
+    }
+
+    spin_lock_irqsave(&ring->lock, flags);
+    for (i=0; i < ring->nurbs; i++) {
+        if (ring->urbs[i].parked)
+            ring_feed(ring, &ring->urbs[i]);
+    }
+    spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+static void ring_refill_work(struct work_struct * work)
+{
+    struct osrfx2_ring * ring = container_of(to_delayed_work(work),
+                                             struct osrfx2_ring, refill);
+    ring_refill(ring);
+}
+
+/*****************************************************************************/
+/* Lock-free hint for poll: is an URB parked although the consumer has made  */
+/* room in the ring since? ring_refill_work() then should run right away.    */
+/* A failed URB waits out its retry delay regardless.                        */
+/*****************************************************************************/
+static int ring_starved(struct osrfx2_ring * ring, unsigned int tail)
+{
+    unsigned int i;
+
+    if (!ACCESS_ONCE(ring->active) ||
+        (ACCESS_ONCE(ring->submit) - tail) >= ring->slot_count)
+        return FALSE;
+
+    for (i=0; i < ring->nurbs; i++) {
+        if (ACCESS_ONCE(ring->urbs[i].parked) &&
+            !ACCESS_ONCE(ring->urbs[i].failed))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*****************************************************************************/
+/* Stop filling the ring. Slots already published stay valid.                */
+/*****************************************************************************/
+static void ring_stop(struct osrfx2_ring * ring)
+{
+    unsigned int i;
+
+    spin_lock_irq(&ring->lock);
+    ring->active = FALSE;
+    spin_unlock_irq(&ring->lock);
+
+    cancel_delayed_work_sync(&ring->refill);
+    usb_kill_anchored_urbs(&ring->anchor);
+
+    for (i=0; i < ring->nurbs; i++) {
+        ring->urbs[i].parked = FALSE;
+        ring->urbs[i].failed = FALSE;
+    }
+}
+
+/*****************************************************************************/
+/* (Re)start filling the ring right after the last published slot.           */
+/*****************************************************************************/
+static void ring_start(struct osrfx2_ring * ring)
+{
+    unsigned int i;
+
+    ring_stop(ring);
+
+    spin_lock_irq(&ring->lock);
+    ring->active      = TRUE;
+    ring->submit      = ring->head;
+    ring->hdr->error  = 0;
+    for (i=0; i < ring->nurbs; i++)
+        ring_feed(ring, &ring->urbs[i]);
+    spin_unlock_irq(&ring->lock);
+}
+
+/*****************************************************************************/
+/* Free the ring. Pages still mapped by a process stay alive until unmapped, */
+/* since every mapping holds its own page references.                        */
+/*****************************************************************************/
+static void ring_free(struct osrfx2_ring * ring)
+{
+    unsigned int i;
+    unsigned int j;
+
+    ring_stop(ring);
+
+    for (i=0; i < ring->nurbs; i++)
+        usb_free_urb(ring->urbs[i].urb);
+
+    if (ring->slot_page) {
+        for (i=0; i < ring->slot_count; i++) {
+            if (!ring->slot_page[i])
+                continue;
+            for (j=0; j < (1U << ring->order); j++)
+                __free_page(ring->slot_page[i] + j);
+        }
+        kfree(ring->slot_page);
+    }
+
+    if (ring->hdr)
+        free_page((unsigned long)ring->hdr);
+
+    kfree(ring);
+}
+
+/*****************************************************************************/
+/* Allocate a ring of slot_count slots of slot_size bytes. Each slot is one  */
+/* physically contiguous block, split into single pages so that every page   */
+/* can be mapped into user space on its own.                                 */
+/*****************************************************************************/
+static struct osrfx2_ring * ring_alloc(struct osrfx2 * fx2dev,
+                                       unsigned int slot_size,
+                                       unsigned int slot_count)
+{
+    struct osrfx2_ring * ring;
+    struct urb * urb;
+    unsigned long addr;
+    unsigned int i;
+    int pipe;
+
+    ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+    if (!ring)
+        return NULL;
+
+    ring->fx2dev     = fx2dev;
+    ring->slot_size  = slot_size;
+    ring->slot_count = slot_count;
+    ring->order      = get_order(slot_size);
+    ring->nurbs      = min(slot_count, (unsigned int)RING_URBS);
+
+    spin_lock_init(&ring->lock);
+    init_usb_anchor(&ring->anchor);
+    INIT_DELAYED_WORK(&ring->refill, ring_refill_work);
+    atomic_set(&ring->maps, 0);
+
+    ring->hdr = (struct osrfx2_ring_header *)get_zeroed_page(GFP_KERNEL);
+    if (!ring->hdr)
+        goto error;
+
+    ring->hdr->magic       = OSRFX2_RING_MAGIC;
+    ring->hdr->version     = OSRFX2_RING_VERSION;
+    ring->hdr->slot_size   = slot_size;
+    ring->hdr->slot_count  = slot_count;
+    ring->hdr->data_offset = PAGE_SIZE;
+
+    ring->slot_page = kzalloc(slot_count * sizeof(struct page *), GFP_KERNEL);
+    if (!ring->slot_page)
+        goto error;
+
+    for (i=0; i < slot_count; i++) {
+        addr = __get_free_pages(GFP_KERNEL | __GFP_ZERO, ring->order);
+        if (!addr)
+            goto error;
+        ring->slot_page[i] = virt_to_page((void *)addr);
+        split_page(ring->slot_page[i], ring->order);
+    }
+
+    pipe = usb_rcvbulkpipe(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
+
+    for (i=0; i < ring->nurbs; i++) {
+        urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (!urb) {
+            ring->nurbs = i;
+            goto error;
+        }
+        usb_fill_bulk_urb( urb,
+                           fx2dev->udev,
+                           pipe,
+                           NULL,
+                           slot_size,
+                           ring_complete,
+                           &ring->urbs[i] );
+
+        ring->urbs[i].urb  = urb;
+        ring->urbs[i].ring = ring;
+    }
+
+    return ring;
+
+error:
+    ring_free(ring);
+    return NULL;
+}
+
+/*****************************************************************************/
+/* Unpublish and free the ring, once poll can no longer be looking at it.    */
+/* Called with ring_mutex held.                                              */
+/*****************************************************************************/
+static void ring_remove(struct osrfx2 * fx2dev)
+{
+    struct osrfx2_ring * ring = fx2dev->ring;
+
+    if (!ring)
+        return;
+
+    rcu_assign_pointer(fx2dev->ring, NULL);
+    synchronize_rcu();
+    ring_free(ring);
+}
+
+/*****************************************************************************/
+/* OSRFX2_IOCTL_RING_SETUP: replace the ring (slot_count 0 just removes it). */
+/* Not while the ring is mapped, and not while the read-ahead ring holds     */
+/* data that read() hasn't collected yet. Called with ring_mutex held.       */
+/*****************************************************************************/
+static int ring_setup(struct osrfx2 * fx2dev, struct osrfx2_ring_setup * rs)
+{
+    struct osrfx2_ring * ring;
+
+    if (rs->slot_size == 0)
+        rs->slot_size = PAGE_SIZE;
+
+    if (rs->slot_count > OSRFX2_RING_MAX_SLOTS                  ||
+        rs->slot_size  > OSRFX2_RING_MAX_SLOT_SIZE              ||
+        rs->slot_size  < PAGE_SIZE                              ||
+        !is_power_of_2(rs->slot_size)) {
+        return -EINVAL;
+    }
+
+    if (fx2dev->ring && atomic_read(&fx2dev->ring->maps) != 0)
+        return -EBUSY;
+
+    mutex_lock(&fx2dev->rx_mutex);
+    if (fx2dev->rx_active) {
+        if (readahead_ready(fx2dev)) {
+            mutex_unlock(&fx2dev->rx_mutex);
+            return -EBUSY;
+        }
+        readahead_stop(fx2dev);
+    }
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    ring_remove(fx2dev);
+
+    rs->mmap_size = 0;
+
+    if (rs->slot_count == 0)
+        return 0;
+
+    ring = ring_alloc(fx2dev, rs->slot_size, rs->slot_count);
+    if (!ring)
+        return -ENOMEM;
+
+    rcu_assign_pointer(fx2dev->ring, ring);
+    rs->mmap_size = PAGE_SIZE + rs->slot_count * rs->slot_size;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* ioctl handler.                                                            */
+/*****************************************************************************/
+static long osrfx2_ioctl(struct file * file, unsigned int cmd, 
+                         unsigned long arg)
+{
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    struct osrfx2_ring_setup rs;
+    int flags = (file->f_flags & O_ACCMODE);
+    long retval = 0;
+
+    switch (cmd) {
+
+        case OSRFX2_IOCTL_GET_EVENTS:
+            return event_get(fx2dev, file, arg);
+
+        case OSRFX2_IOCTL_RING_SETUP:
+        case OSRFX2_IOCTL_RING_START:
+        case OSRFX2_IOCTL_RING_STOP:
+            /*
+             *  The ring belongs to the bulk-IN pipe, i.e. to the reader.
+             */
+            if (flags == O_WRONLY)
+                return -EBADF;
+            break;
+
+        default:
+            return -ENOTTY;
+    }
+
+    if (mutex_lock_interruptible(&fx2dev->ring_mutex))
+        return -ERESTARTSYS;
+
+    switch (cmd) {
+
+        case OSRFX2_IOCTL_RING_SETUP:
+            if (copy_from_user(&rs, (void __user *)arg, sizeof(rs))) {
+                retval = -EFAULT;
+                break;
+            }
+            retval = ring_setup(fx2dev, &rs);
+            if (retval == 0 && 
+                copy_to_user((void __user *)arg, &rs, sizeof(rs))) {
+                retval = -EFAULT;
+            }
+            break;
+
+        case OSRFX2_IOCTL_RING_START:
+            if (!fx2dev->ring) {
+                retval = -EINVAL;
+                break;
+            }
+            ring_start(fx2dev->ring);
+            break;
+
+        case OSRFX2_IOCTL_RING_STOP:
+            if (fx2dev->ring)
+                ring_stop(fx2dev->ring);
+            break;
+    }
+
+    mutex_unlock(&fx2dev->ring_mutex);
+
+    return retval;
+}
+
+/*****************************************************************************/
+/* Track the mappings of the ring, so that it isn't replaced underneath.     */
+/*****************************************************************************/
+static void ring_vma_open(struct vm_area_struct * vma)
+{
+    struct osrfx2_ring * ring = vma->vm_private_data;
+
+    atomic_inc(&ring->maps);
+}
+
+static void ring_vma_close(struct vm_area_struct * vma)
+{
+    struct osrfx2_ring * ring = vma->vm_private_data;
+
+    atomic_dec(&ring->maps);
+}
+
+static struct vm_operations_struct ring_vm_ops = {
+    .open  = ring_vma_open,
+    .close = ring_vma_close,
+};
+
+/*****************************************************************************/
+/* Map the whole ring - header page first, then the slots - into the         */
+/* caller. Only the exact size returned by OSRFX2_IOCTL_RING_SETUP, at       */
+/* offset 0, is accepted.                                                    */
+/*****************************************************************************/
+static int osrfx2_mmap(struct file * file, struct vm_area_struct * vma)
+{
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    struct osrfx2_ring * ring;
+    unsigned long addr = vma->vm_start;
+    unsigned int i;
+    unsigned int j;
+    int retval = 0;
+
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&fx2dev->ring_mutex))
+        return -ERESTARTSYS;
+
+    ring = fx2dev->ring;
+
+    if (!ring || vma->vm_pgoff != 0 ||
+        (vma->vm_end - vma->vm_start) != 
+            PAGE_SIZE + ring->slot_count * ring->slot_size) {
+        retval = -EINVAL;
+        goto exit;
+    }
+
+    vma->vm_flags |= VM_DONTEXPAND | VM_RESERVED;
+
+    retval = vm_insert_page(vma, addr, virt_to_page(ring->hdr));
+    addr += PAGE_SIZE;
+
+    for (i=0; retval == 0 && i < ring->slot_count; i++) {
+        for (j=0; retval == 0 && j < (1U << ring->order); j++) {
+            retval = vm_insert_page(vma, addr, ring->slot_page[i] + j);
+            addr  += PAGE_SIZE;
+        }
+    }
+
+    if (retval != 0)
+        goto exit;
+
+    vma->vm_ops          = &ring_vm_ops;
+    vma->vm_private_data = ring;
+    ring_vma_open(vma);
+
+exit:
+    mutex_unlock(&fx2dev->ring_mutex);
+    return retval;
+}
+
+/*****************************************************************************/
+/* osrfx2_open                                                               */
+/*                                                                           */
+/* Note:                                                                     */
+/*   The serialization method used below has a side-effect which I don't     */
+/*   particularly care for. In effect switch_events and bulk I/O are         */
+/*   mutually exclusive, e.g. an open for switch_events will exclude         */
+/*   opens for bulk I/O (osrbulk) and vis-a-verse.                           */
+/*                                                                           */
+/* Note:                                                                     */
+/*   The usb_clear_halt() is being used to effect a pipe reset.              */
+/*   This will clear any residual data at the endpoint and ready it for      */
+/*   the new endpoint user's data.                                           */
+/*****************************************************************************/
+static int osrfx2_open(struct inode * inode, struct file * file)
+{
+    struct usb_interface * interface;
+    struct osrfx2 * fx2dev;
+    int retval;
+    int flags;
+    
+    interface = usb_find_interface(&osrfx2_driver, iminor(inode));
+    if (interface == NULL) 
+        return -ENODEV;
+
+    fx2dev = usb_get_intfdata(interface);
+    if (fx2dev == NULL) 
+        return -ENODEV;
+
+    /*
+     *   Serialize access to each of the bulk pipes.
+     */ 
+    flags = (file->f_flags & O_ACCMODE);
+
+    if ((flags == O_WRONLY) || (flags == O_RDWR)) {
+        if (atomic_dec_and_test( &fx2dev->bulk_write_available ) == 0) {
+            atomic_inc( &fx2dev->bulk_write_available );
+            return -EBUSY;
+        }
+
+        /*
+         *   The write interface is serialized, so reset bulk-out pipe (ep-6).
+         */
+        retval = usb_clear_halt(fx2dev->udev, fx2dev->bulk_out_endpointAddr);
+        if ((retval != 0) && (retval != -EPIPE)) {
+            dev_err(&interface->dev, "%s - error(%d) usb_clear_halt(%02X)\n", 
+                    __FUNCTION__, retval, fx2dev->bulk_out_endpointAddr);
+        }
+    }
+
+    if ((flags == O_RDONLY) || (flags == O_RDWR)) {
+        if (atomic_dec_and_test( &fx2dev->bulk_read_available ) == 0) {
+            atomic_inc( &fx2dev->bulk_read_available );
             if (flags == O_RDWR) 
                 atomic_inc( &fx2dev->bulk_write_available );
             return -EBUSY;
         }
 
-        /*
-         *   The read interface is serialized, so reset bulk-in pipe (ep-8).
+        /*
+         *   The read interface is serialized, so reset bulk-in pipe (ep-8).
+         */
+        retval = usb_clear_halt(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
+        if ((retval != 0) && (retval != -EPIPE)) {
+            dev_err(&interface->dev, "%s - error(%d) usb_clear_halt(%02X)\n", 
+                    __FUNCTION__, retval, fx2dev->bulk_in_endpointAddr);
+        }
+
+        /*
+         *   Prime the read-ahead ring, if one is configured.
+         */
+        mutex_lock(&fx2dev->rx_mutex);
+        retval = readahead_start(fx2dev);
+        mutex_unlock(&fx2dev->rx_mutex);
+
+        if (retval != 0) {
+            atomic_inc( &fx2dev->bulk_read_available );
+            if (flags == O_RDWR) 
+                atomic_inc( &fx2dev->bulk_write_available );
+            return retval;
+        }
+    }
+
+    /*
+     *   Set this device as non-seekable.
+     */ 
+    retval = nonseekable_open(inode, file);
+    if (retval != 0) {
+        return retval;
+    }
+
+    /*
+     *   Increment our usage count for the device.
+     */
+    kref_get(&fx2dev->kref);
+
+    /*
+     *   Save pointer to device instance in the file's private structure.
+     */
+    file->private_data = fx2dev;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/*****************************************************************************/
+static int osrfx2_release(struct inode * inode, struct file * file)
+{
+    struct osrfx2 * fx2dev;
+    int flags;
+
+    fx2dev = (struct osrfx2 *)file->private_data;
+    if (fx2dev == NULL)
+        return -ENODEV;
+
+    /* 
+     *  Release any bulk_[write|read]_available serialization.
+     */
+    flags = (file->f_flags & O_ACCMODE);
+
+    if ((flags == O_WRONLY) || (flags == O_RDWR)) {
+        cancel_delayed_work_sync(&fx2dev->tx_flush_work);
+
+        mutex_lock(&fx2dev->tx_mutex);
+        coalesce_flush(fx2dev);
+        mutex_unlock(&fx2dev->tx_mutex);
+
+        atomic_inc( &fx2dev->bulk_write_available );
+    }
+
+    if ((flags == O_RDONLY) || (flags == O_RDWR)) {
+        mutex_lock(&fx2dev->rx_mutex);
+        readahead_stop(fx2dev);
+        mutex_unlock(&fx2dev->rx_mutex);
+
+        mutex_lock(&fx2dev->ring_mutex);
+        ring_remove(fx2dev);
+        mutex_unlock(&fx2dev->ring_mutex);
+
+        atomic_inc( &fx2dev->bulk_read_available );
+    }
+
+    /* 
+     *  Decrement the ref-count on the device instance.
+     */
+    kref_put(&fx2dev->kref, osrfx2_delete);
+    
+    return 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/*****************************************************************************/
+static ssize_t do_read(struct file * file, char * buffer, 
+                       size_t count, loff_t * ppos)
+{
+    struct osrfx2 * fx2dev;
+    ktime_t start;
+    int retval = 0;
+    int bytes_read;
+    int pipe;
+
+    fx2dev = (struct osrfx2 *)file->private_data;
+
+    /*
+     *  The mapped ring owns the bulk-IN pipe.
+     */
+    if (fx2dev->ring)
+        return -EBUSY;
+
+    /*
+     *  With the read-ahead ring running, just drain what it has received.
+     */
+    if (fx2dev->rx_active)
+        return readahead_read(fx2dev, buffer, count,
+                              file->f_flags & O_NONBLOCK);
+
+    pipe = usb_rcvbulkpipe(fx2dev->udev, fx2dev->bulk_in_endpointAddr),
+
+    /* 
+     *  Do a blocking bulk read to get data from the device 
+     */
+    start  = stat_submit(fx2dev, STAT_BULK_IN);
+    retval = usb_bulk_msg( fx2dev->udev, 
+                           pipe,
+                           fx2dev->bulk_in_buffer,
+                           min(fx2dev->bulk_in_size, count),
+                           &bytes_read, 
+                           10000 );
+    stat_complete(fx2dev, STAT_BULK_IN, start, retval, 
+                  retval ? 0 : bytes_read);
+
+    /* 
+     *  If the read was successful, copy the data to userspace 
+     */
+    if (!retval) {
+        if (copy_to_user(buffer, fx2dev->bulk_in_buffer, bytes_read)) {
+            retval = -EFAULT;
+        }
+        else {
+            retval = bytes_read;
+        }
+        
+        /*
+         *  Increment the pending_data counter by the byte count received.
+         */
+        atomic_long_sub(retval, &fx2dev->pending_data);
+    }
+
+    return retval;
+}
+
+/*****************************************************************************/
+/* Coalescing write(): append to the stage, sending each entry as soon as    */
+/* it is full, and arm the flush timer for whatever is left staged.          */
+/* Returns the bytes accepted, the error only if there are none.             */
+/* Called with tx_mutex held.                                                */
+/*****************************************************************************/
+static ssize_t coalesce_write(struct osrfx2 * fx2dev, struct file * file,
+                              const char * user_buffer, size_t count)
+{
+    struct osrfx2_tx_urb * tx;
+    size_t written = 0;
+    size_t staged  = 0;
+    size_t chunk;
+    int retval = 0;
+
+    while (written < count) {
+
+        if (fx2dev->tx_stage == NULL) {
+            retval = write_pool_claim(fx2dev, file, &tx);
+            if (retval != 0)
+                break;
+            fx2dev->tx_stage     = tx;
+            fx2dev->tx_stage_len = 0;
+            staged               = 0;
+        }
+        tx = fx2dev->tx_stage;
+
+        chunk = min(count - written, 
+                    fx2dev->tx_urb_size - fx2dev->tx_stage_len);
+
+        if (copy_from_user((char *)tx->urb->transfer_buffer + 
+                                   fx2dev->tx_stage_len,
+                           user_buffer + written, chunk)) {
+            retval = -EFAULT;
+            break;
+        }
+
+        fx2dev->tx_stage_len += chunk;
+        written              += chunk;
+        staged               += chunk;
+
+        if (fx2dev->tx_stage_len == fx2dev->tx_urb_size) {
+            retval = coalesce_flush(fx2dev);
+            if (retval != 0) {
+                /*
+                 *  The stage is gone; only what this call put in it is
+                 *  still the caller's to resend. Earlier stages did go out.
+                 */
+                written -= staged;
+                break;
+            }
+        }
+    }
+
+    /*
+     *  Bound the latency of a partly filled stage. An already pending
+     *  flush is left alone: it was armed for older data.
+     */
+    if (fx2dev->tx_stage != NULL && fx2dev->tx_stage_len != 0) {
+        schedule_delayed_work(&fx2dev->tx_flush_work,
+                              usecs_to_jiffies(fx2dev->tx_coalesce));
+    }
+
+    return (written != 0) ? written : retval;
+}
+
+/*****************************************************************************/
+/* The data is copied into idle write pool entries, tx_urb_size bytes at a   */
+/* time, and sent without waiting for completion. Once the pool is drained   */
+/* a blocking writer sleeps until an entry comes back, a non-blocking one    */
+/* gets -EAGAIN. If anything has been queued already, that count is          */
+/* returned instead of the error.                                            */
+/*****************************************************************************/
+static ssize_t do_write(struct file * file, const char * user_buffer, 
+                        size_t count, loff_t * ppos)
+{
+    struct osrfx2 * fx2dev;
+    struct osrfx2_tx_urb * tx;
+    size_t written = 0;
+    size_t chunk;
+    int retval = 0;
+
+    fx2dev = (struct osrfx2 *)file->private_data;
+
+    if (count == 0)
+        return count;
+
+    if (mutex_lock_interruptible(&fx2dev->tx_mutex))
+        return -ERESTARTSYS;
+
+    if (fx2dev->tx_coalesce != 0) {
+        written = coalesce_write(fx2dev, file, user_buffer, count);
+        mutex_unlock(&fx2dev->tx_mutex);
+        return written;
+    }
+
+    /*
+     *  Coalescing was just switched off: keep the byte order intact.
+     */
+    retval = coalesce_flush(fx2dev);
+    if (retval != 0) {
+        mutex_unlock(&fx2dev->tx_mutex);
+        return retval;
+    }
+
+    while (written < count) {
+
+        /* 
+         *  Claim an idle pool entry, waiting for one if need be.
+         */
+        if (written != 0 && !write_pool_ready(fx2dev))
+            break;
+
+        retval = write_pool_claim(fx2dev, file, &tx);
+        if (retval != 0)
+            break;
+
+        chunk = min(count - written, fx2dev->tx_urb_size);
+
+        if (copy_from_user(tx->urb->transfer_buffer, 
+                           user_buffer + written, chunk)) {
+            write_pool_put(fx2dev, tx);
+            retval = -EFAULT;
+            break;
+        }
+
+        /* 
+         *  Send the data out the bulk port
          */
-        retval = usb_clear_halt(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
-        if ((retval != 0) && (retval != -EPIPE)) {
-            dev_err(&interface->dev, "%s - error(%d) usb_clear_halt(%02X)\n", 
-                    __FUNCTION__, retval, fx2dev->bulk_in_endpointAddr);
+        retval = write_pool_submit(fx2dev, tx, chunk);
+        if (retval != 0)
+            break;
+
+        written += chunk;
+    }
+
+    mutex_unlock(&fx2dev->tx_mutex);
+
+    return (written != 0) ? written : retval;
+}
+
+/*****************************************************************************/
+/* Push out any coalesced data when a descriptor of the file is closed.      */
+/*****************************************************************************/
+static int osrfx2_flush(struct file * file, fl_owner_t id)
+{
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    int retval;
+
+    if ((file->f_flags & O_ACCMODE) == O_RDONLY)
+        return 0;
+
+    /*
+     *  A writer may hold tx_mutex while it sleeps for a pool entry; let a
+     *  signal get close() out of waiting behind it.
+     */
+    if (mutex_lock_interruptible(&fx2dev->tx_mutex))
+        return -ERESTARTSYS;
+    retval = coalesce_flush(fx2dev);
+    mutex_unlock(&fx2dev->tx_mutex);
+
+    return retval;
+}
+
+/*****************************************************************************/
+/* Push out any coalesced data and wait until every write has completed.     */
+/*****************************************************************************/
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35)
+static int osrfx2_fsync(struct file * file, struct dentry * dentry, 
+                        int datasync)
+#else
+static int osrfx2_fsync(struct file * file, int datasync)
+#endif
+{
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    int retval;
+
+    if (mutex_lock_interruptible(&fx2dev->tx_mutex))
+        return -ERESTARTSYS;
+    retval = coalesce_flush(fx2dev);
+    mutex_unlock(&fx2dev->tx_mutex);
+
+    if (retval != 0)
+        return retval;
+
+    if (!usb_wait_anchor_empty_timeout(&fx2dev->tx_anchor, 10000))
+        return -ETIMEDOUT;
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* Vectored I/O.                                                             */
+/*                                                                           */
+/* readv() and writev() come in through aio_read/aio_write and are turned    */
+/* into one usb_sg_request covering the whole vector (up to                  */
+/* MAX_SG_TRANSFER bytes), instead of one syscall and one URB per segment.   */
+/*                                                                           */
+/* The user pages are pinned and handed to the host controller as they are.  */
+/* That only works if every piece but the last is a whole number of          */
+/* packets: otherwise a short packet would end the transfer early (IN) or    */
+/* split it (OUT). Vectors which don't line up go through one bounce buffer  */
+/* instead, which is still a single transfer. An IN transfer is cut to whole */
+/* packets as well, the device may always send a full one; a readv() of less */
+/* than one packet gets -EINVAL.                                             */
+/*****************************************************************************/
+struct osrfx2_sg {
+
+    struct usb_sg_request io;
+    struct timer_list     timer;
+
+    struct scatterlist    sg [MAX_SG_ENTRIES];
+    struct page         * pages [MAX_SG_ENTRIES];
+    int                   npages;
+    int                   nents;
+
+    char                * bounce;
+    size_t                length;
+};
+
+/*****************************************************************************/
+/* usb_sg_wait() has no timeout of its own; give up after the same 10 sec    */
+/* that the synchronous read path uses.                                      */
+/*****************************************************************************/
+static void sg_timeout(unsigned long data)
+{
+    struct osrfx2_sg * req = (struct osrfx2_sg *)data;
+
+    usb_sg_cancel(&req->io);
+}
+
+/*****************************************************************************/
+/* Drop the page references taken by sg_map_user.                            */
+/*****************************************************************************/
+static void sg_unmap_user(struct osrfx2_sg * req, int dirty)
+{
+    int i;
+
+    for (i=0; i < req->npages; i++) {
+        if (dirty)
+            set_page_dirty_lock(req->pages[i]);
+        put_page(req->pages[i]);
+    }
+    req->npages = 0;
+    req->nents  = 0;
+}
+
+/*****************************************************************************/
+/* Pin the first req->length bytes of the vector and describe them in        */
+/* req->sg. Returns -EINVAL if the pieces don't line up on packet            */
+/* boundaries, in which case nothing stays pinned.                           */
+/*****************************************************************************/
+static int sg_map_user(struct osrfx2_sg * req, const struct iovec * iov,
+                       unsigned long nr_segs, size_t maxp, int is_read)
+{
+    unsigned long addr;
+    unsigned int  offset;
+    size_t  left = req->length;
+    size_t  seg_len;
+    size_t  len;
+    int     n;
+    int     got;
+
+    sg_init_table(req->sg, MAX_SG_ENTRIES);
+
+    for (; left != 0 && nr_segs != 0; iov++, nr_segs--) {
+
+        addr    = (unsigned long)iov->iov_base;
+        seg_len = min(iov->iov_len, left);
+        left   -= seg_len;
+
+        while (seg_len != 0) {
+
+            offset = addr & ~PAGE_MASK;
+            len    = min(seg_len, (size_t)(PAGE_SIZE - offset));
+
+            /*
+             *  Every piece except the very last must be whole packets.
+             */
+            if ((left != 0 || seg_len != len) && (len % maxp) != 0)
+                goto misaligned;
+
+            if (req->nents == MAX_SG_ENTRIES)
+                goto misaligned;
+
+            n   = req->nents;
+            got = get_user_pages_fast(addr & PAGE_MASK, 1, is_read,
+                                      &req->pages[n]);
+            if (got != 1) {
+                sg_unmap_user(req, FALSE);
+                return (got < 0) ? got : -EFAULT;
+            }
+            req->npages++;
+
+            sg_set_page(&req->sg[n], req->pages[n], len, offset);
+            req->nents++;
+
+            addr    += len;
+            seg_len -= len;
+        }
+    }
+
+    sg_mark_end(&req->sg[req->nents - 1]);
+    return 0;
+
+misaligned:
+    sg_unmap_user(req, FALSE);
+    return -EINVAL;
+}
+
+/*****************************************************************************/
+/* Copy between the vector and the bounce buffer.                            */
+/*****************************************************************************/
+static int sg_copy_user(struct osrfx2_sg * req, const struct iovec * iov,
+                        unsigned long nr_segs, size_t length, int to_user)
+{
+    size_t done = 0;
+    size_t len;
+    unsigned long left;
+
+    for (; done < length && nr_segs != 0; iov++, nr_segs--) {
+
+        len = min(iov->iov_len, length - done);
+
+        if (to_user)
+            left = copy_to_user(iov->iov_base, req->bounce + done, len);
+        else
+            left = copy_from_user(req->bounce + done, iov->iov_base, len);
+        if (left != 0)
+            return -EFAULT;
+
+        done += len;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* Move one vector across the given bulk pipe as a single sg request.        */
+/* Returns the number of bytes transferred or a negative errno.              */
+/*****************************************************************************/
+static ssize_t sg_transfer(struct osrfx2 * fx2dev, int pipe,
+                           const struct iovec * iov, unsigned long nr_segs,
+                           int is_read)
+{
+    struct osrfx2_sg * req;
+    size_t maxp;
+    unsigned long i;
+    ktime_t start;
+    int cls;
+    ssize_t retval;
+
+    req = kzalloc(sizeof(*req), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+
+    maxp = is_read ? fx2dev->bulk_in_size : fx2dev->bulk_out_size;
+
+    for (i=0; i < nr_segs && req->length < MAX_SG_TRANSFER; i++) {
+        req->length += min(iov[i].iov_len,
+                           (size_t)MAX_SG_TRANSFER - req->length);
+    }
+    if (req->length == 0) {
+        kfree(req);
+        return 0;
+    }
+
+    /*
+     *  A full-size packet past the end would fail the transfer with
+     *  -EOVERFLOW; the rest of the vector is left for the next call.
+     */
+    if (is_read) {
+        req->length -= req->length % maxp;
+        if (req->length == 0) {
+            kfree(req);
+            return -EINVAL;
         }
     }
 
     /*
-     *   Set this device as non-seekable.
-     */ 
-    retval = nonseekable_open(inode, file);
+     *  Zero-copy if the vector lines up, else a single bounce buffer.
+     */
+    retval = sg_map_user(req, iov, nr_segs, maxp, is_read);
+    if (retval == -EINVAL) {
+        req->bounce = kmalloc(req->length, GFP_KERNEL);
+        if (!req->bounce) {
+            retval = -ENOMEM;
+            goto exit;
+        }
+        if (!is_read) {
+            retval = sg_copy_user(req, iov, nr_segs, req->length, FALSE);
+            if (retval != 0)
+                goto exit;
+        }
+        sg_init_one(&req->sg[0], req->bounce, req->length);
+        req->nents = 1;
+    }
+    else if (retval != 0) {
+        goto exit;
+    }
+
+    retval = usb_sg_init( &req->io,
+                          fx2dev->udev,
+                          pipe,
+                          0,
+                          req->sg,
+                          req->nents,
+                          req->length,
+                          GFP_KERNEL );
     if (retval != 0) {
-        return retval;
+        dev_err(&fx2dev->interface->dev, "%s - usb_sg_init failed: %d\n",
+                __FUNCTION__, (int)retval);
+        goto exit;
+    }
+
+    setup_timer(&req->timer, sg_timeout, (unsigned long)req);
+    mod_timer(&req->timer, jiffies + msecs_to_jiffies(10000));
+
+    cls   = is_read ? STAT_BULK_IN : STAT_BULK_OUT;
+    start = stat_submit(fx2dev, cls);
+
+    usb_sg_wait(&req->io);
+
+    if (!del_timer_sync(&req->timer) && req->io.status == -ECONNRESET)
+        req->io.status = -ETIMEDOUT;
+
+    stat_complete(fx2dev, cls, start, req->io.status, req->io.bytes);
+
+    retval = req->io.bytes;
+
+    if (req->io.status != 0 && req->io.bytes == 0)
+        retval = req->io.status;
+
+    if (is_read && req->bounce && retval > 0) {
+        if (sg_copy_user(req, iov, nr_segs, retval, TRUE) != 0)
+            retval = -EFAULT;
+    }
+
+exit:
+    sg_unmap_user(req, is_read);
+    kfree(req->bounce);
+    kfree(req);
+    return retval;
+}
+
+/*****************************************************************************/
+/* Asynchronous I/O.                                                         */
+/*                                                                           */
+/* A single-segment AIO read or write (io_submit with IOCB_CMD_PREAD/PWRITE) */
+/* is not waited for: it gets its own URB, -EIOCBQUEUED goes back to the     */
+/* submitter, and the URB's completion routine calls aio_complete(). One     */
+/* thread can thus keep many transfers queued on the device. Everything else */
+/* (vectors, writes larger than a pool entry, read-ahead or mapped ring      */
+/* active, coalescing on) takes the synchronous path. O_NONBLOCK makes submission fail with -EAGAIN rather    */
+/* than wait for a free write pool entry or AIO read slot.                   */
+/*                                                                           */
+/* An AIO read pins the user pages at submission; the completion routine     */
+/* copies the data in through kmap_atomic. Releasing the pages and the DMA   */
+/* buffer may sleep, so that is left to a work item.                         */
+/*****************************************************************************/
+#define AIO_MAX_PAGES           ((MAX_SG_TRANSFER / PAGE_SIZE) + 1)
+
+struct osrfx2_aio_read {
+
+    struct kiocb       * iocb;
+    struct urb         * urb;
+    struct osrfx2      * fx2dev;
+    struct work_struct   release;
+
+    struct page        * pages [AIO_MAX_PAGES];
+    int                  npages;
+    unsigned int         offset;     /* of the user buffer in pages[0] */
+    ktime_t              submitted;
+};
+
+/*****************************************************************************/
+/* Give back what an AIO read held, in process context.                      */
+/*****************************************************************************/
+static void aio_read_release(struct work_struct * work)
+{
+    struct osrfx2_aio_read * ar = container_of(work, struct osrfx2_aio_read,
+                                               release);
+    struct osrfx2 * fx2dev = ar->fx2dev;
+    int i;
+
+    for (i=0; i < ar->npages; i++) {
+        set_page_dirty_lock(ar->pages[i]);
+        put_page(ar->pages[i]);
+    }
+
+    if (ar->urb) {
+        if (ar->urb->transfer_buffer) {
+            usb_buffer_free( fx2dev->udev,
+                             ar->urb->transfer_buffer_length,
+                             ar->urb->transfer_buffer,
+                             ar->urb->transfer_dma );
+        }
+        usb_free_urb(ar->urb);
+    }
+
+    kfree(ar);
+
+    kref_put(&fx2dev->kref, osrfx2_delete);
+}
+
+/*****************************************************************************/
+/* AIO read completion routine: copy into the pinned user pages and          */
+/* complete the kiocb.                                                       */
+/*****************************************************************************/
+static void aio_read_complete(struct urb * urb)
+{
+    struct osrfx2_aio_read * ar     = urb->context;
+    struct osrfx2          * fx2dev = ar->fx2dev;
+    char * src = urb->transfer_buffer;
+    char * dst;
+    size_t left = urb->actual_length;
+    size_t len;
+    unsigned int offset = ar->offset;
+    long result;
+    int i;
+
+    trace_osrfx2_urb_complete(urb);
+    stat_complete(fx2dev, STAT_BULK_IN, ar->submitted,
+                  urb->status, urb->actual_length);
+
+    switch (urb->status) {
+        case 0:
+            result = urb->actual_length;
+            break;
+        case -ECONNRESET:
+        case -ENOENT:
+            result = -ECANCELED;
+            break;
+        default:
+            result = urb->status;
+            break;
+    }
+
+    for (i=0; left != 0 && i < ar->npages; i++) {
+        len = min(left, (size_t)(PAGE_SIZE - offset));
+        dst = osrfx2_kmap_atomic(ar->pages[i]);
+        memcpy(dst + offset, src, len);
+        osrfx2_kunmap_atomic(dst);
+        src   += len;
+        left  -= len;
+        offset = 0;
     }
 
+    if (result > 0)
+        atomic_long_sub(result, &fx2dev->pending_data);
+
+    aio_complete(ar->iocb, result, 0);
+
+    atomic_dec(&fx2dev->aio_reads);
+    wake_pollers(fx2dev, OSRFX2_WAKE_AIO_READ);
+
+    schedule_work(&ar->release);
+}
+
+/*****************************************************************************/
+/* io_cancel() on a queued AIO: unlink the URB. The kiocb is already marked  */
+/* cancelled, so the completion which follows just disposes of it.           */
+/*****************************************************************************/
+static int aio_read_cancel(struct kiocb * iocb, struct io_event * event)
+{
+    struct osrfx2_aio_read * ar = iocb->private;
+
+    usb_unlink_urb(ar->urb);
+    return -EAGAIN;
+}
+
+static int aio_write_cancel(struct kiocb * iocb, struct io_event * event)
+{
+    struct osrfx2_tx_urb * tx = iocb->private;
+
+    usb_unlink_urb(tx->urb);
+    return -EAGAIN;
+}
+
+/*****************************************************************************/
+/* Queue an AIO read of up to MAX_SG_TRANSFER bytes.                         */
+/*****************************************************************************/
+static ssize_t aio_read_submit(struct osrfx2 * fx2dev, struct kiocb * iocb,
+                               const struct iovec * iov)
+{
+    struct osrfx2_aio_read * ar;
+    unsigned long addr = (unsigned long)iov->iov_base;
+    size_t length = min(iov->iov_len, (size_t)MAX_SG_TRANSFER);
+    void * buf;
+    int pipe;
+    int got;
+    int retval;
+
+    if (length == 0)
+        return 0;
+
     /*
-     *   Increment our usage count for the device.
+     *  Claim one of the aio_depth read slots.
      */
+    while (atomic_inc_return(&fx2dev->aio_reads) > fx2dev->aio_depth) {
+        atomic_dec(&fx2dev->aio_reads);
+        if (iocb->ki_filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(fx2dev->FieldEventQueue,
+                  atomic_read(&fx2dev->aio_reads) < fx2dev->aio_depth)) {
+            return -ERESTARTSYS;
+        }
+    }
+
+    ar = kzalloc(sizeof(*ar), GFP_KERNEL);
+    if (!ar) {
+        atomic_dec(&fx2dev->aio_reads);
+        return -ENOMEM;
+    }
+
+    ar->iocb   = iocb;
+    ar->fx2dev = fx2dev;
+    ar->offset = addr & ~PAGE_MASK;
+    INIT_WORK(&ar->release, aio_read_release);
     kref_get(&fx2dev->kref);
 
-    /*
-     *   Save pointer to device instance in the file's private structure.
-     */
-    file->private_data = fx2dev;
+    ar->npages = (ar->offset + length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    got = get_user_pages_fast(addr & PAGE_MASK, ar->npages, 1, ar->pages);
+    if (got != ar->npages) {
+        ar->npages = (got > 0) ? got : 0;
+        retval = (got < 0) ? got : -EFAULT;
+        goto error;
+    }
+
+    ar->urb = usb_alloc_urb(0, GFP_KERNEL);
+    if (!ar->urb) {
+        retval = -ENOMEM;
+        goto error;
+    }
+
+    buf = usb_buffer_alloc( fx2dev->udev, 
+                            length, 
+                            GFP_KERNEL, 
+                            &ar->urb->transfer_dma );
+    if (!buf) {
+        retval = -ENOMEM;
+        goto error;
+    }
+
+    pipe = usb_rcvbulkpipe(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
+
+    usb_fill_bulk_urb( ar->urb,
+                       fx2dev->udev,
+                       pipe,
+                       buf,
+                       length,
+                       aio_read_complete,
+                       ar );
+
+    ar->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+    iocb->private   = ar;
+    iocb->ki_cancel = aio_read_cancel;
+
+    usb_anchor_urb(ar->urb, &fx2dev->aio_anchor);
+
+    ar->submitted = stat_submit(fx2dev, STAT_BULK_IN);
+    trace_osrfx2_urb_submit(ar->urb);
+    retval = usb_submit_urb(ar->urb, GFP_KERNEL);
+    if (retval != 0) {
+        stat_submit_failed(fx2dev, STAT_BULK_IN, retval);
+        usb_unanchor_urb(ar->urb);
+        iocb->ki_cancel = NULL;
+        dev_err(&fx2dev->interface->dev, "%s - usb_submit_urb failed: %d\n",
+                __FUNCTION__, retval);
+        goto error;
+    }
+
+    return -EIOCBQUEUED;
 
-    return 0;
+error:
+    atomic_dec(&fx2dev->aio_reads);
+    aio_read_release(&ar->release);
+    return retval;
 }
 
 /*****************************************************************************/
-/*                                                                           */
+/* Queue an AIO write of up to one write pool entry (tx_urb_size bytes); a   */
+/* longer one is not cut short but sent by do_aio_write() as an sg transfer. */
+/* Called with tx_mutex held.                                                */
 /*****************************************************************************/
-static int osrfx2_release(struct inode * inode, struct file * file)
+static ssize_t aio_write_submit(struct osrfx2 * fx2dev, struct kiocb * iocb,
+                                const struct iovec * iov)
 {
-    struct osrfx2 * fx2dev;
-    int flags;
+    struct osrfx2_tx_urb * tx;
+    size_t length = iov->iov_len;
+    int retval;
 
-    fx2dev = (struct osrfx2 *)file->private_data;
-    if (fx2dev == NULL)
-        return -ENODEV;
+    if (length == 0)
+        return 0;
 
-    /* 
-     *  Release any bulk_[write|read]_available serialization.
-     */
-    flags = (file->f_flags & O_ACCMODE);
+    retval = write_pool_claim(fx2dev, iocb->ki_filp, &tx);
+    if (retval != 0)
+        return retval;
 
-    if ((flags == O_WRONLY) || (flags == O_RDWR))
-        atomic_inc( &fx2dev->bulk_write_available );
+    if (copy_from_user(tx->urb->transfer_buffer, iov->iov_base, length)) {
+        write_pool_put(fx2dev, tx);
+        return -EFAULT;
+    }
 
-    if ((flags == O_RDONLY) || (flags == O_RDWR)) 
-        atomic_inc( &fx2dev->bulk_read_available );
+    tx->iocb        = iocb;
+    iocb->private   = tx;
+    iocb->ki_cancel = aio_write_cancel;
 
-    /* 
-     *  Decrement the ref-count on the device instance.
-     */
-    kref_put(&fx2dev->kref, osrfx2_delete);
-    
-    return 0;
+    retval = write_pool_submit(fx2dev, tx, length);
+    if (retval != 0) {
+        iocb->ki_cancel = NULL;
+        return retval;
+    }
+
+    return -EIOCBQUEUED;
 }
 
 /*****************************************************************************/
-/*                                                                           */
+/* readv() and AIO reads: one sg transfer, or - with the read-ahead ring     */
+/* running - drain the ring segment by segment, only ever blocking for the   */
+/* first one. A single-segment AIO read is queued instead (see above).       */
 /*****************************************************************************/
-static ssize_t osrfx2_read(struct file * file, char * buffer, 
-                           size_t count, loff_t * ppos)
+static ssize_t do_aio_read(struct kiocb * iocb, const struct iovec * iov,
+                           unsigned long nr_segs, loff_t pos)
 {
-    struct osrfx2 * fx2dev;
-    int retval = 0;
-    int bytes_read;
+    struct file   * file   = iocb->ki_filp;
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    ssize_t copied = 0;
+    ssize_t retval;
+    unsigned long i;
     int pipe;
 
-    fx2dev = (struct osrfx2 *)file->private_data;
+    if (fx2dev->ring)
+        return -EBUSY;
+
+    if (!is_sync_kiocb(iocb) && nr_segs == 1 && !fx2dev->rx_active)
+        return aio_read_submit(fx2dev, iocb, iov);
+
+    if (fx2dev->rx_active) {
+        for (i=0; i < nr_segs; i++) {
+            if (iov[i].iov_len == 0)
+                continue;
+            retval = readahead_read(fx2dev, iov[i].iov_base, iov[i].iov_len,
+                                    (copied != 0) ||
+                                    (file->f_flags & O_NONBLOCK));
+            if (retval <= 0)
+                return (copied != 0) ? copied : retval;
+            copied += retval;
+            if (retval < iov[i].iov_len)
+                break;
+        }
+        return copied;
+    }
 
-    pipe = usb_rcvbulkpipe(fx2dev->udev, fx2dev->bulk_in_endpointAddr),
+    pipe = usb_rcvbulkpipe(fx2dev->udev, fx2dev->bulk_in_endpointAddr);
 
-    /* 
-     *  Do a blocking bulk read to get data from the device 
-     */
-    retval = usb_bulk_msg( fx2dev->udev, 
-                           pipe,
-                           fx2dev->bulk_in_buffer,
-                           min(fx2dev->bulk_in_size, count),
-                           &bytes_read, 
-                           10000 );
+    retval = sg_transfer(fx2dev, pipe, iov, nr_segs, TRUE);
 
-    /* 
-     *  If the read was successful, copy the data to userspace 
-     */
-    if (!retval) {
-        if (copy_to_user(buffer, fx2dev->bulk_in_buffer, bytes_read)) {
-            retval = -EFAULT;
-        }
-        else {
-            retval = bytes_read;
-        }
-        
-        /*
-         *  Increment the pending_data counter by the byte count received.
-         */
-        fx2dev->pending_data -= retval;
-    }
+    if (retval > 0)
+        atomic_long_sub(retval, &fx2dev->pending_data);
 
     return retval;
 }
 
 /*****************************************************************************/
-/*                                                                           */
+/* writev() and AIO writes: one sg transfer, queued behind any coalesced and */
+/* pooled data. A single-segment AIO write is queued instead (see above).    */
 /*****************************************************************************/
-static void write_bulk_backend(struct urb * urb)
+static ssize_t do_aio_write(struct kiocb * iocb, const struct iovec * iov,
+                            unsigned long nr_segs, loff_t pos)
 {
-    struct osrfx2 * fx2dev = (struct osrfx2 *)urb->context;
+    struct osrfx2 * fx2dev = (struct osrfx2 *)iocb->ki_filp->private_data;
+    ssize_t retval;
+    int pipe;
 
-    /* 
-     *  Filter sync and async unlink events as non-errors.
-     */
-    if (urb->status && 
-        !(urb->status == -ENOENT || 
-          urb->status == -ECONNRESET ||
-          urb->status == -ESHUTDOWN)) {
-        dev_err(&fx2dev->interface->dev, 
-                "%s - non-zero status received: %d\n",
-                __FUNCTION__, urb->status);
+    if (mutex_lock_interruptible(&fx2dev->tx_mutex))
+        return -ERESTARTSYS;
+
+    retval = coalesce_flush(fx2dev);
+    if (retval != 0)
+        goto exit;
+
+    if (!is_sync_kiocb(iocb) && nr_segs == 1 && fx2dev->tx_coalesce == 0 &&
+        iov->iov_len <= fx2dev->tx_urb_size) {
+        retval = aio_write_submit(fx2dev, iocb, iov);
+        goto exit;
     }
 
-    /* 
-     *  Free the spent buffer.
-     */
-    usb_buffer_free( urb->dev, 
-                     urb->transfer_buffer_length, 
-                     urb->transfer_buffer, 
-                     urb->transfer_dma );
+    pipe   = usb_sndbulkpipe(fx2dev->udev, fx2dev->bulk_out_endpointAddr);
+    retval = sg_transfer(fx2dev, pipe, iov, nr_segs, FALSE);
+
+    if (retval > 0)
+        atomic_long_add(retval, &fx2dev->pending_data);
+
+exit:
+    mutex_unlock(&fx2dev->tx_mutex);
+
+    return retval;
 }
 
 /*****************************************************************************/
-/*                                                                           */
+/* File operation entry points: bracket the work with the read/write         */
+/* enter and exit tracepoints.                                               */
 /*****************************************************************************/
-static ssize_t osrfx2_write(struct file * file, const char * user_buffer, 
-                            size_t count, loff_t * ppos)
+static ssize_t osrfx2_read(struct file * file, char * buffer, 
+                           size_t count, loff_t * ppos)
 {
-    struct osrfx2 * fx2dev;
-    struct urb * urb = NULL;
-    char * buf = NULL;
-    int pipe;
-    int retval = 0;
-
-    fx2dev = (struct osrfx2 *)file->private_data;
-
-    if (count == 0)
-        return count;
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    int minor = fx2dev->interface->minor;
+    ssize_t retval;
 
-    /* 
-     *  Create a urb, and a buffer for it, and copy the data to the urb.
-     */
-    urb = usb_alloc_urb(0, GFP_KERNEL);
-    if (!urb) {
-        retval = -ENOMEM;
-        goto error;
-    }
+    trace_osrfx2_read_enter(minor, count, file->f_flags & O_NONBLOCK);
+    retval = do_read(file, buffer, count, ppos);
+    trace_osrfx2_read_exit(minor, retval);
 
-    buf = usb_buffer_alloc( fx2dev->udev, 
-                            count, 
-                            GFP_KERNEL, 
-                            &urb->transfer_dma );
-    if (!buf) {
-        retval = -ENOMEM;
-        goto error;
-    }
+    return retval;
+}
 
-    if (copy_from_user(buf, user_buffer, count)) {
-        retval = -EFAULT;
-        goto error;
-    }
+static ssize_t osrfx2_write(struct file * file, const char * user_buffer, 
+                            size_t count, loff_t * ppos)
+{
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    int minor = fx2dev->interface->minor;
+    ssize_t retval;
 
-    /* 
-     *  Initialize the urb properly.
-     */
-    pipe = usb_sndbulkpipe( fx2dev->udev, fx2dev->bulk_out_endpointAddr );
+    trace_osrfx2_write_enter(minor, count, file->f_flags & O_NONBLOCK);
+    retval = do_write(file, user_buffer, count, ppos);
+    trace_osrfx2_write_exit(minor, retval);
 
-    usb_fill_bulk_urb( urb, 
-                       fx2dev->udev,
-                       pipe,
-                       buf, 
-                       count, 
-                       write_bulk_backend, 
-                       fx2dev );
+    return retval;
+}
 
-    urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+static ssize_t osrfx2_aio_read(struct kiocb * iocb, const struct iovec * iov,
+                               unsigned long nr_segs, loff_t pos)
+{
+    struct file   * file   = iocb->ki_filp;
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    int minor = fx2dev->interface->minor;
+    ssize_t retval;
 
-    /* 
-     *  Send the data out the bulk port
-     */
-    retval = usb_submit_urb(urb, GFP_KERNEL);
-    if (retval) {
-        dev_err(&fx2dev->interface->dev, "%s - usb_submit_urb failed: %d\n",
-                __FUNCTION__, retval);
-        goto error;
-    }
+    trace_osrfx2_read_enter(minor, iov_length(iov, nr_segs),
+                            file->f_flags & O_NONBLOCK);
+    retval = do_aio_read(iocb, iov, nr_segs, pos);
+    trace_osrfx2_read_exit(minor, retval);
 
-    /*
-     *  Increment the pending_data counter by the byte count sent.
-     */
-    fx2dev->pending_data += count;
+    return retval;
+}
 
-    /* 
-     *  Release the reference to this urb, the USB core
-     *  will eventually free it entirely.
-     */
-    usb_free_urb(urb);
+static ssize_t osrfx2_aio_write(struct kiocb * iocb, const struct iovec * iov,
+                                unsigned long nr_segs, loff_t pos)
+{
+    struct file   * file   = iocb->ki_filp;
+    struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    int minor = fx2dev->interface->minor;
+    ssize_t retval;
 
-    return count;
+    trace_osrfx2_write_enter(minor, iov_length(iov, nr_segs),
+                             file->f_flags & O_NONBLOCK);
+    retval = do_aio_write(iocb, iov, nr_segs, pos);
+    trace_osrfx2_write_exit(minor, retval);
 
-error:
-    usb_buffer_free(fx2dev->udev, count, buf, urb->transfer_dma);
-    usb_free_urb(urb);
     return retval;
 }
 
 /*****************************************************************************/
-/*                                                                           */
+/* poll never sleeps and takes no lock: every readiness test below is an     */
+/* atomic or a lock-free snapshot, so any number of (e)poll waiters can run  */
+/* it concurrently. Whoever changes that state wakes FieldEventQueue         */
+/* afterwards, and the wake-up orders the change before the re-poll. The     */
+/* ring is only looked at under rcu_read_lock(), which keeps ring_remove()   */
+/* from freeing it underneath; poll reads its head and tail and leaves the   */
+/* resubmission of parked URBs to ring_refill_work().                        */
 /*****************************************************************************/
 static unsigned int osrfx2_poll(struct file * file, poll_table * wait)
 {
     struct osrfx2 * fx2dev = (struct osrfx2 *)file->private_data;
+    struct osrfx2_ring * ring;
     unsigned int mask = 0;
-    int retval = 0;
+    unsigned int tail;
 
-    retval = down_interruptible( &fx2dev->sem );
-    
     poll_wait(file, &fx2dev->FieldEventQueue, wait);
 
-    if ( fx2dev->notify == TRUE ) {
-        fx2dev->notify = FALSE;
+    if (atomic_xchg(&fx2dev->notify, FALSE)) {
         mask |= POLLPRI;
     }
 
-    if ( fx2dev->pending_data > 0) {
-        mask |= POLLIN | POLLRDNORM;
+    if (event_pending(fx2dev)) {
+        mask |= POLLPRI;
+    }
+
+    rcu_read_lock();
+    ring = rcu_dereference(fx2dev->ring);
+    if (ring) {
+        tail = ACCESS_ONCE(ring->hdr->tail);
+        if (ring_starved(ring, tail)) {
+            /*
+             *  Pull the pending refill in rather than wait for its delay.
+             */
+            cancel_delayed_work(&ring->refill);
+            schedule_delayed_work(&ring->refill, 0);
+        }
+        if (ACCESS_ONCE(ring->head) != tail)
+            mask |= POLLIN | POLLRDNORM;
+    }
+    else if (ACCESS_ONCE(fx2dev->rx_active)) {
+        if (readahead_ready(fx2dev))
+            mask |= POLLIN | POLLRDNORM;
+    }
+    else if (ACCESS_ONCE(fx2dev->rx_error) == -ENODEV) {
+        mask |= POLLERR | POLLHUP;
+    }
+    else {
+        /*
+         *  Only in loopback do writes come back to be read; the sink
+         *  swallows them, while the source always has data.
+         */
+        switch (ACCESS_ONCE(fx2dev->stream_mode)) {
+            case OSRFX2_STREAM_LOOPBACK:
+                if (atomic_long_read(&fx2dev->pending_data) > 0)
+                    mask |= POLLIN | POLLRDNORM;
+                break;
+            case OSRFX2_STREAM_SOURCE:
+                mask |= POLLIN | POLLRDNORM;
+                break;
+        }
+    }
+    rcu_read_unlock();
+
+    if (write_pool_ready(fx2dev)) {
+        mask |= POLLOUT | POLLWRNORM;
     }
 
-    up( &fx2dev->sem );
-    
     return mask;
 }
 
@@ -1083,14 +4278,147 @@ static unsigned int osrfx2_poll(struct file * file, poll_table * wait)
 /* This fills-in the driver-supported file_operations fields.                */
 /*****************************************************************************/
 static struct file_operations osrfx2_file_ops = {
-    .owner   = THIS_MODULE,
-    .open    = osrfx2_open,
-    .release = osrfx2_release,
-    .read    = osrfx2_read,
-    .write   = osrfx2_write,
-    .poll    = osrfx2_poll,
+    .owner     = THIS_MODULE,
+    .open      = osrfx2_open,
+    .release   = osrfx2_release,
+    .read      = osrfx2_read,
+    .write     = osrfx2_write,
+    .aio_read  = osrfx2_aio_read,
+    .aio_write = osrfx2_aio_write,
+    .poll      = osrfx2_poll,
+    .flush     = osrfx2_flush,
+    .fsync     = osrfx2_fsync,
+    .mmap      = osrfx2_mmap,
+    .unlocked_ioctl = osrfx2_ioctl,
+    .compat_ioctl   = osrfx2_ioctl,
 };
  
+/*****************************************************************************/
+/* debugfs statistics                                                        */
+/*                                                                           */
+/* /sys/kernel/debug/osrfx2/<interface>/stats shows, per URB class, the      */
+/* counters summed over all CPUs, the current and highest number of URBs in  */
+/* flight, the failures by errno and a log2 histogram of the completion      */
+/* latency: bucket n counts transfers which took [2^(n-1), 2^n) us.          */
+/*****************************************************************************/
+static struct dentry * osrfx2_debugfs_root;
+
+static const char * const stat_class_name [STAT_CLASSES] = {
+    [STAT_BULK_IN]               = "bulk_in",
+    [STAT_BULK_OUT]              = "bulk_out",
+    [STAT_INT_IN]                = "int_in",
+    [STAT_READ_7SEGMENT_DISPLAY] = "read_7segment_display",
+    [STAT_READ_SWITCHES]         = "read_switches",
+    [STAT_READ_BARGRAPH_DISPLAY] = "read_bargraph_display",
+    [STAT_SET_BARGRAPH_DISPLAY]  = "set_bargraph_display",
+    [STAT_IS_HIGH_SPEED]         = "is_high_speed",
+    [STAT_REENUMERATE]           = "reenumerate",
+    [STAT_SET_7SEGMENT_DISPLAY]  = "set_7segment_display",
+    [STAT_SET_KEY_EVENTS]        = "set_key_events",
+    [STAT_READ_COUNTERS]         = "read_counters",
+    [STAT_RESET_COUNTERS]        = "reset_counters",
+    [STAT_SET_STREAM_MODE]       = "set_stream_mode",
+    [STAT_VENDOR_OTHER]          = "vendor_other",
+};
+
+static const char * const stat_error_name [STAT_ERRORS] = {
+    [STAT_ERR_ENOENT]            = "-ENOENT",
+    [STAT_ERR_ECONNRESET]        = "-ECONNRESET",
+    [STAT_ERR_ESHUTDOWN]         = "-ESHUTDOWN",
+    [STAT_ERR_EPIPE]             = "-EPIPE",
+    [STAT_ERR_EPROTO]            = "-EPROTO",
+    [STAT_ERR_EOVERFLOW]         = "-EOVERFLOW",
+    [STAT_ERR_ETIMEDOUT]         = "-ETIMEDOUT",
+    [STAT_ERR_OTHER]             = "other",
+};
+
+static int stats_show(struct seq_file * m, void * v)
+{
+    struct osrfx2 * fx2dev = m->private;
+    struct osrfx2_stat * sum;
+    int cpu, cls, i;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if (sum == NULL)
+        return -ENOMEM;
+
+    for (cls = 0; cls < STAT_CLASSES; cls++) {
+
+        memset(sum, 0, sizeof(*sum));
+
+        for_each_possible_cpu(cpu) {
+            struct osrfx2_stat * st = 
+                &per_cpu_ptr(fx2dev->stats, cpu)->cls[cls];
+
+            sum->submitted += st->submitted;
+            sum->completed += st->completed;
+            sum->bytes     += st->bytes;
+            for (i=0; i < STAT_ERRORS; i++)
+                sum->errors[i] += st->errors[i];
+            for (i=0; i < STAT_HIST_BUCKETS; i++)
+                sum->latency[i] += st->latency[i];
+        }
+
+        seq_printf(m, "%s:\n", stat_class_name[cls]);
+        seq_printf(m, "  submitted %llu completed %llu bytes %llu\n",
+                   (unsigned long long) sum->submitted,
+                   (unsigned long long) sum->completed,
+                   (unsigned long long) sum->bytes);
+        seq_printf(m, "  in_flight %d in_flight_max %d\n",
+                   atomic_read(&fx2dev->stat_inflight[cls]),
+                   fx2dev->stat_inflight_max[cls]);
+
+        seq_printf(m, "  errors");
+        for (i=0; i < STAT_ERRORS; i++) {
+            if (sum->errors[i])
+                seq_printf(m, " %s:%llu", stat_error_name[i],
+                           (unsigned long long) sum->errors[i]);
+        }
+        seq_printf(m, "\n");
+
+        seq_printf(m, "  latency_us");
+        for (i=0; i < STAT_HIST_BUCKETS; i++) {
+            if (sum->latency[i])
+                seq_printf(m, " <%lu:%llu", 1UL << i,
+                           (unsigned long long) sum->latency[i]);
+        }
+        seq_printf(m, "\n");
+    }
+
+    kfree(sum);
+
+    return 0;
+}
+
+static int stats_open(struct inode * inode, struct file * file)
+{
+    return single_open(file, stats_show, inode->i_private);
+}
+
+static const struct file_operations stats_fops = {
+    .owner   = THIS_MODULE,
+    .open    = stats_open,
+    .read    = seq_read,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+static void stats_debugfs_create(struct osrfx2 * fx2dev)
+{
+    struct dentry * dir;
+
+    if (osrfx2_debugfs_root == NULL)
+        return;
+
+    dir = debugfs_create_dir(dev_name(&fx2dev->interface->dev), 
+                             osrfx2_debugfs_root);
+    if (dir == NULL || IS_ERR(dir))
+        return;
+
+    debugfs_create_file("stats", S_IRUSR, dir, fx2dev, &stats_fops);
+    fx2dev->debugfs_dir = dir;
+}
+
 /*****************************************************************************/
 /* Usb class driver info in order to get a minor number from the usb core,   */
 /* and to have the device registered with devfs and the driver core.         */
@@ -1119,6 +4447,12 @@ static int osrfx2_probe(struct usb_interface * interface,
     memset(fx2dev, 0, sizeof(*fx2dev));
     kref_init( &fx2dev->kref );
 
+    fx2dev->stats = alloc_percpu(struct osrfx2_stats);
+    if (fx2dev->stats == NULL) {
+        retval = -ENOMEM;
+        goto error;
+    }
+
     fx2dev->udev = usb_get_dev(udev);
     fx2dev->interface = interface;
     fx2dev->suspended = FALSE;
@@ -1129,8 +4463,23 @@ static int osrfx2_probe(struct usb_interface * interface,
     usb_set_intfdata(interface, fx2dev);
 
     device_create_file(&interface->dev, &dev_attr_switches);
+    device_create_file(&interface->dev, &dev_attr_event_overflows);
     device_create_file(&interface->dev, &dev_attr_bargraph);
     device_create_file(&interface->dev, &dev_attr_7segment);
+    device_create_file(&interface->dev, &dev_attr_readahead_depth);
+    device_create_file(&interface->dev, &dev_attr_readahead_size);
+    device_create_file(&interface->dev, &dev_attr_coalesce_usecs);
+    device_create_file(&interface->dev, &dev_attr_fw_counters);
+    device_create_file(&interface->dev, &dev_attr_stream_mode);
+
+    retval = select_altsetting( fx2dev );
+    if (retval != 0)
+        goto error;
+
+    /*
+     *  Only now does fifo_depth show the depth actually in use.
+     */
+    device_create_file(&interface->dev, &dev_attr_fifo_depth);
 
     retval = find_endpoints( fx2dev );
     if (retval != 0) 
@@ -1149,6 +4498,8 @@ static int osrfx2_probe(struct usb_interface * interface,
         usb_set_intfdata(interface, NULL);
     }
 
+    stats_debugfs_create( fx2dev );
+
     dev_info(&interface->dev, "OSR USB-FX2 device now attached.\n");
 
     return 0;
@@ -1173,12 +4524,65 @@ static void osrfx2_disconnect(struct usb_interface * interface)
     fx2dev = usb_get_intfdata(interface);
 
     usb_kill_urb(fx2dev->int_in_urb);
+
+    /*
+     *  No more events will come: GET_EVENTS waiters return -ENODEV.
+     */
+    fx2dev->disconnected = TRUE;
+    wake_pollers(fx2dev, OSRFX2_WAKE_DISCONNECT);
+
+    /*
+     *  Leave the firmware with plain switch reports and in loopback for
+     *  whoever binds next.
+     *  Fails harmlessly when the device is already gone.
+     */
+    if (fx2dev->key_events) {
+        vendor_request(fx2dev, OSRFX2_SET_KEY_EVENTS, USB_DIR_OUT, 0, NULL, 0);
+    }
+    if (fx2dev->stream_mode != OSRFX2_STREAM_LOOPBACK) {
+        vendor_request(fx2dev, OSRFX2_SET_STREAM_MODE, USB_DIR_OUT,
+                       OSRFX2_STREAM_LOOPBACK, NULL, 0);
+    }
+
+    /*
+     *  Readers waiting for read-ahead data would never see it now: end
+     *  the ring for them, read() returns -ENODEV and poll POLLERR.
+     */
+    mutex_lock(&fx2dev->rx_mutex);
+    spin_lock_irq(&fx2dev->rx_lock);
+    if (fx2dev->rx_active) {
+        fx2dev->rx_active = FALSE;
+        fx2dev->rx_error  = -ENODEV;
+    }
+    spin_unlock_irq(&fx2dev->rx_lock);
+    usb_kill_anchored_urbs(&fx2dev->rx_anchor);
+    mutex_unlock(&fx2dev->rx_mutex);
+    wake_pollers(fx2dev, OSRFX2_WAKE_RX_DATA);
+
+    cancel_delayed_work_sync(&fx2dev->tx_flush_work);
+    usb_kill_anchored_urbs(&fx2dev->tx_anchor);
+    usb_kill_anchored_urbs(&fx2dev->aio_anchor);
+
+    mutex_lock(&fx2dev->ring_mutex);
+    if (fx2dev->ring)
+        ring_stop(fx2dev->ring);
+    mutex_unlock(&fx2dev->ring_mutex);
     
     usb_set_intfdata(interface, NULL);
 
     device_remove_file(&interface->dev, &dev_attr_switches);
+    device_remove_file(&interface->dev, &dev_attr_event_overflows);
     device_remove_file(&interface->dev, &dev_attr_bargraph);
     device_remove_file(&interface->dev, &dev_attr_7segment);
+    device_remove_file(&interface->dev, &dev_attr_readahead_depth);
+    device_remove_file(&interface->dev, &dev_attr_readahead_size);
+    device_remove_file(&interface->dev, &dev_attr_coalesce_usecs);
+    device_remove_file(&interface->dev, &dev_attr_fifo_depth);
+    device_remove_file(&interface->dev, &dev_attr_fw_counters);
+    device_remove_file(&interface->dev, &dev_attr_stream_mode);
+
+    debugfs_remove_recursive(fx2dev->debugfs_dir);
+    fx2dev->debugfs_dir = NULL;
 
     usb_deregister_dev(interface, &osrfx2_class);
 
@@ -1209,6 +4613,28 @@ static int osrfx2_suspend(struct usb_interface * intf, pm_message_t message)
      */
     usb_kill_urb(fx2dev->int_in_urb);
 
+    /*
+     *  Stop the read-ahead ring; staged data stays queued for read().
+     */
+    mutex_lock(&fx2dev->rx_mutex);
+    usb_kill_anchored_urbs(&fx2dev->rx_anchor);
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    /*
+     *  Queued AIO reads complete with -ECANCELED.
+     */
+    usb_kill_anchored_urbs(&fx2dev->aio_anchor);
+
+    /*
+     *  Stop the zero-copy ring; it restarts after the last published slot.
+     */
+    mutex_lock(&fx2dev->ring_mutex);
+    if (fx2dev->ring) {
+        fx2dev->ring->restart = fx2dev->ring->active;
+        ring_stop(fx2dev->ring);
+    }
+    mutex_unlock(&fx2dev->ring_mutex);
+
     up(&fx2dev->sem);
 
     return 0;
@@ -1233,9 +4659,12 @@ static int osrfx2_resume(struct usb_interface * intf)
     /* 
      *  Re-start the interrupt pipe read urb.
      */
+    fx2dev->int_in_submitted = stat_submit(fx2dev, STAT_INT_IN);
+    trace_osrfx2_urb_submit(fx2dev->int_in_urb);
     retval = usb_submit_urb( fx2dev->int_in_urb, GFP_KERNEL );
     
     if (retval) {
+        stat_submit_failed(fx2dev, STAT_INT_IN, retval);
         dev_err(&intf->dev, "%s - usb_submit_urb failed %d\n",
                 __FUNCTION__, retval);
 
@@ -1251,6 +4680,29 @@ static int osrfx2_resume(struct usb_interface * intf)
 
         }
     }
+
+    /*
+     *  Re-prime the read-ahead slots which were in flight at suspend time.
+     */
+    mutex_lock(&fx2dev->rx_mutex);
+    if (fx2dev->rx_active) {
+        struct osrfx2_rx_urb * rx;
+        unsigned int i;
+
+        for (i=0; i < fx2dev->rx_depth; i++) {
+            rx = &fx2dev->rx_ring[i];
+            if (list_empty(&rx->list) && !rx->failed)
+                readahead_submit(rx, GFP_KERNEL);
+        }
+    }
+    mutex_unlock(&fx2dev->rx_mutex);
+
+    mutex_lock(&fx2dev->ring_mutex);
+    if (fx2dev->ring && fx2dev->ring->restart) {
+        fx2dev->ring->restart = FALSE;
+        ring_start(fx2dev->ring);
+    }
+    mutex_unlock(&fx2dev->ring_mutex);
     
     up(&fx2dev->sem);
 
@@ -1276,7 +4728,17 @@ static int __init osrfx2_init(void)
 {
     int retval;
 
+    /*
+     *  debugfs is optional: without it the statistics are just not shown.
+     */
+    osrfx2_debugfs_root = debugfs_create_dir("osrfx2", NULL);
+    if (IS_ERR(osrfx2_debugfs_root))
+        osrfx2_debugfs_root = NULL;
+
     retval = usb_register(&osrfx2_driver);
+    if (retval != 0) {
+        debugfs_remove_recursive(osrfx2_debugfs_root);
+    }
 
     return retval;
 }
@@ -1287,6 +4749,7 @@ static int __init osrfx2_init(void)
 static void __exit osrfx2_exit(void)
 {
     usb_deregister( &osrfx2_driver );
+    debugfs_remove_recursive( osrfx2_debugfs_root );
 }
 
 /*****************************************************************************/
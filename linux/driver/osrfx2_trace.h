@@ -0,0 +1,224 @@
+/**
+ * osrfx2_trace.h
+ *
+ * osrfx2  - A Driver for the OSR USB FX2 Learning Kit device
+ *
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * Tracepoints of the osrfx2 driver. They show up under events/osrfx2 in
+ * ftrace and as osrfx2:* in perf and bpftrace, next to the scheduler and
+ * usb host controller events. A disabled tracepoint costs one not-taken
+ * branch.
+ *
+ *   osrfx2_urb_submit     an URB is handed to the usb core
+ *   osrfx2_urb_complete   its completion handler runs (status, length)
+ *   osrfx2_poll_wakeup    pollers/sleepers are woken, and why
+ *   osrfx2_read_enter     read()/aio_read() entry and exit
+ *   osrfx2_read_exit
+ *   osrfx2_write_enter    write()/aio_write() entry and exit
+ *   osrfx2_write_exit
+ *
+ * Only osrfx2.c includes this file; it defines CREATE_TRACE_POINTS first.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM osrfx2
+
+#if !defined(_OSRFX2_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _OSRFX2_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+/*
+ *  Reasons for osrfx2_poll_wakeup.
+ */
+#ifndef OSRFX2_WAKE_INT_IN
+#define OSRFX2_WAKE_INT_IN      0   /* interrupt report (switches/events)   */
+#define OSRFX2_WAKE_TX_FREE     1   /* a bulk-OUT pool entry is free again  */
+#define OSRFX2_WAKE_RX_DATA     2   /* read-ahead data (or error) staged    */
+#define OSRFX2_WAKE_RING        3   /* zero-copy ring slot published        */
+#define OSRFX2_WAKE_AIO_READ    4   /* an AIO read completed                */
+#define OSRFX2_WAKE_DISCONNECT  5   /* the device went away                 */
+#endif
+
+TRACE_EVENT(osrfx2_urb_submit,
+
+    TP_PROTO(struct urb * urb),
+
+    TP_ARGS(urb),
+
+    TP_STRUCT__entry(
+        __field( void *,        urb     )
+        __field( int,           devnum  )
+        __field( unsigned int,  ep      )
+        __field( int,           dir_in  )
+        __field( u32,           length  )
+    ),
+
+    TP_fast_assign(
+        __entry->urb    = urb;
+        __entry->devnum = urb->dev->devnum;
+        __entry->ep     = usb_pipeendpoint(urb->pipe);
+        __entry->dir_in = usb_pipein(urb->pipe);
+        __entry->length = urb->transfer_buffer_length;
+    ),
+
+    TP_printk("dev %d ep%u%s urb %p length %u",
+              __entry->devnum, __entry->ep, __entry->dir_in ? "in" : "out",
+              __entry->urb, __entry->length)
+);
+
+TRACE_EVENT(osrfx2_urb_complete,
+
+    TP_PROTO(struct urb * urb),
+
+    TP_ARGS(urb),
+
+    TP_STRUCT__entry(
+        __field( void *,        urb           )
+        __field( int,           devnum        )
+        __field( unsigned int,  ep            )
+        __field( int,           dir_in        )
+        __field( int,           status        )
+        __field( u32,           actual_length )
+    ),
+
+    TP_fast_assign(
+        __entry->urb           = urb;
+        __entry->devnum        = urb->dev->devnum;
+        __entry->ep            = usb_pipeendpoint(urb->pipe);
+        __entry->dir_in        = usb_pipein(urb->pipe);
+        __entry->status        = urb->status;
+        __entry->actual_length = urb->actual_length;
+    ),
+
+    TP_printk("dev %d ep%u%s urb %p status %d actual_length %u",
+              __entry->devnum, __entry->ep, __entry->dir_in ? "in" : "out",
+              __entry->urb, __entry->status, __entry->actual_length)
+);
+
+TRACE_EVENT(osrfx2_poll_wakeup,
+
+    TP_PROTO(int minor, int reason),
+
+    TP_ARGS(minor, reason),
+
+    TP_STRUCT__entry(
+        __field( int,   minor   )
+        __field( int,   reason  )
+    ),
+
+    TP_fast_assign(
+        __entry->minor  = minor;
+        __entry->reason = reason;
+    ),
+
+    TP_printk("minor %d reason %s", __entry->minor,
+              __print_symbolic(__entry->reason,
+                               { OSRFX2_WAKE_INT_IN,   "int_in"   },
+                               { OSRFX2_WAKE_TX_FREE,  "tx_free"  },
+                               { OSRFX2_WAKE_RX_DATA,  "rx_data"  },
+                               { OSRFX2_WAKE_RING,     "ring"     },
+                               { OSRFX2_WAKE_AIO_READ, "aio_read" },
+                               { OSRFX2_WAKE_DISCONNECT, "disconnect" }))
+);
+
+/*
+ *  File operation entry/exit. Kept as separate TRACE_EVENTs rather than an
+ *  event class so the header also builds on kernels before 2.6.33.
+ */
+TRACE_EVENT(osrfx2_read_enter,
+
+    TP_PROTO(int minor, size_t count, int nonblock),
+
+    TP_ARGS(minor, count, nonblock),
+
+    TP_STRUCT__entry(
+        __field( int,       minor    )
+        __field( size_t,    count    )
+        __field( int,       nonblock )
+    ),
+
+    TP_fast_assign(
+        __entry->minor    = minor;
+        __entry->count    = count;
+        __entry->nonblock = nonblock;
+    ),
+
+    TP_printk("minor %d count %zu%s", __entry->minor, __entry->count,
+              __entry->nonblock ? " nonblock" : "")
+);
+
+TRACE_EVENT(osrfx2_read_exit,
+
+    TP_PROTO(int minor, ssize_t retval),
+
+    TP_ARGS(minor, retval),
+
+    TP_STRUCT__entry(
+        __field( int,       minor  )
+        __field( ssize_t,   retval )
+    ),
+
+    TP_fast_assign(
+        __entry->minor  = minor;
+        __entry->retval = retval;
+    ),
+
+    TP_printk("minor %d retval %zd", __entry->minor, __entry->retval)
+);
+
+TRACE_EVENT(osrfx2_write_enter,
+
+    TP_PROTO(int minor, size_t count, int nonblock),
+
+    TP_ARGS(minor, count, nonblock),
+
+    TP_STRUCT__entry(
+        __field( int,       minor    )
+        __field( size_t,    count    )
+        __field( int,       nonblock )
+    ),
+
+    TP_fast_assign(
+        __entry->minor    = minor;
+        __entry->count    = count;
+        __entry->nonblock = nonblock;
+    ),
+
+    TP_printk("minor %d count %zu%s", __entry->minor, __entry->count,
+              __entry->nonblock ? " nonblock" : "")
+);
+
+TRACE_EVENT(osrfx2_write_exit,
+
+    TP_PROTO(int minor, ssize_t retval),
+
+    TP_ARGS(minor, retval),
+
+    TP_STRUCT__entry(
+        __field( int,       minor  )
+        __field( ssize_t,   retval )
+    ),
+
+    TP_fast_assign(
+        __entry->minor  = minor;
+        __entry->retval = retval;
+    ),
+
+    TP_printk("minor %d retval %zd", __entry->minor, __entry->retval)
+);
+
+#endif /* _OSRFX2_TRACE_H */
+
+/*
+ *  This part must be outside the include guard.
+ */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE osrfx2_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,1119 @@
+/**
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * osrfx2emu - a user space stand-in for the CY001 board running osrfx2fw,
+ * built on the raw-gadget interface. Together with dummy_hcd it lets the
+ * osrfx2 driver and the tools in ../exe run on any Linux box:
+ *
+ *   modprobe dummy_hcd
+ *   modprobe raw_gadget
+ *   ./osrfx2emu &                 (the driver binds to 0547:1002)
+ *   ../exe/aiobench
+ *
+ * What it reproduces from osrfx2fw (periph.c, icd.h, dscr.a51):
+ *
+ *   - The descriptors: one configuration, interface 0 alt 0 with EP1
+ *     interrupt-IN, EP6 bulk-OUT and EP8 bulk-IN, 512 byte bulk packets at
+ *     high speed and 64 at full speed. The FIFO depth descriptor after the
+ *     interface descriptor reports the -b buffering. The deeper alternate
+ *     settings 1 and 2 of the firmware, which move the bulk endpoints to
+ *     EP2/EP6, are not offered; -b covers their depth on alt 0.
+ *   - The vendor commands 0xD4 - 0xE1. Like the firmware it answers
+ *     READ/SET BARGRAPH (0xD7/0xD8), READ DEVINFO LEN/DATA (0xDC/0xDD,
+ *     all the blobs wIndex selects), SET KEY EVENTS (0xDE), READ/RESET
+ *     COUNTERS (0xDF/0xE0; there is no TD_Poll to count or time, so polls
+ *     and cycles stay 0) and SET STREAM MODE (0xE1; a source packet
+ *     already handed to EP8 still goes out after a switch) and stalls the
+ *     ones the CY001 has no hardware for. With -x those are answered the
+ *     way an OSR board would (7-segment, switches, speed).
+ *   - EP6 -> EP8 loopback, one packet at a time, with the four packets of
+ *     buffering of the FX2 (EP6 and EP8 are double buffered): once four
+ *     packets are held EP6 NAKs until the host reads from EP8.
+ *   - EP1 interrupt reports carrying the key byte (MOUSEMOV_* bits), or,
+ *     once the host turned key events on with 0xDE, records of sequence
+ *     number, key byte and frame number (the millisecond clock stands in
+ *     for the USB frame counter), up to 16 per report.
+ *
+ * -D adds a fixed service delay to every looped packet, standing in for
+ * the time the firmware spends in TD_Poll.
+ *
+ * -e queues key events at a fixed rate, as a steady source for
+ * ../exe/evlat to measure the event latency and its jitter with.
+ *
+ * Key presses are read from stdin, one command per line:
+ *   u, d, l, r     report MOUSEMOV_UP, _DOWN, _LEFT or _RIGHT
+ *   k <hex>        report an arbitrary key byte
+ *   s              print statistics
+ *   q              quit
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h> //getopt
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "public.h"
+
+/*---------------------------------------------------------------------------*/
+/* Values shared with osrfx2fw (icd.h, periph.c, dscr.a51)                   */
+/*---------------------------------------------------------------------------*/
+#define USBFX2LK_READ_DEVINFO_LEN	0xDC
+#define USBFX2LK_READ_DEVINFO_DATA	0xDD
+#define DEVINFO_TEXT			0
+#define DEVINFO_BUILD			1
+#define DEVINFO_COUNTERS		2
+#define DEVINFO_CONFIG			3
+#define DEVINFO_CONFIG_LEN		8
+#define USBFX2LK_SET_KEY_EVENTS		0xDE
+#define USBFX2LK_READ_COUNTERS		0xDF
+#define USBFX2LK_RESET_COUNTERS		0xE0
+#define COUNTERS_LEN			24
+#define USBFX2LK_SET_STREAM_MODE	0xE1
+#define STREAM_LOOPBACK			0
+#define STREAM_SINK			1
+#define STREAM_SOURCE			2
+#define VR_NAKALL_ON			0xD0
+#define VR_NAKALL_OFF			0xD1
+
+#define MOUSEMOV_UP			0x01
+#define MOUSEMOV_DOWN			0x02
+#define MOUSEMOV_LEFT			0x04
+#define MOUSEMOV_RIGHT			0x08
+
+#define USB_DT_FIFO			0x24	// DSCR_FIFO
+#define FIFO_BULK			1
+
+#define EP_INT_IN			0x81
+#define EP_BULK_OUT			0x06
+#define EP_BULK_IN			0x88
+
+#define EP0_MAX_DATA			256
+#define BULK_MAXP_HS			512
+#define BULK_MAXP_FS			64
+#define MAX_BUFFER_PACKETS		64
+#define KEY_QUEUE			64
+#define KEY_EVENT_LEN			4
+#define KEY_EVENTS_REPORT		(64 / KEY_EVENT_LEN)
+
+static const char dev_info[] = "SW version is: 1.0.0.0\n"
+			       "Flex version is: 1.0.0.0\n"
+			       "IMEI is: 1234567890\n";
+
+/*---------------------------------------------------------------------------*/
+/* Global data                                                               */
+/*---------------------------------------------------------------------------*/
+char		*udc_driver			= "dummy_udc";
+char		*udc_device			= "dummy_udc.0";
+int		flag_full_speed			= 0;
+int		flag_extended			= 0;
+int		flag_verbose			= 0;
+int		service_delay_us		= 0;		// per looped packet
+int		buffer_packets			= 4;		// EP6 + EP8 buffers
+int		event_rate			= 0;		// -e key events per second
+
+int		fd;
+int		bulk_maxp;
+int		configured;
+int		ep_int_in, ep_bulk_out, ep_bulk_in;		// raw-gadget handles
+
+unsigned char	bargraph;			// curLEDs of periph.c
+unsigned char	segment;			// -x only
+unsigned char	keys;				// last reported key byte
+int		key_events;			// KeyEvents of periph.c
+unsigned char	key_seq;			// KeySeq of periph.c
+
+/*
+ EP6 -> EP8 loopback buffers. A packet is held from the moment EP6
+ accepted it until the host has read it from EP8.
+*/
+struct {
+	unsigned char	data[MAX_BUFFER_PACKETS][BULK_MAXP_HS];
+	int		len[MAX_BUFFER_PACKETS];
+	int		head, tail, count;
+	int		in_flight;			// tail is in an EP8 write
+	int		nakall;
+	int		mode;				// STREAM_*
+	uint32_t	source_seq;			// next source packet
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+} loop = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+};
+
+struct {
+	unsigned char	key[KEY_QUEUE];
+	unsigned char	seq[KEY_QUEUE];
+	unsigned short	frame[KEY_QUEUE];
+	int		head, tail, count;
+	pthread_mutex_t	lock;
+	pthread_cond_t	changed;
+} keyq = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER,
+};
+
+unsigned long	stat_out_packets, stat_in_packets, stat_out_bytes;
+unsigned long	stat_key_reports, stat_key_dropped;
+unsigned long	stat_vendor, stat_stalls;
+
+// the counters of USBFX2LK_READ_COUNTERS, which the host may reset
+uint32_t	cnt_packets, cnt_bytes, cnt_in_full, cnt_reports;
+
+/*---------------------------------------------------------------------------*/
+/* Descriptors, as in dscr.a51                                               */
+/*---------------------------------------------------------------------------*/
+struct usb_device_descriptor device_dscr = {
+	.bLength		= USB_DT_DEVICE_SIZE,
+	.bDescriptorType	= USB_DT_DEVICE,
+	.bcdUSB			= 0x0200,
+	.bDeviceClass		= 0,
+	.bDeviceSubClass	= 0,
+	.bDeviceProtocol	= 0,
+	.bMaxPacketSize0	= 64,
+	.idVendor		= OSRFX2_VENDOR_ID,
+	.idProduct		= OSRFX2_PRODUCT_ID,
+	.bcdDevice		= 0x0000,
+	.iManufacturer		= 1,
+	.iProduct		= 2,
+	.iSerialNumber		= 0,
+	.bNumConfigurations	= 1,
+};
+
+struct usb_qualifier_descriptor qualifier_dscr = {
+	.bLength		= sizeof(struct usb_qualifier_descriptor),
+	.bDescriptorType	= USB_DT_DEVICE_QUALIFIER,
+	.bcdUSB			= 0x0200,
+	.bDeviceClass		= 0,
+	.bDeviceSubClass	= 0,
+	.bDeviceProtocol	= 0,
+	.bMaxPacketSize0	= 64,
+	.bNumConfigurations	= 1,
+	.bRESERVED		= 0,
+};
+
+struct usb_config_descriptor config_dscr = {
+	.bLength		= USB_DT_CONFIG_SIZE,
+	.bDescriptorType	= USB_DT_CONFIG,
+	.wTotalLength		= 0,		// filled in by build_config()
+	.bNumInterfaces		= 1,
+	.bConfigurationValue	= 1,
+	.iConfiguration		= 0,
+	.bmAttributes		= USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_WAKEUP,
+	.bMaxPower		= 50,
+};
+
+struct usb_interface_descriptor interface_dscr = {
+	.bLength		= USB_DT_INTERFACE_SIZE,
+	.bDescriptorType	= USB_DT_INTERFACE,
+	.bInterfaceNumber	= 0,
+	.bAlternateSetting	= 0,
+	.bNumEndpoints		= 3,
+	.bInterfaceClass	= USB_CLASS_VENDOR_SPEC,
+	.bInterfaceSubClass	= 0,
+	.bInterfaceProtocol	= 0,
+	.iInterface		= 0,
+};
+
+struct fifo_descriptor {
+	__u8	bLength;
+	__u8	bDescriptorType;
+	__u8	bDescriptorSubtype;
+	__u8	bOutBuffers;
+	__u8	bInBuffers;
+} __attribute__((packed));
+
+struct fifo_descriptor fifo_dscr = {
+	.bLength		= sizeof(struct fifo_descriptor),
+	.bDescriptorType	= USB_DT_FIFO,
+	.bDescriptorSubtype	= FIFO_BULK,
+	.bOutBuffers		= 2,		// set from -b
+	.bInBuffers		= 2,
+};
+
+struct usb_endpoint_descriptor int_in_dscr = {
+	.bLength		= USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType	= USB_DT_ENDPOINT,
+	.bEndpointAddress	= EP_INT_IN,
+	.bmAttributes		= USB_ENDPOINT_XFER_INT,
+	.wMaxPacketSize		= 64,
+	.bInterval		= 10,
+};
+
+struct usb_endpoint_descriptor bulk_out_dscr = {
+	.bLength		= USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType	= USB_DT_ENDPOINT,
+	.bEndpointAddress	= EP_BULK_OUT,
+	.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+	.wMaxPacketSize		= 0,		// set per speed
+	.bInterval		= 0,
+};
+
+struct usb_endpoint_descriptor bulk_in_dscr = {
+	.bLength		= USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType	= USB_DT_ENDPOINT,
+	.bEndpointAddress	= EP_BULK_IN,
+	.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+	.wMaxPacketSize		= 0,		// set per speed
+	.bInterval		= 0,
+};
+
+static const char *strings[] = { NULL, "Cypress", "OSRFX2" };
+
+/*
+ Build the configuration descriptor for the given bulk packet size (the
+ other-speed one differs from the enabled endpoints). Return its length.
+*/
+static int build_config(char *buf, int maxp, int type)
+{
+	struct usb_config_descriptor *config = (void *)buf;
+	struct usb_endpoint_descriptor bulk_out = bulk_out_dscr;
+	struct usb_endpoint_descriptor bulk_in = bulk_in_dscr;
+	int len = 0;
+
+	bulk_out.wMaxPacketSize = maxp;
+	bulk_in.wMaxPacketSize = maxp;
+
+	memcpy(buf + len, &config_dscr, USB_DT_CONFIG_SIZE);
+	len += USB_DT_CONFIG_SIZE;
+	memcpy(buf + len, &interface_dscr, USB_DT_INTERFACE_SIZE);
+	len += USB_DT_INTERFACE_SIZE;
+	memcpy(buf + len, &fifo_dscr, sizeof(fifo_dscr));
+	len += sizeof(fifo_dscr);
+	memcpy(buf + len, &int_in_dscr, USB_DT_ENDPOINT_SIZE);
+	len += USB_DT_ENDPOINT_SIZE;
+	memcpy(buf + len, &bulk_out, USB_DT_ENDPOINT_SIZE);
+	len += USB_DT_ENDPOINT_SIZE;
+	memcpy(buf + len, &bulk_in, USB_DT_ENDPOINT_SIZE);
+	len += USB_DT_ENDPOINT_SIZE;
+
+	config->bDescriptorType = type;
+	config->wTotalLength = len;
+
+	return len;
+}
+
+static int build_string(char *buf, int index)
+{
+	const char *s;
+	int i;
+
+	if (index == 0) {
+		buf[0] = 4;
+		buf[1] = USB_DT_STRING;
+		buf[2] = 0x09;		// English (US)
+		buf[3] = 0x04;
+		return 4;
+	}
+	if (index >= (int)(sizeof(strings) / sizeof(strings[0])))
+		return -1;
+
+	s = strings[index];
+	buf[0] = 2 + 2 * strlen(s);
+	buf[1] = USB_DT_STRING;
+	for (i = 0; s[i]; i++) {
+		buf[2 + 2 * i] = s[i];
+		buf[3 + 2 * i] = 0;
+	}
+	return buf[0];
+}
+
+/*---------------------------------------------------------------------------*/
+/* raw-gadget wrappers                                                       */
+/*---------------------------------------------------------------------------*/
+struct usb_raw_control_event {
+	struct usb_raw_event	inner;
+	struct usb_ctrlrequest	ctrl;
+};
+
+struct usb_raw_control_io {
+	struct usb_raw_ep_io	inner;
+	char			data[EP0_MAX_DATA];
+};
+
+struct usb_raw_bulk_io {
+	struct usb_raw_ep_io	inner;
+	char			data[BULK_MAXP_HS];
+};
+
+static void fatal(const char *what)
+{
+	fprintf(stderr, "%s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static int ep_enable(struct usb_endpoint_descriptor *desc)
+{
+	int handle = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, desc);
+
+	if (handle < 0)
+		fatal("USB_RAW_IOCTL_EP_ENABLE");
+	return handle;
+}
+
+static int ep_write(int ep, const void *data, int len)
+{
+	struct usb_raw_bulk_io io;
+
+	io.inner.ep = ep;
+	io.inner.flags = 0;
+	io.inner.length = len;
+	memcpy(io.data, data, len);
+	return ioctl(fd, USB_RAW_IOCTL_EP_WRITE, &io);
+}
+
+static int ep_read(int ep, void *data, int len)
+{
+	struct usb_raw_bulk_io io;
+	int ret;
+
+	io.inner.ep = ep;
+	io.inner.flags = 0;
+	io.inner.length = len;
+	ret = ioctl(fd, USB_RAW_IOCTL_EP_READ, &io);
+	if (ret > 0)
+		memcpy(data, io.data, ret);
+	return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Endpoint threads                                                          */
+/*---------------------------------------------------------------------------*/
+
+/*
+ EP6 (bulk-OUT): only ask for the next packet while a buffer is free, so
+ the host sees NAKs once buffer_packets are held, like on the FX2.
+*/
+static void *bulk_out_thread(void *arg)
+{
+	unsigned char packet[BULK_MAXP_HS];
+	int len;
+
+	for (;;) {
+		pthread_mutex_lock(&loop.lock);
+		if (loop.count >= buffer_packets && loop.mode == STREAM_LOOPBACK)
+			cnt_in_full++;
+		while ((loop.count >= buffer_packets && loop.mode != STREAM_SINK) ||
+		       loop.mode == STREAM_SOURCE || loop.nakall)
+			pthread_cond_wait(&loop.changed, &loop.lock);
+		pthread_mutex_unlock(&loop.lock);
+
+		len = ep_read(ep_bulk_out, packet, bulk_maxp);
+		if (len < 0) {
+			fprintf(stderr, "EP6 read: %s\n", strerror(errno));
+			return NULL;
+		}
+
+		pthread_mutex_lock(&loop.lock);
+		if (loop.mode == STREAM_SINK) {
+			stat_out_packets++;
+			stat_out_bytes += len;
+			cnt_packets++;
+			cnt_bytes += len;
+			pthread_mutex_unlock(&loop.lock);
+			continue;
+		}
+		memcpy(loop.data[loop.head], packet, len);
+		loop.len[loop.head] = len;
+		loop.head = (loop.head + 1) % MAX_BUFFER_PACKETS;
+		loop.count++;
+		stat_out_packets++;
+		stat_out_bytes += len;
+		cnt_packets++;
+		cnt_bytes += len;
+		pthread_cond_broadcast(&loop.changed);
+		pthread_mutex_unlock(&loop.lock);
+	}
+	return NULL;
+}
+
+/*
+ EP8 (bulk-IN): hand each held packet back to the host. The buffer is only
+ freed once the host has taken the packet.
+*/
+/*
+ STREAM_SOURCE: the next counter pattern packet, as SourcePacket() sends.
+*/
+static void source_packet(unsigned char *packet, uint32_t seq)
+{
+	int i;
+
+	for (i = 4; i < bulk_maxp; i++)
+		packet[i] = i;
+	packet[0] = seq;
+	packet[1] = seq >> 8;
+	packet[2] = seq >> 16;
+	packet[3] = seq >> 24;
+}
+
+static void *bulk_in_thread(void *arg)
+{
+	unsigned char packet[BULK_MAXP_HS];
+	int len;
+
+	for (;;) {
+		pthread_mutex_lock(&loop.lock);
+		while ((loop.count == 0 && loop.mode != STREAM_SOURCE) ||
+		       loop.mode == STREAM_SINK || loop.nakall)
+			pthread_cond_wait(&loop.changed, &loop.lock);
+		if (loop.mode == STREAM_SOURCE) {
+			source_packet(packet, loop.source_seq++);
+			pthread_mutex_unlock(&loop.lock);
+
+			if (ep_write(ep_bulk_in, packet, bulk_maxp) < 0) {
+				fprintf(stderr, "EP8 write: %s\n", strerror(errno));
+				return NULL;
+			}
+
+			pthread_mutex_lock(&loop.lock);
+			stat_in_packets++;
+			cnt_packets++;
+			cnt_bytes += bulk_maxp;
+			pthread_mutex_unlock(&loop.lock);
+			continue;
+		}
+		len = loop.len[loop.tail];
+		loop.in_flight = 1;
+		pthread_mutex_unlock(&loop.lock);
+
+		if (service_delay_us)
+			usleep(service_delay_us);
+
+		if (ep_write(ep_bulk_in, loop.data[loop.tail], len) < 0) {
+			fprintf(stderr, "EP8 write: %s\n", strerror(errno));
+			return NULL;
+		}
+
+		pthread_mutex_lock(&loop.lock);
+		loop.in_flight = 0;
+		loop.tail = (loop.tail + 1) % MAX_BUFFER_PACKETS;
+		loop.count--;
+		stat_in_packets++;
+		pthread_cond_broadcast(&loop.changed);
+		pthread_mutex_unlock(&loop.lock);
+	}
+	return NULL;
+}
+
+/*
+ EP1 (interrupt-IN): one report byte per queued key press, or with key
+ events on as many queued records as fit one report, as KeyService() does.
+*/
+static void *int_in_thread(void *arg)
+{
+	unsigned char report[KEY_EVENTS_REPORT * KEY_EVENT_LEN];
+	int len, n;
+
+	for (;;) {
+		pthread_mutex_lock(&keyq.lock);
+		while (keyq.count == 0)
+			pthread_cond_wait(&keyq.changed, &keyq.lock);
+		len = 0;
+		n = key_events ? KEY_EVENTS_REPORT : 1;
+		while (keyq.count && n--) {
+			if (key_events) {
+				report[len++] = keyq.seq[keyq.tail];
+				report[len++] = keyq.key[keyq.tail];
+				report[len++] = keyq.frame[keyq.tail] & 0xFF;
+				report[len++] = keyq.frame[keyq.tail] >> 8;
+			} else {
+				report[len++] = keyq.key[keyq.tail];
+			}
+			keys = keyq.key[keyq.tail];
+			keyq.tail = (keyq.tail + 1) % KEY_QUEUE;
+			keyq.count--;
+		}
+		pthread_mutex_unlock(&keyq.lock);
+
+		if (ep_write(ep_int_in, report, len) < 0) {
+			fprintf(stderr, "EP1 write: %s\n", strerror(errno));
+			return NULL;
+		}
+		stat_key_reports++;
+		cnt_reports++;
+	}
+	return NULL;
+}
+
+/*
+ The 11 bit frame number the firmware reads from USBFRAMEH/L.
+*/
+static unsigned short frame_number(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) & 0x7FF;
+}
+
+static void queue_key(unsigned char key)
+{
+	pthread_mutex_lock(&keyq.lock);
+	if (keyq.count < KEY_QUEUE) {
+		keyq.key[keyq.head] = key;
+		keyq.seq[keyq.head] = key_seq;
+		keyq.frame[keyq.head] = frame_number();
+		keyq.head = (keyq.head + 1) % KEY_QUEUE;
+		keyq.count++;
+		pthread_cond_signal(&keyq.changed);
+	} else {
+		stat_key_dropped++;
+	}
+	key_seq++;		// also for a dropped event, so the host sees the gap
+	pthread_mutex_unlock(&keyq.lock);
+}
+
+/*
+ -e: queue a key event every 1/event_rate seconds once configured. The
+ deadlines are absolute, so the rate does not drift with the time one
+ round takes. The keys go round up, right, down, left.
+*/
+static void *event_thread(void *arg)
+{
+	static const unsigned char key[] = {
+		MOUSEMOV_UP, MOUSEMOV_RIGHT, MOUSEMOV_DOWN, MOUSEMOV_LEFT,
+	};
+	long period_ns = 1000000000L / event_rate;
+	struct timespec next;
+	unsigned int n = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		next.tv_nsec += period_ns;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR)
+			;
+		if (configured)
+			queue_key(key[n++ % sizeof(key)]);
+	}
+	return NULL;
+}
+
+static void start_thread(void *(*fn)(void *))
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, fn, NULL) != 0) {
+		fprintf(stderr, "pthread_create failed\n");
+		exit(1);
+	}
+	pthread_detach(thread);
+}
+
+/*
+ SET_CONFIGURATION 1: enable the endpoints and start serving them.
+*/
+static void configure(void)
+{
+	__u32 power = config_dscr.bMaxPower;
+
+	if (configured)
+		return;
+
+	ep_int_in = ep_enable(&int_in_dscr);
+	ep_bulk_out = ep_enable(&bulk_out_dscr);
+	ep_bulk_in = ep_enable(&bulk_in_dscr);
+
+	if (ioctl(fd, USB_RAW_IOCTL_VBUS_DRAW, power) < 0)
+		fatal("USB_RAW_IOCTL_VBUS_DRAW");
+	if (ioctl(fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+		fatal("USB_RAW_IOCTL_CONFIGURE");
+
+	start_thread(int_in_thread);
+	start_thread(bulk_out_thread);
+	start_thread(bulk_in_thread);
+
+	configured = 1;
+	printf("configured, bulk packets of %d bytes\n", bulk_maxp);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Endpoint 0                                                                */
+/*---------------------------------------------------------------------------*/
+
+/*
+ Standard requests. Return the length of the IN data in buf (0 for an
+ OUT request), or -1 to stall.
+*/
+static int standard_request(struct usb_ctrlrequest *ctrl, char *buf)
+{
+	int type = ctrl->wValue >> 8;
+	int index = ctrl->wValue & 0xff;
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (type) {
+		case USB_DT_DEVICE:
+			memcpy(buf, &device_dscr, sizeof(device_dscr));
+			return sizeof(device_dscr);
+		case USB_DT_DEVICE_QUALIFIER:
+			if (flag_full_speed)
+				return -1;
+			memcpy(buf, &qualifier_dscr, sizeof(qualifier_dscr));
+			return sizeof(qualifier_dscr);
+		case USB_DT_CONFIG:
+			return build_config(buf, bulk_maxp, USB_DT_CONFIG);
+		case USB_DT_OTHER_SPEED_CONFIG:
+			if (flag_full_speed)
+				return -1;
+			return build_config(buf, BULK_MAXP_FS,
+					    USB_DT_OTHER_SPEED_CONFIG);
+		case USB_DT_STRING:
+			return build_string(buf, index);
+		default:
+			return -1;
+		}
+	case USB_REQ_SET_CONFIGURATION:
+		if (ctrl->wValue == 1)
+			configure();
+		return 0;
+	case USB_REQ_GET_CONFIGURATION:
+		buf[0] = configured;
+		return 1;
+	case USB_REQ_SET_INTERFACE:
+		return (ctrl->wValue == 0) ? 0 : -1;
+	case USB_REQ_GET_INTERFACE:
+		buf[0] = 0;
+		return 1;
+	case USB_REQ_GET_STATUS:
+		buf[0] = buf[1] = 0;
+		return 2;
+	case USB_REQ_CLEAR_FEATURE:
+	case USB_REQ_SET_FEATURE:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static void put_le32(char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int get_counters(char *buf)
+{
+	memset(buf, 0, COUNTERS_LEN);
+	pthread_mutex_lock(&loop.lock);
+	put_le32(buf, cnt_packets);
+	put_le32(buf + 4, cnt_bytes);
+	put_le32(buf + 8, cnt_in_full);
+	pthread_mutex_unlock(&loop.lock);
+	put_le32(buf + 12, cnt_reports);
+	return COUNTERS_LEN;
+}
+
+/*
+ The device information blob index of icd.h, as DI_Blob() builds it.
+ Returns its length, or -1 if there is no such blob.
+*/
+static int devinfo_blob(int index, char *blob)
+{
+	switch (index) {
+	case DEVINFO_TEXT:
+		memcpy(blob, dev_info, strlen(dev_info));
+		return strlen(dev_info);
+
+	case DEVINFO_BUILD:
+		strcpy(blob, __DATE__ " " __TIME__);
+		return strlen(blob);
+
+	case DEVINFO_COUNTERS:
+		return get_counters(blob);
+
+	case DEVINFO_CONFIG:
+		blob[0] = 0;			// alt 0 is the only one offered
+		blob[1] = loop.mode;
+		blob[2] = key_events;
+		blob[3] = !flag_full_speed;
+		blob[4] = 0;			// no build options
+		blob[5] = 0;			// nor a serial log
+		blob[6] = blob[7] = 0;
+		return DEVINFO_CONFIG_LEN;
+	}
+	return -1;
+}
+
+/*
+ Vendor requests of icd.h, as handled by DR_VendorCmnd(). data holds the
+ OUT data stage, if any. Return the length of the IN data in buf, 0 for an
+ OUT request, or -1 to stall as the firmware does for commands it lacks.
+*/
+static int vendor_request(struct usb_ctrlrequest *ctrl, char *buf,
+			  const char *data, int len)
+{
+	char blob[EP0_MAX_DATA];
+	int n;
+
+	stat_vendor++;
+
+	switch (ctrl->bRequest) {
+	case VR_NAKALL_ON:
+	case VR_NAKALL_OFF:
+		pthread_mutex_lock(&loop.lock);
+		loop.nakall = (ctrl->bRequest == VR_NAKALL_ON);
+		pthread_cond_broadcast(&loop.changed);
+		pthread_mutex_unlock(&loop.lock);
+		return 0;
+
+	case OSRFX2_SET_BARGRAPH_DISPLAY:
+		if (len < 1)
+			return -1;
+		if (data[0] & BARGRAPH_ON)
+			bargraph |= data[0] & 0x0F;
+		else
+			bargraph &= ~data[0] & 0x0F;
+		return 0;
+
+	case OSRFX2_READ_BARGRAPH_DISPLAY:
+		buf[0] = bargraph;
+		return 1;
+
+	case USBFX2LK_READ_DEVINFO_LEN:
+		n = devinfo_blob(ctrl->wIndex, blob);
+		if (n < 0)
+			return -1;
+		buf[0] = n;
+		return 1;
+
+	case USBFX2LK_READ_DEVINFO_DATA:
+		/* the board sends exactly wLength bytes, see DR_VendorCmnd() */
+		n = devinfo_blob(ctrl->wIndex, blob);
+		if (n < 0 || ctrl->wLength > n)
+			return -1;
+		memcpy(buf, blob, ctrl->wLength);
+		return ctrl->wLength;
+
+	case USBFX2LK_READ_COUNTERS:
+		return get_counters(buf);
+
+	case USBFX2LK_RESET_COUNTERS:
+		pthread_mutex_lock(&loop.lock);
+		cnt_packets = cnt_bytes = cnt_in_full = 0;
+		pthread_mutex_unlock(&loop.lock);
+		cnt_reports = 0;
+		return 0;
+
+	case USBFX2LK_SET_STREAM_MODE:
+		if (ctrl->wValue > STREAM_SOURCE)
+			return -1;
+		pthread_mutex_lock(&loop.lock);
+		loop.mode = ctrl->wValue;
+		loop.source_seq = 0;
+		/*
+		 Drop what EP8 held. A packet already handed to the gadget
+		 can't be taken back; it stays counted until bulk_in_thread
+		 sees its write finish.
+		*/
+		loop.count = loop.in_flight;
+		loop.head = (loop.tail + loop.count) % MAX_BUFFER_PACKETS;
+		pthread_cond_broadcast(&loop.changed);
+		pthread_mutex_unlock(&loop.lock);
+		return 0;
+
+	case USBFX2LK_SET_KEY_EVENTS:
+		pthread_mutex_lock(&keyq.lock);
+		key_events = (ctrl->wValue != 0);
+		keyq.head = keyq.tail = keyq.count = 0;
+		key_seq = 0;
+		pthread_mutex_unlock(&keyq.lock);
+		return 0;
+	}
+
+	if (!flag_extended)
+		return -1;
+
+	/*
+	 The commands below only exist on the OSR board.
+	*/
+	switch (ctrl->bRequest) {
+	case OSRFX2_READ_7SEGMENT_DISPLAY:
+		buf[0] = segment;
+		return 1;
+	case OSRFX2_SET_7SEGMENT_DISPLAY:
+		if (len < 1)
+			return -1;
+		segment = data[0];
+		return 0;
+	case OSRFX2_READ_SWITCHES:
+		buf[0] = keys;
+		return 1;
+	case OSRFX2_IS_HIGH_SPEED:
+		buf[0] = !flag_full_speed;
+		return 1;
+	case OSRFX2_REENUMERATE:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ True for the requests with an OUT data stage that are handled. The data
+ stage has to be accepted or stalled before the request is processed.
+*/
+static int accepts_out_data(struct usb_ctrlrequest *ctrl)
+{
+	if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_VENDOR)
+		return 0;
+
+	switch (ctrl->bRequest) {
+	case OSRFX2_SET_BARGRAPH_DISPLAY:
+		return 1;
+	case OSRFX2_SET_7SEGMENT_DISPLAY:
+		return flag_extended;
+	default:
+		return 0;
+	}
+}
+
+static void ep0_stall(void)
+{
+	stat_stalls++;
+	if (ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0) < 0)
+		perror("USB_RAW_IOCTL_EP0_STALL");
+}
+
+static void handle_control(struct usb_ctrlrequest *ctrl)
+{
+	struct usb_raw_control_io io;
+	char buf[EP0_MAX_DATA];
+	int is_in = ctrl->bRequestType & USB_DIR_IN;
+	int len = 0;
+
+	if (flag_verbose)
+		printf("setup %02x %02x %04x %04x %04x\n", ctrl->bRequestType,
+			ctrl->bRequest, ctrl->wValue, ctrl->wIndex, ctrl->wLength);
+
+	io.inner.ep = 0;
+	io.inner.flags = 0;
+
+	/*
+	 Fetch the data stage of an OUT request first.
+	*/
+	if (!is_in && ctrl->wLength) {
+		if (!accepts_out_data(ctrl)) {
+			ep0_stall();
+			return;
+		}
+		io.inner.length = ctrl->wLength > EP0_MAX_DATA ?
+				  EP0_MAX_DATA : ctrl->wLength;
+		len = ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io);
+		if (len < 0) {
+			perror("USB_RAW_IOCTL_EP0_READ");
+			return;
+		}
+	}
+
+	switch (ctrl->bRequestType & USB_TYPE_MASK) {
+	case USB_TYPE_STANDARD:
+		len = standard_request(ctrl, buf);
+		break;
+	case USB_TYPE_VENDOR:
+		len = vendor_request(ctrl, buf, io.data, len);
+		break;
+	default:
+		len = -1;
+		break;
+	}
+
+	if (len < 0) {
+		ep0_stall();
+		return;
+	}
+
+	if (is_in) {
+		io.inner.length = len < ctrl->wLength ? len : ctrl->wLength;
+		memcpy(io.data, buf, io.inner.length);
+		if (ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io) < 0)
+			perror("USB_RAW_IOCTL_EP0_WRITE");
+	} else if (ctrl->wLength == 0) {
+		/* status stage */
+		io.inner.length = 0;
+		if (ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io) < 0)
+			perror("USB_RAW_IOCTL_EP0_READ");
+	}
+}
+
+static void *ep0_thread(void *arg)
+{
+	struct usb_raw_control_event event;
+
+	for (;;) {
+		event.inner.type = 0;
+		event.inner.length = sizeof(event.ctrl);
+
+		if (ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0)
+			fatal("USB_RAW_IOCTL_EVENT_FETCH");
+
+		switch (event.inner.type) {
+		case USB_RAW_EVENT_CONNECT:
+			printf("connected\n");
+			break;
+		case USB_RAW_EVENT_CONTROL:
+			handle_control(&event.ctrl);
+			break;
+		default:
+			break;
+		}
+	}
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Console                                                                   */
+/*---------------------------------------------------------------------------*/
+static void print_stats(void)
+{
+	printf("EP6 out: %lu packets, %lu bytes  EP8 in: %lu packets  held: %d\n",
+		stat_out_packets, stat_out_bytes, stat_in_packets, loop.count);
+	printf("EP1 key reports: %lu (%lu dropped)  vendor requests: %lu"
+		"  stalls: %lu\n",
+		stat_key_reports, stat_key_dropped, stat_vendor, stat_stalls);
+}
+
+void print_usage()
+{
+	printf("Usage for osrfx2emu:\n");
+	printf("-u [name] UDC driver name (default dummy_udc)\n");
+	printf("-U [name] UDC device name (default dummy_udc.0)\n");
+	printf("-f to emulate a full speed device (default high speed)\n");
+	printf("-x to also answer the OSR-only vendor commands\n");
+	printf("-D [n] where n is the per-packet service delay in usecs (default 0)\n");
+	printf("-b [n] where n is the number of loopback buffers (default 4, max %d)\n",
+		MAX_BUFFER_PACKETS);
+	printf("-e [n] where n is key events queued per second (default 0, max 8000)\n");
+	printf("-v to log every setup packet\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct usb_raw_init init;
+	char line[64];
+	unsigned int key;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "u:U:fxD:b:e:vh")) != -1) {
+		switch (ch) {
+		case 'u':
+			udc_driver = optarg;
+			break;
+		case 'U':
+			udc_device = optarg;
+			break;
+		case 'f':
+			flag_full_speed = 1;
+			break;
+		case 'x':
+			flag_extended = 1;
+			break;
+		case 'D':
+			service_delay_us = atoi(optarg);
+			break;
+		case 'b':
+			buffer_packets = atoi(optarg);
+			break;
+		case 'e':
+			event_rate = atoi(optarg);
+			break;
+		case 'v':
+			flag_verbose = 1;
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+	if (service_delay_us < 0 || buffer_packets <= 0 ||
+	    buffer_packets > MAX_BUFFER_PACKETS ||
+	    event_rate < 0 || event_rate > 8000) {
+		print_usage();
+		return 1;
+	}
+
+	bulk_maxp = flag_full_speed ? BULK_MAXP_FS : BULK_MAXP_HS;
+	bulk_out_dscr.wMaxPacketSize = bulk_maxp;
+	bulk_in_dscr.wMaxPacketSize = bulk_maxp;
+	fifo_dscr.bInBuffers = buffer_packets / 2;
+	fifo_dscr.bOutBuffers = buffer_packets - fifo_dscr.bInBuffers;
+
+	fd = open("/dev/raw-gadget", O_RDWR);
+	if (fd < 0)
+		fatal("open /dev/raw-gadget");
+
+	memset(&init, 0, sizeof(init));
+	strncpy((char *)init.driver_name, udc_driver, UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, udc_device, UDC_NAME_LENGTH_MAX - 1);
+	init.speed = flag_full_speed ? USB_SPEED_FULL : USB_SPEED_HIGH;
+
+	if (ioctl(fd, USB_RAW_IOCTL_INIT, &init) < 0)
+		fatal("USB_RAW_IOCTL_INIT");
+	if (ioctl(fd, USB_RAW_IOCTL_RUN, 0) < 0)
+		fatal("USB_RAW_IOCTL_RUN");
+
+	start_thread(ep0_thread);
+
+	printf("osrfx2emu on %s, %s speed, %d loopback buffers, %d us delay\n",
+		udc_device, flag_full_speed ? "full" : "high",
+		buffer_packets, service_delay_us);
+
+	if (event_rate) {
+		start_thread(event_thread);
+		printf("%d key events per second\n", event_rate);
+	}
+
+	while (fgets(line, sizeof(line), stdin)) {
+		switch (line[0]) {
+		case 'u':
+			queue_key(MOUSEMOV_UP);
+			break;
+		case 'd':
+			queue_key(MOUSEMOV_DOWN);
+			break;
+		case 'l':
+			queue_key(MOUSEMOV_LEFT);
+			break;
+		case 'r':
+			queue_key(MOUSEMOV_RIGHT);
+			break;
+		case 'k':
+			if (sscanf(line + 1, "%x", &key) == 1)
+				queue_key(key);
+			break;
+		case 's':
+			print_stats();
+			break;
+		case 'q':
+			print_stats();
+			close(fd);
+			return 0;
+		default:
+			break;
+		}
+	}
+
+	/*
+	 No console (e.g. started in the background): just keep serving.
+	*/
+	for (;;)
+		pause();
+
+	return 0;
+}
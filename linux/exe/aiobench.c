@@ -0,0 +1,276 @@
+/**
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * aiobench - loopback throughput of the osrfx2 driver, blocking
+ * read()/write() against queued kernel AIO (io_submit).
+ *
+ * The blocking pass writes one record and reads it back before the next,
+ * i.e. queue depth 1. The AIO pass keeps up to <depth> writes and <depth>
+ * reads in flight from a single thread and reaps them with io_getevents.
+ * Both passes move the same number of records of the same size. A record
+ * larger than one of the driver's write pool entries is written as a
+ * synchronous sg transfer even in the AIO pass, only the reads stay queued.
+ *
+ * Uses the raw io_setup/io_submit/io_getevents syscalls, so no libaio is
+ * needed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h> //getopt
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#include "libosrfx2.h"
+
+#define MAX_DEVPATH_LENGTH 256
+#define MAX_DEPTH 256
+#define MAX_RECORD (64 * 1024)	// the driver's largest single transfer
+
+/*---------------------------------------------------------------------------*/
+/* Global data                                                               */
+/*---------------------------------------------------------------------------*/
+char		*dev_name			= NULL;
+int		record_len			= 512;		// bytes per record
+unsigned long	record_count			= 10000;	// records per pass
+int		depth				= 32;		// AIO queue depth
+int		flag_skip_blocking		= 0;
+
+/*---------------------------------------------------------------------------*/
+/* Thin wrappers for the AIO syscalls                                        */
+/*---------------------------------------------------------------------------*/
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+	return syscall(SYS_io_setup, nr, ctx);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+	return syscall(SYS_io_destroy, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbpp)
+{
+	return syscall(SYS_io_submit, ctx, nr, iocbpp);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+			struct io_event *events, struct timespec *timeout)
+{
+	return syscall(SYS_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double secs)
+{
+	double bytes = (double)record_len * record_count;
+
+	printf("%-10s %8lu records x %6d bytes  %8.3f s  %10.0f rec/s  %8.2f MB/s\n",
+		name, record_count, record_len, secs,
+		record_count / secs, bytes / secs / 1e6);
+}
+
+void print_usage()
+{
+	printf("Usage for aiobench:\n");
+	printf("-d [name] device name (default osrfx2_0)\n");
+	printf("-s [n] where n is bytes per record (default 512, max %d)\n",
+		MAX_RECORD);
+	printf("-c [n] where n is number of records (default 10000)\n");
+	printf("-q [n] where n is the AIO queue depth (default 32, max %d)\n",
+		MAX_DEPTH);
+	printf("-a to run the AIO pass only\n");
+}
+
+/*
+ Write a record, read it back, repeat. Retrun 0, OK, else failed
+*/
+static int run_blocking(int wfd, int rfd, unsigned char *out, unsigned char *in)
+{
+	unsigned long i;
+	ssize_t len, got;
+	double start;
+
+	start = now();
+	for (i = 0; i < record_count; i++) {
+		len = write(wfd, out, record_len);
+		if (len != record_len) {
+			fprintf(stderr, "write (%lu) returned %zd: %s\n",
+				i, len, strerror(errno));
+			return -1;
+		}
+		/* read-ahead hands back what has landed so far */
+		for (got = 0; got < record_len; got += len) {
+			len = read(rfd, in + got, record_len - got);
+			if (len <= 0) {
+				fprintf(stderr, "read (%lu) returned %zd: %s\n",
+					i, len, strerror(errno));
+				return -1;
+			}
+		}
+	}
+	report("blocking", now() - start);
+
+	return 0;
+}
+
+/*
+ Keep depth writes and depth reads queued. Retrun 0, OK, else failed
+*/
+static int run_aio(int wfd, int rfd, unsigned char *out, unsigned char *in)
+{
+	aio_context_t ctx = 0;
+	struct iocb cbs[2 * MAX_DEPTH];
+	struct iocb *free_cbs[2 * MAX_DEPTH];
+	struct iocb *batch[2 * MAX_DEPTH];
+	struct io_event events[2 * MAX_DEPTH];
+	unsigned long writes = 0, reads = 0, done = 0;
+	int nfree = 0;
+	int n, i;
+	int result = 0;
+	double start;
+
+	if (io_setup(2 * depth, &ctx) < 0) {
+		fprintf(stderr, "io_setup failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < 2 * depth; i++)
+		free_cbs[nfree++] = &cbs[i];
+
+	start = now();
+	while (done < 2 * record_count) {
+		/* top up both queues */
+		n = 0;
+		while (nfree > 0 && (writes < record_count || reads < record_count)) {
+			struct iocb *cb = free_cbs[--nfree];
+			int is_write = (writes < record_count) &&
+				(writes <= reads || reads == record_count);
+
+			memset(cb, 0, sizeof(*cb));
+			cb->aio_lio_opcode = is_write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+			cb->aio_fildes = is_write ? wfd : rfd;
+			cb->aio_buf = (uint64_t)(uintptr_t)(is_write ?
+				out : in + (reads % depth) * record_len);
+			cb->aio_nbytes = record_len;
+			cb->aio_data = is_write;
+			if (is_write) writes++; else reads++;
+			batch[n++] = cb;
+		}
+		if (n > 0) {
+			int ret = io_submit(ctx, n, batch);
+			if (ret != n) {
+				fprintf(stderr, "io_submit(%d) returned %d: %s\n",
+					n, ret, strerror(errno));
+				result = -1;
+				goto exit;
+			}
+		}
+
+		n = io_getevents(ctx, 1, 2 * depth, events, NULL);
+		if (n < 0) {
+			fprintf(stderr, "io_getevents failed: %s\n", strerror(errno));
+			result = -1;
+			goto exit;
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].res != record_len) {
+				fprintf(stderr, "%s completed with %lld\n",
+					events[i].data ? "write" : "read",
+					(long long)events[i].res);
+				result = -1;
+				goto exit;
+			}
+			free_cbs[nfree++] = (struct iocb *)(uintptr_t)events[i].obj;
+		}
+		done += n;
+	}
+	report("aio", now() - start);
+
+exit:
+	io_destroy(ctx);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	char dev_path[MAX_DEVPATH_LENGTH];
+	struct osrfx2_dev *io;
+	unsigned char *out, *in;
+	int wfd, rfd;
+	int ch;
+	int result = 0;
+
+	while ((ch = getopt(argc, argv, "d:s:c:q:ah")) != -1) {
+		switch (ch) {
+		case 'd':
+			dev_name = optarg;
+			break;
+		case 's':
+			record_len = atoi(optarg);
+			break;
+		case 'c':
+			record_count = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'a':
+			flag_skip_blocking = 1;
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+	if (record_len <= 0 || record_len > MAX_RECORD || record_count == 0 ||
+	    depth <= 0 || depth > MAX_DEPTH) {
+		print_usage();
+		return 1;
+	}
+
+	snprintf(dev_path, sizeof(dev_path), "/dev/%s",
+		dev_name ? dev_name : "osrfx2_0");
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_READ | OSRFX2_WRITE, &io)) {
+		fprintf(stderr, "open for read and write: %s failed\n", dev_path);
+		return 1;
+	}
+	wfd = osrfx2_fd(io, OSRFX2_WRITE);
+	rfd = osrfx2_fd(io, OSRFX2_READ);
+
+	out = malloc(record_len);
+	in = malloc(record_len * depth);
+	if (!out || !in) {
+		result = 1;
+		goto exit;
+	}
+	memset(out, 0xA5, record_len);
+
+	printf("device %s, queue depth %d\n", dev_path, depth);
+
+	if (!flag_skip_blocking && run_blocking(wfd, rfd, out, in) != 0)
+		result = 1;
+	if (result == 0 && run_aio(wfd, rfd, out, in) != 0)
+		result = 1;
+
+exit:
+	free(out);
+	free(in);
+	osrfx2_close(io);
+	return result;
+}
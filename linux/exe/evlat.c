@@ -0,0 +1,331 @@
+/**
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * evlat - latency of the osrfx2 switch/key events on their way from the
+ * device to user space.
+ *
+ * Every event the driver queues (see osrfx2_ioctl.h) has three times:
+ * the USB frame in which the firmware saw the change (key event reports
+ * of osrfx2fw or osrfx2emu only, 1 ms), the driver's CLOCK_MONOTONIC at
+ * the completion of the EP1 URB, and the time poll() returned POLLPRI
+ * here. evlat takes the queued events with OSRFX2_IOCTL_GET_EVENTS after
+ * every wakeup and reports histograms of:
+ *
+ *   wakeup   URB completion to the poll() wakeup, per event
+ *   fetch    poll() wakeup to the return of the ioctl, per batch
+ *   device   device frame to URB completion, less the smallest such
+ *            offset seen: the clocks are not synchronised, so this is the
+ *            delivery delay beyond the best case, in whole milliseconds
+ *   driver   with -p, how far the spacing of the URB completions is from
+ *            the period the events were sent with
+ *   user     with -p, per wakeup, how far the spacing of the wakeups is
+ *            from the period times the number of events each one took
+ *
+ * A steady source is osrfx2emu -e; -l adds busy threads to see how CPU
+ * load moves the wakeups. evlat opens the device for reading, so the bulk
+ * read pipe is taken while it runs.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h> //getopt
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "libosrfx2.h"
+#include "osrfx2_ioctl.h"
+
+#define MAX_DEVPATH_LENGTH 256
+#define MAX_BATCH 64			// events per OSRFX2_IOCTL_GET_EVENTS
+#define HIST_BUCKETS 32			// [0] below 1 us, [i] 2^(i-1) to 2^i us
+#define HIST_BAR 40			// columns of the fullest bucket
+#define FRAME_MASK 0x7FF		// the USB frame number is 11 bits
+
+struct hist {
+	const char	*name;
+	unsigned long	count[HIST_BUCKETS];
+	unsigned long	n;
+	double		sum, min, max;	// us
+};
+
+/*---------------------------------------------------------------------------*/
+/* Global data                                                               */
+/*---------------------------------------------------------------------------*/
+char		*dev_name			= NULL;
+int		events				= 1000;		// events to measure
+int		period_us			= 0;		// -p send period, 0 if unknown
+int		load_threads			= 0;		// -l busy threads
+int		timeout_ms			= 5000;		// give up without events
+
+struct hist	h_wakeup = { .name = "wakeup" };
+struct hist	h_fetch = { .name = "fetch" };
+struct hist	h_device = { .name = "device" };
+struct hist	h_driver = { .name = "driver" };
+struct hist	h_user = { .name = "user" };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hist_add(struct hist *h, double us)
+{
+	int i = 0;
+
+	if (us < 0)
+		us = 0;
+	while (i < HIST_BUCKETS - 1 && us >= (double)(1UL << i))
+		i++;
+	h->count[i]++;
+
+	if (h->n == 0 || us < h->min)
+		h->min = us;
+	if (h->n == 0 || us > h->max)
+		h->max = us;
+	h->sum += us;
+	h->n++;
+}
+
+static void hist_print(const struct hist *h)
+{
+	unsigned long most = 0;
+	int first = -1, last = 0;
+	int i;
+
+	if (h->n == 0)
+		return;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (h->count[i] == 0)
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+		if (h->count[i] > most)
+			most = h->count[i];
+	}
+
+	printf("%s: %lu samples, min %.1f  avg %.1f  max %.1f us\n",
+		h->name, h->n, h->min, h->sum / h->n, h->max);
+	for (i = first; i <= last; i++) {
+		printf("  %9lu - %9lu us %8lu %5.1f%% ",
+			i ? 1UL << (i - 1) : 0UL, 1UL << i, h->count[i],
+			100.0 * h->count[i] / h->n);
+		printf("%.*s\n", (int)((h->count[i] * HIST_BAR + most - 1) / most),
+			"########################################");
+	}
+}
+
+/*
+ -l: keep a CPU busy
+*/
+static void *load_thread(void *arg)
+{
+	volatile unsigned long spin = 0;
+
+	for (;;)
+		spin++;
+	return NULL;
+}
+
+void print_usage()
+{
+	printf("Usage for evlat:\n");
+	printf("-d [name] device name (default osrfx2_0)\n");
+	printf("-c [n] where n is the number of events to measure (default 1000)\n");
+	printf("-p [n] where n is the usecs between events the device sends,\n");
+	printf("       for the driver and user jitter (default unknown)\n");
+	printf("-l [n] where n is the number of busy threads to run (default 0)\n");
+	printf("-t [n] where n is the msecs to wait for an event (default 5000)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char dev_path[MAX_DEVPATH_LENGTH];
+	struct osrfx2_event ev[MAX_BATCH];
+	struct osrfx2_event_batch batch;
+	struct osrfx2_dev *dev;
+	struct pollfd pfd;
+	pthread_t thread;
+	double *offset = NULL;		// URB completion - device frame, ms
+	double min_offset = 0;
+	uint64_t wake, fetched;
+	uint64_t last_ts = 0, last_wake = 0;
+	int64_t frame_ms = 0;		// device frames, unwrapped
+	double ts_ms, last_ts_ms = 0;
+	unsigned int last_frame = 0, d;
+	unsigned long lost = 0;
+	uint32_t next_seq = 0;
+	int got = 0, first = 0, noffset = 0;
+	int ch, fd, i, n;
+	int result = 0;
+
+	while ((ch = getopt(argc, argv, "d:c:p:l:t:h")) != -1) {
+		switch (ch) {
+		case 'd':
+			dev_name = optarg;
+			break;
+		case 'c':
+			events = atoi(optarg);
+			break;
+		case 'p':
+			period_us = atoi(optarg);
+			break;
+		case 'l':
+			load_threads = atoi(optarg);
+			break;
+		case 't':
+			timeout_ms = atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+	if (events <= 0 || period_us < 0 || load_threads < 0 ||
+	    timeout_ms <= 0) {
+		print_usage();
+		return 1;
+	}
+
+	snprintf(dev_path, sizeof(dev_path), "/dev/%s",
+		dev_name ? dev_name : "osrfx2_0");
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_READ | OSRFX2_NONBLOCK, &dev)) {
+		fprintf(stderr, "open for read: %s failed\n", dev_path);
+		return 1;
+	}
+	fd = osrfx2_fd(dev, OSRFX2_READ);
+
+	offset = calloc(events, sizeof(*offset));
+	if (!offset) {
+		result = 1;
+		goto exit;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.events = (uintptr_t)ev;
+	batch.max_events = MAX_BATCH;
+
+	/* what was queued before we started is not measured */
+	while (ioctl(fd, OSRFX2_IOCTL_GET_EVENTS, &batch) == 0 &&
+	       batch.count == MAX_BATCH)
+		;
+
+	for (i = 0; i < load_threads; i++) {
+		if (pthread_create(&thread, NULL, load_thread, NULL) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+		pthread_detach(thread);
+	}
+
+	printf("device %s, %d events, %d busy threads", dev_path, events,
+		load_threads);
+	if (period_us)
+		printf(", sent every %d us", period_us);
+	printf("\n");
+
+	pfd.fd = fd;
+	pfd.events = POLLPRI;
+
+	while (got < events) {
+		n = poll(&pfd, 1, timeout_ms);
+		wake = now_ns();
+		if (n == 0) {
+			fprintf(stderr, "no event in %d ms, stopping\n",
+				timeout_ms);
+			break;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			result = 1;
+			break;
+		}
+
+		if (ioctl(fd, OSRFX2_IOCTL_GET_EVENTS, &batch) < 0) {
+			if (errno == EAGAIN)
+				continue;	// POLLPRI of a device notify
+			fprintf(stderr, "OSRFX2_IOCTL_GET_EVENTS: %s\n",
+				strerror(errno));
+			result = 1;
+			break;
+		}
+		fetched = now_ns();
+		if (batch.count == 0)
+			continue;
+		hist_add(&h_fetch, (fetched - wake) / 1e3);
+
+		first = got;
+		for (i = 0; i < (int)batch.count && got < events; i++, got++) {
+			hist_add(&h_wakeup, (wake - ev[i].timestamp_ns) / 1e3);
+
+			if (got && ev[i].seq != next_seq)
+				lost += ev[i].seq - next_seq;
+			next_seq = ev[i].seq + 1;
+
+			if (got && period_us)
+				hist_add(&h_driver, fabs((ev[i].timestamp_ns -
+					last_ts) / 1e3 - period_us));
+			last_ts = ev[i].timestamp_ns;
+
+			if (ev[i].flags & OSRFX2_EVENT_FRAME) {
+				/*
+				 The frame number wraps every 2048 ms; the
+				 driver's clock says how many wraps passed.
+				*/
+				ts_ms = ev[i].timestamp_ns / 1000000;
+				if (noffset) {
+					d = (ev[i].frame - last_frame) & FRAME_MASK;
+					frame_ms += d + (FRAME_MASK + 1) *
+						llround((ts_ms - last_ts_ms - d) /
+							(FRAME_MASK + 1));
+				}
+				last_frame = ev[i].frame;
+				last_ts_ms = ts_ms;
+				offset[noffset] = ts_ms - frame_ms;
+				if (noffset == 0 || offset[noffset] < min_offset)
+					min_offset = offset[noffset];
+				noffset++;
+			}
+		}
+
+		/* one wakeup brings the whole batch: one sample per wakeup */
+		if (first && period_us)
+			hist_add(&h_user, fabs((wake - last_wake) / 1e3 -
+				(double)(got - first) * period_us));
+		last_wake = wake;
+	}
+
+	for (i = 0; i < noffset; i++)
+		hist_add(&h_device, (offset[i] - min_offset) * 1e3);
+
+	printf("%d events, %lu lost on the way (gaps in seq)\n", got, lost);
+	hist_print(&h_wakeup);
+	hist_print(&h_fetch);
+	if (noffset)
+		hist_print(&h_device);
+	else if (got)
+		printf("device: no frame numbers, key events are off\n");
+	hist_print(&h_driver);
+	hist_print(&h_user);
+
+exit:
+	free(offset);
+	osrfx2_close(dev);
+	return result;
+}
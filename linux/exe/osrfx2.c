@@ -10,12 +10,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <endian.h>
 #include <fcntl.h>
-#include <unistd.h> //getopt
+#include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
-#include "public.h"
+#include "libosrfx2.h"
 
 /* It's better to define a max length for myself instead of system defined.
    Refer to http://stackoverflow.com/questions/833291/is-there-an-equivalent-to-winapis-max-path-under-linux-unix
@@ -56,13 +65,25 @@ BOOL		flag_read			= FALSE;
 BOOL		flag_write			= FALSE;
 BOOL		flag_play_with_device		= FALSE;
 BOOL		flag_perform_blocking_io	= TRUE;
+BOOL		flag_sink			= FALSE;	// --sink benchmark
+BOOL		flag_source			= FALSE;	// --source benchmark
+BOOL		flag_bench			= FALSE;	// --bench loopback benchmark
+BOOL		flag_pipeline			= FALSE;	// --pipeline threaded read/write test
+BOOL		flag_count_set			= FALSE;	// -c was given
 unsigned long	iteration_count			= 1;		//count of iterations of the test we are to perform
+double		bench_secs			= 0;		// --time, 0 if not limited
+unsigned long long bench_bytes			= 0;		// --bytes, 0 if not limited
+int		bench_depth			= 1;		// --depth, transfers in flight
+int		bench_format			= 0;		// --format, BENCH_TEXT/JSON/CSV
+int		pattern_kind			= 0;		// --pattern, PATTERN_COUNTER/LFSR
+unsigned long long pattern_seed			= 0;		// --seed
 int		write_len			= 512;		// #bytes to write
 int		read_len			= 512;		// #bytes to read
 
 char		*dev_name			= NULL;
 char		*dev_path			= NULL;
 char		*sys_path			= NULL;
+struct osrfx2_dev *ctl				= NULL;		// control handle, no bulk pipes
 
 typedef enum _INPUT_FUNCTION {
 	LIGHT_ONE_BAR = 1,
@@ -84,23 +105,17 @@ typedef enum _INPUT_FUNCTION {
 */
 static int get_device_path(void)
 {
-	char	*devname;
-	char	devpath [MAX_DEVPATH_LENGTH];
-	char	syspath [MAX_DEVPATH_LENGTH];
+	const struct osrfx2_info *info;
 
-	devname = (dev_name) ? dev_name : "osrfx2_0";
-
-	// get device path
-	snprintf ( devpath, sizeof(devpath), "/dev/%s", devname );
-	if( access( devpath, F_OK ) == -1 ) {
-    	fprintf ( stderr, "Can't find %s device\n", devpath );
-    	return -1;
+	if (0 != osrfx2_open(dev_name, 0, &ctl)) {
+		fprintf ( stderr, "Can't find /dev/%s device\n",
+			dev_name ? dev_name : "osrfx2_0" );
+		return -1;
 	}
-	dev_path = strdup(devpath);
 
-	// get sys path
-	snprintf(syspath, sizeof(syspath), "/sys/class/usb/%s/device", devname);
-	sys_path = strdup(syspath);
+	info = osrfx2_get_info(ctl);
+	dev_path = strdup(info->dev_path);
+	sys_path = strdup(info->sys_path);
 
 	return 0;
 }
@@ -124,6 +139,16 @@ void print_usage()
     printf("-p to control bar LEDs, seven segment, and dip switch\n");
     printf("-n to perform select I/O (default is blocking I/O)\n");
     printf("-u to dump USB configuration and pipe info \n");
+    printf("--sink to time -c writes of -w bytes with the device discarding them\n");
+    printf("--source to time -c reads of -r bytes of a pattern the device sends\n");
+    printf("--bench to measure loopback transfers of -w (or -r) bytes, stopping\n");
+    printf("        after -c transfers, --bytes [n] or --time [secs] (default 10 s)\n");
+    printf("--depth [n] transfers --bench keeps in flight (default 1)\n");
+    printf("--format [text|json|csv] how --bench reports (default text)\n");
+    printf("--pattern [counter|lfsr] data the read/write test streams (default counter)\n");
+    printf("--seed [n] where n starts the pattern (default 0)\n");
+    printf("--pipeline to loop -c writes of -w bytes back through writer, reader\n");
+    printf("        (-r byte buffers) and verifier threads\n");
 
     return;
 }
@@ -137,6 +162,44 @@ Return Value:
 	1, parse OK, 0, parse failed
     When parse OK, sets global flags as per user function request
 --*/
+enum {
+	OPT_SINK = 0x100,
+	OPT_SOURCE,
+	OPT_BENCH,
+	OPT_TIME,
+	OPT_BYTES,
+	OPT_DEPTH,
+	OPT_FORMAT,
+	OPT_PATTERN,
+	OPT_SEED,
+	OPT_PIPELINE,
+};
+
+enum {
+	BENCH_TEXT,
+	BENCH_JSON,
+	BENCH_CSV,
+};
+
+enum {
+	PATTERN_COUNTER,
+	PATTERN_LFSR,
+};
+
+static const struct option long_options[] = {
+	{ "sink",	no_argument,		NULL,	OPT_SINK },
+	{ "source",	no_argument,		NULL,	OPT_SOURCE },
+	{ "bench",	no_argument,		NULL,	OPT_BENCH },
+	{ "time",	required_argument,	NULL,	OPT_TIME },
+	{ "bytes",	required_argument,	NULL,	OPT_BYTES },
+	{ "depth",	required_argument,	NULL,	OPT_DEPTH },
+	{ "format",	required_argument,	NULL,	OPT_FORMAT },
+	{ "pattern",	required_argument,	NULL,	OPT_PATTERN },
+	{ "seed",	required_argument,	NULL,	OPT_SEED },
+	{ "pipeline",	no_argument,		NULL,	OPT_PIPELINE },
+	{ NULL,		0,			NULL,	0 },
+};
+
 int parse_arg( int argc, char** argv )
 {
 	int ch;
@@ -150,7 +213,8 @@ int parse_arg( int argc, char** argv )
 
 	/* Regarding getopt, refer to http://blog.csdn.net/lazy_tiger/article/details/1806367 */
 	while ((1 == retval) && 
-		((ch = getopt(argc, argv, "r:R:w:W:c:C:uUpPnNvV")) != -1)) {
+		((ch = getopt_long(argc, argv, "r:R:w:W:c:C:uUpPnNvV",
+				   long_options, NULL)) != -1)) {
 #if 0
     	printf("optind:%d\n",optind);
     	printf("optarg:%s\n",optarg);
@@ -186,6 +250,7 @@ int parse_arg( int argc, char** argv )
             
 		case 'c':
 		case 'C':
+			flag_count_set = TRUE;
 			iteration_count = atoi(optarg);
 			if (0 == iteration_count) {
 				if(0 != strcmp("0", optarg)) {
@@ -214,12 +279,105 @@ int parse_arg( int argc, char** argv )
 		case 'V':
 			flag_dump_read_data = TRUE;
 			break;
+
+		case OPT_SINK:
+			flag_sink = TRUE;
+			break;
+
+		case OPT_SOURCE:
+			flag_source = TRUE;
+			break;
+
+		case OPT_BENCH:
+			flag_bench = TRUE;
+			break;
+
+		case OPT_TIME:
+			bench_secs = strtod(optarg, NULL);
+			if (bench_secs <= 0) {
+				fprintf(stderr, "--time needs a number of seconds\n");
+				retval = 0;
+			}
+			break;
+
+		case OPT_BYTES:
+			bench_bytes = strtoull(optarg, NULL, 0);
+			if (0 == bench_bytes) {
+				fprintf(stderr, "--bytes needs a byte count\n");
+				retval = 0;
+			}
+			break;
+
+		case OPT_DEPTH:
+			bench_depth = atoi(optarg);
+			if (bench_depth <= 0) {
+				fprintf(stderr, "--depth needs at least 1\n");
+				retval = 0;
+			}
+			break;
+
+		case OPT_FORMAT:
+			if (0 == strcmp(optarg, "text")) {
+				bench_format = BENCH_TEXT;
+			} else if (0 == strcmp(optarg, "json")) {
+				bench_format = BENCH_JSON;
+			} else if (0 == strcmp(optarg, "csv")) {
+				bench_format = BENCH_CSV;
+			} else {
+				fprintf(stderr, "--format is text, json or csv\n");
+				retval = 0;
+			}
+			break;
+
+		case OPT_PATTERN:
+			if (0 == strcmp(optarg, "counter")) {
+				pattern_kind = PATTERN_COUNTER;
+			} else if (0 == strcmp(optarg, "lfsr")) {
+				pattern_kind = PATTERN_LFSR;
+			} else {
+				fprintf(stderr, "--pattern is counter or lfsr\n");
+				retval = 0;
+			}
+			break;
+
+		case OPT_SEED:
+			pattern_seed = strtoull(optarg, NULL, 0);
+			break;
+
+		case OPT_PIPELINE:
+			flag_pipeline = TRUE;
+			break;
             
 		default:
 			retval = 0;
 		}
 	}
 
+	if (flag_sink && flag_source) {
+		fprintf(stderr, "--sink and --source measure one direction each\n");
+		retval = 0;
+	}
+
+	if (flag_bench && (flag_sink || flag_source)) {
+		fprintf(stderr, "--bench measures the loopback, not --sink or --source\n");
+		retval = 0;
+	}
+
+	if (flag_bench && flag_read && flag_write && read_len != write_len) {
+		fprintf(stderr, "--bench moves transfers of one size, -r and -w differ\n");
+		retval = 0;
+	}
+
+	if (flag_pipeline && (flag_bench || flag_sink || flag_source)) {
+		fprintf(stderr, "--pipeline runs on its own\n");
+		retval = 0;
+	}
+
+	if (flag_pipeline && (!flag_write || write_len <= 0 || read_len <= 0)) {
+		fprintf(stderr, "--pipeline needs -w, and -r if given, above 0\n");
+		retval = 0;
+	}
+
 	if(0 == retval) {
 		print_usage();
 	}
@@ -330,61 +488,6 @@ exit:
 	if (-1 != fd) 	close(fd);
 }
 
-/*---------------------------------------------------------------------------*/
-/*                                                                           */
-/*---------------------------------------------------------------------------*/
-static char *get_bargraph_display(void)
-{
-	int    fd;
-	int    count;
-	char   attrname [MAX_DEVPATH_LENGTH];
-	char   attrvalue [32];
-
-	snprintf(attrname, sizeof(attrname), "%s/bargraph", sys_path);
-
-	fd = open(attrname, O_RDONLY);
-	if (fd == -1)
-	        return NULL;
-
-	memset(attrvalue, 0x00, 32);
-	count = read(fd, &attrvalue, sizeof(attrvalue));
-	
-	close(fd);
-
-	if (count == 8) { 
-		return strdup(attrvalue);
-	}
-	
-	return NULL;
-}
-
-/*---------------------------------------------------------------------------*/
-/*                                                                           */
-/*---------------------------------------------------------------------------*/
-static int set_bargraph_display(unsigned char value)
-{
-	int    fd;
-	int    count;
-	int    len;
-	char   attrname [MAX_DEVPATH_LENGTH];
-	char   attrvalue [32];
-
-	snprintf(attrname, sizeof(attrname), "%s/bargraph", sys_path);
-	snprintf(attrvalue, sizeof(attrvalue), "%d", value);
-	len = strlen(attrvalue) + 1;
-
-	fd = open(attrname, O_WRONLY);
-	if (fd == -1) 
-		return -1;
-
-	count = write(fd, &attrvalue, len);
-	close(fd);
-	if (count != len) 
-		return -1;
-
-	return 0;
-}
-
 #if 0
 /*---------------------------------------------------------------------------*/
 /*                                                                           */
@@ -503,7 +606,7 @@ void play_with_device()
 {
 	int function;
 	int bar;
-	unsigned char barValue;
+	unsigned char bars;
 
 	/*
 	 * Infinitely print out the list of choices, ask for input, process
@@ -547,11 +650,8 @@ void play_with_device()
 
 			bar--; // normalize to 0 to 3
 
-			barValue = 1 << (unsigned char)bar;
-			barValue |= BARGRAPH_ON;
-
-			if ( 0 != set_bargraph_display(barValue)) {
-				printf("set_bargraph_display failed with error \n");
+			if (0 != osrfx2_light_bars(ctl, 1 << bar)) {
+				printf("osrfx2_light_bars failed with error \n");
 				goto error;	
 			}
 
@@ -570,47 +670,33 @@ void play_with_device()
 			}
 
 			bar--;
-			barValue = BARGRAPH_OFF; // reset and flag off
-			barValue |= 1 << (unsigned char) bar;
-
-			if (0 != set_bargraph_display(barValue)) {
-				printf("set_bargraph_display failed with error \n");
+			if (0 != osrfx2_clear_bars(ctl, 1 << bar)) {
+				printf("osrfx2_clear_bars failed with error \n");
 				goto error;
 			}
 	            
 			break;
 
 		case LIGHT_ALL_BARS:
-			if (0 != set_bargraph_display(0x8F)) {
-				printf("set_bargraph_display failed with error\n");
+			if (0 != osrfx2_light_bars(ctl, 0x0F)) {
+				printf("osrfx2_light_bars failed with error\n");
 				goto error;
 			}
 			break;
 
 		case CLEAR_ALL_BARS:
-			if (0 != set_bargraph_display(0x0F)) {
-				printf("set_bargraph_display failed with error \n");
+			if (0 != osrfx2_clear_bars(ctl, 0x0F)) {
+				printf("osrfx2_clear_bars failed with error \n");
 				goto error;
 			}
 			break;
 
 		case GET_BAR_GRAPH_LIGHT_STATE:
-			{
-				char *str = get_bargraph_display();
-
-				if (str) {
-					printf("Bar Graph: \n");
-					printf("    Bar8 is %s\n", str[7] == '*' ? "ON" : "OFF");
-					printf("    Bar7 is %s\n", str[6] == '*' ? "ON" : "OFF");
-					printf("    Bar6 is %s\n", str[5] == '*' ? "ON" : "OFF");
-					printf("    Bar5 is %s\n", str[4] == '*' ? "ON" : "OFF");
-					printf("    Bar4 is %s\n", str[3] == '*' ? "ON" : "OFF");
-					printf("    Bar3 is %s\n", str[2] == '*' ? "ON" : "OFF");
-					printf("    Bar2 is %s\n", str[1] == '*' ? "ON" : "OFF");
-					printf("    Bar1 is %s\n", str[0] == '*' ? "ON" : "OFF");
-
-					free(str);
-				}
+			if (0 == osrfx2_get_bars(ctl, &bars)) {
+				printf("Bar Graph: \n");
+				for (bar = 8; bar > 0; bar--)
+					printf("    Bar%d is %s\n", bar,
+						bars & (1 << (bar - 1)) ? "ON" : "OFF");
 			}
 			break;
 	            
@@ -702,6 +788,157 @@ Return Value:
 	printf("\n****** END DUMP LEN decimal %d, 0x%x\n", len,len);
 }
 
+/*---------------------------------------------------------------------------*/
+/* Stream pattern                                                            */
+/*                                                                           */
+/* The data written is one endless stream of 64 bit little endian words      */
+/* started from --seed: a counter (seed, seed + 1, ...) or an xorshift64     */
+/* LFSR sequence. Each write takes the next bytes of the stream and each     */
+/* read is checked against the bytes at its own stream position, so one      */
+/* buffer per direction does for any number of iterations, and -r and -w     */
+/* need not match.                                                           */
+/*---------------------------------------------------------------------------*/
+#define PATTERN_BLOCK	64	// words generated and compared at a time
+
+struct pattern {
+	int			kind;		// PATTERN_*
+	uint64_t		state;		// generator state
+	uint64_t		word;		// word being handed out bytewise
+	unsigned		used;		// bytes of word handed out, 8 if none
+	unsigned long long	pos;		// stream offset of the next byte
+};
+
+static void pattern_init(struct pattern *p, int kind, uint64_t seed)
+{
+	p->kind  = kind;
+	p->state = seed;
+	if (kind == PATTERN_LFSR && seed == 0)
+		p->state = 0x9E3779B97F4A7C15ULL;	// the LFSR sticks at 0
+	p->word  = 0;
+	p->used  = 8;
+	p->pos   = 0;
+}
+
+static inline uint64_t pattern_next(struct pattern *p)
+{
+	uint64_t x = p->state;
+
+	if (p->kind == PATTERN_COUNTER) {
+		p->state++;
+		return x;
+	}
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	p->state = x;
+	return x;
+}
+
+/*
+ Fill buf with the next len bytes of the stream
+*/
+static void pattern_fill(struct pattern *p, unsigned char *buf, size_t len)
+{
+	uint64_t w;
+	size_t i = 0;
+
+	/* the rest of a word the last buffer ended in */
+	while (p->used < 8 && i < len)
+		buf[i++] = p->word >> (8 * p->used++);
+
+	for (; len - i >= 8; i += 8) {
+		w = htole64(pattern_next(p));
+		memcpy(buf + i, &w, 8);
+	}
+
+	if (i < len) {
+		p->word = pattern_next(p);
+		p->used = 0;
+		while (i < len)
+			buf[i++] = p->word >> (8 * p->used++);
+	}
+	p->pos += len;
+}
+
+/*
+ Check buf against the next len bytes of the stream. Returns the number of
+ bytes which differ and sets *first to the stream offset of the first.
+ Whole words are compared a block at a time, the bytes are only looked at
+ in a block which differs.
+*/
+static unsigned long pattern_check(struct pattern *p, const unsigned char *buf,
+				   size_t len, unsigned long long *first)
+{
+	uint64_t expect [PATTERN_BLOCK];
+	uint64_t actual [PATTERN_BLOCK];
+	uint64_t diff;
+	const unsigned char *e;
+	unsigned long bad = 0;
+	unsigned char c;
+	size_t i = 0, j, n;
+
+	while (p->used < 8 && i < len) {
+		c = p->word >> (8 * p->used++);
+		if (buf[i] != c && bad++ == 0)
+			*first = p->pos + i;
+		i++;
+	}
+
+	while (len - i >= 8) {
+		n = (len - i) / 8;
+		if (n > PATTERN_BLOCK)
+			n = PATTERN_BLOCK;
+
+		for (j = 0; j < n; j++)
+			expect[j] = htole64(pattern_next(p));
+		memcpy(actual, buf + i, n * 8);
+
+		diff = 0;
+		for (j = 0; j < n; j++)
+			diff |= actual[j] ^ expect[j];
+
+		if (diff) {
+			e = (const unsigned char *)expect;
+			for (j = 0; j < n * 8; j++) {
+				if (buf[i + j] != e[j] && bad++ == 0)
+					*first = p->pos + i + j;
+			}
+		}
+		i += n * 8;
+	}
+
+	if (i < len) {
+		p->word = pattern_next(p);
+		p->used = 0;
+		while (i < len) {
+			c = p->word >> (8 * p->used++);
+			if (buf[i] != c && bad++ == 0)
+				*first = p->pos + i;
+			i++;
+		}
+	}
+	p->pos += len;
+
+	return bad;
+}
+
+/*
+ Check a read buffer, printing the outcome like the plain memcmp did
+*/
+static void check_read(struct pattern *p, const unsigned char *buf, size_t len)
+{
+	unsigned long long first = 0;
+	unsigned long bad;
+
+	bad = pattern_check(p, buf, len, &first);
+	if (bad) {
+		fprintf(stderr, "Mismatch error between buffer contents: %lu bytes "
+			"differ, the first at stream offset %llu!\n", bad, first);
+	} else {
+		printf("\nMatched between Write and Read!\n");
+	}
+}
+
 int rw_init(
 	int		*p_rfd,
 	int		*p_wfd,
@@ -735,22 +972,9 @@ int rw_init(
 			}
 		}
 
-		p_buf_out = malloc((write_len * iteration_count));
-		if (NULL != p_buf_out) {
-			ULONG num_longs = write_len / sizeof(ULONG);
-			/* put some data in the output buffer */
-			int i,j;
-			unsigned char *p_buf = p_buf_out;
-			ULONG *p_long;
-			for(i=0; i< iteration_count; i++) {
-				p_long = (ULONG *)p_buf;
-				for (j=0; j<num_longs; j++) {
-					*(p_long+j) = i;
-				}
-				//dump(p_buf,  write_len);
-				p_buf += write_len;
-			}
-		} else {
+		/* one buffer, filled from the stream pattern before each write */
+		p_buf_out = malloc(write_len);
+		if (NULL == p_buf_out) {
 			result = -1;
 			goto exit;
 		}
@@ -831,6 +1055,7 @@ void rw_blocking()
 	unsigned char *p_buf_out = NULL;
 	ssize_t wlen;
 	ssize_t rlen;
+	struct pattern wpat, rpat;
 
 	int i;
 
@@ -839,13 +1064,17 @@ void rw_blocking()
 		return;
 	}
 
+	pattern_init(&wpat, pattern_kind, pattern_seed);
+	pattern_init(&rpat, pattern_kind, pattern_seed);
+
 	for (i = 0; i < iteration_count; i++) {
 
 		if (flag_write) {
 	            //
 	            // send the write
 	            //
-			wlen = write(wfd, (p_buf_out + (i*write_len)), write_len);
+			pattern_fill(&wpat, p_buf_out, write_len);
+			wlen = write(wfd, p_buf_out, write_len);
 			if (wlen < 0) {
 				fprintf(stderr, "write error\n");
 				goto exit;
@@ -864,23 +1093,18 @@ void rw_blocking()
 
 			if (flag_write) {
 
-				/* validate the input buffer against what
-				 * we sent
+				/* validate the input buffer against its
+				 * place in what we sent
 				 * Till we arrive here, we have asserted length of
-				 * read should be read_len and that of write should
-				 * be write_len
+				 * read should be read_len
 				 */
-				if (memcmp(p_buf_out, p_buf_in, write_len) != 0) {
-		                	fprintf(stderr, "Mismatch error between buffer contents!\n");
-				} else {
-					printf("\nMatched between Write and Read!\n");
-				}
+				check_read(&rpat, p_buf_in, read_len);
 
 				if (flag_dump_read_data) {
 					printf("\nDumping read buffer ...\n");
 					dump(p_buf_in,  read_len);
 					printf("\nDumping write buffer ...\n");
-					dump((p_buf_out + (i*write_len)), write_len);
+					dump(p_buf_out, write_len);
 				}
 			}
 		}
@@ -911,6 +1135,8 @@ void rw_noblocking()
 
 	int i_r, i_w;
 	int rw_ready = READ_READY | WRITE_READY;
+	struct pattern wpat, rpat;
+	BOOL out_filled = FALSE;	// p_buf_out holds a write still to go
 
 	fd_set rfds,wfds;
 	fd_set *p_rfds;
@@ -922,6 +1148,9 @@ void rw_noblocking()
 		return;
 	}
 
+	pattern_init(&wpat, pattern_kind, pattern_seed);
+	pattern_init(&rpat, pattern_kind, pattern_seed);
+
 	i_r = flag_read ? iteration_count : 0;
 	i_w = flag_write ? iteration_count : 0;
 
@@ -930,14 +1159,19 @@ void rw_noblocking()
 ready_for_write:
 		if (flag_write && i_w && (rw_ready&WRITE_READY)) {
 			int ii_w = iteration_count - i_w;
-			wlen = write(wfd, (p_buf_out + (ii_w*write_len)), write_len);
+			if (!out_filled) {	// not after -EAGAIN, it is still there
+				pattern_fill(&wpat, p_buf_out, write_len);
+				out_filled = TRUE;
+			}
+			wlen = write(wfd, p_buf_out, write_len);
 			if (wlen != -1) {
 				printf("write (%04d) : request %06d bytes -- %06d bytes written\n",
 					ii_w, write_len, wlen);
 				assert(wlen == write_len);
+				out_filled = FALSE;
 				if (flag_dump_read_data) {
 					printf("\nDumping write buffer ...\n");
-					dump((p_buf_out + (ii_w * write_len)), write_len);
+					dump(p_buf_out, write_len);
 				}
 				i_w--;
 				goto ready_for_write; // continue write till failed or EAGAIN
@@ -958,6 +1192,8 @@ ready_for_read:	// Till now, write needs select
 			rlen = do_read(rfd, p_buf_in, ii_r);
 			if (rlen != -1) {
 				assert(rlen == read_len);
+				if (flag_write)
+					check_read(&rpat, p_buf_in, read_len);
 				if (flag_dump_read_data) {
 					printf("\nDumping read buffer ...\n");
 					dump(p_buf_in,  read_len);
@@ -1035,6 +1271,802 @@ exit:
 	if (NULL != p_buf_out) free(p_buf_out);
 }
 
+/*---------------------------------------------------------------------------*/
+/* Stream benchmarks                                                         */
+/*                                                                           */
+/* In loopback every byte read must have been written first, so neither      */
+/* direction can go faster than the other. The firmware's sink and source    */
+/* stream modes take the other direction out: --sink only writes, the device */
+/* throws the data away; --source only reads what the device sends.          */
+/*---------------------------------------------------------------------------*/
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report_rate(const char *what, unsigned long long bytes,
+			double secs)
+{
+	printf("%s %llu bytes in %.3f s: %.2f MB/s\n", what, bytes, secs,
+		secs > 0 ? bytes / secs / 1e6 : 0.0);
+}
+
+void stream_sink(void)
+{
+	unsigned char *buf;
+	unsigned long i;
+	unsigned long long total = 0;
+	ssize_t wlen;
+	double start;
+	struct osrfx2_dev *io;
+	int wfd;
+
+	buf = malloc(write_len);
+	if (NULL == buf) {
+		return;
+	}
+	memset(buf, 0x5A, write_len);
+
+	if (0 != osrfx2_set_stream_mode(ctl, OSRFX2_MODE_SINK)) {
+		fprintf(stderr, "can't set %s/stream_mode\n", sys_path);
+		free(buf);
+		return;
+	}
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_WRITE, &io)) {
+		fprintf(stderr, "open for write: %s failed\n", dev_path);
+		goto exit;
+	}
+	wfd = osrfx2_fd(io, OSRFX2_WRITE);
+
+	start = now();
+	for (i = 0; i < iteration_count; i++) {
+		wlen = write(wfd, buf, write_len);
+		if (wlen < 0) {
+			fprintf(stderr, "write (%04lu) error (%d)\n", i, errno);
+			break;
+		}
+		total += wlen;
+	}
+	report_rate("sink: wrote", total, now() - start);
+
+	osrfx2_close(io);
+exit:
+	osrfx2_set_stream_mode(ctl, OSRFX2_MODE_LOOPBACK);
+	free(buf);
+}
+
+void stream_source(void)
+{
+	unsigned char *buf;
+	unsigned long i;
+	unsigned long long total = 0;
+	unsigned long long pos = 0;	// offset in the stream
+	unsigned long mismatches = 0;
+	unsigned int seq = 0, expect = 0;
+	unsigned int off;
+	int psize;
+	ssize_t rlen, j;
+	double start;
+	struct osrfx2_dev *io;
+	int rfd;
+
+	buf = malloc(read_len);
+	if (NULL == buf) {
+		return;
+	}
+
+	psize = osrfx2_get_info(ctl)->packet_size;
+	if (!psize)
+		printf("unknown device speed, not checking the pattern\n");
+
+	if (0 != osrfx2_set_stream_mode(ctl, OSRFX2_MODE_SOURCE)) {
+		fprintf(stderr, "can't set %s/stream_mode\n", sys_path);
+		free(buf);
+		return;
+	}
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_READ, &io)) {
+		fprintf(stderr, "open for read: %s failed\n", dev_path);
+		goto exit;
+	}
+	rfd = osrfx2_fd(io, OSRFX2_READ);
+
+	start = now();
+	for (i = 0; i < iteration_count; i++) {
+		rlen = read(rfd, buf, read_len);
+		if (rlen < 0) {
+			fprintf(stderr, "read (%04lu) error (%d)\n", i, errno);
+			break;
+		}
+		total += rlen;
+
+		/* packet number (little endian), then byte n = n & 0xFF */
+		for (j = 0; psize && j < rlen; j++, pos++) {
+			off = pos % psize;
+			if (off < 4) {
+				seq |= (unsigned int)buf[j] << (8 * off);
+				if (off == 3) {
+					if (seq != expect)
+						mismatches++;
+					expect = seq + 1;
+					seq = 0;
+				}
+			} else if (buf[j] != (unsigned char)off) {
+				mismatches++;
+			}
+		}
+	}
+	report_rate("source: read", total, now() - start);
+	if (psize)
+		printf("pattern: %lu mismatches in %llu packets\n",
+			mismatches, pos / psize);
+
+	osrfx2_close(io);
+exit:
+	osrfx2_set_stream_mode(ctl, OSRFX2_MODE_LOOPBACK);
+	free(buf);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Loopback benchmark                                                        */
+/*                                                                           */
+/* --bench keeps up to --depth transfers of one size in flight. Each one is  */
+/* written, looped back by the device and read back whole; its latency runs  */
+/* from the start of its write to the end of its read. Both descriptors are  */
+/* non-blocking and the loop sleeps in poll() only when neither can move, so */
+/* a deep queue can not deadlock against the device buffers. Nothing is      */
+/* printed until the run is over, and the data read back is never compared;  */
+/* --pipeline is the mode that verifies what comes back.                     */
+/*---------------------------------------------------------------------------*/
+#define BENCH_DEFAULT_SECS	10
+#define BENCH_STALL_MS		5000	// give up if nothing moves this long
+
+struct bench_result {
+	size_t		size;		// bytes per transfer
+	int		depth;
+	unsigned long	transfers;
+	double		secs;
+	double		*lat;		// latency per transfer, seconds
+	unsigned long	nlat;
+	unsigned long	maxlat;		// room in lat
+};
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ Nearest rank percentile of the sorted v, permille of 1000
+*/
+static double percentile(const double *v, unsigned long n, unsigned permille)
+{
+	unsigned long rank;
+
+	if (n == 0)
+		return 0;
+	rank = (n * permille + 999) / 1000;
+	return v[rank ? rank - 1 : 0];
+}
+
+/*
+ Retrun 0, OK, else failed
+*/
+static int bench_add_latency(struct bench_result *res, double lat)
+{
+	double *p;
+
+	if (res->nlat == res->maxlat) {
+		res->maxlat = res->maxlat ? 2 * res->maxlat : 4096;
+		p = realloc(res->lat, res->maxlat * sizeof(*p));
+		if (NULL == p)
+			return -1;
+		res->lat = p;
+	}
+	res->lat[res->nlat++] = lat;
+	return 0;
+}
+
+/*
+ Run the transfers. Retrun 0, OK, else failed
+*/
+static int bench_run(int rfd, int wfd, unsigned char *out, unsigned char *in,
+		     struct bench_result *res)
+{
+	size_t size = res->size;
+	unsigned long long window = (unsigned long long)size * res->depth;
+	unsigned long long limit = 0;	// bytes to write, 0 if not limited
+	unsigned long long wbytes = 0, rbytes = 0;
+	double *stamp;			// write start of the transfers in flight
+	double start, deadline = 0;
+	BOOL stop = FALSE, started = FALSE, moved;
+	struct pollfd pfd[2];
+	size_t off;
+	ssize_t len;
+	int n, result = 0;
+
+	stamp = calloc(res->depth, sizeof(*stamp));
+	if (NULL == stamp)
+		return -1;
+
+	if (flag_count_set)
+		limit = (unsigned long long)size * iteration_count;
+	if (bench_bytes && (!limit || bench_bytes < limit))
+		limit = (bench_bytes + size - 1) / size * size;
+
+	start = now();
+	if (bench_secs > 0)
+		deadline = start + bench_secs;
+	else if (!limit)
+		deadline = start + BENCH_DEFAULT_SECS;
+
+	for (;;) {
+		moved = FALSE;
+
+		/* start no more transfers once the limit is reached */
+		if (!stop && wbytes % size == 0 &&
+		    ((limit && wbytes >= limit) ||
+		     (deadline && now() >= deadline)))
+			stop = TRUE;
+		if (stop && rbytes == wbytes)
+			break;
+
+		if ((!stop || wbytes % size) && wbytes - rbytes < window) {
+			off = wbytes % size;
+			if (off == 0 && !started) {
+				stamp[(wbytes / size) % res->depth] = now();
+				started = TRUE;
+			}
+			len = write(wfd, out + off, size - off);
+			if (len > 0) {
+				wbytes += len;
+				if (wbytes % size == 0)
+					started = FALSE;
+				moved = TRUE;
+			} else if (len < 0 && errno != EAGAIN) {
+				fprintf(stderr, "write error (%d)\n", errno);
+				result = -1;
+				break;
+			}
+		}
+
+		if (rbytes < wbytes) {
+			off = rbytes % size;
+			len = read(rfd, in + off, size - off);
+			if (len > 0) {
+				rbytes += len;
+				if (rbytes % size == 0 &&
+				    bench_add_latency(res, now() -
+					stamp[(rbytes / size - 1) % res->depth])) {
+					fprintf(stderr, "out of memory\n");
+					result = -1;
+					break;
+				}
+				moved = TRUE;
+			} else if (len == 0 || errno != EAGAIN) {
+				fprintf(stderr, "read error (%d)\n", len ? errno : 0);
+				result = -1;
+				break;
+			}
+		}
+
+		if (moved)
+			continue;
+
+		/* neither can move: wait for the device */
+		n = 0;
+		if ((!stop || wbytes % size) && wbytes - rbytes < window) {
+			pfd[n].fd = wfd;
+			pfd[n++].events = POLLOUT;
+		}
+		if (rbytes < wbytes) {
+			pfd[n].fd = rfd;
+			pfd[n++].events = POLLIN;
+		}
+		if (n && poll(pfd, n, BENCH_STALL_MS) <= 0) {
+			fprintf(stderr, "no transfer moved in %d ms\n",
+				BENCH_STALL_MS);
+			result = -1;
+			break;
+		}
+	}
+	res->secs = now() - start;
+	res->transfers = rbytes / size;
+
+	free(stamp);
+	return result;
+}
+
+static void bench_report(struct bench_result *res)
+{
+	double bytes = (double)res->size * res->transfers;
+	double mbs = res->secs > 0 ? bytes / res->secs / 1e6 : 0;
+	double iops = res->secs > 0 ? res->transfers / res->secs : 0;
+	double lmin, p50, p99, p999, lmax;
+
+	qsort(res->lat, res->nlat, sizeof(*res->lat), compare_double);
+	lmin = res->nlat ? res->lat[0] * 1e6 : 0;
+	lmax = res->nlat ? res->lat[res->nlat - 1] * 1e6 : 0;
+	p50  = percentile(res->lat, res->nlat, 500) * 1e6;
+	p99  = percentile(res->lat, res->nlat, 990) * 1e6;
+	p999 = percentile(res->lat, res->nlat, 999) * 1e6;
+
+	switch (bench_format) {
+	case BENCH_JSON:
+		printf("{\"size\": %zu, \"depth\": %d, \"transfers\": %lu, "
+			"\"bytes\": %.0f, \"seconds\": %.6f, \"mb_per_s\": %.3f, "
+			"\"iops\": %.1f, \"latency_us\": {\"min\": %.1f, "
+			"\"p50\": %.1f, \"p99\": %.1f, \"p99.9\": %.1f, "
+			"\"max\": %.1f}}\n",
+			res->size, res->depth, res->transfers, bytes, res->secs,
+			mbs, iops, lmin, p50, p99, p999, lmax);
+		break;
+
+	case BENCH_CSV:
+		printf("size,depth,transfers,bytes,seconds,mb_per_s,iops,"
+			"lat_min_us,lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us\n");
+		printf("%zu,%d,%lu,%.0f,%.6f,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+			res->size, res->depth, res->transfers, bytes, res->secs,
+			mbs, iops, lmin, p50, p99, p999, lmax);
+		break;
+
+	default:
+		printf("bench: %lu transfers x %zu bytes, depth %d, %.3f s\n",
+			res->transfers, res->size, res->depth, res->secs);
+		printf("  %.2f MB/s  %.0f IOPS\n", mbs, iops);
+		printf("  latency us: min %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+			lmin, p50, p99, p999, lmax);
+		break;
+	}
+}
+
+void loop_bench(void)
+{
+	struct bench_result res;
+	unsigned char *out = NULL, *in = NULL;
+	struct osrfx2_dev *io = NULL;
+	int rfd, wfd;
+
+	memset(&res, 0, sizeof(res));
+	res.size = flag_write ? write_len : read_len;
+	res.depth = bench_depth;
+	if (res.size == 0) {
+		fprintf(stderr, "--bench needs a transfer size\n");
+		return;
+	}
+
+	out = malloc(res.size);
+	in = malloc(res.size);
+	if (NULL == out || NULL == in)
+		goto exit;
+	memset(out, 0xA5, res.size);
+
+	/* the device may have been left in a stream mode */
+	osrfx2_set_stream_mode(ctl, OSRFX2_MODE_LOOPBACK);
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_READ | OSRFX2_WRITE |
+			     OSRFX2_NONBLOCK, &io)) {
+		fprintf(stderr, "open for read and write: %s failed\n", dev_path);
+		goto exit;
+	}
+	wfd = osrfx2_fd(io, OSRFX2_WRITE);
+	rfd = osrfx2_fd(io, OSRFX2_READ);
+
+	if (0 != bench_run(rfd, wfd, out, in, &res))
+		fprintf(stderr, "bench stopped after %lu transfers\n",
+			res.nlat);
+	bench_report(&res);
+
+exit:
+	osrfx2_close(io);
+	free(res.lat);
+	free(out);
+	free(in);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Pipeline                                                                  */
+/*                                                                           */
+/* --pipeline moves -c writes of -w bytes through the loopback with three    */
+/* threads: a writer streaming the pattern out, a reader filling -r byte     */
+/* buffers and a verifier checking them. The reader hands full buffers to    */
+/* the verifier and gets them back empty through two single producer/single  */
+/* consumer rings, so neither bulk pipe waits for the check. Both device     */
+/* descriptors are non-blocking and waited for with edge-triggered epoll:    */
+/* a thread only sleeps after read() or write() said -EAGAIN.                */
+/*---------------------------------------------------------------------------*/
+#define PIPE_BUFFERS	64	// reader buffers, a power of two
+#define PIPE_WAIT_MS	1000	// wake up this often to look at stop
+
+struct pipe_buf {
+	size_t		len;
+	unsigned char	data [];
+};
+
+/*
+ Kick and drain the non-blocking eventfds below. EAGAIN is expected and
+ harmless: a kick only fails that way with the counter at its maximum, a
+ wakeup is pending then, and a drain when nobody kicked. Anything else is
+ a bug worth seeing.
+*/
+static void efd_kick(int efd)
+{
+	uint64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "eventfd kick failed: %s\n", strerror(errno));
+}
+
+static void efd_drain(int efd)
+{
+	uint64_t count;
+
+	if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		fprintf(stderr, "eventfd drain failed: %s\n", strerror(errno));
+}
+
+/*
+ Lock-free ring of PIPE_BUFFERS pointers for one producer and one consumer
+ thread. A consumer about to sleep sets sleeping and the producer then
+ kicks efd after a push; the fences make sure one of the two sees the
+ other, so no wakeup is lost.
+*/
+struct spsc_ring {
+	_Alignas(64) atomic_size_t	head;		// producer
+	_Alignas(64) atomic_size_t	tail;		// consumer
+	_Alignas(64) atomic_int		sleeping;	// consumer waits on efd
+	int				efd;
+	struct pipe_buf			*slot [PIPE_BUFFERS];
+};
+
+static void ring_push(struct spsc_ring *r, struct pipe_buf *b)
+{
+	size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	/* never full: there are only PIPE_BUFFERS buffers */
+	r->slot[h & (PIPE_BUFFERS - 1)] = b;
+	atomic_store_explicit(&r->head, h + 1, memory_order_release);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&r->sleeping, memory_order_relaxed))
+		efd_kick(r->efd);
+}
+
+static struct pipe_buf *ring_pop(struct spsc_ring *r)
+{
+	size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	struct pipe_buf *b;
+
+	if (atomic_load_explicit(&r->head, memory_order_acquire) == t)
+		return NULL;
+	b = r->slot[t & (PIPE_BUFFERS - 1)];
+	atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+	return b;
+}
+
+/*
+ Consumer side: announce the sleep and say whether r is still empty, in
+ which case the caller waits for efd and then calls ring_wake_done
+*/
+static BOOL ring_sleep(struct spsc_ring *r)
+{
+	atomic_store_explicit(&r->sleeping, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&r->head, memory_order_relaxed) !=
+	    atomic_load_explicit(&r->tail, memory_order_relaxed)) {
+		atomic_store_explicit(&r->sleeping, 0, memory_order_relaxed);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void ring_wake_done(struct spsc_ring *r)
+{
+	atomic_store_explicit(&r->sleeping, 0, memory_order_relaxed);
+	efd_drain(r->efd);
+}
+
+struct pipeline {
+	int			rfd;
+	int			wfd;
+	unsigned long long	total;		// bytes through the loopback
+	struct spsc_ring	full;		// reader -> verifier
+	struct spsc_ring	empty;		// verifier -> reader
+	atomic_int		stop;		// a thread failed
+	double			start;
+	double			wdone;		// when the last byte was written
+	double			rdone;		// ... read
+	double			vdone;		// ... checked
+	unsigned long		mismatches;
+	unsigned long long	first;
+	unsigned long		rsleeps;	// reader waits for the device
+	unsigned long		rstarved;	// reader waits for a buffer
+	unsigned long		wsleeps;	// writer waits for the device
+};
+
+static void pipe_fail(struct pipeline *pl, const char *what, int err)
+{
+	fprintf(stderr, "pipeline: %s (%d)\n", what, err);
+	atomic_store(&pl->stop, 1);
+	efd_kick(pl->full.efd);
+	efd_kick(pl->empty.efd);
+}
+
+/*
+ Wait for fd (edge triggered, registered with epfd) or a kick of the other
+ descriptors in the set. Returns 0, or -1 once the pipeline stopped or the
+ device did not move for BENCH_STALL_MS.
+*/
+static int pipe_wait(struct pipeline *pl, int epfd)
+{
+	struct epoll_event ev [2];
+	int waited = 0;
+	int n;
+
+	while (!atomic_load(&pl->stop)) {
+		n = epoll_wait(epfd, ev, 2, PIPE_WAIT_MS);
+		if (n > 0)
+			return 0;
+		if (n < 0 && errno != EINTR) {
+			pipe_fail(pl, "epoll_wait error", errno);
+			break;
+		}
+		waited += PIPE_WAIT_MS;
+		if (waited >= BENCH_STALL_MS) {
+			pipe_fail(pl, "no transfer moved", ETIMEDOUT);
+			break;
+		}
+	}
+	return -1;
+}
+
+static int pipe_epoll(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	int epfd;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		return -1;
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(epfd);
+		return -1;
+	}
+	return epfd;
+}
+
+static void *pipe_writer(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct pattern pat;
+	unsigned char *buf;
+	unsigned long long written = 0;
+	size_t off = 0, len = 0;
+	ssize_t n;
+	int epfd;
+
+	buf = malloc(write_len);
+	epfd = pipe_epoll(pl->wfd, EPOLLOUT | EPOLLET);
+	if (NULL == buf || epfd < 0) {
+		pipe_fail(pl, "writer setup failed", errno);
+		goto exit;
+	}
+	pattern_init(&pat, pattern_kind, pattern_seed);
+
+	while (written < pl->total && !atomic_load(&pl->stop)) {
+		if (off == len) {
+			len = write_len;
+			if (len > pl->total - written)
+				len = pl->total - written;
+			pattern_fill(&pat, buf, len);
+			off = 0;
+		}
+		n = write(pl->wfd, buf + off, len - off);
+		if (n > 0) {
+			off += n;
+			written += n;
+		} else if (n < 0 && errno == EAGAIN) {
+			pl->wsleeps++;
+			if (pipe_wait(pl, epfd))
+				break;
+		} else {
+			pipe_fail(pl, "write error", errno);
+			break;
+		}
+	}
+	pl->wdone = now();
+
+exit:
+	if (epfd >= 0) close(epfd);
+	free(buf);
+	return NULL;
+}
+
+static void *pipe_reader(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct pipe_buf *b = NULL;
+	struct epoll_event ev;
+	unsigned long long got = 0;
+	ssize_t n;
+	size_t want;
+	int epfd;
+
+	/*
+	 the device, and the verifier handing back a buffer. Edge triggered
+	 too: a kick can land after ring_sleep found a buffer after all, and
+	 level triggered it would end every later pipe_wait at once
+	*/
+	epfd = pipe_epoll(pl->rfd, EPOLLIN | EPOLLET);
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = pl->empty.efd;
+	if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, pl->empty.efd, &ev) < 0) {
+		pipe_fail(pl, "reader setup failed", errno);
+		goto exit;
+	}
+
+	while (got < pl->total && !atomic_load(&pl->stop)) {
+		if (NULL == b) {
+			b = ring_pop(&pl->empty);
+			if (NULL == b) {
+				pl->rstarved++;
+				if (ring_sleep(&pl->empty)) {
+					if (pipe_wait(pl, epfd))
+						break;
+					ring_wake_done(&pl->empty);
+				}
+				continue;
+			}
+			b->len = 0;
+		}
+
+		want = read_len - b->len;
+		if (want > pl->total - got)
+			want = pl->total - got;
+		n = read(pl->rfd, b->data + b->len, want);
+		if (n > 0) {
+			b->len += n;
+			got += n;
+			if (b->len == read_len || got == pl->total) {
+				ring_push(&pl->full, b);
+				b = NULL;
+			}
+		} else if (n < 0 && errno == EAGAIN) {
+			pl->rsleeps++;
+			if (pipe_wait(pl, epfd))
+				break;
+		} else {
+			pipe_fail(pl, "read error", n ? errno : 0);
+			break;
+		}
+	}
+	pl->rdone = now();
+
+exit:
+	if (epfd >= 0) close(epfd);
+	return NULL;
+}
+
+static void *pipe_verifier(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct pattern pat;
+	struct pipe_buf *b;
+	struct pollfd pfd;
+	unsigned long long checked = 0, first = 0;
+	unsigned long bad;
+
+	pattern_init(&pat, pattern_kind, pattern_seed);
+	pfd.fd = pl->full.efd;
+	pfd.events = POLLIN;
+
+	while (checked < pl->total && !atomic_load(&pl->stop)) {
+		b = ring_pop(&pl->full);
+		if (NULL == b) {
+			if (ring_sleep(&pl->full)) {
+				poll(&pfd, 1, PIPE_WAIT_MS);
+				ring_wake_done(&pl->full);
+			}
+			continue;
+		}
+
+		bad = pattern_check(&pat, b->data, b->len, &first);
+		if (bad && pl->mismatches == 0)
+			pl->first = first;
+		pl->mismatches += bad;
+		checked += b->len;
+
+		ring_push(&pl->empty, b);
+	}
+	pl->vdone = now();
+
+	return NULL;
+}
+
+void rw_pipeline(void)
+{
+	struct osrfx2_dev *io = NULL;
+	struct pipeline *pl;
+	struct pipe_buf *bufs [PIPE_BUFFERS];
+	pthread_t tid [3];
+	void *(*fn [3])(void *) = { pipe_verifier, pipe_reader, pipe_writer };
+	double secs;
+	int started = 0;
+	int i;
+
+	memset(bufs, 0, sizeof(bufs));
+	pl = calloc(1, sizeof(*pl));
+	if (NULL == pl)
+		return;
+	pl->rfd = pl->wfd = pl->full.efd = pl->empty.efd = -1;
+	pl->total = (unsigned long long)write_len * iteration_count;
+
+	for (i = 0; i < PIPE_BUFFERS; i++) {
+		bufs[i] = malloc(sizeof(struct pipe_buf) + read_len);
+		if (NULL == bufs[i])
+			goto exit;
+		ring_push(&pl->empty, bufs[i]);
+	}
+
+	pl->full.efd = eventfd(0, EFD_NONBLOCK);
+	pl->empty.efd = eventfd(0, EFD_NONBLOCK);
+	if (pl->full.efd < 0 || pl->empty.efd < 0) {
+		fprintf(stderr, "eventfd failed (%d)\n", errno);
+		goto exit;
+	}
+
+	/* the device may have been left in a stream mode */
+	osrfx2_set_stream_mode(ctl, OSRFX2_MODE_LOOPBACK);
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_READ | OSRFX2_WRITE |
+			     OSRFX2_NONBLOCK, &io)) {
+		fprintf(stderr, "open for read and write: %s failed\n", dev_path);
+		goto exit;
+	}
+	pl->wfd = osrfx2_fd(io, OSRFX2_WRITE);
+	pl->rfd = osrfx2_fd(io, OSRFX2_READ);
+
+	pl->start = now();
+	for (started = 0; started < 3; started++) {
+		if (pthread_create(&tid[started], NULL, fn[started], pl)) {
+			pipe_fail(pl, "pthread_create failed", errno);
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(tid[i], NULL);
+
+	secs = pl->vdone - pl->start;
+	printf("pipeline: %llu bytes, writes of %d, reads of %d bytes\n",
+		pl->total, write_len, read_len);
+	printf("  written %.3f s, read %.3f s, checked %.3f s: %.2f MB/s\n",
+		pl->wdone - pl->start, pl->rdone - pl->start, secs,
+		secs > 0 ? pl->total / secs / 1e6 : 0.0);
+	printf("  writer slept %lu, reader slept %lu, reader out of buffers %lu times\n",
+		pl->wsleeps, pl->rsleeps, pl->rstarved);
+	if (pl->mismatches)
+		printf("  %lu bytes differ, the first at stream offset %llu\n",
+			pl->mismatches, pl->first);
+	else if (!atomic_load(&pl->stop))
+		printf("  all data matched\n");
+
+exit:
+	osrfx2_close(io);
+	if (pl->full.efd >= 0) close(pl->full.efd);
+	if (pl->empty.efd >= 0) close(pl->empty.efd);
+	for (i = 0; i < PIPE_BUFFERS; i++)
+		free(bufs[i]);
+	free(pl);
+}
+
 /*---------------------------------------------------------------------------*/
 /*                                                                           */
 /*---------------------------------------------------------------------------*/
@@ -1060,6 +2092,26 @@ int main(int argc, char **argv)
 		goto done;
 	}
 
+	if (flag_sink) {
+		stream_sink();
+		goto done;
+	}
+
+	if (flag_source) {
+		stream_source();
+		goto done;
+	}
+
+	if (flag_bench) {
+		loop_bench();
+		goto done;
+	}
+
+	if (flag_pipeline) {
+		rw_pipeline();
+		goto done;
+	}
+
 	// doing a read, write, or both test
 	if ((flag_read) || (flag_write)) {
 		if (flag_perform_blocking_io) {
@@ -1075,6 +2127,7 @@ int main(int argc, char **argv)
  	 *   Clean-up and exit.
 	 */ 
 done:
+	osrfx2_close(ctl);
 	if (dev_name)   free(dev_name);
 	if (dev_path)   free(dev_path);
 	if (sys_path)   free(sys_path);
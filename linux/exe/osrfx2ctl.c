@@ -0,0 +1,229 @@
+/**
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * osrfx2ctl - the board's controls from the command line, through
+ * libosrfx2. The operations given run as one osrfx2_control() batch, in
+ * order, and the getters print one line each:
+ *
+ *   osrfx2ctl clear-bars 15 light-bars 2 get-bars
+ *
+ * Bars and switches are printed the way the driver shows them, first one
+ * first ("*.*....."), and taken as bit masks, bit 0 the first bar. The sh
+ * scripts of linux/scripts/sh are loops around this.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h> //getopt
+
+#include "libosrfx2.h"
+
+#define MAX_OPS 32
+#define MAX_BOARDS 16
+
+struct command {
+	const char	*name;
+	int		op;		// OSRFX2_*
+	int		has_value;
+};
+
+static const struct command commands[] = {
+	{ "get-bars",		OSRFX2_GET_BARS,	0 },
+	{ "light-bars",		OSRFX2_LIGHT_BARS,	1 },
+	{ "clear-bars",		OSRFX2_CLEAR_BARS,	1 },
+	{ "get-switches",	OSRFX2_GET_SWITCHES,	0 },
+	{ "get-7segment",	OSRFX2_GET_7SEGMENT,	0 },
+	{ "set-7segment",	OSRFX2_SET_7SEGMENT,	1 },
+	{ "get-stream-mode",	OSRFX2_GET_STREAM_MODE,	0 },
+	{ "set-stream-mode",	OSRFX2_SET_STREAM_MODE,	1 },
+};
+
+#define COMMANDS (int)(sizeof(commands) / sizeof(commands[0]))
+
+// indexed by OSRFX2_MODE_*
+static const char * const mode_name[] = { "loopback", "sink", "source" };
+
+/*---------------------------------------------------------------------------*/
+/* Global data                                                               */
+/*---------------------------------------------------------------------------*/
+char		*dev_name			= NULL;
+int		flag_list			= 0;		// -l
+
+void print_usage()
+{
+	int i;
+
+	printf("Usage for osrfx2ctl: osrfx2ctl [-d name] [-l] [operation ...]\n");
+	printf("-d [name] device name (default osrfx2_0)\n");
+	printf("-l list the boards\n");
+	printf("operations:\n");
+	for (i = 0; i < COMMANDS; i++)
+		printf("  %s%s\n", commands[i].name,
+			commands[i].has_value ? " [value]" : "");
+	printf("bars are bit masks, bit 0 bar 1; modes loopback, sink or source\n");
+}
+
+static const char *op_name(int op)
+{
+	int i;
+
+	for (i = 0; i < COMMANDS; i++)
+		if (commands[i].op == op)
+			return commands[i].name;
+	return "?";
+}
+
+static void print_mask(int mask)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		putchar(mask & (1 << i) ? '*' : '.');
+	putchar('\n');
+}
+
+static int list_boards(void)
+{
+	struct osrfx2_info info[MAX_BOARDS];
+	int i, n;
+
+	n = osrfx2_enumerate(info, MAX_BOARDS);
+	if (n < 0) {
+		fprintf(stderr, "osrfx2_enumerate: %s\n", strerror(-n));
+		return -1;
+	}
+	for (i = 0; i < n && i < MAX_BOARDS; i++)
+		printf("%s %s %s %d\n", info[i].name, info[i].dev_path,
+			info[i].sys_path, info[i].packet_size);
+	return 0;
+}
+
+/*
+ Parse the operation at argv[*i], and its value, into ctrl. Return 0, OK,
+ else failed
+*/
+static int parse_op(char *argv[], int argc, int *i, struct osrfx2_ctrl *ctrl)
+{
+	const struct command *cmd = NULL;
+	const char *value;
+	char *end;
+	int j;
+
+	for (j = 0; j < COMMANDS; j++)
+		if (strcmp(argv[*i], commands[j].name) == 0)
+			cmd = &commands[j];
+	if (cmd == NULL) {
+		fprintf(stderr, "unknown operation %s\n", argv[*i]);
+		return -1;
+	}
+
+	memset(ctrl, 0, sizeof(*ctrl));
+	ctrl->op = cmd->op;
+	if (!cmd->has_value)
+		return 0;
+
+	if (++*i >= argc) {
+		fprintf(stderr, "%s needs a value\n", cmd->name);
+		return -1;
+	}
+	value = argv[*i];
+
+	if (cmd->op == OSRFX2_SET_STREAM_MODE) {
+		for (j = 0; j < 3; j++)
+			if (strcmp(value, mode_name[j]) == 0)
+				break;
+		if (j == 3) {
+			fprintf(stderr, "no stream mode %s\n", value);
+			return -1;
+		}
+		ctrl->value = j;
+		return 0;
+	}
+
+	ctrl->value = strtol(value, &end, 0);
+	if (*value == '\0' || *end != '\0') {
+		fprintf(stderr, "%s: bad value %s\n", cmd->name, value);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct osrfx2_ctrl ops[MAX_OPS];
+	struct osrfx2_dev *dev;
+	int nops = 0;
+	int ch, i, n;
+	int result = 0;
+
+	while ((ch = getopt(argc, argv, "d:lh")) != -1) {
+		switch (ch) {
+		case 'd':
+			dev_name = optarg;
+			break;
+		case 'l':
+			flag_list = 1;
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (nops == MAX_OPS) {
+			fprintf(stderr, "more than %d operations\n", MAX_OPS);
+			return 1;
+		}
+		if (parse_op(argv, argc, &i, &ops[nops]) != 0)
+			return 1;
+		nops++;
+	}
+
+	if (flag_list && list_boards() != 0)
+		return 1;
+	if (nops == 0) {
+		if (!flag_list)
+			print_usage();
+		return flag_list ? 0 : 1;
+	}
+
+	n = osrfx2_open(dev_name, 0, &dev);
+	if (n != 0) {
+		fprintf(stderr, "Can't find /dev/%s device\n",
+			dev_name ? dev_name : "osrfx2_0");
+		return 1;
+	}
+
+	if (osrfx2_control(dev, ops, nops) != 0)
+		result = 1;
+
+	for (i = 0; i < nops; i++) {
+		if (ops[i].result != 0) {
+			fprintf(stderr, "%s: %s\n", op_name(ops[i].op),
+				strerror(-ops[i].result));
+			break;
+		}
+		switch (ops[i].op) {
+		case OSRFX2_GET_BARS:
+		case OSRFX2_GET_SWITCHES:
+			print_mask(ops[i].value);
+			break;
+		case OSRFX2_GET_7SEGMENT:
+			if (ops[i].value < 0)
+				printf("-\n");
+			else
+				printf("%d\n", ops[i].value);
+			break;
+		case OSRFX2_GET_STREAM_MODE:
+			printf("%s\n", mode_name[ops[i].value]);
+			break;
+		}
+	}
+
+	osrfx2_close(dev);
+	return result;
+}
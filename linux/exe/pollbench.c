@@ -0,0 +1,264 @@
+/**
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * pollbench - epoll wakeup latency of the osrfx2 driver with many
+ * concurrent waiters.
+ *
+ * <waiters> threads each own an epoll instance watching the same read
+ * descriptor for EPOLLIN. Every round the main thread lets them block in
+ * epoll_wait and writes one record, which in time makes the descriptor
+ * readable. The main thread spins on a zero-timeout poll() to timestamp
+ * the moment it does, and every waiter's latency runs from then to its own
+ * wakeup, so neither the write nor the USB round trip is counted. The
+ * record is then read back so the next round starts idle again.
+ *
+ * Reported are the percentiles of the per-waiter wakeup latency and of
+ * the per-round spread (last waiter minus first waiter), which grows when
+ * the poll path serializes the waiters. Waits which timed out are only
+ * counted, not part of either.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h> //getopt
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include "libosrfx2.h"
+
+#define MAX_DEVPATH_LENGTH 256
+#define MAX_WAITERS 1024
+#define WAIT_MS 5000
+
+/*---------------------------------------------------------------------------*/
+/* Global data                                                               */
+/*---------------------------------------------------------------------------*/
+char		*dev_name			= NULL;
+int		waiters				= 64;		// concurrent epoll waiters
+int		rounds				= 1000;		// wakeups to measure
+int		record_len			= 64;		// bytes written per round
+int		settle_us			= 1000;		// time to let waiters block
+
+int		rfd;
+pthread_barrier_t	start_barrier;
+pthread_barrier_t	done_barrier;
+double		*wake;				// [waiters] of this round, 0 timed out
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *v, int n)
+{
+	qsort(v, n, sizeof(*v), compare_double);
+	printf("%-10s min %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %8.1f us\n",
+		name, v[0] * 1e6, v[n / 2] * 1e6, v[n * 9 / 10] * 1e6,
+		v[n * 99 / 100] * 1e6, v[n - 1] * 1e6);
+}
+
+void print_usage()
+{
+	printf("Usage for pollbench:\n");
+	printf("-d [name] device name (default osrfx2_0)\n");
+	printf("-w [n] where n is the number of epoll waiters (default 64, max %d)\n",
+		MAX_WAITERS);
+	printf("-c [n] where n is the number of rounds (default 1000)\n");
+	printf("-s [n] where n is bytes written per round (default 64)\n");
+	printf("-p [n] where n is usecs to let the waiters block (default 1000)\n");
+}
+
+/*
+ One waiter: block in epoll_wait once per round and record when it woke.
+*/
+static void *waiter(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	struct epoll_event ev;
+	int ep, r, n;
+
+	ep = epoll_create(1);
+	if (ep < 0) {
+		fprintf(stderr, "epoll_create: %s\n", strerror(errno));
+		exit(1);
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, rfd, &ev) < 0) {
+		fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+		exit(1);
+	}
+
+	for (r = 0; r < rounds; r++) {
+		pthread_barrier_wait(&start_barrier);
+		n = epoll_wait(ep, &ev, 1, WAIT_MS);
+		wake[id] = (n == 1) ? now() : 0;
+		pthread_barrier_wait(&done_barrier);
+	}
+
+	close(ep);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	char dev_path[MAX_DEVPATH_LENGTH];
+	struct osrfx2_dev *io;
+	pthread_t threads[MAX_WAITERS];
+	struct pollfd pfd;
+	unsigned char *buf;
+	double *latency, *spread;
+	double ready, t, lo, hi;
+	int nlatency = 0, nspread = 0;
+	int timeouts = 0;
+	int wfd;
+	int readable;
+	int ch, r, i, n;
+	int result = 0;
+
+	while ((ch = getopt(argc, argv, "d:w:c:s:p:h")) != -1) {
+		switch (ch) {
+		case 'd':
+			dev_name = optarg;
+			break;
+		case 'w':
+			waiters = atoi(optarg);
+			break;
+		case 'c':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			record_len = atoi(optarg);
+			break;
+		case 'p':
+			settle_us = atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return 1;
+		}
+	}
+	if (waiters <= 0 || waiters > MAX_WAITERS || rounds <= 0 ||
+	    record_len <= 0 || settle_us < 0) {
+		print_usage();
+		return 1;
+	}
+
+	snprintf(dev_path, sizeof(dev_path), "/dev/%s",
+		dev_name ? dev_name : "osrfx2_0");
+
+	if (0 != osrfx2_open(dev_name, OSRFX2_READ | OSRFX2_WRITE, &io)) {
+		fprintf(stderr, "open for read and write: %s failed\n", dev_path);
+		return 1;
+	}
+	wfd = osrfx2_fd(io, OSRFX2_WRITE);
+	rfd = osrfx2_fd(io, OSRFX2_READ);
+
+	buf = malloc(record_len);
+	wake = calloc(waiters, sizeof(*wake));
+	latency = calloc((size_t)rounds * waiters, sizeof(*latency));
+	spread = calloc(rounds, sizeof(*spread));
+	if (!buf || !wake || !latency || !spread) {
+		result = 1;
+		goto exit;
+	}
+	memset(buf, 0x5A, record_len);
+
+	pthread_barrier_init(&start_barrier, NULL, waiters + 1);
+	pthread_barrier_init(&done_barrier, NULL, waiters + 1);
+
+	for (i = 0; i < waiters; i++) {
+		if (pthread_create(&threads[i], NULL, waiter,
+				   (void *)(intptr_t)i) != 0) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	printf("device %s, %d waiters, %d rounds of %d bytes\n",
+		dev_path, waiters, rounds, record_len);
+
+	pfd.fd = rfd;
+	pfd.events = POLLIN;
+
+	for (r = 0; r < rounds; r++) {
+		pthread_barrier_wait(&start_barrier);
+		usleep(settle_us);
+
+		if (write(wfd, buf, record_len) != record_len) {
+			fprintf(stderr, "write (%d) failed: %s\n", r, strerror(errno));
+			exit(1);
+		}
+
+		/* the moment the record is readable, as closely as a spin sees it */
+		t = now();
+		do {
+			n = poll(&pfd, 1, 0);
+			ready = now();
+		} while (n == 0 && ready - t < WAIT_MS / 1e3);
+		readable = (n > 0);
+
+		pthread_barrier_wait(&done_barrier);
+
+		if (read(rfd, buf, record_len) != record_len) {
+			fprintf(stderr, "read (%d) failed: %s\n", r, strerror(errno));
+			exit(1);
+		}
+
+		/* a waiter may see it a hair before the spin does: count as 0 */
+		lo = hi = 0;
+		n = 0;
+		for (i = 0; i < waiters; i++) {
+			if (wake[i] == 0 || !readable) {
+				timeouts++;
+				continue;
+			}
+			t = (wake[i] > ready) ? wake[i] - ready : 0;
+			latency[nlatency++] = t;
+			if (n == 0 || t < lo)
+				lo = t;
+			if (n == 0 || t > hi)
+				hi = t;
+			n++;
+		}
+		if (n != 0)
+			spread[nspread++] = hi - lo;
+	}
+
+	for (i = 0; i < waiters; i++)
+		pthread_join(threads[i], NULL);
+
+	if (timeouts)
+		printf("%d waits timed out, left out below\n", timeouts);
+
+	if (nlatency != 0) {
+		report("wakeup", latency, nlatency);
+		report("spread", spread, nspread);
+	}
+
+exit:
+	free(spread);
+	free(latency);
+	free(wake);
+	free(buf);
+	osrfx2_close(io);
+	return result;
+}
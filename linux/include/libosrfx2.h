@@ -0,0 +1,172 @@
+/**
+ * libosrfx2.h
+ *
+ * osrfx2  - A Driver for the OSR USB FX2 Learning Kit device
+ *
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * libosrfx2, the user space side of the osrfx2 driver: finding boards,
+ * the sysfs controls, and bulk transfers done for the caller on an I/O
+ * thread. osrfx2.hpp wraps it for C++.
+ *
+ * Unless noted otherwise the functions return 0 on success and a negative
+ * errno on failure.
+ */
+
+#ifndef _LIBOSRFX2_H
+#define _LIBOSRFX2_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "public.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OSRFX2_NAME_MAX		32
+#define OSRFX2_PATH_MAX		256
+
+/**
+ * Discovery
+ *
+ * Every bound board is a /sys/class/usb/osrfx2_<n> entry and a
+ * /dev/osrfx2_<n> node. osrfx2_find() fills in one board by name
+ * (NULL is osrfx2_0), osrfx2_enumerate() up to max of them in minor
+ * order and returns how many there are, which may be more than max.
+ */
+struct osrfx2_info {
+	char	name[OSRFX2_NAME_MAX];		/* osrfx2_<n> */
+	char	dev_path[OSRFX2_PATH_MAX];	/* /dev/osrfx2_<n> */
+	char	sys_path[OSRFX2_PATH_MAX];	/* the interface in sysfs */
+	int	packet_size;			/* bulk packet, 512 or 64 */
+};
+
+int osrfx2_find(const char *name, struct osrfx2_info *info);
+int osrfx2_enumerate(struct osrfx2_info *info, int max);
+
+/**
+ * Handles
+ *
+ * OSRFX2_READ and OSRFX2_WRITE open the bulk pipes the handle moves data
+ * on; the driver lets one reader and one writer in at a time. A handle
+ * with neither only controls the board. OSRFX2_NONBLOCK opens the pipes
+ * non-blocking, OSRFX2_ASYNC implies it and starts the I/O thread which
+ * serves osrfx2_submit().
+ */
+#define OSRFX2_READ		0x01
+#define OSRFX2_WRITE		0x02
+#define OSRFX2_NONBLOCK		0x04
+#define OSRFX2_ASYNC		0x08
+
+struct osrfx2_dev;
+
+int osrfx2_open(const char *name, int flags, struct osrfx2_dev **dev);
+void osrfx2_close(struct osrfx2_dev *dev);
+
+const struct osrfx2_info *osrfx2_get_info(const struct osrfx2_dev *dev);
+int osrfx2_fd(const struct osrfx2_dev *dev, int dir);	/* -1 if not open */
+
+/**
+ * Control
+ *
+ * The board's sysfs attributes, with the encodings of the driver and the
+ * firmware hidden: bars and switches are bit masks, bit 0 the first bar
+ * or switch. The attribute files stay open in the handle, so a control
+ * costs one pread() or pwrite().
+ *
+ * osrfx2_control() runs n operations in one call and stops at the first
+ * failure; each op gets its own result, and value for the reads.
+ * Switching the stream mode needs the bulk read pipe closed.
+ */
+enum osrfx2_ctrl_op {
+	OSRFX2_GET_BARS,		/* value: lit bars */
+	OSRFX2_LIGHT_BARS,		/* value: bars to light */
+	OSRFX2_CLEAR_BARS,		/* value: bars to clear */
+	OSRFX2_GET_SWITCHES,		/* value: switches on */
+	OSRFX2_GET_7SEGMENT,		/* value: digit, or -1 if none */
+	OSRFX2_SET_7SEGMENT,		/* value: digit 0-9 */
+	OSRFX2_GET_STREAM_MODE,		/* value: OSRFX2_MODE_* */
+	OSRFX2_SET_STREAM_MODE,		/* value: OSRFX2_MODE_* */
+};
+
+enum osrfx2_stream_mode {
+	OSRFX2_MODE_LOOPBACK,
+	OSRFX2_MODE_SINK,
+	OSRFX2_MODE_SOURCE,
+};
+
+struct osrfx2_ctrl {
+	int	op;		/* enum osrfx2_ctrl_op */
+	int	value;
+	int	result;		/* out: 0 or -errno */
+};
+
+int osrfx2_control(struct osrfx2_dev *dev, struct osrfx2_ctrl *ops, int n);
+
+int osrfx2_get_bars(struct osrfx2_dev *dev, unsigned char *bars);
+int osrfx2_light_bars(struct osrfx2_dev *dev, unsigned char bars);
+int osrfx2_clear_bars(struct osrfx2_dev *dev, unsigned char bars);
+int osrfx2_get_switches(struct osrfx2_dev *dev, unsigned char *switches);
+int osrfx2_set_stream_mode(struct osrfx2_dev *dev, int mode);
+
+/**
+ * Asynchronous bulk transfers (OSRFX2_ASYNC)
+ *
+ * osrfx2_submit() queues a transfer and returns at once. Reads and writes
+ * each complete in submission order; both pipes are kept busy at the same
+ * time. A write is done when all len bytes went out, a read when it got
+ * any data, as read() would. result then holds the byte count or -errno
+ * (-ECANCELED for what osrfx2_close() found queued).
+ *
+ * With a done callback the transfer is handed back through it, called on
+ * the I/O thread; the library does not touch the transfer afterwards, so
+ * done may free or resubmit it. Without one, osrfx2_wait() blocks until
+ * the transfer is done and returns its result.
+ */
+struct osrfx2_xfer;
+
+typedef void (*osrfx2_done_fn)(struct osrfx2_xfer *xfer);
+
+struct osrfx2_xfer {
+	int			dir;		/* OSRFX2_READ or OSRFX2_WRITE */
+	void			*buf;
+	size_t			len;
+	ssize_t			result;		/* out */
+	osrfx2_done_fn		done;		/* NULL for osrfx2_wait() */
+	void			*user;
+
+	/* library private */
+	struct osrfx2_xfer	*next;
+	size_t			moved;
+	int			state;
+};
+
+int osrfx2_submit(struct osrfx2_dev *dev, struct osrfx2_xfer *xfer);
+ssize_t osrfx2_wait(struct osrfx2_dev *dev, struct osrfx2_xfer *xfer);
+
+/**
+ * Buffer pool
+ *
+ * Page aligned buffers of one size for the transfers of a handle, taken
+ * and given back without a malloc(). osrfx2_pool_init() sets it up with
+ * count buffers of size bytes; without it the first osrfx2_buf_get() sets
+ * up OSRFX2_POOL_COUNT of OSRFX2_POOL_SIZE. osrfx2_buf_get() returns NULL
+ * when all are taken. Safe to call from a done callback.
+ */
+#define OSRFX2_POOL_SIZE	(16 * 1024)
+#define OSRFX2_POOL_COUNT	32
+
+int osrfx2_pool_init(struct osrfx2_dev *dev, size_t size, int count);
+void *osrfx2_buf_get(struct osrfx2_dev *dev);
+void osrfx2_buf_put(struct osrfx2_dev *dev, void *buf);
+size_t osrfx2_buf_size(const struct osrfx2_dev *dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_LIBOSRFX2_H */
@@ -0,0 +1,270 @@
+/**
+ * osrfx2.hpp
+ *
+ * osrfx2  - A Driver for the OSR USB FX2 Learning Kit device
+ *
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * Header-only C++11 wrapper of libosrfx2 (libosrfx2.h): osrfx2::device
+ * owns a handle, osrfx2::buffer a pool buffer, and failures throw
+ * std::system_error. Asynchronous transfers return a std::future or call
+ * a std::function on the I/O thread.
+ */
+
+#ifndef _OSRFX2_HPP
+#define _OSRFX2_HPP
+
+#include <cerrno>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "libosrfx2.h"
+
+namespace osrfx2 {
+
+inline void check(long result, const char *what)
+{
+	if (result < 0)
+		throw std::system_error((int)-result, std::generic_category(), what);
+}
+
+typedef osrfx2_info info;
+
+inline std::vector<info> enumerate()
+{
+	std::vector<info> boards;
+	int n;
+
+	do {
+		n = osrfx2_enumerate(boards.data(), boards.size());
+		check(n, "osrfx2_enumerate");
+		if ((size_t)n <= boards.size())
+			break;
+		boards.resize(n);
+	} while (true);
+	boards.resize(n);
+	return boards;
+}
+
+class device;
+
+/*
+ A buffer of the device's pool, given back when it goes out of scope
+*/
+class buffer {
+public:
+	buffer() : dev_(nullptr), data_(nullptr), size_(0) {}
+	buffer(buffer &&other) noexcept : buffer() { swap(other); }
+	buffer &operator=(buffer &&other) noexcept
+	{
+		buffer(std::move(other)).swap(*this);
+		return *this;
+	}
+	buffer(const buffer &) = delete;
+	buffer &operator=(const buffer &) = delete;
+	~buffer() { osrfx2_buf_put(dev_, data_); }
+
+	unsigned char *data() const { return data_; }
+	size_t size() const { return size_; }
+	explicit operator bool() const { return data_ != nullptr; }
+
+	void swap(buffer &other) noexcept
+	{
+		std::swap(dev_, other.dev_);
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+	}
+
+private:
+	friend class device;
+	buffer(struct osrfx2_dev *dev, void *data)
+		: dev_(dev), data_(static_cast<unsigned char *>(data)),
+		  size_(osrfx2_buf_size(dev)) {}
+
+	struct osrfx2_dev	*dev_;
+	unsigned char	*data_;
+	size_t		size_;
+};
+
+/*
+ Control operations run together by device::run(); the getters' results
+ are in the returned vector, in the order they were added
+*/
+class batch {
+public:
+	batch &get_bars() { return add(OSRFX2_GET_BARS, 0); }
+	batch &light_bars(unsigned char bars) { return add(OSRFX2_LIGHT_BARS, bars); }
+	batch &clear_bars(unsigned char bars) { return add(OSRFX2_CLEAR_BARS, bars); }
+	batch &get_switches() { return add(OSRFX2_GET_SWITCHES, 0); }
+	batch &get_7segment() { return add(OSRFX2_GET_7SEGMENT, 0); }
+	batch &set_7segment(int digit) { return add(OSRFX2_SET_7SEGMENT, digit); }
+	batch &stream_mode(osrfx2_stream_mode mode)
+	{
+		return add(OSRFX2_SET_STREAM_MODE, mode);
+	}
+
+private:
+	friend class device;
+	batch &add(int op, int value)
+	{
+		struct osrfx2_ctrl ctrl = { op, value, 0 };
+
+		ops_.push_back(ctrl);
+		return *this;
+	}
+
+	std::vector<struct osrfx2_ctrl> ops_;
+};
+
+class device {
+public:
+	typedef std::function<void(ssize_t)> callback;
+
+	explicit device(const char *name = nullptr,
+			int flags = OSRFX2_READ | OSRFX2_WRITE | OSRFX2_ASYNC)
+		: dev_(nullptr)
+	{
+		check(osrfx2_open(name, flags, &dev_), "osrfx2_open");
+	}
+	explicit device(const std::string &name,
+			int flags = OSRFX2_READ | OSRFX2_WRITE | OSRFX2_ASYNC)
+		: device(name.c_str(), flags) {}
+	device(device &&other) noexcept : dev_(other.dev_) { other.dev_ = nullptr; }
+	device &operator=(device &&other) noexcept
+	{
+		std::swap(dev_, other.dev_);
+		return *this;
+	}
+	device(const device &) = delete;
+	device &operator=(const device &) = delete;
+	~device() { osrfx2_close(dev_); }
+
+	struct osrfx2_dev *get() const { return dev_; }
+	const info &board() const { return *osrfx2_get_info(dev_); }
+	int fd(int dir) const { return osrfx2_fd(dev_, dir); }
+
+	// control
+	unsigned char bars()
+	{
+		unsigned char bars;
+
+		check(osrfx2_get_bars(dev_, &bars), "get bars");
+		return bars;
+	}
+	void light_bars(unsigned char bars) { check(osrfx2_light_bars(dev_, bars), "light bars"); }
+	void clear_bars(unsigned char bars) { check(osrfx2_clear_bars(dev_, bars), "clear bars"); }
+	unsigned char switches()
+	{
+		unsigned char switches;
+
+		check(osrfx2_get_switches(dev_, &switches), "get switches");
+		return switches;
+	}
+	void stream_mode(osrfx2_stream_mode mode)
+	{
+		check(osrfx2_set_stream_mode(dev_, mode), "set stream mode");
+	}
+
+	std::vector<int> run(batch &ops)
+	{
+		std::vector<int> values;
+
+		check(osrfx2_control(dev_, ops.ops_.data(), ops.ops_.size()),
+		      "osrfx2_control");
+		for (const struct osrfx2_ctrl &op : ops.ops_)
+			values.push_back(op.value);
+		return values;
+	}
+
+	// buffers
+	buffer get_buffer()
+	{
+		void *data = osrfx2_buf_get(dev_);
+
+		if (data == nullptr)
+			throw std::system_error(ENOBUFS, std::generic_category(),
+						"osrfx2_buf_get");
+		return buffer(dev_, data);
+	}
+
+	// asynchronous transfers; buf must stay valid until they are done
+	std::future<ssize_t> read_async(void *buf, size_t len)
+	{
+		return submit_future(OSRFX2_READ, buf, len);
+	}
+	std::future<ssize_t> write_async(const void *buf, size_t len)
+	{
+		return submit_future(OSRFX2_WRITE, const_cast<void *>(buf), len);
+	}
+	void read_async(void *buf, size_t len, callback done)
+	{
+		submit(OSRFX2_READ, buf, len, std::move(done));
+	}
+	void write_async(const void *buf, size_t len, callback done)
+	{
+		submit(OSRFX2_WRITE, const_cast<void *>(buf), len, std::move(done));
+	}
+
+	// synchronous, through the same queues
+	ssize_t read(void *buf, size_t len) { return get_result(read_async(buf, len)); }
+	ssize_t write(const void *buf, size_t len) { return get_result(write_async(buf, len)); }
+
+private:
+	struct request {
+		struct osrfx2_xfer	xfer;
+		callback		done;
+	};
+
+	static void on_done(struct osrfx2_xfer *xfer)
+	{
+		std::unique_ptr<request> req(static_cast<request *>(xfer->user));
+
+		req->done(xfer->result);
+	}
+
+	void submit(int dir, void *buf, size_t len, callback done)
+	{
+		std::unique_ptr<request> req(new request());
+
+		req->xfer.dir = dir;
+		req->xfer.buf = buf;
+		req->xfer.len = len;
+		req->xfer.done = on_done;
+		req->xfer.user = req.get();
+		req->done = std::move(done);
+		check(osrfx2_submit(dev_, &req->xfer), "osrfx2_submit");
+		req.release();		// on_done owns it now
+	}
+
+	std::future<ssize_t> submit_future(int dir, void *buf, size_t len)
+	{
+		std::shared_ptr<std::promise<ssize_t>> promise =
+			std::make_shared<std::promise<ssize_t>>();
+
+		submit(dir, buf, len, [promise](ssize_t result) {
+			promise->set_value(result);
+		});
+		return promise->get_future();
+	}
+
+	static ssize_t get_result(std::future<ssize_t> future)
+	{
+		ssize_t result = future.get();
+
+		check(result, "osrfx2 transfer");
+		return result;
+	}
+
+	struct osrfx2_dev	*dev_;
+};
+
+} // namespace osrfx2
+
+#endif /*_OSRFX2_HPP */
@@ -0,0 +1,119 @@
+/**
+ * osrfx2_ioctl.h
+ *
+ * osrfx2  - A Driver for the OSR USB FX2 Learning Kit device
+ *
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * ioctl interface of the osrfx2 character device. This header is shared
+ * by the driver and by user space, so it only uses the fixed-size types
+ * of <linux/types.h>.
+ */
+
+#ifndef _OSRFX2_IOCTL_H
+#define _OSRFX2_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define OSRFX2_IOC_MAGIC	'x'
+
+/**
+ * Zero-copy receive ring
+ *
+ * A reader can have the bulk-IN data (EP8) delivered straight into memory
+ * shared with the driver instead of calling read():
+ *
+ *   1. OSRFX2_IOCTL_RING_SETUP allocates slot_count slots of slot_size
+ *      bytes each and returns the size to mmap().
+ *   2. mmap() the device at offset 0 with PROT_READ | PROT_WRITE and
+ *      MAP_SHARED. The first page is struct osrfx2_ring_header, slot n
+ *      starts at data_offset + n * slot_size.
+ *   3. OSRFX2_IOCTL_RING_START starts filling the ring.
+ *
+ * The driver is the producer: it fills slot (head % slot_count), stores
+ * the received byte count in slot_len[] and then advances head. The
+ * application is the consumer: it processes slots from tail up to head
+ * and then advances tail. Both indices run freely and wrap at 2^32. When
+ * head - tail == slot_count the ring is full and the driver stops reading
+ * from the device until tail moves on; it notices at the next poll(), or
+ * within 50ms without one. poll() reports POLLIN while head != tail. A
+ * slot may be empty (slot_len 0), e.g. for a zero-length packet or a
+ * failed transfer; a failed transfer also sets error, and the driver
+ * retries it 100ms later.
+ */
+#define OSRFX2_RING_MAGIC	0x5846524f	/* "ORFX" */
+#define OSRFX2_RING_VERSION	1
+#define OSRFX2_RING_MAX_SLOTS	512
+#define OSRFX2_RING_MAX_SLOT_SIZE	(64 * 1024)
+
+struct osrfx2_ring_header {
+	__u32 magic;		/* OSRFX2_RING_MAGIC */
+	__u32 version;		/* OSRFX2_RING_VERSION */
+	__u32 slot_size;	/* bytes per slot, a power-of-two page count */
+	__u32 slot_count;	/* number of slots */
+	__u32 data_offset;	/* offset of slot 0 in the mapping */
+	__u32 head;		/* producer index, written by the driver */
+	__u32 tail;		/* consumer index, written by the application */
+	__s32 error;		/* last transfer error (negative errno) or 0 */
+	__u32 slot_len[OSRFX2_RING_MAX_SLOTS];	/* bytes received per slot */
+};
+
+struct osrfx2_ring_setup {
+	__u32 slot_size;	/* in: bytes per slot (0 = one page) */
+	__u32 slot_count;	/* in: number of slots (0 = tear down) */
+	__u32 mmap_size;	/* out: length to pass to mmap() */
+};
+
+#define OSRFX2_IOCTL_RING_SETUP	_IOWR(OSRFX2_IOC_MAGIC, 0x01, struct osrfx2_ring_setup)
+#define OSRFX2_IOCTL_RING_START	_IO(OSRFX2_IOC_MAGIC, 0x02)
+#define OSRFX2_IOCTL_RING_STOP	_IO(OSRFX2_IOC_MAGIC, 0x03)
+
+/**
+ * Switch/mouse event queue
+ *
+ * Every interrupt-IN (EP1) report is queued by the driver as one
+ * struct osrfx2_event, time-stamped on arrival with the monotonic clock.
+ * seq counts reports per device, including the ones which had to be
+ * dropped because the queue was full, so a gap in seq shows exactly where
+ * events were lost.
+ *
+ * With firmware that queues key events itself (osrfx2fw, icd.h), one
+ * report may carry several events; each becomes its own struct
+ * osrfx2_event, all with the arrival time of that report, and
+ * OSRFX2_EVENT_FRAME is set in flags: frame then holds the USB frame
+ * number (1 ms, 11 bits) in which the device saw the change, which gives
+ * the exact spacing of events that arrived together. seq follows the
+ * firmware's numbering, so events the device had to drop show up as gaps
+ * and in overflows as well.
+ *
+ * OSRFX2_IOCTL_GET_EVENTS moves up to max_events queued events to the
+ * array at events and returns how many it moved in count. It blocks until
+ * at least one event is queued, unless the device was opened O_NONBLOCK,
+ * and fails with ENODEV once the device is unplugged and nothing is left
+ * queued. overflows returns the number of events dropped since the previous call.
+ * poll() reports POLLPRI while events are queued.
+ */
+#define OSRFX2_EVENT_FRAME	0x01	/* frame is valid */
+
+struct osrfx2_event {
+	__u64 timestamp_ns;	/* arrival time, CLOCK_MONOTONIC */
+	__u32 seq;		/* report sequence number */
+	__u8  switches;		/* switch/direction byte of the report */
+	__u8  flags;		/* OSRFX2_EVENT_* */
+	__u16 frame;		/* device USB frame number of the change */
+};
+
+struct osrfx2_event_batch {
+	__u64 events;		/* in: user address of struct osrfx2_event[] */
+	__u32 max_events;	/* in: capacity of that array */
+	__u32 count;		/* out: events returned */
+	__u32 overflows;	/* out: events dropped since the last call */
+	__u32 reserved;
+};
+
+#define OSRFX2_IOCTL_GET_EVENTS	_IOWR(OSRFX2_IOC_MAGIC, 0x10, struct osrfx2_event_batch)
+
+#endif /*_OSRFX2_IOCTL_H */
@@ -11,6 +11,8 @@
 #ifndef _PUBLIC_H
 #define _PUBLIC_H
 
+#include "osrfx2_ioctl.h"
+
 /* Define these values to match your devices */
 #define OSRFX2_VENDOR_ID	0x0547
 #define OSRFX2_PRODUCT_ID	0x1002
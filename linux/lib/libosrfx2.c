@@ -0,0 +1,800 @@
+/**
+ * This program is free software. You can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, version 2.
+ *
+ * libosrfx2 - see libosrfx2.h.
+ *
+ * A handle keeps the bulk pipe descriptors and the sysfs attribute files
+ * it used open. With OSRFX2_ASYNC it owns an I/O thread: submitted
+ * transfers wait in a queue per pipe, the thread moves the head of each
+ * until the pipe says -EAGAIN and then sleeps in epoll_wait() on both
+ * pipes (edge triggered) and an eventfd that osrfx2_submit() kicks.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "libosrfx2.h"
+
+#define SYS_CLASS	"/sys/class/usb"
+#define DEV_PREFIX	"osrfx2_"
+
+enum {
+	ATTR_BARGRAPH,
+	ATTR_SWITCHES,
+	ATTR_7SEGMENT,
+	ATTR_STREAM_MODE,
+	ATTR_COUNT,
+};
+
+static const char * const attr_name[ATTR_COUNT] = {
+	[ATTR_BARGRAPH]		= "bargraph",
+	[ATTR_SWITCHES]		= "switches",
+	[ATTR_7SEGMENT]		= "7segment",
+	[ATTR_STREAM_MODE]	= "stream_mode",
+};
+
+// as the driver spells them, indexed by OSRFX2_MODE_*
+static const char * const stream_mode_name[] = {
+	[OSRFX2_MODE_LOOPBACK]	= "loopback",
+	[OSRFX2_MODE_SINK]	= "sink",
+	[OSRFX2_MODE_SOURCE]	= "source",
+};
+
+#define MODES	(int)(sizeof(stream_mode_name) / sizeof(stream_mode_name[0]))
+
+enum {
+	XFER_QUEUED = 1,
+	XFER_DONE,
+};
+
+struct xfer_queue {
+	struct osrfx2_xfer	*head;
+	struct osrfx2_xfer	*tail;
+};
+
+struct osrfx2_dev {
+	struct osrfx2_info	info;
+	int			rfd;
+	int			wfd;
+	int			attr_fd[ATTR_COUNT];
+	pthread_mutex_t		attr_lock;	// attr_fd
+
+	// I/O thread, OSRFX2_ASYNC
+	pthread_t		thread;
+	int			running;
+	int			stop;
+	int			epfd;
+	int			kick;		// eventfd
+	pthread_mutex_t		lock;		// queues, stop, state
+	pthread_cond_t		done;		// a waited for transfer is done
+	struct xfer_queue	rq;
+	struct xfer_queue	wq;
+
+	// buffer pool
+	pthread_mutex_t		pool_lock;
+	unsigned char		*pool;
+	size_t			pool_size;	// bytes per buffer
+	int			pool_count;
+	void			**free_buf;
+	int			nfree;
+};
+
+/*---------------------------------------------------------------------------*/
+/* Discovery                                                                 */
+/*---------------------------------------------------------------------------*/
+
+/*
+ Bulk packet size: 512 at high speed, 64 at full speed, as the usb core
+ reports the speed of the device the interface belongs to. 0 if unknown.
+*/
+static int packet_size(const char *sys_path)
+{
+	char path[OSRFX2_PATH_MAX + 16];
+	FILE *f;
+	int speed = 0;
+
+	snprintf(path, sizeof(path), "%s/../speed", sys_path);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%d", &speed) != 1)
+		speed = 0;
+	fclose(f);
+
+	return speed >= 480 ? 512 : (speed ? 64 : 0);
+}
+
+int osrfx2_find(const char *name, struct osrfx2_info *info)
+{
+	if (name == NULL)
+		name = DEV_PREFIX "0";
+	if (strlen(name) >= OSRFX2_NAME_MAX)
+		return -ENAMETOOLONG;
+
+	memset(info, 0, sizeof(*info));
+	strcpy(info->name, name);
+	snprintf(info->dev_path, sizeof(info->dev_path), "/dev/%s", name);
+	snprintf(info->sys_path, sizeof(info->sys_path), SYS_CLASS "/%s/device",
+		name);
+
+	if (access(info->dev_path, F_OK) == -1)
+		return -errno;
+	info->packet_size = packet_size(info->sys_path);
+
+	return 0;
+}
+
+static int minor_of(const char *name)
+{
+	return atoi(name + strlen(DEV_PREFIX));
+}
+
+static int compare_minor(const void *a, const void *b)
+{
+	return minor_of(((const struct osrfx2_info *)a)->name) -
+	       minor_of(((const struct osrfx2_info *)b)->name);
+}
+
+int osrfx2_enumerate(struct osrfx2_info *info, int max)
+{
+	struct osrfx2_info *all = NULL, *more;
+	struct dirent *de;
+	DIR *dir;
+	int n = 0, room = 0;
+
+	dir = opendir(SYS_CLASS);
+	if (dir == NULL)
+		return errno == ENOENT ? 0 : -errno;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, DEV_PREFIX, strlen(DEV_PREFIX)) != 0)
+			continue;
+		if (n == room) {
+			room = room ? room * 2 : 8;
+			more = realloc(all, room * sizeof(*all));
+			if (more == NULL) {
+				closedir(dir);
+				free(all);
+				return -ENOMEM;
+			}
+			all = more;
+		}
+		if (osrfx2_find(de->d_name, &all[n]) == 0)
+			n++;
+	}
+	closedir(dir);
+
+	if (n && max > 0) {
+		qsort(all, n, sizeof(*all), compare_minor);
+		memcpy(info, all, (n < max ? n : max) * sizeof(*info));
+	}
+	free(all);
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Control                                                                   */
+/*---------------------------------------------------------------------------*/
+
+/*
+ The open attribute file; the caller holds attr_lock. Opened read-write
+ where the attribute can be written, which fails for the read-only ones.
+*/
+static int attr_open(struct osrfx2_dev *dev, int attr)
+{
+	char path[OSRFX2_PATH_MAX + 32];
+	int fd;
+
+	if (dev->attr_fd[attr] >= 0)
+		return dev->attr_fd[attr];
+
+	snprintf(path, sizeof(path), "%s/%s", dev->info.sys_path,
+		attr_name[attr]);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0 && (errno == EACCES || errno == EPERM))
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	dev->attr_fd[attr] = fd;
+	return fd;
+}
+
+// a sysfs attribute is shown anew by every read from offset 0
+static int attr_read(struct osrfx2_dev *dev, int attr, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = attr_open(dev, attr);
+	if (fd < 0)
+		return fd;
+	n = pread(fd, buf, len - 1, 0);
+	if (n < 0)
+		return -errno;
+	buf[n] = '\0';
+	return n;
+}
+
+static int attr_write(struct osrfx2_dev *dev, int attr, const char *value)
+{
+	size_t len = strlen(value);
+	ssize_t n;
+	int fd;
+
+	fd = attr_open(dev, attr);
+	if (fd < 0)
+		return fd;
+	n = pwrite(fd, value, len, 0);
+	if (n < 0)
+		return -errno;
+	return (size_t)n == len ? 0 : -EIO;
+}
+
+// "*.*....." as the driver shows bars and switches, first one first
+static int stars_to_mask(const char *s, int len)
+{
+	int mask = 0;
+	int i;
+
+	if (len < 8)
+		return -EIO;
+	for (i = 0; i < 8; i++)
+		if (s[i] == '*')
+			mask |= 1 << i;
+	return mask;
+}
+
+/*
+ The firmware lights the bars set in the low bits when BARGRAPH_ON is set
+ and clears them when it is not (icd.h, CY001 has BARGRAPH_MAXBAR bars).
+*/
+static int set_bars(struct osrfx2_dev *dev, int bars, int on)
+{
+	char value[8];
+
+	bars &= (1 << BARGRAPH_MAXBAR) - 1;
+	snprintf(value, sizeof(value), "%d", bars | (on ? BARGRAPH_ON : BARGRAPH_OFF));
+	return attr_write(dev, ATTR_BARGRAPH, value);
+}
+
+static int control_one(struct osrfx2_dev *dev, struct osrfx2_ctrl *op)
+{
+	char buf[32];
+	int n, i;
+
+	switch (op->op) {
+	case OSRFX2_GET_BARS:
+	case OSRFX2_GET_SWITCHES:
+		n = attr_read(dev, op->op == OSRFX2_GET_BARS ?
+			      ATTR_BARGRAPH : ATTR_SWITCHES, buf, sizeof(buf));
+		if (n < 0)
+			return n;
+		n = stars_to_mask(buf, n);
+		if (n < 0)
+			return n;
+		op->value = n;
+		return 0;
+
+	case OSRFX2_LIGHT_BARS:
+		return set_bars(dev, op->value, 1);
+
+	case OSRFX2_CLEAR_BARS:
+		return set_bars(dev, op->value, 0);
+
+	case OSRFX2_GET_7SEGMENT:
+		n = attr_read(dev, ATTR_7SEGMENT, buf, sizeof(buf));
+		if (n < 0)
+			return n;
+		op->value = (buf[0] >= '0' && buf[0] <= '9') ? buf[0] - '0' : -1;
+		return 0;
+
+	case OSRFX2_SET_7SEGMENT:
+		if (op->value < 0 || op->value > 9)
+			return -EINVAL;
+		snprintf(buf, sizeof(buf), "%d", op->value);
+		return attr_write(dev, ATTR_7SEGMENT, buf);
+
+	case OSRFX2_GET_STREAM_MODE:
+		n = attr_read(dev, ATTR_STREAM_MODE, buf, sizeof(buf));
+		if (n < 0)
+			return n;
+		for (i = 0; i < MODES; i++) {
+			if (strncmp(buf, stream_mode_name[i],
+				    strlen(stream_mode_name[i])) == 0) {
+				op->value = i;
+				return 0;
+			}
+		}
+		return -EIO;
+
+	case OSRFX2_SET_STREAM_MODE:
+		if (op->value < 0 || op->value >= MODES)
+			return -EINVAL;
+		return attr_write(dev, ATTR_STREAM_MODE,
+				  stream_mode_name[op->value]);
+	}
+
+	return -EINVAL;
+}
+
+int osrfx2_control(struct osrfx2_dev *dev, struct osrfx2_ctrl *ops, int n)
+{
+	int result = 0;
+	int i;
+
+	pthread_mutex_lock(&dev->attr_lock);
+	for (i = 0; i < n; i++)
+		ops[i].result = -ECANCELED;
+	for (i = 0; i < n; i++) {
+		ops[i].result = control_one(dev, &ops[i]);
+		if (ops[i].result < 0) {
+			result = ops[i].result;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dev->attr_lock);
+
+	return result;
+}
+
+static int control_get(struct osrfx2_dev *dev, int op, unsigned char *value)
+{
+	struct osrfx2_ctrl ctrl = { .op = op };
+	int result;
+
+	result = osrfx2_control(dev, &ctrl, 1);
+	if (result == 0)
+		*value = ctrl.value;
+	return result;
+}
+
+static int control_set(struct osrfx2_dev *dev, int op, int value)
+{
+	struct osrfx2_ctrl ctrl = { .op = op, .value = value };
+
+	return osrfx2_control(dev, &ctrl, 1);
+}
+
+int osrfx2_get_bars(struct osrfx2_dev *dev, unsigned char *bars)
+{
+	return control_get(dev, OSRFX2_GET_BARS, bars);
+}
+
+int osrfx2_light_bars(struct osrfx2_dev *dev, unsigned char bars)
+{
+	return control_set(dev, OSRFX2_LIGHT_BARS, bars);
+}
+
+int osrfx2_clear_bars(struct osrfx2_dev *dev, unsigned char bars)
+{
+	return control_set(dev, OSRFX2_CLEAR_BARS, bars);
+}
+
+int osrfx2_get_switches(struct osrfx2_dev *dev, unsigned char *switches)
+{
+	return control_get(dev, OSRFX2_GET_SWITCHES, switches);
+}
+
+int osrfx2_set_stream_mode(struct osrfx2_dev *dev, int mode)
+{
+	return control_set(dev, OSRFX2_SET_STREAM_MODE, mode);
+}
+
+/*---------------------------------------------------------------------------*/
+/* I/O thread                                                                */
+/*---------------------------------------------------------------------------*/
+static void queue_add(struct xfer_queue *q, struct osrfx2_xfer *xfer)
+{
+	xfer->next = NULL;
+	if (q->tail)
+		q->tail->next = xfer;
+	else
+		q->head = xfer;
+	q->tail = xfer;
+}
+
+static struct osrfx2_xfer *queue_take(struct xfer_queue *q)
+{
+	struct osrfx2_xfer *xfer = q->head;
+
+	if (xfer) {
+		q->head = xfer->next;
+		if (q->head == NULL)
+			q->tail = NULL;
+	}
+	return xfer;
+}
+
+/*
+ Hand a finished transfer back: through its callback, or to osrfx2_wait().
+ Called without dev->lock.
+*/
+static void complete(struct osrfx2_dev *dev, struct osrfx2_xfer *xfer)
+{
+	if (xfer->done) {
+		xfer->done(xfer);
+		return;
+	}
+	pthread_mutex_lock(&dev->lock);
+	xfer->state = XFER_DONE;
+	pthread_cond_broadcast(&dev->done);
+	pthread_mutex_unlock(&dev->lock);
+}
+
+/*
+ Move the head transfer of q until it is done or fd says -EAGAIN. Only the
+ I/O thread takes transfers off the queues, so the head stays put while
+ it is worked on without the lock. Returns 1 if a transfer completed.
+*/
+static int pump(struct osrfx2_dev *dev, struct xfer_queue *q, int fd)
+{
+	struct osrfx2_xfer *xfer;
+	ssize_t n;
+
+	pthread_mutex_lock(&dev->lock);
+	xfer = q->head;
+	pthread_mutex_unlock(&dev->lock);
+	if (xfer == NULL)
+		return 0;
+
+	for (;;) {
+		if (xfer->dir == OSRFX2_WRITE)
+			n = write(fd, (char *)xfer->buf + xfer->moved,
+				  xfer->len - xfer->moved);
+		else
+			n = read(fd, xfer->buf, xfer->len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return 0;
+		if (n < 0) {
+			xfer->result = -errno;
+			break;
+		}
+		xfer->moved += n;
+		if (xfer->dir == OSRFX2_READ || xfer->moved == xfer->len ||
+		    n == 0) {
+			xfer->result = xfer->moved;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	queue_take(q);
+	pthread_mutex_unlock(&dev->lock);
+	complete(dev, xfer);
+
+	return 1;
+}
+
+static void cancel_all(struct osrfx2_dev *dev)
+{
+	struct osrfx2_xfer *xfer;
+
+	for (;;) {
+		pthread_mutex_lock(&dev->lock);
+		xfer = queue_take(&dev->wq);
+		if (xfer == NULL)
+			xfer = queue_take(&dev->rq);
+		pthread_mutex_unlock(&dev->lock);
+		if (xfer == NULL)
+			break;
+		xfer->result = -ECANCELED;
+		complete(dev, xfer);
+	}
+}
+
+static void *io_thread(void *arg)
+{
+	struct osrfx2_dev *dev = arg;
+	struct epoll_event ev[3];
+	uint64_t count;
+	ssize_t n;
+	int moved, stop;
+
+	for (;;) {
+		do {
+			moved = 0;
+			if (dev->wfd >= 0)
+				moved |= pump(dev, &dev->wq, dev->wfd);
+			if (dev->rfd >= 0)
+				moved |= pump(dev, &dev->rq, dev->rfd);
+		} while (moved);
+
+		pthread_mutex_lock(&dev->lock);
+		stop = dev->stop;
+		pthread_mutex_unlock(&dev->lock);
+		if (stop)
+			break;
+
+		if (epoll_wait(dev->epfd, ev, 3, -1) < 0 && errno != EINTR)
+			break;
+		/* EAGAIN if not kicked: a pipe is ready */
+		n = read(dev->kick, &count, sizeof(count));
+		(void)n;
+	}
+
+	cancel_all(dev);
+	return NULL;
+}
+
+static int epoll_add(int epfd, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int io_start(struct osrfx2_dev *dev)
+{
+	int err;
+
+	dev->epfd = epoll_create1(EPOLL_CLOEXEC);
+	dev->kick = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (dev->epfd < 0 || dev->kick < 0)
+		return -errno;
+	if (epoll_add(dev->epfd, dev->kick, EPOLLIN) < 0 ||
+	    (dev->rfd >= 0 && epoll_add(dev->epfd, dev->rfd, EPOLLIN | EPOLLET) < 0) ||
+	    (dev->wfd >= 0 && epoll_add(dev->epfd, dev->wfd, EPOLLOUT | EPOLLET) < 0))
+		return -errno;
+
+	err = pthread_create(&dev->thread, NULL, io_thread, dev);
+	if (err)
+		return -err;
+	dev->running = 1;
+	return 0;
+}
+
+/*
+ Wake the I/O thread. On the non-blocking eventfd io_start made, write()
+ can only fail with EAGAIN, the counter at its maximum: a wakeup is then
+ pending already, so losing this one is harmless
+*/
+static void io_kick(struct osrfx2_dev *dev)
+{
+	uint64_t one = 1;
+	ssize_t n;
+
+	n = write(dev->kick, &one, sizeof(one));
+	(void)n;
+}
+
+int osrfx2_submit(struct osrfx2_dev *dev, struct osrfx2_xfer *xfer)
+{
+	struct xfer_queue *q;
+
+	if (!dev->running)
+		return -EINVAL;
+	if (xfer->dir == OSRFX2_READ && dev->rfd >= 0)
+		q = &dev->rq;
+	else if (xfer->dir == OSRFX2_WRITE && dev->wfd >= 0)
+		q = &dev->wq;
+	else
+		return -EBADF;
+
+	xfer->result = 0;
+	xfer->moved = 0;
+	xfer->state = XFER_QUEUED;
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->stop) {
+		pthread_mutex_unlock(&dev->lock);
+		return -ESHUTDOWN;
+	}
+	queue_add(q, xfer);
+	pthread_mutex_unlock(&dev->lock);
+
+	io_kick(dev);
+	return 0;
+}
+
+ssize_t osrfx2_wait(struct osrfx2_dev *dev, struct osrfx2_xfer *xfer)
+{
+	if (xfer->done)
+		return -EINVAL;
+
+	pthread_mutex_lock(&dev->lock);
+	while (xfer->state != XFER_DONE)
+		pthread_cond_wait(&dev->done, &dev->lock);
+	pthread_mutex_unlock(&dev->lock);
+
+	return xfer->result;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Buffer pool                                                               */
+/*---------------------------------------------------------------------------*/
+int osrfx2_pool_init(struct osrfx2_dev *dev, size_t size, int count)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	void *pool;
+	void **free_buf;
+	int i;
+
+	if (size == 0 || count <= 0)
+		return -EINVAL;
+	size = (size + page - 1) / page * page;
+
+	if (posix_memalign(&pool, page, size * count))
+		return -ENOMEM;
+	free_buf = malloc(count * sizeof(*free_buf));
+	if (free_buf == NULL) {
+		free(pool);
+		return -ENOMEM;
+	}
+
+	pthread_mutex_lock(&dev->pool_lock);
+	if (dev->pool) {
+		// taken buffers would be lost
+		pthread_mutex_unlock(&dev->pool_lock);
+		free(free_buf);
+		free(pool);
+		return -EBUSY;
+	}
+	dev->pool = pool;
+	dev->pool_size = size;
+	dev->pool_count = count;
+	dev->free_buf = free_buf;
+	for (i = 0; i < count; i++)
+		free_buf[i] = dev->pool + (size_t)(count - 1 - i) * size;
+	dev->nfree = count;
+	pthread_mutex_unlock(&dev->pool_lock);
+
+	return 0;
+}
+
+void *osrfx2_buf_get(struct osrfx2_dev *dev)
+{
+	void *buf = NULL;
+
+	pthread_mutex_lock(&dev->pool_lock);
+	if (dev->pool == NULL) {
+		// osrfx2_pool_init takes the lock, and loses to anyone faster
+		pthread_mutex_unlock(&dev->pool_lock);
+		osrfx2_pool_init(dev, OSRFX2_POOL_SIZE, OSRFX2_POOL_COUNT);
+		pthread_mutex_lock(&dev->pool_lock);
+	}
+	if (dev->nfree)
+		buf = dev->free_buf[--dev->nfree];
+	pthread_mutex_unlock(&dev->pool_lock);
+
+	return buf;
+}
+
+void osrfx2_buf_put(struct osrfx2_dev *dev, void *buf)
+{
+	if (buf == NULL)
+		return;
+
+	pthread_mutex_lock(&dev->pool_lock);
+	dev->free_buf[dev->nfree++] = buf;
+	pthread_mutex_unlock(&dev->pool_lock);
+}
+
+size_t osrfx2_buf_size(const struct osrfx2_dev *dev)
+{
+	return dev->pool ? dev->pool_size : OSRFX2_POOL_SIZE;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Handles                                                                   */
+/*---------------------------------------------------------------------------*/
+int osrfx2_open(const char *name, int flags, struct osrfx2_dev **devp)
+{
+	struct osrfx2_dev *dev;
+	int oflag = O_CLOEXEC;
+	int result;
+	int i;
+
+	*devp = NULL;
+	if (flags & OSRFX2_ASYNC) {
+		if (!(flags & (OSRFX2_READ | OSRFX2_WRITE)))
+			return -EINVAL;
+		flags |= OSRFX2_NONBLOCK;
+	}
+	if (flags & OSRFX2_NONBLOCK)
+		oflag |= O_NONBLOCK;
+
+	dev = calloc(1, sizeof(*dev));
+	if (dev == NULL)
+		return -ENOMEM;
+	dev->rfd = dev->wfd = dev->epfd = dev->kick = -1;
+	for (i = 0; i < ATTR_COUNT; i++)
+		dev->attr_fd[i] = -1;
+	pthread_mutex_init(&dev->attr_lock, NULL);
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_mutex_init(&dev->pool_lock, NULL);
+	pthread_cond_init(&dev->done, NULL);
+
+	result = osrfx2_find(name, &dev->info);
+	if (result)
+		goto fail;
+
+	// as the driver serializes them: writer first
+	if (flags & OSRFX2_WRITE) {
+		dev->wfd = open(dev->info.dev_path, O_WRONLY | oflag);
+		if (dev->wfd < 0) {
+			result = -errno;
+			goto fail;
+		}
+	}
+	if (flags & OSRFX2_READ) {
+		dev->rfd = open(dev->info.dev_path, O_RDONLY | oflag);
+		if (dev->rfd < 0) {
+			result = -errno;
+			goto fail;
+		}
+	}
+
+	if (flags & OSRFX2_ASYNC) {
+		result = io_start(dev);
+		if (result)
+			goto fail;
+	}
+
+	*devp = dev;
+	return 0;
+
+fail:
+	osrfx2_close(dev);
+	return result;
+}
+
+void osrfx2_close(struct osrfx2_dev *dev)
+{
+	int i;
+
+	if (dev == NULL)
+		return;
+
+	if (dev->running) {
+		pthread_mutex_lock(&dev->lock);
+		dev->stop = 1;
+		pthread_mutex_unlock(&dev->lock);
+		io_kick(dev);
+		pthread_join(dev->thread, NULL);
+	}
+
+	if (dev->epfd >= 0) close(dev->epfd);
+	if (dev->kick >= 0) close(dev->kick);
+	if (dev->rfd >= 0) close(dev->rfd);
+	if (dev->wfd >= 0) close(dev->wfd);
+	for (i = 0; i < ATTR_COUNT; i++)
+		if (dev->attr_fd[i] >= 0)
+			close(dev->attr_fd[i]);
+
+	pthread_cond_destroy(&dev->done);
+	pthread_mutex_destroy(&dev->pool_lock);
+	pthread_mutex_destroy(&dev->lock);
+	pthread_mutex_destroy(&dev->attr_lock);
+	free(dev->free_buf);
+	free(dev->pool);
+	free(dev);
+}
+
+const struct osrfx2_info *osrfx2_get_info(const struct osrfx2_dev *dev)
+{
+	return &dev->info;
+}
+
+int osrfx2_fd(const struct osrfx2_dev *dev, int dir)
+{
+	return dir == OSRFX2_WRITE ? dev->wfd : (dir == OSRFX2_READ ? dev->rfd : -1);
+}
@@ -0,0 +1,180 @@
+#!/usr/bin/python
+# Filename: libosrfx2.py
+'''ctypes binding of libosrfx2 (linux/lib, see linux/include/libosrfx2.h).
+
+Finds the boards and drives their controls the way the C tools do, so the
+scripts know neither the sysfs paths nor the bargraph encoding. Bars and
+switches are bit masks, bit 0 the first one. Failures raise OSError.
+
+	dev = Device()
+	dev.light_bars(0x01)
+	print(dev.switches())
+	dev.close()
+
+'''
+
+import os
+import ctypes
+import ctypes.util
+
+# libosrfx2.h
+NAME_MAX = 32
+PATH_MAX = 256
+
+READ		= 0x01
+WRITE		= 0x02
+NONBLOCK	= 0x04
+ASYNC		= 0x08
+
+GET_BARS		= 0
+LIGHT_BARS		= 1
+CLEAR_BARS		= 2
+GET_SWITCHES		= 3
+GET_7SEGMENT		= 4
+SET_7SEGMENT		= 5
+GET_STREAM_MODE		= 6
+SET_STREAM_MODE		= 7
+
+MODE_LOOPBACK	= 0
+MODE_SINK		= 1
+MODE_SOURCE		= 2
+
+class Info(ctypes.Structure):
+	'''struct osrfx2_info'''
+	_fields_ = [("name", ctypes.c_char * NAME_MAX),
+		    ("dev_path", ctypes.c_char * PATH_MAX),
+		    ("sys_path", ctypes.c_char * PATH_MAX),
+		    ("packet_size", ctypes.c_int)]
+
+class Ctrl(ctypes.Structure):
+	'''struct osrfx2_ctrl'''
+	_fields_ = [("op", ctypes.c_int),
+		    ("value", ctypes.c_int),
+		    ("result", ctypes.c_int)]
+
+def _load():
+	'''The library of this tree, linux/lib, else the installed one.
+
+	'''
+	here = os.path.dirname(os.path.abspath(__file__))
+	path = os.path.join(here, "..", "..", "lib", "libosrfx2.so.1")
+	if not os.path.exists(path):
+		path = ctypes.util.find_library("osrfx2") or "libosrfx2.so.1"
+	lib = ctypes.CDLL(path)
+
+	dev_p = ctypes.c_void_p
+	lib.osrfx2_find.argtypes = [ctypes.c_char_p, ctypes.POINTER(Info)]
+	lib.osrfx2_enumerate.argtypes = [ctypes.POINTER(Info), ctypes.c_int]
+	lib.osrfx2_open.argtypes = [ctypes.c_char_p, ctypes.c_int,
+				    ctypes.POINTER(dev_p)]
+	lib.osrfx2_close.argtypes = [dev_p]
+	lib.osrfx2_close.restype = None
+	lib.osrfx2_get_info.argtypes = [dev_p]
+	lib.osrfx2_get_info.restype = ctypes.POINTER(Info)
+	lib.osrfx2_fd.argtypes = [dev_p, ctypes.c_int]
+	lib.osrfx2_control.argtypes = [dev_p, ctypes.POINTER(Ctrl), ctypes.c_int]
+	return lib
+
+_lib = _load()
+
+def _check(result, what):
+	if result < 0:
+		raise OSError(-result, os.strerror(-result), what)
+	return result
+
+def _name(name):
+	if name is None or isinstance(name, bytes):
+		return name
+	return name.encode()
+
+def find(name=None):
+	'''The Info of one board, osrfx2_0 if no name is given.
+
+	'''
+	info = Info()
+	_check(_lib.osrfx2_find(_name(name), ctypes.byref(info)), "osrfx2_find")
+	return info
+
+def enumerate():
+	'''The Info of every board, in minor order.
+
+	'''
+	n = _check(_lib.osrfx2_enumerate(None, 0), "osrfx2_enumerate")
+	while True:
+		infos = (Info * n)()
+		m = _check(_lib.osrfx2_enumerate(infos, n), "osrfx2_enumerate")
+		if m <= n:
+			return list(infos)[:m]
+		n = m
+
+class Device(object):
+	'''A handle of one board; flags as osrfx2_open() takes them, 0 to just
+	control it.
+
+	'''
+	def __init__(self, name=None, flags=0):
+		self._dev = ctypes.c_void_p()
+		_check(_lib.osrfx2_open(_name(name), flags, ctypes.byref(self._dev)),
+		       "osrfx2_open")
+
+	def close(self):
+		if self._dev:
+			_lib.osrfx2_close(self._dev)
+			self._dev = ctypes.c_void_p()
+
+	def __enter__(self):
+		return self
+
+	def __exit__(self, *exc):
+		self.close()
+
+	def __del__(self):
+		self.close()
+
+	def info(self):
+		return _lib.osrfx2_get_info(self._dev).contents
+
+	def fd(self, direction):
+		'''The bulk pipe descriptor of READ or WRITE, -1 if not open.
+
+		'''
+		return _lib.osrfx2_fd(self._dev, direction)
+
+	def run(self, ops):
+		'''Run [(op, value), ...] as one osrfx2_control() batch; returns
+		the value of every op, the readings of the getters.
+
+		'''
+		ctrls = (Ctrl * len(ops))()
+		for i in range(len(ops)):
+			ctrls[i].op, ctrls[i].value = ops[i]
+		_check(_lib.osrfx2_control(self._dev, ctrls, len(ops)), "osrfx2_control")
+		return [c.value for c in ctrls]
+
+	def bars(self):
+		return self.run([(GET_BARS, 0)])[0]
+
+	def light_bars(self, bars):
+		self.run([(LIGHT_BARS, bars)])
+
+	def clear_bars(self, bars):
+		self.run([(CLEAR_BARS, bars)])
+
+	def switches(self):
+		return self.run([(GET_SWITCHES, 0)])[0]
+
+	def seven_segment(self):
+		'''The digit shown, None if it is not one.
+
+		'''
+		digit = self.run([(GET_7SEGMENT, 0)])[0]
+		return None if digit < 0 else digit
+
+	def set_seven_segment(self, digit):
+		self.run([(SET_7SEGMENT, digit)])
+
+	def stream_mode(self):
+		return self.run([(GET_STREAM_MODE, 0)])[0]
+
+	def set_stream_mode(self, mode):
+		self.run([(SET_STREAM_MODE, mode)])
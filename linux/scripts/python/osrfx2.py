@@ -25,15 +25,13 @@ import sys
 import getopt
 #from commands import getoutput
 from getch import getch
+import libosrfx2
 
 __DEBUG = 1
 
-BARGRAPH_ON = 0x80
-BARGRAPH_OFF = 0x00
-
 BARGRAPH_MAXBAR = 4 #CY001 only have 4 LED bars availabe
 
-_device_path = ('', '') # store device path in (devFS, sysFS)
+_device = None # libosrfx2.Device of the board
 
 _flag_read					= False
 _len_read					= 512
@@ -45,36 +43,14 @@ _flag_play_with_device 		= False
 _flag_perform_blocking_io 	= True
 _flag_dump_read_data		= False
 
-def find_sys_device(search_path):
-	'''Find the osrfx2 device connected in sysFS.
-	
-	'''
-	found_path = ""
-
-	dev_path = os.path.abspath(search_path)
-	if os.path.exists(dev_path) == False:
-		return ""
-
-	if os.path.islink(dev_path):
-		found_path = os.path.realpath(dev_path)
-		
-	return found_path
-
-
-def get_device_path():
-	''' Get dev and sys path for the osrfx2 device
+def get_device():
+	''' Open the osrfx2 device, None if there is none
 
 	'''
-	device_dev_path = "/dev/osrfx2_0"
-	device_sys_path = find_sys_device("/sys/class/usb/osrfx2_0")
-
-	if False == os.access(device_dev_path, os.R_OK):
-		device_dev_path = ""
-
-	if "" == device_dev_path or "" == device_sys_path:
+	try:
+		return libosrfx2.Device()
+	except OSError:
 		return None
-		
-	return [device_dev_path, device_sys_path]
 
 def usage():
 	print(__doc__)
@@ -143,14 +119,17 @@ def get_mouse_position_by_interrupt():
 	'''
 	pass
 
-def set_bargraph_display(value):
-	'''Function to set bar-graph display.
+def set_bargraph_display(bars, on):
+	'''Function to light (on) or clear bar-graph bars, a bit mask.
 
 	'''
-	str_value = "%d" %(value)
-	command = 'echo' + ' ' + str_value + ' > ' + _device_path[1] + '/device/bargraph ' + '2>/dev/null'
-	#(status, output) = getstatusoutput(command)
-	#return status
+	try:
+		if on:
+			_device.light_bars(bars)
+		else:
+			_device.clear_bars(bars)
+	except (OSError, AttributeError):
+		return -1
 	return 0
 
 def handle_light_one_bar():
@@ -168,10 +147,7 @@ def handle_light_one_bar():
 
 	bar = bar - 1 #normalize to 0 to 3
 
-	barValue = 1 << bar
-	barValue = barValue | BARGRAPH_ON
-
-	if( 0 != set_bargraph_display(barValue)):
+	if( 0 != set_bargraph_display(1 << bar, True)):
 		print("set_bargraph_display failed with error")
 		return
 
@@ -189,20 +165,17 @@ def handle_clear_one_bar():
 		return
 
 	bar = bar - 1 #normalize to 0 to 3
-	barValue = BARGRAPH_OFF; # reset and flag off
-	barValue = barValue | (1 << bar)
-
-	if (0 != set_bargraph_display(barValue)):
+	if (0 != set_bargraph_display(1 << bar, False)):
 		print("set_bargraph_display failed with error")
 		return
 
 def handle_light_all_bars():
-	if( 0 != set_bargraph_display(0x8F)):
+	if( 0 != set_bargraph_display(0x0F, True)):
 		print("set_bargraph_display failed with error")
 		return
 
 def handle_clear_all_bars():
-	if( 0 != set_bargraph_display(0x0F)):
+	if( 0 != set_bargraph_display(0x0F, False)):
 		print("set_bargraph_display failed with error")
 		return
 
@@ -210,18 +183,16 @@ def handle_get_bar_state():
 	'''Function to get bar-graph display status.
 
 	'''
-	#command = 'cat' + ' ' + _device_path[1] + '/device/bargraph ' + '2>/dev/null'
-	bargraph = getoutput(command)
+	try:
+		bargraph = _device.bars()
+	except (OSError, AttributeError):
+		print("get bar graph failed with error")
+		return
 
 	print("Bar Graph:")
-	bar = 'ON' if bargraph[7] == '*' else 'OFF'; print("    Bar8 is %s" %bar)
-	bar = 'ON' if bargraph[6] == '*' else 'OFF'; print("    Bar7 is %s" %bar)
-	bar = 'ON' if bargraph[5] == '*' else 'OFF'; print("    Bar6 is %s" %bar)
-	bar = 'ON' if bargraph[4] == '*' else 'OFF'; print("    Bar5 is %s" %bar)
-	bar = 'ON' if bargraph[3] == '*' else 'OFF'; print("    Bar4 is %s" %bar)
-	bar = 'ON' if bargraph[2] == '*' else 'OFF'; print("    Bar3 is %s" %bar)
-	bar = 'ON' if bargraph[1] == '*' else 'OFF'; print("    Bar2 is %s" %bar)
-	bar = 'ON' if bargraph[0] == '*' else 'OFF'; print("    Bar1 is %s" %bar)
+	for bar in range(8, 0, -1):
+		state = 'ON' if bargraph & (1 << (bar - 1)) else 'OFF'
+		print("    Bar%d is %s" %(bar, state))
 
 LIGHT_ONE_BAR = b'1'
 CLEAR_ONE_BAR = b'2'
@@ -294,18 +265,19 @@ def play_with_device():
 def main(argv):
 
 	global _flag_play_with_device
+	global _device
 	
 	if False == parse_arg(argv):
 		sys.exit()
 
-	_device_path = get_device_path()
-	if None == _device_path:
+	_device = get_device()
+	if None == _device:
 		print("Can't find OSR USB-FX2 device")
 #		sys.exit()
 
 #	print("find OSR USB-FX2 device:")
-#	print(" - %s" %(_device_path[0]))
-#	print(" - %s -> %s" %(_device_path[1]))
+#	print(" - %s" %(_device.info().dev_path))
+#	print(" - %s" %(_device.info().sys_path))
 
 	# start process
 
@@ -5,13 +5,41 @@
 
 #include "stdarg.h"
 
+// Transmit ring, drained by ISR_Serial0. TxHead and TxTail are BYTEs and
+// TX_RING_SIZE is 256, so both wrap by themselves; TxHead == TxTail means
+// empty, so the ring holds at most 255 characters.
+#define TX_RING_SIZE	256
+
+BYTE xdata TxRing[TX_RING_SIZE];
+BYTE TxHead;				// next free slot, written by the loggers
+BYTE TxTail;				// next character to send, written by the ISR
+volatile BOOL TxBusy;			// the ISR is sending or about to be called
+WORD xdata FX2LPSerial_Dropped;		// messages dropped on a full ring
+
+// printf formats into FmtBuf with interrupts on and only copies the result
+// into the ring with them off. A printf from an ISR which finds FmtBuf in
+// use is dropped like one which finds the ring full.
+static char xdata FmtBuf[TX_RING_SIZE - 1];
+static BOOL FmtBusy;
+
+#define TX_FREE()	((BYTE)(TxTail - TxHead - 1))
+
+// Make sure ISR_Serial0 runs: setting TI raises the interrupt as if the
+// last character had just gone out. Interrupts must be off.
+#define TX_KICK()	do { if (!TxBusy) { TxBusy = TRUE; TI = 1; } } while (0)
+
 void FX2LPSerial_Init()  // initializes the registers for using Timer2 as baud rate generator for a Baud rate of 38400.
 {
 	T2CON = 0x34 ;
 	RCAP2H  = 0xFF ;
 	RCAP2L = 0xD9;
 	SCON0 = 0x5A ;
+
+	TxHead = TxTail = 0;
+	FX2LPSerial_Dropped = 0;
+	TxBusy = TRUE;		// TI is set, the first interrupt starts sending
 	TI = 1;
+	ES0 = 1;		// serial port 0 interrupt, once fw.c sets EA
 
 	CPUCS = ((CPUCS & ~bmCLKSPD) | bmCLKSPD1) ;	//Setting up the clock frequency
 
@@ -19,11 +47,32 @@ void FX2LPSerial_Init()  // initializes the registers for using Timer2 as baud r
 	 
 }
 
-void FX2LPSerial_XmitChar(char ch) reentrant // prints a character
+// Serial port 0: send the next character of the ring, if any
+void ISR_Serial0(void) interrupt 4
+{
+	if (RI)
+		RI = 0;			// nothing is received
+	if (TI) {
+		TI = 0;
+		if (TxTail != TxHead)
+			SBUF0 = TxRing[TxTail++];
+		else
+			TxBusy = FALSE;
+	}
+}
+
+void FX2LPSerial_XmitChar(char ch) reentrant // queues a character, dropped if the ring is full
 {
-	while (TI == 0) ;
-	TI = 0 ;
-	SBUF0 = ch ;	//print the character
+	BYTE ea = EA;
+
+	EA = 0;
+	if (TX_FREE() != 0) {
+		TxRing[TxHead++] = ch;
+		TX_KICK();
+	} else {
+		FX2LPSerial_Dropped++;
+	}
+	EA = ea;
 }
 
 void FX2LPSerial_XmitHex1(BYTE b) // intermediate function to print the 4-bit nibble in hex format
@@ -46,27 +95,50 @@ void FX2LPSerial_XmitHex4(WORD w) // prints the value of the WORD variable in he
 	FX2LPSerial_XmitHex2(w & 0xff) ;
 }
 
-void FX2LPSerial_XmitString(char *str) reentrant
+void FX2LPSerial_XmitString(char *str) reentrant // queues a string whole, or drops it
 {
-	while (*str)
-		FX2LPSerial_XmitChar(*str++) ;
+	BYTE ea = EA;
+	char *p;
+	WORD len;
+
+	for (p = str; *p; p++)
+		;
+	len = p - str;
+
+	EA = 0;
+	if (len <= TX_FREE()) {
+		while (*str)
+			TxRing[TxHead++] = *str++;
+		TX_KICK();
+	} else {
+		FX2LPSerial_Dropped++;
+	}
+	EA = ea;
 }
 
-int printf (const char *fmt, ...) reentrant
+// The characters of one printf conversion, hex digits made from the low
+// nibble of b
+static char HexDigit(BYTE b)
+{
+	b &= 0x0f;
+	return (b < 10) ? (b + '0') : (b - 10 + 'A');
+}
+
+// Format fmt into FmtBuf. Returns the number of characters, or -1 if they
+// do not fit, in which case the ring could not take them either.
+static int Format(const char *fmt, va_list ap) reentrant
 {
     const char *s;
 	char c;
 	BYTE b;
     WORD w;
 	int ret = 0;
-    
-	va_list ap;
-    va_start(ap, fmt);
+
+#define PUT(ch)	do { if (ret == sizeof(FmtBuf)) return -1; FmtBuf[ret++] = (ch); } while (0)
 
     while ( *fmt ) {
         if ( *fmt != '%' ) {
-            FX2LPSerial_XmitChar ( *fmt++ );
-			ret++;
+            PUT ( *fmt++ );
             continue;
         }
 		else
@@ -74,8 +146,7 @@ int printf (const char *fmt, ...) reentrant
 			fmt++;
 			if ( 0x00 == *fmt ) {
 				// for the case the format is end with '%'
-				FX2LPSerial_XmitChar ( '%' );
-				ret++;
+				PUT ( '%' );
 				break;
 			}
 		}
@@ -84,38 +155,74 @@ int printf (const char *fmt, ...) reentrant
         case 's':
             s = va_arg ( ap, const char * );
             for ( ; *s; s++ ) {
-                FX2LPSerial_XmitChar ( *s );
-				ret++;
+                PUT ( *s );
             }
             break;
 		case 'c':
 			c = va_arg ( ap, char );
-			FX2LPSerial_XmitChar ( c ) ;
-			ret++;
+			PUT ( c );
             break;
 		case 'b':
 			b = va_arg ( ap, BYTE );
-			FX2LPSerial_XmitHex2 ( b );
-			ret += 2;
+			PUT ( HexDigit ( b >> 4 ) );
+			PUT ( HexDigit ( b ) );
             break;
         case 'x':
             w = va_arg ( ap, WORD );
-			FX2LPSerial_XmitHex4 ( w );
-			ret += 4;
+			PUT ( HexDigit ( w >> 12 ) );
+			PUT ( HexDigit ( w >> 8 ) );
+			PUT ( HexDigit ( w >> 4 ) );
+			PUT ( HexDigit ( w ) );
 			break;
             /* Add other specifiers here... */              
         default:
 			// for unsupport type, just print out as it is
-			FX2LPSerial_XmitChar ( '%' );
-			FX2LPSerial_XmitChar ( *fmt );
-			ret += 2;
+			PUT ( '%' );
+			PUT ( *fmt );
             break;
         }
         fmt++;
     }
-	
+
+#undef PUT
+
+    return ret;
+}
+
+int printf (const char *fmt, ...) reentrant
+{
+	BYTE ea = EA;
+	char xdata *p;
+	int ret;
+	va_list ap;
+
+	EA = 0;
+	if ( FmtBusy ) {
+		FX2LPSerial_Dropped++;
+		EA = ea;
+		return -1;
+	}
+	FmtBusy = TRUE;
+	EA = ea;
+
+    va_start(ap, fmt);
+	ret = Format ( fmt, ap );
 	va_end(ap);
 
+	// Only the copy runs with interrupts off, so that a message from an
+	// ISR can not end up in the middle of this one
+	EA = 0;
+	if ( ret >= 0 && ret <= TX_FREE() ) {
+		for ( p = FmtBuf; p != FmtBuf + ret; p++ )
+			TxRing[TxHead++] = *p;
+		TX_KICK();
+	} else {
+		FX2LPSerial_Dropped++;
+		ret = -1;
+	}
+	FmtBusy = FALSE;
+	EA = ea;
+
     return ret;
 }
 
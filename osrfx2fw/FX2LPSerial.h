@@ -5,6 +5,15 @@
 #define FX2LP_SERIAL
 #ifdef FX2LP_SERIAL
 
+/*---------------------------------------------------------------------------/
+ Output goes through a 256 byte transmit ring which the serial port 0
+ interrupt drains, so none of the functions below waits for the UART. A
+ string or printf message which does not fit in whole is dropped and
+ counted in FX2LPSerial_Dropped, as is a printf from an interrupt while
+ another one is formatting; XmitChar and XmitHex work per character.
+----------------------------------------------------------------------------*/
+extern WORD xdata FX2LPSerial_Dropped;
+
 
 extern void FX2LPSerial_Init() ;
 
@@ -37,6 +46,41 @@ FX2LPSerial_XmitString(char *str) reentrant;
 ----------------------------------------------------------------------------*/
 extern int printf(const char *fmt, ...) reentrant;
 
+/*---------------------------------------------------------------------------/
+ Log levels
+ LOG_LEVEL selects at compile time which of the macros below print; the
+ others expand to nothing, arguments included. They take the printf
+ arguments in double parentheses, C51 has no variadic macros:
+
+     LOG_DBG (( "SetupCommand %b\r\n", SETUPDAT[1] ));
+----------------------------------------------------------------------------*/
+#define LOG_LEVEL_OFF   0
+#define LOG_LEVEL_ERR   1
+#define LOG_LEVEL_INF   2
+#define LOG_LEVEL_DBG   3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INF
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERR
+#define LOG_ERR(args)   printf args
+#else
+#define LOG_ERR(args)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INF
+#define LOG_INF(args)   printf args
+#else
+#define LOG_INF(args)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DBG
+#define LOG_DBG(args)   printf args
+#else
+#define LOG_DBG(args)
+#endif
+
 #endif // FX2LP_SERIAL
 
 #endif // _INCLUDED_FX2LPSERIAL_H
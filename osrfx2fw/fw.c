@@ -107,7 +107,7 @@ void main(void)
 
    // Initialize user device
    TD_Init();
-	printf ( "TD_Init\r\n" );
+	LOG_INF (( "TD_Init\r\n" ));
 
    // The following section of code is used to relocate the descriptor table. 
    // The frameworks uses SUDPTRH and SUDPTRL to automate the SETUP requests
@@ -160,13 +160,13 @@ void main(void)
    // is already set, there is no need to renumerate.  The renum bit will
    // already be set if this firmware was loaded from an eeprom.
 
-   	printf ( "USBCS:%b\r\n", USBCS );
+   	LOG_DBG (( "USBCS:%b\r\n", USBCS ));
 	if(!(USBCS & bmRENUM))
    	{
-    	printf ( "EZUSB_Discon\r\n" );
+    	LOG_INF (( "EZUSB_Discon\r\n" ));
        	EZUSB_Discon(TRUE);   // renumerate
    	}
-	printf ( "USBCS:%b\r\n", USBCS );
+	LOG_DBG (( "USBCS:%b\r\n", USBCS ));
 #endif
 
    // unconditionally re-connect.  If we loaded from eeprom we are
@@ -236,7 +236,7 @@ void SetupCommand(void)
 {
 	void   *dscr_ptr;
 
-	printf ( "SetupCommand %b\r\n", SETUPDAT[1] );
+	LOG_DBG (( "SetupCommand %b\r\n", SETUPDAT[1] ));
    switch(SETUPDAT[1])
    {
       case SC_GET_DESCRIPTOR:                  // *** Get Descriptor
@@ -33,6 +33,10 @@ unicornx       June/2013  N/A             Added comments for Bar Graph
 #define USBFX2LK_SET_7SEGMENT_DISPLAY       0xDB
 #define USBFX2LK_READ_DEVINFO_LEN           0xDC
 #define USBFX2LK_READ_DEVINFO_DATA          0xDD
+#define USBFX2LK_SET_KEY_EVENTS             0xDE
+#define USBFX2LK_READ_COUNTERS              0xDF
+#define USBFX2LK_RESET_COUNTERS             0xE0
+#define USBFX2LK_SET_STREAM_MODE            0xE1
 
 
 /*-----------------------------------------------------------------------------
@@ -74,5 +78,100 @@ unicornx       June/2013  N/A             Added comments for Bar Graph
 #define MOUSEMOV_LEFT  0x04
 #define MOUSEMOV_RIGHT 0x08
 
+/*-----------------------------------------------------------------------------
+  Key event reports
+  By default an EP1 report is one byte, the keys held (MOUSEMOV_* bits), sent
+  again and again while any key is held; a press that comes and goes while a
+  report is pending is lost.
+  USBFX2LK_SET_KEY_EVENTS (no data stage) with wValue 1 switches to event
+  reports, wValue 0 back to the default; a USB reset does so too. Then every
+  change of the keys is queued on the board and a report carries as many
+  queued events as fit, up to 16, KEY_EVENT_LEN bytes each:
+
+ byte: | 0   | 1    | 2           | 3
+ ------+-----+------+-------------+-------------
+ def:  | seq | keys | frame (LSB) | frame (MSB)
+
+ seq numbers the events from 0 after the switch, wrapping at 256; an event
+ dropped because the queue was full still takes its number. keys is the new
+ key state, frame the USB frame number (11 bits, 1ms) the change was seen in.
+-----------------------------------------------------------------------------*/
+#define KEY_EVENT_LEN  4
+
+/*-----------------------------------------------------------------------------
+  Performance counters
+  USBFX2LK_READ_COUNTERS returns COUNTERS_LEN bytes of counters kept by the
+  firmware since power-up or the last USBFX2LK_RESET_COUNTERS (no data stage).
+  All fields are little endian, 4 bytes each except the last two:
+
+ offset: | 0       | 4     | 8      | 12      | 16    | 20     | 22
+ --------+---------+-------+--------+---------+-------+--------+-----------
+ def:    | packets | bytes | infull | reports | polls | cycles | cycles max
+
+ packets, bytes  looped from the bulk OUT to the bulk IN endpoint, or taken
+                 in or sent out in the sink and source stream modes
+ infull          times the OUT endpoint held a packet but the IN endpoint
+                 had no free buffer for it
+ reports         EP1 reports sent
+ polls           TD_Poll passes
+ cycles          instruction cycles (CLKOUT/4, 4 per cycle at 48MHz) the
+                 last looped packet took, and the most any packet took
+-----------------------------------------------------------------------------*/
+#define COUNTERS_LEN   24
+
+/*-----------------------------------------------------------------------------
+  Device information blobs
+  USBFX2LK_READ_DEVINFO_LEN returns in one byte the length of the blob that
+  wIndex selects, USBFX2LK_READ_DEVINFO_DATA the blob itself. Both stall for
+  an unknown wIndex. DATA must ask for at most the length LEN returned (the
+  board sends exactly wLength bytes) and stalls otherwise.
+
+  DEVINFO_TEXT      the device information text, the only blob before
+  DEVINFO_BUILD     build date and time of the firmware, text
+  DEVINFO_COUNTERS  snapshot of the performance counters, as above
+  DEVINFO_CONFIG    DEVINFO_CONFIG_LEN bytes:
+
+ byte: | 0           | 1           | 2          | 3          | 4
+ ------+-------------+-------------+------------+------------+---------------
+ def:  | alt setting | stream mode | key events | high speed | build options
+
+ byte: | 5         | 6 - 7
+ ------+-----------+------------------------------------------
+ def:  | log level | serial log messages dropped (little endian)
+
+  build options: bit 0 LOOPBACK_FAST, bit 1 INTERRUPT_DRIVEN, bit 2
+  CYCLE_STATS (see periph.h); log level: LOG_LEVEL (see FX2LPSerial.h)
+-----------------------------------------------------------------------------*/
+#define DEVINFO_TEXT        0
+#define DEVINFO_BUILD       1
+#define DEVINFO_COUNTERS    2
+#define DEVINFO_CONFIG      3
+
+#define DEVINFO_CONFIG_LEN  8
+
+/*-----------------------------------------------------------------------------
+  Stream modes
+  USBFX2LK_SET_STREAM_MODE (no data stage) selects with wValue what the bulk
+  endpoints do, so each direction can be measured on its own:
+
+  STREAM_LOOPBACK  the default: bulk OUT packets come back on bulk IN
+  STREAM_SINK      bulk OUT packets are thrown away as soon as they arrive,
+                   bulk IN sends nothing
+  STREAM_SOURCE    bulk IN sends full-sized packets without pause; bulk OUT
+                   packets stay in the endpoint buffers until the mode changes
+
+ Every source packet holds a counter pattern:
+
+ byte: | 0 - 3                         | 4 ... size-1
+ ------+-------------------------------+----------------------
+ def:  | packet number (little endian) | n & 0xFF at offset n
+
+ The packet number starts at 0 when the mode is set. Switching modes drops
+ what the bulk IN endpoint held. A USB reset goes back to STREAM_LOOPBACK.
+-----------------------------------------------------------------------------*/
+#define STREAM_LOOPBACK  0
+#define STREAM_SINK      1
+#define STREAM_SOURCE    2
+
 #endif // _ICD_H
 
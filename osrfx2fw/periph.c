@@ -41,17 +41,41 @@ BYTE AlternateSetting;          // Alternate settings
 #define VR_NAKALL_ON    0xD0
 #define VR_NAKALL_OFF   0xD1
 
-#define EP0BUFF_SIZE	0x40
-
 /*-----------------------------------------------------------------------------
   Mouse Position tracking simulation
 -----------------------------------------------------------------------------*/
 BYTE xdata KeyS; // Key State, real-time key state. Board produces key actions 
                  // (UP, DOWN, LEFT, RIGHT) and report this to host through EP1
 
+// Key event queue, used once the host asked for event reports (see icd.h).
+// Every change of KeyS is queued with its sequence number and USB frame
+// until an EP1 report takes it; a full queue drops the new event, which
+// still uses up its sequence number so the host sees the gap.
+#define KEY_EVENTS          32      // queue length, a power of two
+#define KEY_EVENTS_REPORT   (64 / KEY_EVENT_LEN)
+
+BOOL KeyEvents;                             // event reports on
+BYTE xdata KeyQ[KEY_EVENTS][KEY_EVENT_LEN];
+BYTE KeyQHead;                              // oldest queued event
+BYTE KeyQCount;
+BYTE KeySeq;                                // number of the next event
+BYTE KeyLast;                               // KeyS of the last event
+
 void MP_Init ( void )
 {
 	KeyS = 0x0;
+	KeyEvents = FALSE;
+}
+
+// Switch event reports on or off, starting from an empty queue
+void MP_SetEvents ( BOOL on )
+{
+	EA = 0;                 // the queue may be in use by KeyService
+	KeyEvents = on;
+	KeyQHead = KeyQCount = 0;
+	KeySeq = 0;
+	KeyLast = 0;
+	EA = 1;
 }
 
 
@@ -108,14 +132,201 @@ void BG_Get ( void )
 /*-----------------------------------------------------------------------------
 	Device Information
 -----------------------------------------------------------------------------*/
-BYTE xdata devInfo[] = "SW version is: 1.0.0.0\n"
-                       "Flex version is: 1.0.0.0\n"
-                       "IMEI is: 1234567890\n";
+// The blobs of USBFX2LK_READ_DEVINFO_LEN/DATA, selected by wIndex (see
+// icd.h). The SUDPTR auto transfer sends them: the FX2 moves one EP0 packet
+// after the other by itself while TD_Poll goes on.
+extern BYTE code DevInfoText[];     // dscr.a51
+extern BYTE xdata Ep0Blob[];        // dscr.a51, EP0_BLOB_MAX bytes
 #define LEN_DEVINFO 68
 
+char code BuildId[] = __DATE__ " " __TIME__;
+
+/*-----------------------------------------------------------------------------
+	Performance Counters
+-----------------------------------------------------------------------------*/
+// see icd.h for their meaning; updated from the endpoint interrupts too
+DWORD xdata CntPackets;
+DWORD xdata CntBytes;
+DWORD xdata CntInFull;
+DWORD xdata CntReports;
+DWORD xdata CntPolls;
+WORD xdata CntCycles;
+WORD xdata CntCyclesMax;
+
+void CNT_Reset ( void )
+{
+	EA = 0;
+	CntPackets = CntBytes = CntInFull = CntReports = CntPolls = 0;
+	CntCycles = CntCyclesMax = 0;
+	EA = 1;
+}
+
+// Store v little endian at p
+static void CNT_Put ( volatile BYTE xdata *p, DWORD v )
+{
+	p[0] = (BYTE)v;
+	p[1] = (BYTE)(v >> 8);
+	p[2] = (BYTE)(v >> 16);
+	p[3] = (BYTE)(v >> 24);
+}
+
+// Write the counters to p in the layout of icd.h
+void CNT_Snapshot ( volatile BYTE xdata *p )
+{
+	EA = 0;                 // one consistent snapshot
+	CNT_Put( p,      CntPackets );
+	CNT_Put( p + 4,  CntBytes );
+	CNT_Put( p + 8,  CntInFull );
+	CNT_Put( p + 12, CntReports );
+	CNT_Put( p + 16, CntPolls );
+	p[20] = LSB( CntCycles );
+	p[21] = MSB( CntCycles );
+	p[22] = LSB( CntCyclesMax );
+	p[23] = MSB( CntCyclesMax );
+	EA = 1;
+}
+
+void CNT_Get ( void )
+{
+	CNT_Snapshot( EP0BUF );
+
+	EP0BCH=0;
+	SYNCDELAY;
+	EP0BCL=COUNTERS_LEN;
+	SYNCDELAY;
+}
+
 /*-----------------------------------------------------------------------------
 	End Points
 -----------------------------------------------------------------------------*/
+// EPIE/EPIRQ bits
+#define EPIRQ_EP1IN     0x04
+#define EPIRQ_EP2       0x10
+#define EPIRQ_EP6       0x40
+#define EPIRQ_EP8       0x80
+
+#if CYCLE_STATS
+#define CYCLE_REPORT    1024    // looped packets between two reports
+
+WORD xdata CycPktMin;           // cycles to move one packet
+WORD xdata CycPktMax;
+WORD xdata CycGapMax;           // polled: between TD_Poll passes,
+                                // interrupt driven: one endpoint interrupt
+WORD xdata CycPackets;          // packets since the last report
+#endif
+
+// Bulk loopback endpoints of the current alternate setting, set by EP_Config
+volatile BYTE xdata *LoopOutFifo;   // EPxFIFOBUF of the OUT endpoint
+volatile BYTE xdata *LoopInFifo;    // EPxFIFOBUF of the IN endpoint
+volatile BYTE xdata *LoopOutBC;     // EPxBCH of the OUT endpoint, EPxBCL follows
+volatile BYTE xdata *LoopInBC;      // EPxBCH of the IN endpoint, EPxBCL follows
+BYTE LoopOutEmpty;                  // EP2468STAT bit: OUT endpoint has no packet
+BYTE LoopInFull;                    // EP2468STAT bit: IN endpoint has no buffer
+BYTE LoopInEp;                      // number of the IN endpoint, for FIFORESET
+BYTE LoopInBuffers;                 // buffers of the IN endpoint
+
+// Stream mode (see icd.h). A source packet gets the byte ramp written only
+// while SourceFill says some IN buffer never had it, later just its number.
+BYTE StreamMode;
+BYTE SourceFill;
+DWORD xdata SourceSeq;
+
+#if INTERRUPT_DRIVEN
+// Set by SM_Set for the next SOF interrupt to run the loop: a source, or
+// OUT packets held over the switch, raise no endpoint interrupt on their own,
+// and LoopPacket must stay out of the main context call tree (overlaid data)
+volatile BOOL LoopKick;
+#endif
+
+void EP_Config ( BYTE alt )
+{
+  BYTE outBuffers;
+#if INTERRUPT_DRIVEN
+  BYTE irqs;
+
+  // keep the loopback interrupts away while the endpoints change under them
+  EPIE &= ~(EPIRQ_EP2 | EPIRQ_EP6 | EPIRQ_EP8);
+#endif
+
+  // The buffer RAM is laid out by the EP2/EP6 BUF bits, see TRM 1.18. An
+  // endpoint which is not part of the setting has its VALID bit cleared.
+  switch ( alt )
+  {
+  case ALT_QUAD_OUT: // EP2 OUT 4 x 512 -> EP8 IN 2 x 512
+    EP2CFG = 0xA0;  SYNCDELAY;
+    EP4CFG = 0;     SYNCDELAY;
+    EP6CFG = 0;     SYNCDELAY;
+    EP8CFG = 0xE0;  SYNCDELAY;
+    LoopOutFifo = EP2FIFOBUF;   LoopOutBC = &EP2BCH;  LoopOutEmpty = bmEP2EMPTY;
+    LoopInFifo  = EP8FIFOBUF;   LoopInBC  = &EP8BCH;  LoopInFull   = bmEP8FULL;
+    LoopInEp = 8;   LoopInBuffers = 2;
+    outBuffers = 4;
+#if INTERRUPT_DRIVEN
+    irqs = EPIRQ_EP2 | EPIRQ_EP8;
+#endif
+    break;
+
+  case ALT_QUAD:     // EP2 OUT 4 x 512 -> EP6 IN 4 x 512
+    EP2CFG = 0xA0;  SYNCDELAY;
+    EP4CFG = 0;     SYNCDELAY;
+    EP6CFG = 0xE0;  SYNCDELAY;
+    EP8CFG = 0;     SYNCDELAY;
+    LoopOutFifo = EP2FIFOBUF;   LoopOutBC = &EP2BCH;  LoopOutEmpty = bmEP2EMPTY;
+    LoopInFifo  = EP6FIFOBUF;   LoopInBC  = &EP6BCH;  LoopInFull   = bmEP6FULL;
+    LoopInEp = 6;   LoopInBuffers = 4;
+    outBuffers = 4;
+#if INTERRUPT_DRIVEN
+    irqs = EPIRQ_EP2 | EPIRQ_EP6;
+#endif
+    break;
+
+  default:           // ALT_DOUBLE: EP6 OUT 2 x 512 -> EP8 IN 2 x 512
+    // ep6: bulk, OUT, maxPacketSize 64 bytes in full-speed, 512 bytes in high-speed
+    // ep8: bulk, IN, maxPacketSize 64 bytes in full-speed, 512 bytes in high-speed
+    EP2CFG = 0;     SYNCDELAY;
+    EP4CFG = 0;     SYNCDELAY;
+    EP6CFG = 0xA2;  SYNCDELAY;
+    EP8CFG = 0xE0;  SYNCDELAY;
+    LoopOutFifo = EP6FIFOBUF;   LoopOutBC = &EP6BCH;  LoopOutEmpty = bmEP6EMPTY;
+    LoopInFifo  = EP8FIFOBUF;   LoopInBC  = &EP8BCH;  LoopInFull   = bmEP8FULL;
+    LoopInEp = 8;   LoopInBuffers = 2;
+    outBuffers = 2;
+#if INTERRUPT_DRIVEN
+    irqs = EPIRQ_EP6 | EPIRQ_EP8;
+#endif
+    break;
+  }
+
+  // drop whatever the old layout held and start all data toggles at DATA0
+  FIFORESET = 0x80;  SYNCDELAY; // NAK all transfers while resetting
+  FIFORESET = 0x02;  SYNCDELAY;
+  FIFORESET = 0x04;  SYNCDELAY;
+  FIFORESET = 0x06;  SYNCDELAY;
+  FIFORESET = 0x08;  SYNCDELAY;
+  FIFORESET = 0x00;  SYNCDELAY;
+
+  TOGCTL = 0x02;  TOGCTL |= bmRESETTOGGLE;    // EP2 OUT
+  TOGCTL = 0x06;  TOGCTL |= bmRESETTOGGLE;    // EP6 OUT
+  TOGCTL = 0x16;  TOGCTL |= bmRESETTOGGLE;    // EP6 IN
+  TOGCTL = 0x18;  TOGCTL |= bmRESETTOGGLE;    // EP8 IN
+  SourceFill = LoopInBuffers;                 // fresh buffers
+
+  // out endpoints do not come up armed: write a dummy byte count with skip
+  // once per buffer
+  while ( outBuffers-- )
+  {
+    LoopOutBC[1] = 0x80;
+    SYNCDELAY;
+  }
+
+#if INTERRUPT_DRIVEN
+  // an OUT endpoint interrupts when a packet arrived, an IN endpoint when
+  // the host took one; either may let the next packet move
+  EPIRQ = EPIRQ_EP2 | EPIRQ_EP6 | EPIRQ_EP8;  // drop stale requests
+  EPIE |= irqs;
+#endif
+}
+
 void EP_Init ( void )
 {
   // Registers which require a synchronization delay, see section 15.14
@@ -148,25 +359,11 @@ void EP_Init ( void )
   
   SYNCDELAY;                    // see TRM section 15.14
   
-  // ep6: bulk, OUT, maxPacketSize 64 bytes in full-speed, 512 bytes in high-speed
-  EP6CFG = 0xA2;
-  
-  SYNCDELAY;                    
-
-  // ep8: bulk, IN, maxPacketSize 64 bytes in full-speed, 512 bytes in high-speed  
-  EP8CFG = 0xE0;
-
-  SYNCDELAY;
-
-  EP2CFG = EP4CFG = 0; // not used
-  
-  // out endpoints do not come up armed
-  
-  // since the defaults are double buffered we must write dummy byte counts twice
-  SYNCDELAY;                    
-  EP6BCL = 0x80;                // arm EP6OUT by writing byte count w/skip.
-  SYNCDELAY;                    
-  EP6BCL = 0x80;
+  // bulk endpoints: the OSRFX2 layout until the host selects another
+  // alternate setting
+  AlternateSetting = ALT_DOUBLE;
+  StreamMode = STREAM_LOOPBACK;
+  EP_Config( AlternateSetting );
   
   // enable dual autopointer feature
   AUTOPTRSETUP |= 0x01;
@@ -185,7 +382,7 @@ void TD_Init(void)             // Called once at startup
   // set the CPU clock to 48MHz
   //CPUCS = ((CPUCS & ~bmCLKSPD) | bmCLKSPD1) ;	// Commented since the CPU frequency is configured in FX2LPSerial_Init()
   FX2LPSerial_Init(); 					// Serial Debug Code Start
-  printf ( "Serial port initialized\r\n" );
+  LOG_INF (( "Serial port initialized\r\n" ));
 
   // set the slave FIFO interface to 48MHz
   IFCONFIG |= 0x40;
@@ -200,13 +397,77 @@ void TD_Init(void)             // Called once at startup
   IOD=0xF0;	  // LEDs off; 7-Seg off.
 
 	EP_Init();
+
+#if INTERRUPT_DRIVEN
+  // keys are sampled once per (micro)frame; fw.c enables INT2 afterwards
+  USBIE |= bmSOF;
+  EPIE |= EPIRQ_EP1IN;
+#endif
+
+  TMOD = (TMOD & 0xF0) | 0x01;  // timer 0: 16 bit, free running
+  CKCON |= 0x08;                // T0M: count CLKOUT/4
+  TR0 = 1;
+  CNT_Reset();
+
+#if CYCLE_STATS
+  CycPktMin = 0xFFFF;
+  CycPktMax = CycGapMax = CycPackets = 0;
+#endif
 }
 
 
-void TD_Poll(void)              // Called repeatedly while the device is idle
+//-----------------------------------------------------------------------------
+// Endpoint servicing
+//   Called from TD_Poll, or from the endpoint and SOF interrupts when
+//   INTERRUPT_DRIVEN is set (see periph.h), never from both.
+//-----------------------------------------------------------------------------
+
+// Report the keys on EP1: the keys held, repeated while any is held, or the
+// queued key events once the host asked for those
+void KeyService ( void )
 {
-  WORD i;
-  WORD count;
+  BYTE xdata *e;
+  BYTE n, i;
+
+  if ( KeyEvents )
+  {
+    // queue every change of the keys
+  	OEA=0xF0;// low 2 bits	 
+		OEB=0xF0;// low 4 bits		
+		KeyS=(~IOA&0x3)*0x10 + (~IOB&0x0F); 
+
+    if ( KeyS != KeyLast )
+    {
+      KeyLast = KeyS;
+      if ( KeyQCount < KEY_EVENTS )
+      {
+        e = KeyQ[(KeyQHead + KeyQCount) & (KEY_EVENTS - 1)];
+        e[0] = KeySeq;
+        e[1] = KeyS;
+        e[2] = USBFRAMEL;
+        e[3] = USBFRAMEH;
+        KeyQCount++;
+      }
+      KeySeq++;
+    }
+
+    // and send as many as one packet holds once EP1 is free
+    if ( KeyQCount != 0 && !(EP1INCS & bmEPBUSY) )
+    {
+      n = 0;
+      while ( KeyQCount != 0 && n < KEY_EVENTS_REPORT * KEY_EVENT_LEN )
+      {
+        e = KeyQ[KeyQHead];
+        for ( i = 0; i < KEY_EVENT_LEN; i++ )
+          EP1INBUF[n++] = e[i];
+        KeyQHead = (KeyQHead + 1) & (KEY_EVENTS - 1);
+        KeyQCount--;
+      }
+      EP1INBC = n;          // shoot
+      CntReports++;
+    }
+    return;
+  }
 
 	// Poll Key State
   if( !(EP1INCS & bmEPBUSY) ) // check if EP1 is ready
@@ -220,35 +481,215 @@ void TD_Poll(void)              // Called repeatedly while the device is idle
 	  {
 			EP1INBUF[0] = KeyS; // arm to EP1 IN buffer
 			EP1INBC = 1; 		    // shoot
+			CntReports++;
 	  }      
   }		   
+}
 
-  // EP6 -> EP8
-  if(!(EP2468STAT & bmEP6EMPTY))
-  { // check EP6 EMPTY(busy) bit in EP2468STAT (SFR), core set's this bit when FIFO is empty
-     if(!(EP2468STAT & bmEP8FULL))
-     {  // check EP8 FULL(busy) bit in EP2468STAT (SFR), core set's this bit when FIFO is full
-        APTR1H = MSB( &EP6FIFOBUF );
-        APTR1L = LSB( &EP6FIFOBUF );
-
-        AUTOPTRH2 = MSB( &EP8FIFOBUF );
-        AUTOPTRL2 = LSB( &EP8FIFOBUF );
-
-        count = (EP6BCH << 8) + EP6BCL;
-
-        // loop EP6OUT buffer data to EP8IN
-        for( i = 0x0000; i < count; i++ )
-        {
-           // setup to transfer EP6OUT buffer to EP8IN buffer using AUTOPOINTER(s)
-           EXTAUTODAT2 = EXTAUTODAT1;
-        }
-        EP8BCH = EP6BCH;  
-        SYNCDELAY;  
-        EP8BCL = EP6BCL;        // arm EP8IN
-        SYNCDELAY;                    
-        EP6BCL = 0x80;          // re(arm) EP6OUT
-     }
+// Account for one packet of count bytes which took cycles to handle
+static void CountPacket ( WORD count, WORD cycles )
+{
+  CntPackets++;
+  CntBytes += count;
+  CntCycles = cycles;
+  if ( cycles > CntCyclesMax ) CntCyclesMax = cycles;
+
+#if CYCLE_STATS
+  if ( cycles < CycPktMin ) CycPktMin = cycles;
+  if ( cycles > CycPktMax ) CycPktMax = cycles;
+  CycPackets++;
+#endif
+}
+
+// STREAM_SINK: hand an OUT packet straight back to the endpoint
+static BOOL SinkPacket ( void )
+{
+  WORD count;
+  WORD t0, t1;
+
+  if( EP2468STAT & LoopOutEmpty )
+     return(FALSE);
+
+  CYCLE_READ( t0 );
+  count = (LoopOutBC[0] << 8) + LoopOutBC[1];
+  LoopOutBC[1] = 0x80;         // re(arm) OUT, skipping the data
+  SYNCDELAY;
+  CYCLE_READ( t1 );
+
+  CountPacket( count, t1 - t0 );
+  return(TRUE);
+}
+
+// STREAM_SOURCE: send the next counter pattern packet, see icd.h
+static BOOL SourcePacket ( void )
+{
+  WORD size, i;
+  WORD t0, t1;
+
+  if( EP2468STAT & LoopInFull )
+     return(FALSE);
+
+  CYCLE_READ( t0 );
+  size = EZUSB_HIGHSPEED() ? 512 : 64;
+
+  if ( SourceFill )            // the buffers take turns, so after the first
+  {                            // LoopInBuffers packets all hold the ramp
+    AUTOPTRH2 = MSB( LoopInFifo );
+    AUTOPTRL2 = LSB( LoopInFifo );
+    for( i = 0x0000; i < size; i++ )
+      EXTAUTODAT2 = (BYTE)i;
+    SourceFill--;
   }
+
+  LoopInFifo[0] = (BYTE)SourceSeq;
+  LoopInFifo[1] = (BYTE)(SourceSeq >> 8);
+  LoopInFifo[2] = (BYTE)(SourceSeq >> 16);
+  LoopInFifo[3] = (BYTE)(SourceSeq >> 24);
+  SourceSeq++;
+
+  LoopInBC[0] = MSB( size );
+  SYNCDELAY;
+  LoopInBC[1] = LSB( size );   // arm IN
+  SYNCDELAY;
+  CYCLE_READ( t1 );
+
+  CountPacket( size, t1 - t0 );
+  return(TRUE);
+}
+
+// Switch the stream mode, dropping what the IN endpoint held; its data
+// toggle is left alone, the host does not know about the switch
+void SM_Set ( BYTE mode )
+{
+  EA = 0;                       // the endpoint interrupts use the mode
+  FIFORESET = 0x80;  SYNCDELAY; // NAK all transfers while resetting
+  FIFORESET = LoopInEp;  SYNCDELAY;
+  FIFORESET = 0x00;  SYNCDELAY;
+
+  StreamMode = mode;
+  SourceFill = LoopInBuffers;
+  SourceSeq = 0;
+#if INTERRUPT_DRIVEN
+  LoopKick = TRUE;              // a source starts without an endpoint interrupt
+#endif
+  EA = 1;
+}
+
+// Bulk OUT -> bulk IN of the current alternate setting (EP6 -> EP8 in
+// alt 0), see EP_Config. Moves one packet if the OUT endpoint holds one and
+// the IN endpoint has room for it; returns TRUE if it did. In the sink and
+// source stream modes it takes in or sends out one packet instead.
+BOOL LoopPacket ( void )
+{
+  WORD count;
+#if !LOOPBACK_FAST
+  WORD i;
+#endif
+  WORD t0, t1;
+
+  if ( StreamMode == STREAM_SINK )
+     return SinkPacket();
+  if ( StreamMode == STREAM_SOURCE )
+     return SourcePacket();
+
+  // check OUT EMPTY(busy) bit in EP2468STAT (SFR), core set's this bit when FIFO is empty
+  // check IN FULL(busy) bit in EP2468STAT (SFR), core set's this bit when FIFO is full
+  if( EP2468STAT & LoopOutEmpty )
+     return(FALSE);
+  if( EP2468STAT & LoopInFull )
+  {
+     CntInFull++;           // the packet waits for the host to read
+     return(FALSE);
+  }
+
+  CYCLE_READ( t0 );
+
+  APTR1H = MSB( LoopOutFifo );
+  APTR1L = LSB( LoopOutFifo );
+
+  AUTOPTRH2 = MSB( LoopInFifo );
+  AUTOPTRL2 = LSB( LoopInFifo );
+
+  count = (LoopOutBC[0] << 8) + LoopOutBC[1];
+
+#if LOOPBACK_FAST
+  LoopCopy( count );
+#else
+  // loop OUT buffer data to IN
+  for( i = 0x0000; i < count; i++ )
+  {
+     // setup to transfer OUT buffer to IN buffer using AUTOPOINTER(s)
+     EXTAUTODAT2 = EXTAUTODAT1;
+  }
+#endif
+
+  LoopInBC[0] = LoopOutBC[0];
+  SYNCDELAY;
+  LoopInBC[1] = LoopOutBC[1];  // arm IN
+  SYNCDELAY;
+  LoopOutBC[1] = 0x80;         // re(arm) OUT
+  SYNCDELAY;
+
+  CYCLE_READ( t1 );
+
+  CountPacket( count, t1 - t0 );
+  return(TRUE);
+}
+
+#if CYCLE_STATS
+// Print and restart the cycle statistics every CYCLE_REPORT packets
+void CycleReport ( void )
+{
+  WORD pktMin, pktMax, gapMax;
+
+  if ( CycPackets < CYCLE_REPORT )
+    return;
+
+  EA = 0;                       // a consistent snapshot
+  pktMin = CycPktMin;
+  pktMax = CycPktMax;
+  gapMax = CycGapMax;
+  CycPktMin = 0xFFFF;
+  CycPktMax = CycGapMax = CycPackets = 0;
+  EA = 1;
+
+#if INTERRUPT_DRIVEN
+  printf ( "cycles: packet %x-%x, irq max %x\r\n", pktMin, pktMax, gapMax );
+#else
+  printf ( "cycles: packet %x-%x, poll gap max %x\r\n", pktMin, pktMax, gapMax );
+#endif
+}
+#endif
+
+void TD_Poll(void)              // Called repeatedly while the device is idle
+{
+#if CYCLE_STATS && !INTERRUPT_DRIVEN
+  static WORD xdata last;
+  WORD now;
+
+  // how long a packet may have waited for this pass
+  CYCLE_READ( now );
+  if ( (WORD)(now - last) > CycGapMax ) CycGapMax = now - last;
+#endif
+
+  CntPolls++;
+
+#if !INTERRUPT_DRIVEN
+  KeyService();
+
+#if LOOPBACK_FAST
+  while( LoopPacket() );        // every packet the IN endpoint has room for
+#else
+  LoopPacket();
+#endif
+#endif
+
+#if CYCLE_STATS
+  CycleReport();
+#if !INTERRUPT_DRIVEN
+  CYCLE_READ( last );           // the report itself is not counted
+#endif
+#endif
 }
 
 BOOL TD_Suspend(void)          // Called before the device goes into suspend mode
@@ -272,6 +713,49 @@ BOOL TD_Resume(void)          // Called after the device resumes
 	return(TRUE);
 }
 
+// Find device information blob index, building it in Ep0Blob first if it
+// is made at request time. Returns its length and sets *addr, or returns 0
+// if there is no such blob.
+static BYTE DI_Blob ( BYTE index, WORD *addr )
+{
+  BYTE i;
+
+  switch ( index )
+  {
+  case DEVINFO_TEXT:
+    *addr = (WORD)DevInfoText;
+    return LEN_DEVINFO;
+
+  case DEVINFO_BUILD:
+    for ( i = 0; BuildId[i] != 0; i++ )
+      Ep0Blob[i] = BuildId[i];
+    *addr = (WORD)Ep0Blob;
+    return i;
+
+  case DEVINFO_COUNTERS:
+    CNT_Snapshot( Ep0Blob );
+    *addr = (WORD)Ep0Blob;
+    return COUNTERS_LEN;
+
+  case DEVINFO_CONFIG:
+    Ep0Blob[0] = AlternateSetting;
+    Ep0Blob[1] = StreamMode;
+    Ep0Blob[2] = KeyEvents;
+    Ep0Blob[3] = EZUSB_HIGHSPEED() ? 1 : 0;
+    Ep0Blob[4] = (LOOPBACK_FAST ? 0x01 : 0) | (INTERRUPT_DRIVEN ? 0x02 : 0) |
+                 (CYCLE_STATS ? 0x04 : 0);
+    Ep0Blob[5] = LOG_LEVEL;
+    EA = 0;
+    Ep0Blob[6] = LSB( FX2LPSerial_Dropped );
+    Ep0Blob[7] = MSB( FX2LPSerial_Dropped );
+    EA = 1;
+    *addr = (WORD)Ep0Blob;
+    return DEVINFO_CONFIG_LEN;
+  }
+
+  return 0;
+}
+
 //-----------------------------------------------------------------------------
 // Device Request hooks
 //   The following hooks are called by the end point 0 device request parser.
@@ -285,6 +769,11 @@ BOOL DR_GetDescriptor(void)
 BOOL DR_SetConfiguration(void)   // Called when a Set Configuration command is received
 {
    Configuration = SETUPDAT[2];
+
+   // every interface starts over in alt 0 (USB 2.0 9.1.1.5), and the host
+   // won't say so with a Set Interface
+   AlternateSetting = ALT_DOUBLE;
+   EP_Config( AlternateSetting );
    return(TRUE);            // Handled by user code
 }
 
@@ -298,7 +787,14 @@ BOOL DR_GetConfiguration(void)   // Called when a Get Configuration command is r
 
 BOOL DR_SetInterface(void)       // Called when a Set Interface command is received
 {
+   if ( SETUPDAT[4] != 0 || SETUPDAT[2] >= ALT_COUNT )
+   {
+      EZUSB_STALL_EP0();    // no such interface/alternate setting
+      return(TRUE);
+   }
+
    AlternateSetting = SETUPDAT[2];
+   EP_Config( AlternateSetting );
    return(TRUE);            // Handled by user code
 }
 
@@ -328,8 +824,8 @@ BOOL DR_SetFeature(void)
 BOOL DR_VendorCmnd(void)
 {
   BYTE tmp;
-	WORD lenTotal, lenSent, i;
-	BYTE *addr;
+	BYTE len;
+	WORD addr;
   
   switch (SETUPDAT[1])
   {
@@ -355,8 +851,29 @@ BOOL DR_VendorCmnd(void)
 		BG_Get();
 		break;
 
+	case USBFX2LK_SET_KEY_EVENTS:
+		MP_SetEvents( SETUPDAT[2] != 0 );
+		break;
+
+	case USBFX2LK_READ_COUNTERS:
+		CNT_Get();
+		break;
+
+	case USBFX2LK_RESET_COUNTERS:
+		CNT_Reset();
+		break;
+
+	case USBFX2LK_SET_STREAM_MODE:
+		if ( SETUPDAT[2] > STREAM_SOURCE || SETUPDAT[3] != 0 )
+			return(TRUE);     // stall: no such mode
+		SM_Set( SETUPDAT[2] );
+		break;
+
 	case USBFX2LK_READ_DEVINFO_LEN:
-		EP0BUF[0] = LEN_DEVINFO;
+		len = DI_Blob( SETUPDAT[4], &addr );
+		if ( len == 0 || SETUPDAT[5] != 0 )
+			return(TRUE);     // stall: no such blob
+		EP0BUF[0] = len;
 		EP0BCH=0;
 		SYNCDELAY;
 		EP0BCL=1;
@@ -364,31 +881,17 @@ BOOL DR_VendorCmnd(void)
 		break;
 
 	case USBFX2LK_READ_DEVINFO_DATA:
-		lenTotal = LEN_DEVINFO;
-		addr = devInfo;
-
-		while ( lenTotal ) // Move requested data through EP0IN 
-		{							     // one packet at a time.
-			while(EP0CS & bmEPBUSY);
-			if ( lenTotal < EP0BUFF_SIZE ) {
-				lenSent = lenTotal;
-			}
-			else {
-				lenSent = EP0BUFF_SIZE;
-			}
-			for ( i = 0; i < lenSent; i++ ) {
-				*(EP0BUF+i) = *((BYTE xdata *)addr+i);
-			}
-
-			EP0BCH = 0;
-			SYNCDELAY;
-			EP0BCL = (BYTE)lenSent; // Arm endpoint with # bytes to transfer
-			SYNCDELAY;
-
-			addr += lenSent;
-			lenTotal -= lenSent;
-		}
-
+		len = DI_Blob( SETUPDAT[4], &addr );
+		// the auto transfer sends wLength bytes, whatever follows the blob
+		// included, so the host may not ask for more than it holds
+		if ( len == 0 || SETUPDAT[5] != 0 ||
+		     SETUPDAT[7] != 0 || SETUPDAT[6] > len )
+			return(TRUE);     // stall
+		if ( SETUPDAT[6] == 0 )
+			break;            // no data stage
+
+		SUDPTRH = MSB( addr );  // and the FX2 does the rest
+		SUDPTRL = LSB( addr );
 		break;
 
      default:
@@ -422,11 +925,22 @@ void ISR_Sof(void) interrupt 0
 {
    EZUSB_IRQ_CLEAR();
    USBIRQ = bmSOF;            // Clear SOF IRQ
+#if INTERRUPT_DRIVEN
+   KeyService();              // sample the keys once per (micro)frame
+   if ( LoopKick )            // the stream mode changed, see SM_Set
+   {
+      LoopKick = FALSE;
+      while( LoopPacket() );
+   }
+#endif
 }
 
 void ISR_Ures(void) interrupt 0
 {
-   printf ( "USB Reset ISR triggered\r\n" );
+   LOG_INF (( "USB Reset ISR triggered\r\n" ));
+   KeyEvents = FALSE;        // back to plain key reports, see icd.h
+   StreamMode = STREAM_LOOPBACK;
+   AlternateSetting = ALT_DOUBLE; // the endpoints follow at Set Configuration
    // whenever we get a USB reset, we should revert to full speed mode
    pConfigDscr = pFullSpeedConfigDscr;
    ((CONFIGDSCR xdata *) pConfigDscr)->type = CONFIG_DSCR;
@@ -439,7 +953,7 @@ void ISR_Ures(void) interrupt 0
 
 void ISR_Susp(void) interrupt 0
 {
-	printf ( "USB Suspend ISR triggered\r\n" );
+	LOG_INF (( "USB Suspend ISR triggered\r\n" ));
 
 	// turn off all bars
 	IOD = IOD | 0xF0; //  below 4Pin
@@ -481,21 +995,71 @@ void ISR_Ep0out(void) interrupt 0
 }
 void ISR_Ep1in(void) interrupt 0
 {
+#if INTERRUPT_DRIVEN
+   EZUSB_IRQ_CLEAR();
+   EPIRQ = EPIRQ_EP1IN;       // Clear EP1 IN IRQ
+   KeyService();              // the host took the report, send the next one
+#endif
 }
 void ISR_Ep1out(void) interrupt 0
 {
 }
 void ISR_Ep2inout(void) interrupt 0
 {
+#if INTERRUPT_DRIVEN
+#if CYCLE_STATS
+   WORD t0, t1;
+
+   CYCLE_READ( t0 );
+#endif
+   EZUSB_IRQ_CLEAR();
+   EPIRQ = EPIRQ_EP2;         // Clear EP2 IRQ before looking, so a packet
+                              // arriving meanwhile raises it again
+   while( LoopPacket() );
+#if CYCLE_STATS
+   CYCLE_READ( t1 );
+   if ( (WORD)(t1 - t0) > CycGapMax ) CycGapMax = t1 - t0;
+#endif
+#endif
 }
 void ISR_Ep4inout(void) interrupt 0
 {
 }
 void ISR_Ep6inout(void) interrupt 0
 {
+#if INTERRUPT_DRIVEN
+#if CYCLE_STATS
+   WORD t0, t1;
+
+   CYCLE_READ( t0 );
+#endif
+   EZUSB_IRQ_CLEAR();
+   EPIRQ = EPIRQ_EP6;         // Clear EP6 IRQ before looking, so a packet
+                              // arriving meanwhile raises it again
+   while( LoopPacket() );
+#if CYCLE_STATS
+   CYCLE_READ( t1 );
+   if ( (WORD)(t1 - t0) > CycGapMax ) CycGapMax = t1 - t0;
+#endif
+#endif
 }
 void ISR_Ep8inout(void) interrupt 0
 {
+#if INTERRUPT_DRIVEN
+#if CYCLE_STATS
+   WORD t0, t1;
+
+   CYCLE_READ( t0 );
+#endif
+   EZUSB_IRQ_CLEAR();
+   EPIRQ = EPIRQ_EP8;         // Clear EP8 IRQ before looking, so a packet
+                              // arriving meanwhile raises it again
+   while( LoopPacket() );
+#if CYCLE_STATS
+   CYCLE_READ( t1 );
+   if ( (WORD)(t1 - t0) > CycGapMax ) CycGapMax = t1 - t0;
+#endif
+#endif
 }
 void ISR_Ibn(void) interrupt 0
 {
@@ -18,5 +18,90 @@ void BG_Get  ( void );
 
 // Mouse Position tracking simulation
 void MM_Init ( void );
+void MP_SetEvents ( BOOL on ); // key event reports on/off, see icd.h
+
+// Performance counters (USBFX2LK_READ/RESET_COUNTERS, see icd.h)
+void CNT_Reset ( void );
+void CNT_Get   ( void );
+void CNT_Snapshot ( volatile BYTE xdata *p ); // COUNTERS_LEN bytes, see icd.h
+
+// Device information blobs (see icd.h). Ep0Blob (dscr.a51) holds the ones
+// built at request time; keep EP0_BLOB_MAX in step with dscr.a51.
+#define EP0_BLOB_MAX    256
+
+// Alternate settings of interface 0 (see dscr.a51)
+//
+// They only differ in how deep the bulk endpoint buffers are. The FX2 can
+// triple- or quad-buffer EP2 and EP6 alone, by borrowing the buffer RAM of
+// EP4 and EP8, so the deeper settings move the loopback onto those:
+//
+//   alt 0  EP6 OUT 2 x 512  ->  EP8 IN 2 x 512   4 packets (OSRFX2 layout)
+//   alt 1  EP2 OUT 4 x 512  ->  EP8 IN 2 x 512   6 packets
+//   alt 2  EP2 OUT 4 x 512  ->  EP6 IN 4 x 512   8 packets
+//
+// No triple-buffered setting is offered: with 512-byte buffers it takes the
+// same RAM as quad-buffering and holds one packet less.
+#define ALT_DOUBLE      0
+#define ALT_QUAD_OUT    1
+#define ALT_QUAD        2
+#define ALT_COUNT       3
+
+void EP_Config ( BYTE alt ); // (re)configure the bulk endpoints for alt
+void SM_Set ( BYTE mode );   // STREAM_* of icd.h
+
+// Bulk loopback
+//
+// LOOPBACK_FAST selects the copy loop of TD_Poll. 0 is the original C loop,
+// one byte per iteration. 1 moves every packet with LoopCopy (loopcopy.a51):
+// both autopointers behind the two data pointers, eight bytes per loop
+// pass, and TD_Poll drains all packets the IN endpoint has room for before
+// it returns.
+//
+// Note: the FX2 has no internal path from an OUT endpoint buffer to an IN
+// endpoint. AUTOOUT/AUTOIN only commit packets to and from the slave FIFO
+// pins, which would need an external master to close the loop, so the
+// bytes still pass through the 8051; LOOPBACK_FAST makes that as cheap as
+// the core allows.
+#ifndef LOOPBACK_FAST
+#define LOOPBACK_FAST 0
+#endif
+
+void LoopCopy ( WORD count ); // AUTOPTR1 -> AUTOPTR2, set up by the caller
+
+// Endpoint servicing
+//
+// INTERRUPT_DRIVEN 0 services the EP1 key reports and the bulk loopback
+// from TD_Poll, so a packet or a key press waits until the main loop comes
+// round again, including any setup request it is busy with. 1 services them
+// from interrupts instead: a packet moves from the OUT endpoint's interrupt
+// (a packet arrived) or the IN endpoint's (the host took one), and as many
+// move as fit. The keys are sampled in the SOF interrupt, every 125us at
+// high speed and every 1ms at full speed, since the key inputs on port B
+// cannot interrupt, and are reported again from the EP1 IN interrupt while
+// they are held.
+#ifndef INTERRUPT_DRIVEN
+#define INTERRUPT_DRIVEN 0
+#endif
+
+void KeyService ( void );     // report the keys on EP1 while any is held
+BOOL LoopPacket ( void );     // move one bulk packet, TRUE if it did
+
+// Timer 0 always runs at CLKOUT/4, one count per instruction cycle, for the
+// cycle counters of USBFX2LK_READ_COUNTERS. CYCLE_STATS 1 in addition
+// prints every 1024 looped packets over the serial port the min/max
+// cycles to move one packet and the max cycles of either one main loop
+// pass (polled: the longest a packet can wait) or one endpoint interrupt
+// (interrupt driven: the longest the main loop is held off). Counts wrap
+// at 65536 cycles, 5.4ms at 48MHz.
+#ifndef CYCLE_STATS
+#define CYCLE_STATS 0
+#endif
+
+// Read Timer 0 into the WORD w. TH0 is read twice so a carry from TL0 in
+// between is not mistaken for 256 cycles.
+#define CYCLE_READ(w)   do { BYTE h;                                      \
+                             do { h = TH0; (w) = ((WORD)h << 8) | TL0; } \
+                             while ( h != TH0 );                         \
+                        } while (0)
 
 #endif // PERIPH_H
@@ -0,0 +1,309 @@
+//-----------------------------------------------------------------------------
+//   File:      bench.c
+//   Contents:  Cycle benchmark of the firmware hot paths under ucsim (s51).
+//
+//   Takes the place of fw.c, dscr.a51 and the EZ-USB library: periph.c and
+//   FX2LPSerial.c run as they are, but nothing here is a USB core. Before
+//   every call each case below loads the registers the way the core would
+//   have (a packet waiting in the OUT endpoint, a setup packet in SETUPDAT),
+//   and Timer 0 counts the cycles of the call. The report goes to the ucsim
+//   console through the simulator interface, see the Makefile.
+//-----------------------------------------------------------------------------
+#include "fx2.h"
+#include "fx2regs.h"
+#include "syncdly.h"
+
+#include "FX2LPSerial.h"
+
+#include "icd.h"
+#include "periph.h"
+
+#if LOOPBACK_FAST
+#error "LoopCopy is in loopcopy.a51, which only the Keil A51 assembles"
+#endif
+
+//-----------------------------------------------------------------------------
+// What fw.c, dscr.a51 and the EZ-USB library provide
+//-----------------------------------------------------------------------------
+BOOL GotSUD;
+BOOL Sleep;
+BOOL Rwuen;
+BOOL Selfpwr;
+
+WORD pConfigDscr;
+WORD pOtherConfigDscr;
+WORD pHighSpeedConfigDscr;
+WORD pFullSpeedConfigDscr;
+CONFIGDSCR xdata HighSpeedConfigDscr;
+CONFIGDSCR xdata FullSpeedConfigDscr;
+
+BYTE code DevInfoText[] = "SW version is: 1.0.0.0\n"
+                          "Flex version is: 1.0.0.0\n"
+                          "IMEI is: 1234567890\n";
+BYTE xdata Ep0Blob[EP0_BLOB_MAX];
+
+// Not simulated: BG_Set waits 100ms in here, which would be all its count
+void EZUSB_Delay ( WORD ms )
+{
+  (void)ms;
+}
+
+// The one interrupt which runs, FX2LPSerial.c. Declared here so that SDCC
+// puts its vector with main().
+void ISR_Serial0 ( void ) __interrupt (4);
+extern volatile BOOL TxBusy;
+
+extern BYTE StreamMode;
+
+//-----------------------------------------------------------------------------
+// ucsim simulator interface (s51 -I if=sfr[0xff])
+//-----------------------------------------------------------------------------
+__sfr __at (0xFF) SIF;
+
+#define SIF_PRINT   'p'     // the next byte written goes to the console
+#define SIF_STOP    's'     // stop the simulation
+
+static void PutChar ( char c )
+{
+  SIF = SIF_PRINT;
+  SIF = c;
+}
+
+static void PutString ( char *s )
+{
+  while ( *s )
+    PutChar( *s++ );
+}
+
+// w in decimal, right aligned in width columns
+static void PutDec ( WORD w, BYTE width )
+{
+  char buf[5];
+  BYTE n = 0;
+
+  do {
+    buf[n++] = '0' + w % 10;
+    w /= 10;
+  } while ( w != 0 );
+
+  while ( width-- > n )
+    PutChar( ' ' );
+  while ( n != 0 )
+    PutChar( buf[--n] );
+}
+
+//-----------------------------------------------------------------------------
+// Benchmark cases
+//-----------------------------------------------------------------------------
+#define CASE_PACKET     0   // LoopPacket with one packet of count bytes
+#define CASE_POLL       1   // TD_Poll, with a packet of count bytes if not 0
+#define CASE_VENDOR     2   // DR_VendorCmnd with setup in SETUPDAT
+
+#define RUNS            8   // calls per case
+
+typedef struct
+{
+  char *name;
+  BYTE kind;                // CASE_*
+  BYTE alt;                 // alternate setting, CASE_PACKET/POLL
+  BYTE mode;                // stream mode, CASE_PACKET/POLL
+  WORD count;               // packet bytes, CASE_PACKET/POLL
+  BYTE setup[8];            // setup packet, CASE_VENDOR
+} BENCH_CASE;
+
+#define PACKET(name, alt, mode, count) \
+  { name, CASE_PACKET, alt, mode, count, { 0 } }
+#define POLL(name, count) \
+  { name, CASE_POLL, ALT_DOUBLE, STREAM_LOOPBACK, count, { 0 } }
+#define VENDOR_OUT(name, req, value) \
+  { name, CASE_VENDOR, 0, 0, 0, { 0x40, req, value, 0, 0, 0, 0, 0 } }
+#define VENDOR_IN(name, req, index, length) \
+  { name, CASE_VENDOR, 0, 0, 0, { 0xC0, req, 0, 0, index, 0, length, 0 } }
+
+static BENCH_CASE code Cases[] =
+{
+  POLL( "poll idle", 0 ),
+  POLL( "poll 512", 512 ),
+
+  PACKET( "loop 64 alt0", ALT_DOUBLE, STREAM_LOOPBACK, 64 ),
+  PACKET( "loop 512 alt0", ALT_DOUBLE, STREAM_LOOPBACK, 512 ),
+  PACKET( "loop 512 alt1", ALT_QUAD_OUT, STREAM_LOOPBACK, 512 ),
+  PACKET( "loop 512 alt2", ALT_QUAD, STREAM_LOOPBACK, 512 ),
+  PACKET( "sink 512", ALT_DOUBLE, STREAM_SINK, 512 ),
+  PACKET( "source 512", ALT_DOUBLE, STREAM_SOURCE, 0 ),
+
+  VENDOR_OUT( "NAKALL_ON", 0xD0, 0 ),
+  VENDOR_OUT( "NAKALL_OFF", 0xD1, 0 ),
+  VENDOR_OUT( "SET_BARGRAPH", USBFX2LK_SET_BARGRAPH_DISPLAY, 0 ),
+  VENDOR_IN( "READ_BARGRAPH", USBFX2LK_READ_BARGRAPH_DISPLAY, 0, 1 ),
+  VENDOR_OUT( "SET_KEY_EVENTS 1", USBFX2LK_SET_KEY_EVENTS, 1 ),
+  POLL( "poll key events", 0 ),
+  VENDOR_OUT( "SET_KEY_EVENTS 0", USBFX2LK_SET_KEY_EVENTS, 0 ),
+  VENDOR_IN( "READ_COUNTERS", USBFX2LK_READ_COUNTERS, 0, COUNTERS_LEN ),
+  VENDOR_OUT( "RESET_COUNTERS", USBFX2LK_RESET_COUNTERS, 0 ),
+  VENDOR_OUT( "SET_STREAM_MODE 0", USBFX2LK_SET_STREAM_MODE,
+              STREAM_LOOPBACK ),
+  VENDOR_IN( "DEVINFO_LEN text", USBFX2LK_READ_DEVINFO_LEN,
+             DEVINFO_TEXT, 1 ),
+  VENDOR_IN( "DEVINFO_DATA text", USBFX2LK_READ_DEVINFO_DATA,
+             DEVINFO_TEXT, 68 ),
+  VENDOR_IN( "DEVINFO_DATA build", USBFX2LK_READ_DEVINFO_DATA,
+             DEVINFO_BUILD, 20 ),
+  VENDOR_IN( "DEVINFO_DATA counters", USBFX2LK_READ_DEVINFO_DATA,
+             DEVINFO_COUNTERS, COUNTERS_LEN ),
+  VENDOR_IN( "DEVINFO_DATA config", USBFX2LK_READ_DEVINFO_DATA,
+             DEVINFO_CONFIG, DEVINFO_CONFIG_LEN ),
+};
+
+#define CASES   (sizeof(Cases) / sizeof(Cases[0]))
+
+// What the core shows when nothing can move: the OUT endpoints empty and
+// the IN endpoints full
+#define STAT_IDLE   (bmEP2EMPTY | bmEP4EMPTY | bmEP6EMPTY | bmEP8EMPTY | \
+                     bmEP2FULL | bmEP4FULL | bmEP6FULL | bmEP8FULL)
+
+BYTE Alt;                   // endpoint setup the cases left behind
+WORD Overhead;              // cycles of two CYCLE_READs in a row
+
+// Load the registers as the core would for one call of case c
+static void Arm ( BENCH_CASE code *c )
+{
+  BYTE i;
+
+  if ( c->kind == CASE_VENDOR )
+  {
+    EP2468STAT = STAT_IDLE;
+    for ( i = 0; i < 8; i++ )
+      SETUPDAT[i] = c->setup[i];
+    EP0BUF[0] = BARGRAPH_ON | 0x01;     // data stage of SET_BARGRAPH
+    return;
+  }
+
+  // the IN endpoint has room, and a packet arrived if there is one
+  EP2468STAT = bmEP2EMPTY | bmEP4EMPTY | bmEP6EMPTY | bmEP8EMPTY;
+  if ( c->count == 0 )
+    return;
+
+  if ( c->alt == ALT_DOUBLE )
+  {
+    EP2468STAT &= ~bmEP6EMPTY;
+    EP6BCH = MSB( c->count );
+    EP6BCL = LSB( c->count );
+  }
+  else
+  {
+    EP2468STAT &= ~bmEP2EMPTY;
+    EP2BCH = MSB( c->count );
+    EP2BCL = LSB( c->count );
+  }
+}
+
+// Run case c RUNS times and print its min and max cycles
+static void Run ( BENCH_CASE code *c )
+{
+  WORD t0, t1, t;
+  WORD min = 0xFFFF, max = 0;
+  BOOL moved = TRUE, stalled = FALSE;
+  BYTE i;
+
+  if ( c->kind != CASE_VENDOR && (c->alt != Alt || c->mode != StreamMode) )
+  {
+    EP2468STAT = STAT_IDLE;         // nothing held over from the last case
+    EP_Config( c->alt );
+    SM_Set( c->mode );
+    Alt = c->alt;
+  }
+
+  for ( i = 0; i < RUNS; i++ )
+  {
+    Arm( c );
+
+    switch ( c->kind )
+    {
+    case CASE_PACKET:
+      CYCLE_READ( t0 );
+      moved = LoopPacket();
+      CYCLE_READ( t1 );
+      break;
+
+    case CASE_POLL:
+      CYCLE_READ( t0 );
+      TD_Poll();
+      CYCLE_READ( t1 );
+      break;
+
+    default:
+      CYCLE_READ( t0 );
+      stalled = DR_VendorCmnd();
+      CYCLE_READ( t1 );
+      break;
+    }
+
+    t = t1 - t0 - Overhead;
+    if ( t < min ) min = t;
+    if ( t > max ) max = t;
+  }
+
+  PutString( c->name );
+  for ( i = 0; c->name[i] != 0; i++ )
+    ;
+  while ( i++ < 24 )
+    PutChar( ' ' );
+  PutDec( min, 7 );
+  PutDec( max, 7 );
+  if ( !moved )
+    PutString( "  no packet moved" );
+  if ( stalled )
+    PutString( "  stalled" );
+  PutString( "\n" );
+}
+
+void main ( void )
+{
+  WORD t0, t1;
+  WORD i;
+  BYTE n;
+
+  USBCS = bmHSM;                    // high speed: 512 byte packets
+  pHighSpeedConfigDscr = (WORD)&HighSpeedConfigDscr;
+  pFullSpeedConfigDscr = (WORD)&FullSpeedConfigDscr;
+  pConfigDscr = pHighSpeedConfigDscr;
+  pOtherConfigDscr = pFullSpeedConfigDscr;
+
+  TD_Init();
+  Alt = ALT_DOUBLE;
+  EA = 1;                           // as fw.c, for the serial port
+
+  // let the start up messages go out, their interrupts would be counted;
+  // bounded, in case the simulated UART never finishes
+  for ( i = 0; TxBusy && i < 0xFFFF; i++ )
+    ;
+
+  CYCLE_READ( t0 );
+  CYCLE_READ( t1 );
+  Overhead = t1 - t0;
+
+  PutString( "osrfx2fw cycles: 8051 machine cycles, min/max of " );
+  PutDec( RUNS, 0 );
+  PutString( " calls\n" );
+  PutString( "LOOPBACK_FAST " );
+  PutDec( LOOPBACK_FAST, 0 );
+  PutString( ", INTERRUPT_DRIVEN " );
+  PutDec( INTERRUPT_DRIVEN, 0 );
+  PutString( ", CYCLE_STATS " );
+  PutDec( CYCLE_STATS, 0 );
+  PutString( ", LOG_LEVEL " );
+  PutDec( LOG_LEVEL, 0 );
+  PutString( "\ncase" );
+  for ( n = 4; n < 24; n++ )
+    PutChar( ' ' );
+  PutString( "    min    max\n" );
+
+  for ( n = 0; n < CASES; n++ )
+    Run( &Cases[n] );
+
+  PutString( "end\n" );
+  SIF = SIF_STOP;
+  while ( 1 )
+    ;
+}
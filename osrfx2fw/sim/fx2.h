@@ -0,0 +1,76 @@
+//-----------------------------------------------------------------------------
+//   File:      fx2.h
+//   Contents:  The parts of the Cypress fx2.h (EZ-USB frameworks) the
+//              firmware uses, for SDCC and the ucsim benchmark only.
+//
+//   The Keil build takes the Cypress headers from the frameworks install;
+//   the Makefile here puts this directory first on the include path.
+//-----------------------------------------------------------------------------
+#ifndef FX2_H
+#define FX2_H
+
+// Keil C51 keywords. The "interrupt n" of a function definition can not be
+// a macro, the Makefile rewrites it.
+#define xdata       __xdata
+#define code        __code
+#define reentrant   __reentrant
+
+typedef unsigned char   BYTE;
+typedef unsigned short  WORD;
+typedef unsigned long   DWORD;
+typedef __bit           BOOL;   // bit as in the Cypress fx2.h, so that SDCC
+                                // rejects what Keil C51 rejects, e.g. a BOOL
+                                // local of a reentrant function
+
+#define TRUE    1
+#define FALSE   0
+
+#define MSB(word)   (BYTE)(((WORD)(word) >> 8) & 0xff)
+#define LSB(word)   (BYTE)((WORD)(word) & 0xff)
+
+// Descriptor types
+#define CONFIG_DSCR         2
+#define OTHERSPEED_DSCR     7
+
+typedef struct
+{
+   BYTE length;
+   BYTE type;
+   WORD config_len;
+   BYTE interfaces;
+   BYTE index;
+   BYTE config_dscr;
+   BYTE attrib;
+   BYTE power;
+} CONFIGDSCR;
+
+// Descriptor pointers, fw.c
+extern WORD pHighSpeedConfigDscr;
+extern WORD pFullSpeedConfigDscr;
+extern WORD pConfigDscr;
+extern WORD pOtherConfigDscr;
+
+// Task dispatcher and device request hooks, periph.c
+void TD_Init ( void );
+void TD_Poll ( void );
+BOOL TD_Suspend ( void );
+BOOL TD_Resume ( void );
+
+BOOL DR_GetDescriptor ( void );
+BOOL DR_SetConfiguration ( void );
+BOOL DR_GetConfiguration ( void );
+BOOL DR_SetInterface ( void );
+BOOL DR_GetInterface ( void );
+BOOL DR_GetStatus ( void );
+BOOL DR_ClearFeature ( void );
+BOOL DR_SetFeature ( void );
+BOOL DR_VendorCmnd ( void );
+
+// EZ-USB library, see bench.c
+void EZUSB_Delay ( WORD ms );
+
+#define EZUSB_IRQ_CLEAR()   EXIF &= ~0x10       // clear USB IRQ (INT2)
+#define EZUSB_STALL_EP0()   EP0CS |= bmEPSTALL
+#define EZUSB_HIGHSPEED()   (USBCS & bmHSM)
+
+#endif // FX2_H
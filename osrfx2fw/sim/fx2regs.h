@@ -0,0 +1,123 @@
+//-----------------------------------------------------------------------------
+//   File:      fx2regs.h
+//   Contents:  The FX2 registers the firmware uses, at their TRM addresses,
+//              for SDCC and the ucsim benchmark only.
+//
+//   ucsim simulates a plain 8052, so everything here that is not part of one
+//   is plain memory: nothing sets or clears the FIFO flags, byte counts do
+//   not arm anything, and EXTAUTODAT1/2 do not step the autopointers. The
+//   benchmark loads what the USB core would before each call instead (see
+//   bench.c); the instructions executed are the same either way.
+//-----------------------------------------------------------------------------
+#ifndef FX2REGS_H
+#define FX2REGS_H
+
+//-----------------------------------------------------------------------------
+// Special function registers
+//-----------------------------------------------------------------------------
+__sfr __at (0x80) IOA;
+__sfr __at (0x88) TCON;
+__sfr __at (0x89) TMOD;
+__sfr __at (0x8A) TL0;
+__sfr __at (0x8C) TH0;
+__sfr __at (0x8E) CKCON;
+__sfr __at (0x90) IOB;
+__sfr __at (0x91) EXIF;
+__sfr __at (0x98) SCON0;
+__sfr __at (0x99) SBUF0;
+__sfr __at (0x9A) APTR1H;
+__sfr __at (0x9B) APTR1L;
+__sfr __at (0x9D) AUTOPTRH2;
+__sfr __at (0x9E) AUTOPTRL2;
+__sfr __at (0xA8) IE;
+__sfr __at (0xAA) EP2468STAT;
+__sfr __at (0xAF) AUTOPTRSETUP;
+__sfr __at (0xB0) IOD;
+__sfr __at (0xB2) OEA;
+__sfr __at (0xB3) OEB;
+__sfr __at (0xB5) OED;
+__sfr __at (0xC8) T2CON;
+__sfr __at (0xCA) RCAP2L;
+__sfr __at (0xCB) RCAP2H;
+
+__sbit __at (0x8C) TR0;
+__sbit __at (0x98) RI;
+__sbit __at (0x99) TI;
+__sbit __at (0xAC) ES0;
+__sbit __at (0xAF) EA;
+
+//-----------------------------------------------------------------------------
+// External RAM registers
+//-----------------------------------------------------------------------------
+__xdata __at (0xE600) volatile BYTE CPUCS;
+__xdata __at (0xE601) volatile BYTE IFCONFIG;
+__xdata __at (0xE604) volatile BYTE FIFORESET;
+__xdata __at (0xE605) volatile BYTE BREAKPT;
+__xdata __at (0xE610) volatile BYTE EP1OUTCFG;
+__xdata __at (0xE611) volatile BYTE EP1INCFG;
+__xdata __at (0xE612) volatile BYTE EP2CFG;
+__xdata __at (0xE613) volatile BYTE EP4CFG;
+__xdata __at (0xE614) volatile BYTE EP6CFG;
+__xdata __at (0xE615) volatile BYTE EP8CFG;
+__xdata __at (0xE65C) volatile BYTE USBIE;
+__xdata __at (0xE65D) volatile BYTE USBIRQ;
+__xdata __at (0xE65E) volatile BYTE EPIE;
+__xdata __at (0xE65F) volatile BYTE EPIRQ;
+__xdata __at (0xE67B) volatile BYTE EXTAUTODAT1;
+__xdata __at (0xE67C) volatile BYTE EXTAUTODAT2;
+__xdata __at (0xE680) volatile BYTE USBCS;
+__xdata __at (0xE683) volatile BYTE TOGCTL;
+__xdata __at (0xE684) volatile BYTE USBFRAMEH;
+__xdata __at (0xE685) volatile BYTE USBFRAMEL;
+__xdata __at (0xE68A) volatile BYTE EP0BCH;
+__xdata __at (0xE68B) volatile BYTE EP0BCL;
+__xdata __at (0xE68F) volatile BYTE EP1INBC;
+__xdata __at (0xE690) volatile BYTE EP2BCH;
+__xdata __at (0xE691) volatile BYTE EP2BCL;
+__xdata __at (0xE694) volatile BYTE EP4BCH;
+__xdata __at (0xE695) volatile BYTE EP4BCL;
+__xdata __at (0xE698) volatile BYTE EP6BCH;
+__xdata __at (0xE699) volatile BYTE EP6BCL;
+__xdata __at (0xE69C) volatile BYTE EP8BCH;
+__xdata __at (0xE69D) volatile BYTE EP8BCL;
+__xdata __at (0xE6A0) volatile BYTE EP0CS;
+__xdata __at (0xE6A2) volatile BYTE EP1INCS;
+__xdata __at (0xE6B3) volatile BYTE SUDPTRH;
+__xdata __at (0xE6B4) volatile BYTE SUDPTRL;
+__xdata __at (0xE6B8) volatile BYTE SETUPDAT[8];
+__xdata __at (0xE740) volatile BYTE EP0BUF[64];
+__xdata __at (0xE7C0) volatile BYTE EP1INBUF[64];
+__xdata __at (0xF000) volatile BYTE EP2FIFOBUF[1024];
+__xdata __at (0xF400) volatile BYTE EP4FIFOBUF[1024];
+__xdata __at (0xF800) volatile BYTE EP6FIFOBUF[1024];
+__xdata __at (0xFC00) volatile BYTE EP8FIFOBUF[1024];
+
+//-----------------------------------------------------------------------------
+// Register bit masks
+//-----------------------------------------------------------------------------
+#define bmCLKSPD        0x18    // CPUCS
+#define bmCLKSPD1       0x10
+#define bmBPEN          0x02    // BREAKPT
+#define bmNAKALL        0x80    // FIFORESET
+#define bmHSM           0x80    // USBCS
+#define bmRESETTOGGLE   0x20    // TOGCTL
+#define bmEPSTALL       0x01    // EP0CS, EP1INCS
+#define bmEPBUSY        0x02
+
+#define bmSUDAV         0x01    // USBIE, USBIRQ
+#define bmSOF           0x02
+#define bmSUTOK         0x04
+#define bmSUSP          0x08
+#define bmURES          0x10
+#define bmHSGRANT       0x20
+
+#define bmEP2EMPTY      0x01    // EP2468STAT
+#define bmEP2FULL       0x02
+#define bmEP4EMPTY      0x04
+#define bmEP4FULL       0x08
+#define bmEP6EMPTY      0x10
+#define bmEP6FULL       0x20
+#define bmEP8EMPTY      0x40
+#define bmEP8FULL       0x80
+
+#endif // FX2REGS_H
@@ -0,0 +1,14 @@
+//-----------------------------------------------------------------------------
+//   File:      syncdly.h
+//   Contents:  SYNCDELAY of the Cypress frameworks, for SDCC and the ucsim
+//              benchmark only.
+//
+//   Three NOPs, what the frameworks use with the CPU at 48MHz: the delay is
+//   part of what a register write costs, so it is kept in the count.
+//-----------------------------------------------------------------------------
+#ifndef SYNCDLY_H
+#define SYNCDLY_H
+
+#define SYNCDELAY   __asm__ ("nop\n\tnop\n\tnop")
+
+#endif // SYNCDLY_H